@@ -0,0 +1,117 @@
+#!/bin/bash
+#
+# Drives the benchmark scenarios for "make pgo".
+#
+#   benchmarks/pgo.sh train <instrumented-binary>
+#   benchmarks/pgo.sh compare <baseline-binary> <optimized-binary>
+#
+# Each binary is started on PGO_PORT (default 18085) with the settings from
+# .env, so it talks to the same database as ./run.sh. "train" replays the
+# scenario mix once and stops the server with SIGINT, which writes the .gcda
+# profiles on exit. "compare" runs the mix against both binaries in turn and
+# prints requests per second and server CPU time per request; the CPU figure
+# is the one to look at when the load generator is the bottleneck.
+#
+# The mix is read-only unless PGO_WRITES=1: bulk-insert rows would pile up in
+# the database, and the binary measured last would read more of them.
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+if [ -f .env ]; then
+    export $(cat .env | grep -v '^#' | xargs)
+fi
+
+PORT=${PGO_PORT:-18085}
+TRAIN_SECONDS=${PGO_TRAIN_SECONDS:-30}
+BENCH_SECONDS=${PGO_BENCH_SECONDS:-20}
+WRITES_FLAG=--no-writes
+if [ "${PGO_WRITES:-0}" = 1 ]; then
+    WRITES_FLAG=
+fi
+BASE=http://127.0.0.1:$PORT
+export PORT H2_PORT=0 HTTP_FRONTEND=mhd
+
+SERVER_PID=
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -INT "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+trap stop_server EXIT
+
+# Starts $1 and waits until it answers; fails if the database is unreachable,
+# since a profile of error paths is worse than none.
+start_server() {
+    "$1" > /dev/null &
+    SERVER_PID=$!
+
+    for _ in $(seq 50); do
+        if curl -sf -o /dev/null "$BASE/health"; then
+            break
+        fi
+        sleep 0.1
+    done
+    if ! curl -sf -o /dev/null "$BASE/api/categories"; then
+        echo "pgo: $1 is not serving $BASE/api/categories; check the database settings in .env" >&2
+        exit 1
+    fi
+}
+
+# Prints the user+system CPU time of the server in clock ticks.
+server_ticks() {
+    awk '{ print $14 + $15 }' "/proc/$SERVER_PID/stat"
+}
+
+# Runs the mix against binary $1 for $2 seconds; sets MEASURED to
+# "rps cpu_us_per_request errors".
+measure() {
+    local before after result
+
+    start_server "$1"
+    before=$(server_ticks)
+    result=$(python3 benchmarks/scenarios.py "$BASE" --duration "$2" $WRITES_FLAG)
+    after=$(server_ticks)
+    stop_server
+
+    MEASURED=$(python3 -c '
+import json, os, sys
+result = json.loads(sys.argv[1])
+ticks = int(sys.argv[3]) - int(sys.argv[2])
+us = ticks * 1e6 / os.sysconf("SC_CLK_TCK") / max(result["requests"], 1)
+print(result["rps"], round(us, 1), result["errors"])
+' "$result" "$before" "$after")
+}
+
+case "${1:-}" in
+train)
+    echo "pgo: training $2 for ${TRAIN_SECONDS}s"
+    measure "$2" "$TRAIN_SECONDS"
+    read -r rps us errors <<< "$MEASURED"
+    echo "pgo: trained on $rps req/s ($errors errors)"
+    ;;
+compare)
+    echo "pgo: benchmarking $2 and $3 for ${BENCH_SECONDS}s each"
+    measure "$2" "$BENCH_SECONDS"
+    read -r base_rps base_us base_errors <<< "$MEASURED"
+    measure "$3" "$BENCH_SECONDS"
+    read -r opt_rps opt_us opt_errors <<< "$MEASURED"
+    printf '%-28s %10s %16s %8s\n' binary req/s "cpu us/request" errors
+    printf '%-28s %10s %16s %8s\n' "$2" "$base_rps" "$base_us" "$base_errors"
+    printf '%-28s %10s %16s %8s\n' "$3" "$opt_rps" "$opt_us" "$opt_errors"
+    python3 -c '
+import sys
+base_rps, base_us, opt_rps, opt_us = map(float, sys.argv[1:])
+print("pgo: throughput %+.1f%%, server CPU per request %+.1f%%" % (
+    (opt_rps / base_rps - 1) * 100, (opt_us / base_us - 1) * 100))
+' "$base_rps" "$base_us" "$opt_rps" "$opt_us"
+    ;;
+*)
+    echo "usage: $0 train <binary> | compare <baseline> <optimized>" >&2
+    exit 2
+    ;;
+esac
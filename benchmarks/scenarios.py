@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+Benchmark Scenario Driver
+
+Replays the benchmark scenarios (see docs/DIET_BENCHMARK_BLUEPRINT.md) from a
+few keep-alive connections, without k6. Used by pgo.sh to train the
+instrumented build and to compare builds, so it only needs the standard
+library.
+
+Usage:
+    python scenarios.py http://localhost:8085                  # 30s mix
+    python scenarios.py http://localhost:8085 --duration 10 --workers 8
+    python scenarios.py http://localhost:8085 --no-writes      # skip bulk-insert
+    python scenarios.py http://localhost:8085 --template-strategy mysql
+"""
+
+import argparse
+import http.client
+import json
+import multiprocessing
+import random
+import sys
+import time
+from urllib.parse import quote, urlsplit
+
+SEARCH_TERMS = ["chicken", "rice", "egg", "oat", "salmon", "apple", "yogurt",
+                "brocoli", "almnd", "beef", "bread", "milk"]
+
+
+def bulk_insert_body(rng: random.Random) -> bytes:
+    """Same payload shape as the bulk-insert k6 scenario."""
+    items = []
+    for i in range(50):
+        low = rng.randint(50, 150)
+        items.append({
+            "food_item_id": rng.randint(1, 50),
+            "portion_grams_min": low,
+            "portion_grams_max": low + rng.randint(0, 100),
+            "portion_description": f"{low}g serving",
+            "is_optional": rng.random() < 0.2,
+            "sort_order": i,
+        })
+    return json.dumps({"meal_id": rng.randint(1, 100), "items": items}).encode()
+
+
+def next_request(rng: random.Random, writes: bool, strategy: str = None):
+    """Picks one request of the mix: (name, method, path, body)."""
+    roll = rng.random()
+    if roll < 0.25:
+        return "categories", "GET", "/api/categories", None
+    if roll < 0.55:
+        path = (f"/api/foods?page={rng.randint(1, 10)}&limit=20"
+                f"&category_id={rng.randint(1, 10)}")
+        if rng.random() < 0.3:
+            path += "&search=" + quote(rng.choice(SEARCH_TERMS))
+            if rng.random() < 0.5:
+                path += "&fuzzy=1"
+        if rng.random() < 0.3:
+            path += "&sort=" + rng.choice(["name", "-calories", "protein", "-protein_ratio"])
+            path += f"&max_calories={rng.randint(100, 500)}"
+        return "foods-list", "GET", path, None
+    if roll < 0.65:
+        term = rng.choice(SEARCH_TERMS)[:rng.randint(2, 5)]
+        return "foods-suggest", "GET", f"/api/foods/suggest?q={quote(term)}&limit=10", None
+    if roll < 0.70:
+        return "food", "GET", f"/api/foods/{rng.randint(1, 50)}", None
+    if roll < 0.90 or not writes:
+        path = f"/api/templates/{rng.randint(1, 6)}/full"
+        if strategy:
+            path += "?strategy=" + strategy
+        return "template-full", "GET", path, None
+    return "bulk-insert", "POST", "/api/benchmark/bulk-insert", bulk_insert_body(rng)
+
+
+def worker(args):
+    """Sends requests on one connection until the deadline."""
+    base, seed, deadline, writes, strategy = args
+    url = urlsplit(base)
+    rng = random.Random(seed)
+    counts = {}
+    errors = 0
+    conn = http.client.HTTPConnection(url.hostname, url.port or 80, timeout=30)
+
+    while time.monotonic() < deadline:
+        name, method, path, body = next_request(rng, writes, strategy)
+        headers = {"Content-Type": "application/json"} if body else {}
+        try:
+            conn.request(method, path, body=body, headers=headers)
+            response = conn.getresponse()
+            response.read()
+            if response.status >= 400:
+                errors += 1
+        except (OSError, http.client.HTTPException):
+            errors += 1
+            conn.close()
+            conn = http.client.HTTPConnection(url.hostname, url.port or 80, timeout=30)
+            continue
+        counts[name] = counts.get(name, 0) + 1
+
+    conn.close()
+    return counts, errors
+
+
+def run(base: str, duration: float, workers: int, writes: bool,
+        strategy: str = None) -> dict:
+    """Runs the mix and returns request counts and throughput."""
+    start = time.monotonic()
+    deadline = start + duration
+    with multiprocessing.Pool(workers) as pool:
+        results = pool.map(worker, [(base, i, deadline, writes, strategy)
+                                    for i in range(workers)])
+    elapsed = time.monotonic() - start
+
+    counts = {}
+    errors = 0
+    for worker_counts, worker_errors in results:
+        errors += worker_errors
+        for name, count in worker_counts.items():
+            counts[name] = counts.get(name, 0) + count
+    total = sum(counts.values())
+    return {
+        "requests": total,
+        "errors": errors,
+        "seconds": round(elapsed, 2),
+        "rps": round(total / elapsed, 1),
+        "scenarios": counts,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay the benchmark scenarios")
+    parser.add_argument("base", help="Server URL, e.g. http://localhost:8085")
+    parser.add_argument("--duration", type=float, default=30, help="Seconds to run")
+    parser.add_argument("--workers", type=int, default=multiprocessing.cpu_count(),
+                        help="Concurrent connections (default: one per CPU)")
+    parser.add_argument("--no-writes", action="store_true", help="Skip bulk-insert")
+    parser.add_argument("--template-strategy", choices=["c", "mysql"],
+                        help="Where template-full is assembled (default: server setting)")
+    args = parser.parse_args()
+
+    result = run(args.base, args.duration, args.workers, not args.no_writes,
+                 args.template_strategy)
+    json.dump(result, sys.stdout)
+    print()
+    return 1 if result["requests"] == 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
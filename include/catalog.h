@@ -0,0 +1,155 @@
+/**
+ * @file catalog.h
+ * @brief In-memory snapshot of the food catalog.
+ *
+ * Loads food_items once from MySQL into flat arrays so that search
+ * endpoints (autocomplete, filtering) can be answered without a
+ * database round-trip. Writes produce a new catalog with
+ * catalog_merge(), which replaces the current one under a lock.
+ *
+ * All arrays of a catalog live in one block from placement_alloc(), so
+ * they can be backed by huge pages. With NUMA shards on, every node also
+ * gets its own copy and catalog_get() returns the caller's.
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+
+/** @brief Row block size for column scans (one 64-bit selection word) */
+#define CATALOG_BLOCK 64
+
+/**
+ * @brief In-memory food catalog.
+ *
+ * Entries are stored column-wise and sorted by normalized name.
+ * Index i refers to the same food in every array. Nutrition columns are
+ * padded with NaN up to a multiple of CATALOG_BLOCK entries so they can
+ * be scanned in whole blocks.
+ */
+typedef struct {
+    unsigned long version;      /**< Increases with every catalog_install() */
+    int count;                  /**< Number of foods loaded */
+    int *ids;                   /**< food_items.id */
+    int *category_ids;          /**< food_items.category_id */
+    unsigned int *popularity;   /**< Number of meal items referencing the food */
+    float *calories;            /**< food_items.calories_per_100g */
+    float *protein;             /**< food_items.protein_per_100g */
+    float *carbs;               /**< food_items.carbs_per_100g */
+    float *fat;                 /**< food_items.fat_per_100g */
+    unsigned char *snack_suitable; /**< food_items.is_snack_suitable (0 or 1) */
+    unsigned short *default_portions; /**< food_items.default_portion_grams */
+    char **names;               /**< Display names (point into name_pool) */
+    char **norm_names;          /**< Folded names used for matching (see text_fold()) */
+    unsigned short *norm_lengths; /**< Byte length of each folded name */
+    char *name_pool;            /**< Backing storage: all folded names, then display names */
+    size_t norm_pool_size;      /**< Bytes of name_pool holding folded names */
+    void *arena;                /**< Block holding every array above */
+    size_t arena_size;          /**< Bytes of arena in use */
+} Catalog;
+
+/**
+ * @brief A food added to or replaced in the catalog by catalog_merge().
+ */
+typedef struct {
+    int id;                         /**< food_items.id */
+    int category_id;                /**< food_items.category_id */
+    const char *name;               /**< Display name */
+    float calories;                 /**< Per 100g */
+    float protein;                  /**< Per 100g */
+    float carbs;                    /**< Per 100g */
+    float fat;                      /**< Per 100g */
+    unsigned char snack_suitable;   /**< food_items.is_snack_suitable */
+    unsigned short default_portion; /**< food_items.default_portion_grams */
+} CatalogFood;
+
+/**
+ * @brief Loads the food catalog from the database.
+ *
+ * Must be called after db_init(). Replaces any previously loaded catalog.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int catalog_load(void);
+
+/**
+ * @brief Gets the loaded catalog.
+ *
+ * Returns the copy on the caller's NUMA node when there is one; copies
+ * are identical, so catalog indices are valid in all of them.
+ *
+ * @return Pointer to the catalog, or NULL if not loaded
+ */
+const Catalog *catalog_get(void);
+
+/**
+ * @brief Finds foods whose folded name contains the folded query.
+ *
+ * Case- and diacritic-insensitive substring search over the in-memory
+ * catalog. Results are in catalog (name) order.
+ *
+ * @param query Raw search string
+ * @param category_id Only return foods in this category (0 for any)
+ * @param out Output array of catalog indices
+ * @param max_results Capacity of out
+ * @return Number of matches written, or -1 if the catalog is not loaded
+ */
+int catalog_search(const char *query, int category_id, int *out, int max_results);
+
+/**
+ * @brief Builds a new catalog from the loaded one plus added or changed foods.
+ *
+ * Foods whose id is already loaded replace that entry (keeping its
+ * popularity); the rest are added. The loaded catalog is not modified:
+ * the result must be published with catalog_install(). Callers must not
+ * run two merges at the same time.
+ *
+ * @param foods Foods to upsert (ids must be unique)
+ * @param count Number of foods
+ * @return New catalog, or NULL if out of memory
+ */
+Catalog *catalog_merge(const CatalogFood *foods, int count);
+
+/**
+ * @brief Replaces the loaded catalog, freeing the previous one.
+ *
+ * Must be called with the catalog write lock held, together with
+ * replacing every index built from the previous catalog. Assigns the
+ * catalog its version and makes its per-node copies.
+ *
+ * @param cat Catalog to publish (ownership is taken)
+ */
+void catalog_install(Catalog *cat);
+
+/**
+ * @brief Frees a catalog that was never installed.
+ *
+ * @param cat Catalog to free (may be NULL)
+ */
+void catalog_destroy(Catalog *cat);
+
+/**
+ * @brief Takes the catalog lock for reading.
+ *
+ * Hold it while using the catalog, catalog indices, or results of the
+ * indexes built from it (suggest, fuzzy), so they cannot be replaced
+ * underneath the caller.
+ */
+void catalog_read_lock(void);
+
+/** @brief Releases a lock taken with catalog_read_lock() */
+void catalog_read_unlock(void);
+
+/** @brief Takes the catalog lock for writing (to install a new catalog) */
+void catalog_write_lock(void);
+
+/** @brief Releases a lock taken with catalog_write_lock() */
+void catalog_write_unlock(void);
+
+/**
+ * @brief Frees the loaded catalog.
+ */
+void catalog_cleanup(void);
+
+#endif
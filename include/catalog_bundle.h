@@ -0,0 +1,69 @@
+/**
+ * @file catalog_bundle.h
+ * @brief Whole-catalog binary bundle for offline clients.
+ *
+ * The bundle is built once per catalog version and kept in sealed
+ * in-memory files (plain and gzip-compressed) that are sent with
+ * sendfile, so serving it costs no encoding work and no copy through
+ * user space. Its ETag changes only when the content does.
+ *
+ * Layout (all integers and floats little-endian, sections 4-byte aligned):
+ *
+ *     char     magic[4]              "DCAT"
+ *     uint32   format                CATALOG_BUNDLE_FORMAT
+ *     uint32   food_count            n
+ *     uint32   category_count        c
+ *     uint32   string_bytes          Size of the string table
+ *     uint32   crc32                 Of everything after this header
+ *     int32    food_ids[n]
+ *     int32    food_category_ids[n]
+ *     float32  calories[n]           Per 100 g
+ *     float32  protein[n]            Per 100 g
+ *     float32  carbs[n]              Per 100 g
+ *     float32  fat[n]                Per 100 g
+ *     uint16   default_portions[n]   Grams
+ *     uint8    snack_suitable[n]     0 or 1
+ *     uint32   food_names[n + 1]     Offsets into the string table
+ *     int32    category_ids[c]
+ *     uint32   category_names[c + 1] Offsets into the string table
+ *     char     strings[string_bytes] UTF-8, not NUL-terminated
+ *
+ * Name i spans [names[i], names[i + 1]). Foods are in catalog (name) order.
+ */
+
+#ifndef CATALOG_BUNDLE_H
+#define CATALOG_BUNDLE_H
+
+#include <microhttpd.h>
+#include "http_helpers.h"
+
+/** @brief Bundle layout version written in the header */
+#define CATALOG_BUNDLE_FORMAT 1
+
+/** @brief catalog_bundle_send() error: catalog not loaded */
+#define BUNDLE_ERROR_NO_CATALOG -1
+
+/** @brief catalog_bundle_send() error: category query or allocation failed */
+#define BUNDLE_ERROR_BUILD -2
+
+/**
+ * @brief Queues the bundle of the current catalog.
+ *
+ * Rebuilds the bundle first if the catalog changed since it was built.
+ * Answers 304 Not Modified when if_none_match names the current ETag.
+ *
+ * @param request The HTTP request
+ * @param gzip Non-zero if the client accepts gzip
+ * @param if_none_match If-None-Match request header (may be NULL)
+ * @param ret Set to the result of queueing the response, on success
+ * @return 0 if a response was queued, or a negative BUNDLE_ERROR_* code
+ */
+int catalog_bundle_send(HttpRequest *request, int gzip,
+                        const char *if_none_match, enum MHD_Result *ret);
+
+/**
+ * @brief Frees the cached bundle.
+ */
+void catalog_bundle_cleanup(void);
+
+#endif
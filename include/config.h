@@ -2,18 +2,50 @@
  * @file config.h
  * @brief Application configuration management.
  *
- * Handles loading configuration from environment variables
- * for database connection and server settings.
+ * Every setting is described by an entry of config_options: its key,
+ * type, default and valid range or values. Values come from the
+ * defaults, then environment variables, then the file named by
+ * CONFIG_FILE (KEY=VALUE lines, as in .env), so that editing the file
+ * and reloading can change a setting whatever the environment says.
+ *
+ * Settings marked reloadable can change while the server runs, on
+ * SIGHUP or through /admin/config; code reading them must use
+ * CONFIG_LIVE(). The others need a restart.
  */
 
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
+/*
+ * Limits that bound settings, shared with the modules enforcing them.
+ * They live here so that configuration depends on no other module.
+ */
+
+/** @brief Most connections the database pool can hold (DB_POOL_MAX) */
+#define DB_POOL_HARD_MAX 64
+
+/** @brief Smallest per-thread cJSON cache limit, two batches (JSON_SLAB_THREAD_CACHE) */
+#define JSON_ALLOC_MIN_CACHE 256
+
+/** @brief Default maximum POST body size (1MB, MAX_BODY_SIZE) */
+#define MAX_POST_SIZE (1024 * 1024)
+
+/** @brief Hard maximum POST body size, for /api/foods/import (64MB) */
+#define MAX_IMPORT_SIZE (64 * 1024 * 1024)
+
+/** @brief Maximum plan search time per request in milliseconds (PLAN_BUDGET_MAX_MS may lower it) */
+#define PLAN_MAX_BUDGET_MS 1000
+
+/** @brief Default number of exports running at the same time (EXPORT_CONCURRENCY) */
+#define EXPORT_MAX_CONCURRENT 2
+
 /**
  * @brief Application configuration structure.
  *
- * Holds all configuration values loaded from environment variables.
- * Memory for string fields is dynamically allocated.
+ * Holds all configuration values. Memory for string fields is
+ * dynamically allocated.
  */
 typedef struct {
     char *db_host;      /**< MySQL server hostname (env: DB_HOST) */
@@ -22,21 +54,146 @@ typedef struct {
     char *db_name;      /**< MySQL database name (env: DB_NAME) */
     int db_port;        /**< MySQL server port (env: DB_PORT, default: 3306) */
     int server_port;    /**< HTTP server port (env: PORT, default: 8080) */
+    int plan_threads;   /**< Plan generator worker threads (env: PLAN_THREADS, default: 0 = one per CPU) */
+    char *http_frontend; /**< HTTP front end, "mhd" or "uring" (env: HTTP_FRONTEND, default: mhd) */
+    int uring_threads;  /**< io_uring front end threads (env: URING_THREADS, default: 0 = one per CPU) */
+    int h2_port;        /**< HTTP/2 listener port (env: H2_PORT, default: 0 = disabled) */
+    int h2_threads;     /**< HTTP/2 handler threads (env: H2_THREADS, default: 0 = two per CPU) */
+    char *tls_cert_file; /**< PEM certificate chain for HTTP/2 over TLS (env: TLS_CERT_FILE, default: none = h2c) */
+    char *tls_key_file; /**< PEM private key for TLS_CERT_FILE (env: TLS_KEY_FILE) */
+    int tls_ktls;       /**< Hand TLS records to the kernel when possible (env: TLS_KTLS, default: 1) */
+    int json_slab;      /**< Allocate cJSON nodes from per-thread slabs (env: JSON_SLAB, default: 1) */
+    char *cpu_affinity; /**< CPUs to pin server threads to, "all" or a list like "0-7" (env: CPU_AFFINITY, default: none) */
+    int numa_shards;    /**< Keep a copy of the catalog on each NUMA node (env: NUMA_SHARDS, default: 0) */
+    char *huge_pages;   /**< Backing of large caches, "off", "thp" or "explicit" (env: HUGE_PAGES, default: off) */
+    int json_slab_cache; /**< Free blocks per size class a thread keeps (env: JSON_SLAB_THREAD_CACHE, default: 512) */
+    int plan_budget_max_ms; /**< Longest plan search a request may ask for (env: PLAN_BUDGET_MAX_MS, default: 1000) */
+    int export_concurrency; /**< Exports streaming at the same time (env: EXPORT_CONCURRENCY, default: 2) */
+    int max_body_size;  /**< Largest POST body (env: MAX_BODY_SIZE, default: 1MB) */
+    int import_max_body_size; /**< Largest /api/foods/import body (env: IMPORT_MAX_BODY_SIZE, default: 64MB) */
+    int http_idle_timeout; /**< Seconds of silence before an HTTP/1.1 connection is closed (env: HTTP_IDLE_TIMEOUT, default: 30, 0 = never) */
+    int http_body_timeout; /**< Seconds a client may take to send a POST body, or a whole request on io_uring (env: HTTP_BODY_TIMEOUT, default: 60, 0 = no limit) */
+    int http_connection_limit; /**< Most open HTTP/1.1 connections, and HTTP/2 ones (env: HTTP_CONNECTION_LIMIT, default: 1000) */
+    int http_per_ip_connection_limit; /**< Most HTTP/1.1 connections per client IP (env: HTTP_PER_IP_CONNECTION_LIMIT, default: 64, 0 = no limit) */
+    int db_pool_min;    /**< Fewest pooled MySQL connections (env: DB_POOL_MIN, default: 2) */
+    int db_pool_max;    /**< Most pooled MySQL connections (env: DB_POOL_MAX, default: 16) */
+    char *db_replicas;  /**< Read replicas for template-full, "host[:port],..." (env: DB_REPLICAS, default: none) */
+    int db_hedge_percent; /**< Most replica reads that may be repeated on another replica, in % (env: DB_HEDGE_PERCENT, default: 5) */
+    int template_documents; /**< Store pre-rendered template-full responses in diet_template_documents (env: TEMPLATE_DOCUMENTS, default: 0) */
+    char *template_full_strategy; /**< Where template-full is assembled, "c" or "mysql" (env: TEMPLATE_FULL_STRATEGY, default: c) */
+    int template_cache; /**< Serve template-full from versioned in-memory snapshots (env: TEMPLATE_CACHE, default: 0) */
+    int template_change_log; /**< Meal changes remembered per template for /changes (env: TEMPLATE_CHANGE_LOG, default: 64) */
+    int rate_limit_read; /**< Requests per second per client for reads (env: RATE_LIMIT_READ, default: 0 = unlimited) */
+    int rate_limit_heavy; /**< Same for template-full, plans, exports, bundle (env: RATE_LIMIT_HEAVY, default: 0) */
+    int rate_limit_write; /**< Same for bulk-insert and import (env: RATE_LIMIT_WRITE, default: 0) */
+    int rate_limit_burst; /**< Seconds of rate a client may use at once (env: RATE_LIMIT_BURST, default: 2) */
+    char *rate_limit_key_header; /**< Header identifying a client, such as X-API-Key (env: RATE_LIMIT_KEY_HEADER, default: none = client IP) */
 } Config;
 
 /** @brief Global configuration instance */
 extern Config config;
 
 /**
- * @brief Loads configuration from environment variables.
+ * @brief Reads a reloadable int setting while a reload may be storing it.
+ */
+#define CONFIG_LIVE(field) __atomic_load_n(&config.field, __ATOMIC_RELAXED)
+
+/** @brief Type of a setting */
+typedef enum {
+    CONFIG_STRING,
+    CONFIG_INT
+} ConfigType;
+
+/**
+ * @brief Description of one setting.
+ */
+typedef struct {
+    const char *key;            /**< Environment variable and file key */
+    ConfigType type;            /**< Field type in Config */
+    size_t offset;              /**< Field offset in Config */
+    const char *default_value;  /**< CONFIG_STRING value when unset or empty */
+    long default_int;           /**< CONFIG_INT value when unset or empty */
+    long min;                   /**< Smallest CONFIG_INT value */
+    long max;                   /**< Largest CONFIG_INT value */
+    const char *choices;        /**< CONFIG_STRING values allowed, '|'-separated (NULL = any) */
+    int reloadable;             /**< Can change without a restart */
+    int secret;                 /**< Never shown by config_format() */
+} ConfigOption;
+
+/** @brief Every setting, in display order */
+extern const ConfigOption config_options[];
+
+/** @brief Entries in config_options */
+extern const int config_option_count;
+
+/** @brief Messages kept per kind in a ConfigUpdate */
+#define CONFIG_MAX_MESSAGES 32
+
+/**
+ * @brief Outcome of config_reload() or config_set().
+ */
+typedef struct {
+    int error_count;            /**< Invalid values; nothing was applied if > 0 */
+    char errors[CONFIG_MAX_MESSAGES][160];
+    int applied_count;          /**< Reloadable settings that changed */
+    const char *applied[CONFIG_MAX_MESSAGES];
+    int restart_count;          /**< Changed settings that need a restart (kept as they were) */
+    const char *restart[CONFIG_MAX_MESSAGES];
+} ConfigUpdate;
+
+/**
+ * @brief Loads configuration from defaults, environment and CONFIG_FILE.
  *
- * Reads environment variables and populates the global config struct.
- * Uses default values if variables are not set.
+ * Prints every invalid value to stderr.
  *
- * @return 0 on success, -1 on failure
+ * @return 0 on success, -1 if a value is invalid or the file unreadable
  */
 int load_config(void);
 
+/**
+ * @brief Called after reloadable settings changed, to apply them.
+ */
+typedef void (*ConfigListener)(void);
+
+/**
+ * @brief Registers a function run after each update that changed something.
+ *
+ * @param listener Function to run (at most 8 can be registered)
+ */
+void config_subscribe(ConfigListener listener);
+
+/**
+ * @brief Re-reads environment and CONFIG_FILE and applies what may change live.
+ *
+ * Values set through config_set() are replaced by what the sources say.
+ *
+ * @param result Filled in
+ * @return 0 if applied, -1 if nothing was applied (see result->errors)
+ */
+int config_reload(ConfigUpdate *result);
+
+/**
+ * @brief Changes settings on top of the current configuration.
+ *
+ * All values are validated first; if one is invalid nothing changes.
+ *
+ * @param pairs Key/value pairs
+ * @param count Number of pairs
+ * @param result Filled in
+ * @return 0 if applied, -1 if nothing was applied (see result->errors)
+ */
+int config_set(const char *const pairs[][2], int count, ConfigUpdate *result);
+
+/**
+ * @brief Formats the current value of a setting.
+ *
+ * @param option Entry of config_options
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return Where the value came from: "default", "env", "file" or "admin"
+ */
+const char *config_format(const ConfigOption *option, char *buf, size_t size);
+
 /**
  * @brief Frees allocated configuration memory.
  *
@@ -5,19 +5,64 @@
  * Provides functions for connecting to MySQL, executing queries,
  * and managing the database connection lifecycle.
  *
- * @note Currently uses a single connection. For production with
- *       multi-threaded servers, implement connection pooling.
+ * db_query() and db_execute() run on a pool of connections whose size
+ * adapts between DB_POOL_MIN and DB_POOL_MAX. Once per DB_POOL_INTERVAL_MS
+ * the pool applies Little's law to the last interval: the connections in
+ * use on average are the query rate times the mean execution time. It
+ * grows towards that figure plus headroom while queries wait for a
+ * connection, and shrinks after several calm intervals. A growth step
+ * that raised execution time without raising throughput marks MySQL as
+ * saturated, and the pool returns to the previous size for a while.
+ * Growth also stops while MySQL reports more running threads than
+ * twice the pool size.
  */
 
 #ifndef DB_H
 #define DB_H
 
+#include <stdint.h>
 #include <mysql/mysql.h>
 
+/** @brief Controller period in milliseconds */
+#define DB_POOL_INTERVAL_MS 1000
+
+/**
+ * @brief Pool size and the measurements of the last controller interval.
+ */
+typedef struct {
+    int min;                    /**< DB_POOL_MIN */
+    int max;                    /**< DB_POOL_MAX */
+    int target;                 /**< Size the controller wants */
+    int ceiling;                /**< Size above which MySQL was saturated (max if none) */
+    int open;                   /**< Connections open */
+    int idle;                   /**< Connections not in use */
+    int waiting;                /**< Threads waiting for a connection */
+    double queries_per_sec;     /**< Last interval */
+    double mean_wait_us;        /**< Mean time to get a connection, last interval */
+    double mean_exec_us;        /**< Mean query time, last interval */
+    double busy;                /**< Connections in use on average (rate x time) */
+    int mysql_threads_running;  /**< Threads_running at the last sample (-1 = unknown) */
+    uint64_t queries;           /**< Queries since start */
+    uint64_t waits;             /**< Queries that had to wait for a connection */
+    uint64_t grows;             /**< Controller steps up */
+    uint64_t shrinks;           /**< Controller steps down */
+    uint64_t saturations;       /**< Steps up undone because MySQL was saturated */
+} DbPoolStats;
+
 /**
- * @brief Initializes the database connection.
+ * @brief A transaction holding a pool connection.
+ */
+typedef struct {
+    MYSQL *conn;                /**< Connection to run statements on */
+    uint64_t wait_us;           /**< Time spent waiting for it */
+    uint64_t start_us;          /**< When the transaction started */
+} DbTransaction;
+
+/**
+ * @brief Initializes the connection pool.
  *
- * Connects to MySQL using credentials from the global config.
+ * Opens DB_POOL_MIN connections, plus the one db_get_connection() returns,
+ * using credentials from the global config.
  * Must be called after load_config().
  *
  * @return 0 on success, -1 on failure
@@ -25,14 +70,37 @@
 int db_init(void);
 
 /**
- * @brief Closes the database connection and frees resources.
+ * @brief Opens a new MySQL connection outside the shared one.
+ *
+ * Uses the same credentials as db_init(). Meant for long-running work
+ * (such as streaming exports) that must not hold a pool connection.
+ *
+ * @return New connection (caller closes with mysql_close()), or NULL on failure
+ */
+MYSQL *db_connect(void);
+
+/**
+ * @brief Opens a connection to another server with the same credentials.
+ *
+ * @param host Server hostname
+ * @param port Server port
+ * @return New connection (caller closes with mysql_close()), or NULL on failure
+ */
+MYSQL *db_connect_host(const char *host, int port);
+
+/**
+ * @brief Closes the pool connections and frees resources.
  *
  * Should be called before program exit.
  */
 void db_cleanup(void);
 
 /**
- * @brief Gets the active MySQL connection handle.
+ * @brief Gets a connection handle for mysql_real_escape_string().
+ *
+ * A connection of its own, outside the pool, that stays open until
+ * db_cleanup() and never runs a query, so any thread may escape on it.
+ * Do not run queries on it.
  *
  * @return Pointer to MYSQL connection, or NULL if not connected
  */
@@ -41,7 +109,7 @@ MYSQL *db_get_connection(void);
 /**
  * @brief Executes a SQL query and returns the result set.
  *
- * Thread-safe - uses mutex to protect the connection.
+ * Thread-safe - runs on a pool connection, waiting for one if all are busy.
  *
  * @param query SQL query string to execute
  * @return MYSQL_RES pointer on success (caller must free with mysql_free_result),
@@ -55,11 +123,38 @@ MYSQL_RES *db_query(const char *query);
 /**
  * @brief Executes a SQL statement that doesn't return results (INSERT/UPDATE/DELETE).
  *
- * Thread-safe - uses mutex to protect the connection.
+ * Thread-safe - runs on a pool connection, waiting for one if all are busy.
  *
  * @param query SQL statement to execute
  * @return Number of affected rows on success, -1 on error
  */
 int db_execute(const char *query);
 
+/**
+ * @brief Takes a pool connection and starts a transaction on it.
+ *
+ * Statements are then run on txn->conn with mysql_query() until
+ * db_end() returns it to the pool.
+ *
+ * @param txn Filled in
+ * @return 0 on success, -1 if no connection is available or START TRANSACTION failed
+ */
+int db_begin(DbTransaction *txn);
+
+/**
+ * @brief Ends a transaction started by db_begin() and returns its connection.
+ *
+ * @param txn Transaction from db_begin()
+ * @param commit Nonzero to commit, zero to roll back
+ * @return 0 on success, -1 if the commit failed (the transaction is rolled back)
+ */
+int db_end(DbTransaction *txn, int commit);
+
+/**
+ * @brief Reads the pool size and controller measurements.
+ *
+ * @param stats Filled in
+ */
+void db_pool_stats(DbPoolStats *stats);
+
 #endif
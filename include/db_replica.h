@@ -0,0 +1,86 @@
+/**
+ * @file db_replica.h
+ * @brief Hedged reads on MySQL replicas.
+ *
+ * Reads that tolerate replication lag (template-full) can go to the
+ * replicas listed in DB_REPLICAS, taken in turn. Each such read names a
+ * route, whose latency is kept in a histogram. If a read has not
+ * answered within the p95 of its route, the same query is sent to the
+ * next replica and the first to answer wins; the other is cancelled with
+ * KILL QUERY and drained by a background thread. Hedges come from a
+ * budget refilled by DB_HEDGE_PERCENT of the reads, so they add at most
+ * that share of load.
+ */
+
+#ifndef DB_REPLICA_H
+#define DB_REPLICA_H
+
+#include <stdint.h>
+#include <mysql/mysql.h>
+
+/** @brief Most entries of DB_REPLICAS */
+#define DB_MAX_REPLICAS 8
+
+/** @brief Most routes with their own latency histogram */
+#define DB_MAX_READ_ROUTES 16
+
+/**
+ * @brief Counters of one route.
+ */
+typedef struct {
+    const char *name;           /**< Route given to db_query_read() */
+    uint64_t p95_us;            /**< Hedge delay from the last window (0 = not measured yet) */
+    uint64_t reads;             /**< Reads sent to a replica */
+    uint64_t hedges;            /**< Reads repeated on a second replica */
+    uint64_t hedge_wins;        /**< Hedges that answered first */
+} DbReadRouteStats;
+
+/**
+ * @brief Replica read counters.
+ */
+typedef struct {
+    int replicas;               /**< Replicas configured */
+    int hedge_percent;          /**< DB_HEDGE_PERCENT */
+    uint64_t over_budget;       /**< Hedges skipped because the budget was spent */
+    uint64_t cancelled;         /**< Losing queries killed */
+    uint64_t fallbacks;         /**< Reads sent to the primary after a replica failed */
+    int route_count;
+    DbReadRouteStats routes[DB_MAX_READ_ROUTES];
+} DbReplicaStats;
+
+/**
+ * @brief Parses DB_REPLICAS and opens one connection to each replica.
+ *
+ * Does nothing when DB_REPLICAS is empty. A replica that cannot be
+ * reached now is still tried on later reads.
+ *
+ * @return 0 on success, -1 if DB_REPLICAS is malformed
+ */
+int db_replica_init(void);
+
+/**
+ * @brief Runs a read on a replica, hedging it when it is slow.
+ *
+ * Falls back to db_query() when no replica is configured or the
+ * replica fails. Thread-safe.
+ *
+ * @param route Static name of the calling route, such as "template-full"
+ * @param query SQL query string to execute
+ * @return MYSQL_RES pointer on success (caller must free with mysql_free_result),
+ *         NULL on error
+ */
+MYSQL_RES *db_query_read(const char *route, const char *query);
+
+/**
+ * @brief Reads the counters.
+ *
+ * @param stats Filled in
+ */
+void db_replica_stats(DbReplicaStats *stats);
+
+/**
+ * @brief Stops the cancel thread and closes replica connections.
+ */
+void db_replica_cleanup(void);
+
+#endif
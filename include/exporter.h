@@ -0,0 +1,82 @@
+/**
+ * @file exporter.h
+ * @brief Streaming full-table exports as NDJSON or CSV.
+ *
+ * Rows are read with mysql_use_result() on a dedicated connection and
+ * encoded straight into the HTTP response as the client reads it, so
+ * memory use does not depend on the table size.
+ */
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "http_helpers.h"
+
+/**
+ * @brief Exportable tables.
+ */
+typedef enum {
+    EXPORT_FOODS,       /**< food_items */
+    EXPORT_TEMPLATES    /**< diet_templates */
+} ExportTable;
+
+/**
+ * @brief Output encodings.
+ */
+typedef enum {
+    EXPORT_NDJSON,      /**< One JSON object per line */
+    EXPORT_CSV          /**< RFC 4180 CSV with a header row */
+} ExportFormat;
+
+/** @brief Maximum number of response headers export_open() fills in */
+#define EXPORT_MAX_HEADERS 5
+
+/** @brief export_open() error: EXPORT_CONCURRENCY exports already running */
+#define EXPORT_ERROR_BUSY -1
+
+/** @brief export_open() error: connection, query or allocation failed */
+#define EXPORT_ERROR_DB -2
+
+/** @brief A running export */
+typedef struct export_stream ExportStream;
+
+/**
+ * @brief Starts an export.
+ *
+ * Fills in Content-Type, Content-Disposition, Vary, (with gzip)
+ * Content-Encoding and Connection: close; the values live as long as
+ * the stream. The thread reading the body gets a lower CPU priority and
+ * the connection is closed after the response, so foreground requests
+ * are not slowed.
+ *
+ * @param table Table to export
+ * @param format Output encoding
+ * @param gzip Non-zero to gzip the body
+ * @param stream Set to the export (released by export_close())
+ * @param headers Filled with up to EXPORT_MAX_HEADERS response headers
+ * @return Number of headers on success, or a negative EXPORT_ERROR_* code
+ */
+int export_open(ExportTable table, ExportFormat format, int gzip,
+                ExportStream **stream, HttpHeader *headers);
+
+/**
+ * @brief Content reader: produces the next piece of the body.
+ *
+ * @param cls The ExportStream
+ * @param pos Bytes produced so far (unused)
+ * @param buf Output buffer
+ * @param max Capacity of buf
+ * @return Bytes written, MHD_CONTENT_READER_END_OF_STREAM or MHD_CONTENT_READER_END_WITH_ERROR
+ */
+ssize_t export_read(void *cls, uint64_t pos, char *buf, size_t max);
+
+/**
+ * @brief Releases an export and its database connection.
+ *
+ * @param cls The ExportStream
+ */
+void export_close(void *cls);
+
+#endif
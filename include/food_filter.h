@@ -0,0 +1,90 @@
+/**
+ * @file food_filter.h
+ * @brief Nutrition range filtering and sorting over the food catalog.
+ *
+ * Range predicates are evaluated column by column into a selection
+ * bitmap, one 64-bit word per CATALOG_BLOCK rows. Sorted results are
+ * produced with a bounded heap, so only the requested page is ordered.
+ */
+
+#ifndef FOOD_FILTER_H
+#define FOOD_FILTER_H
+
+#include "catalog.h"
+
+/**
+ * @brief Filterable nutrition columns (values per 100g).
+ */
+typedef enum {
+    NUTRIENT_CALORIES,
+    NUTRIENT_PROTEIN,
+    NUTRIENT_CARBS,
+    NUTRIENT_FAT,
+    NUTRIENT_COUNT
+} Nutrient;
+
+/**
+ * @brief Sort keys for filtered results.
+ */
+typedef enum {
+    FOOD_SORT_NAME,          /**< Catalog order (folded name) */
+    FOOD_SORT_CALORIES,
+    FOOD_SORT_PROTEIN,
+    FOOD_SORT_CARBS,
+    FOOD_SORT_FAT,
+    FOOD_SORT_PROTEIN_RATIO  /**< Grams of protein per 100 kcal */
+} FoodSortKey;
+
+/**
+ * @brief A food filter query.
+ */
+typedef struct {
+    float min[NUTRIENT_COUNT];  /**< Inclusive lower bounds (-INFINITY for none) */
+    float max[NUTRIENT_COUNT];  /**< Inclusive upper bounds (INFINITY for none) */
+    int category_id;            /**< Category filter (0 for any) */
+    const char *search;         /**< Folded substring filter (NULL for none) */
+    FoodSortKey sort;           /**< Result order */
+    int descending;             /**< Non-zero to reverse the sort key */
+} FoodFilter;
+
+/**
+ * @brief Resets a filter to match every food in name order.
+ *
+ * @param filter Filter to initialize
+ */
+void food_filter_init(FoodFilter *filter);
+
+/**
+ * @brief Returns the query parameter suffix for a nutrient.
+ *
+ * @param nutrient Nutrient column
+ * @return Name such as "protein" (used as min_protein / max_protein)
+ */
+const char *food_filter_nutrient_name(Nutrient nutrient);
+
+/**
+ * @brief Parses a sort parameter.
+ *
+ * Accepts "name", "calories", "protein", "carbs", "fat" or
+ * "protein_ratio", optionally prefixed with '-' for descending order.
+ *
+ * @param value Raw parameter value
+ * @param filter Filter to update
+ * @return 0 on success, -1 if the key is unknown
+ */
+int food_filter_parse_sort(const char *value, FoodFilter *filter);
+
+/**
+ * @brief Runs a filter against the loaded catalog.
+ *
+ * Ties on the sort key are broken by name.
+ *
+ * @param filter Filter to apply
+ * @param out Output array of catalog indices, in result order
+ * @param max_results Capacity of out
+ * @return Number of results written, or -1 if the catalog is not loaded
+ *         or memory could not be allocated
+ */
+int food_filter_run(const FoodFilter *filter, int *out, int max_results);
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file food_import.h
+ * @brief Bulk import of food items from NDJSON or CSV.
+ *
+ * Records are parsed and validated by several worker threads, then
+ * written with multi-row INSERT ... ON DUPLICATE KEY UPDATE statements
+ * in bounded transactions on a dedicated connection. Committed rows are
+ * merged into the in-memory catalog and its search indexes.
+ */
+
+#ifndef FOOD_IMPORT_H
+#define FOOD_IMPORT_H
+
+#include <stddef.h>
+
+/** @brief Maximum number of per-row errors reported */
+#define IMPORT_MAX_ERRORS 100
+
+/** @brief Maximum number of records per import */
+#define IMPORT_MAX_RECORDS 1000000
+
+/** @brief Rows per INSERT statement */
+#define IMPORT_BATCH_ROWS 500
+
+/** @brief Rows per transaction */
+#define IMPORT_COMMIT_ROWS 5000
+
+/**
+ * @brief Input encodings.
+ *
+ * Field names are the food_items columns, as written by the exporter:
+ * id, category_id, name, description, default_portion_grams,
+ * calories_per_100g, protein_per_100g, carbs_per_100g, fat_per_100g,
+ * fiber_per_100g, is_snack_suitable, status. Unknown fields are ignored.
+ */
+typedef enum {
+    IMPORT_NDJSON,  /**< One JSON object per line */
+    IMPORT_CSV      /**< RFC 4180 CSV with a header row */
+} ImportFormat;
+
+/**
+ * @brief A rejected record.
+ */
+typedef struct {
+    long line;          /**< 1-based line where the record starts */
+    char message[160];  /**< What was wrong with it */
+} ImportError;
+
+/**
+ * @brief Outcome of an import.
+ */
+typedef struct {
+    long received;      /**< Records in the input (CSV header excluded) */
+    long imported;      /**< Rows committed (or valid, for a dry run) */
+    long failed;        /**< Rows rejected or not committed */
+    int error_count;    /**< Entries used in errors */
+    ImportError errors[IMPORT_MAX_ERRORS]; /**< First errors, in input order per phase */
+    int threads;        /**< Validation threads used */
+    int catalog_updated; /**< In-memory catalog and indexes now include the rows */
+} ImportResult;
+
+/** @brief food_import_run() error: another import is running */
+#define IMPORT_ERROR_BUSY -1
+
+/** @brief food_import_run() error: connection lost or commit failed */
+#define IMPORT_ERROR_DB -2
+
+/** @brief food_import_run() error: out of memory or thread failure */
+#define IMPORT_ERROR_INTERNAL -3
+
+/** @brief food_import_run() error: unusable CSV header or too many records (see errors[0]) */
+#define IMPORT_ERROR_FORMAT -4
+
+/**
+ * @brief Validates and imports food records.
+ *
+ * Rows with an id are upserted; rows without one are inserted and get
+ * new ids. When the same id appears more than once, the last record
+ * wins. Invalid rows are skipped and reported; they do not stop the
+ * import. With IMPORT_ERROR_DB, rows committed before the failure stay
+ * committed and are counted in result->imported.
+ *
+ * @param data Request body
+ * @param size Body length in bytes
+ * @param format Body encoding
+ * @param dry_run Non-zero to validate only
+ * @param result Counts and errors (filled in on success and IMPORT_ERROR_DB)
+ * @return 0 on success, or a negative IMPORT_ERROR_* code
+ */
+int food_import_run(const char *data, size_t size, ImportFormat format, int dry_run,
+                    ImportResult *result);
+
+#endif
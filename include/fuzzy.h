@@ -0,0 +1,82 @@
+/**
+ * @file fuzzy.h
+ * @brief Typo-tolerant food name search.
+ *
+ * Candidates are found with a trigram inverted index over normalized
+ * names, then verified with Myers' bit-parallel approximate substring
+ * matching. Results are ranked by edit distance, then popularity.
+ */
+
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include "catalog.h"
+
+/**
+ * @brief A verified fuzzy search hit.
+ */
+typedef struct {
+    int index;      /**< Catalog index of the food */
+    int distance;   /**< Edit distance of the best matching substring */
+} FuzzyMatch;
+
+/**
+ * @brief Builds the trigram index from a catalog and installs it.
+ *
+ * Replaces any previously built index. Equivalent to fuzzy_prepare()
+ * followed by fuzzy_install().
+ *
+ * @param cat Loaded catalog
+ * @return 0 on success, -1 on failure
+ */
+int fuzzy_build(const Catalog *cat);
+
+/** @brief A built trigram index */
+typedef struct fuzzy_index FuzzyIndex;
+
+/**
+ * @brief Builds a trigram index without installing it.
+ *
+ * @param cat Catalog to index; must outlive the index
+ * @return New index, or NULL on failure
+ */
+FuzzyIndex *fuzzy_prepare(const Catalog *cat);
+
+/**
+ * @brief Replaces the installed index, freeing the previous one.
+ *
+ * Must be called with the catalog write lock held, together with
+ * installing the catalog the index was built from.
+ *
+ * @param idx Index from fuzzy_prepare() (ownership is taken)
+ */
+void fuzzy_install(FuzzyIndex *idx);
+
+/**
+ * @brief Frees an index that was never installed.
+ *
+ * @param idx Index to free (may be NULL)
+ */
+void fuzzy_discard(FuzzyIndex *idx);
+
+/**
+ * @brief Searches food names allowing a few typos.
+ *
+ * The query is folded with text_fold() and split into words. The
+ * allowed edit distance grows with each word's length (0 for up to
+ * 3 bytes, at most 3).
+ *
+ * @param query Raw search string
+ * @param category_id Only return foods in this category (0 for any)
+ * @param out Output array of matches, best first
+ * @param max_results Capacity of out
+ * @return Number of matches written, or -1 if the index is not built
+ */
+int fuzzy_search(const char *query, int category_id, FuzzyMatch *out, int max_results);
+
+/**
+ * @brief Frees the trigram index.
+ */
+void fuzzy_cleanup(void);
+
+#endif
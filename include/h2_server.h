@@ -0,0 +1,68 @@
+/**
+ * @file h2_server.h
+ * @brief Optional HTTP/2 listener (nghttp2).
+ *
+ * Runs on its own port next to the libmicrohttpd listener and speaks h2c
+ * with prior knowledge, or h2 over TLS (ALPN) when a certificate is
+ * configured. A thread per connection owns the nghttp2 session; complete
+ * requests go to a shared pool of handler threads, so the streams of one
+ * connection are served in parallel. Streamed responses (exports) are
+ * produced by a thread of their own into a short queue that the session
+ * drains as the peer's flow-control window allows. File-backed bodies
+ * (the catalog bundle) are sent with sendfile on h2c, and on TLS when
+ * the kernel took over record encryption (kTLS). Built only with
+ * "make HTTP2=1".
+ */
+
+#ifndef H2_SERVER_H
+#define H2_SERVER_H
+
+/** @brief SETTINGS_MAX_CONCURRENT_STREAMS advertised to clients */
+#define H2_MAX_CONCURRENT_STREAMS 100
+
+/** @brief Initial per-stream receive window (request bodies) */
+#define H2_STREAM_WINDOW (1024 * 1024)
+
+/** @brief Connection-level receive window */
+#define H2_CONNECTION_WINDOW (16 * 1024 * 1024)
+
+/** @brief Chunks of a streamed response buffered ahead of the peer */
+#define H2_STREAM_QUEUE_CHUNKS 4
+
+/** @brief h2_server_start() error: built without nghttp2 */
+#define H2_ERROR_UNAVAILABLE -1
+
+/** @brief h2_server_start() error: socket, TLS or thread setup failed */
+#define H2_ERROR_SETUP -2
+
+/**
+ * @brief Starts the HTTP/2 listener and its handler pool.
+ *
+ * @param port TCP port to listen on
+ * @param threads Handler threads (0 = two per CPU)
+ * @param cert_file PEM certificate chain, or NULL/empty for h2c
+ * @param key_file PEM private key (with cert_file)
+ * @param ktls Non-zero to use kernel TLS when available
+ * @param max_connections Most open connections, each holding a thread (0 = no limit)
+ * @return 0 on success, or a negative H2_ERROR_* code
+ */
+int h2_server_start(int port, int threads, const char *cert_file, const char *key_file,
+                    int ktls, int max_connections);
+
+/**
+ * @brief Changes the number of handler threads of a running listener.
+ *
+ * Threads beyond the new count finish their current stream and exit.
+ * Does nothing if the listener is not running.
+ *
+ * @param threads Handler threads (0 = two per CPU)
+ * @return 0 on success, or a negative H2_ERROR_* code
+ */
+int h2_server_resize(int threads);
+
+/**
+ * @brief Stops the listener after sending GOAWAY on open connections.
+ */
+void h2_server_stop(void);
+
+#endif
@@ -1,48 +1,248 @@
 /**
  * @file http_helpers.h
- * @brief HTTP response utilities for libmicrohttpd.
+ * @brief HTTP request and response utilities.
  *
- * Helper functions for sending JSON responses with proper
- * headers and CORS support.
+ * Route handlers see requests through HttpRequest, which hides the HTTP
+ * front end (libmicrohttpd, or the optional io_uring server) behind a
+ * small table of operations. Helper functions send JSON responses with
+ * proper headers and CORS support.
  */
 
 #ifndef HTTP_HELPERS_H
 #define HTTP_HELPERS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
 #include <microhttpd.h>
 
+/** @brief Bytes requested from a content reader per call */
+#define HTTP_STREAM_BLOCK_SIZE (64 * 1024)
+
+/**
+ * @brief A response header.
+ */
+typedef struct {
+    const char *name;   /**< Header name */
+    const char *value;  /**< Header value */
+} HttpHeader;
+
+/**
+ * @brief Operations an HTTP front end provides to route handlers.
+ */
+typedef struct {
+    /** @brief Returns a URL-decoded query argument, or NULL if absent */
+    const char *(*query_arg)(void *conn, const char *key);
+    /** @brief Returns a request header (case-insensitive name), or NULL if absent */
+    const char *(*header)(void *conn, const char *name);
+    /** @brief Sends a complete response with extra headers; the body is copied */
+    enum MHD_Result (*respond)(void *conn, int status_code, const char *content_type,
+                               const HttpHeader *headers, int header_count,
+                               const char *body, size_t body_len);
+    /**
+     * @brief Sends a response whose body is pulled from reader (NULL if
+     * unsupported). The reader follows the MHD content reader contract
+     * and free_cb is called once the body is done or abandoned.
+     */
+    enum MHD_Result (*respond_stream)(void *conn, int status_code,
+                                      const HttpHeader *headers, int header_count,
+                                      MHD_ContentReaderCallback reader, void *reader_cls,
+                                      MHD_ContentReaderFreeCallback free_cb);
+    /**
+     * @brief Sends size bytes of fd from offset as the body (NULL if
+     * unsupported), so it can go out with sendfile. Takes ownership of fd.
+     */
+    enum MHD_Result (*respond_fd)(void *conn, int status_code,
+                                  const HttpHeader *headers, int header_count,
+                                  int fd, uint64_t offset, uint64_t size);
+    /** @brief Fills in the client address; returns 0, or -1 if unknown */
+    int (*peer_address)(void *conn, struct sockaddr_storage *addr);
+} HttpFrontend;
+
+/**
+ * @brief A request being handled.
+ */
+typedef struct {
+    const HttpFrontend *frontend; /**< Front end operations */
+    void *conn;                   /**< Front end connection state */
+    struct MHD_Connection *mhd;   /**< MHD connection, or NULL for other front ends */
+    const char *method;           /**< HTTP method */
+    const char *url;              /**< Path, without the query string */
+    const char *body;             /**< Request body (NUL-terminated, never NULL) */
+    size_t body_len;              /**< Body length in bytes */
+} HttpRequest;
+
+/** @brief Number of entries in http_cors_headers */
+#define HTTP_CORS_HEADER_COUNT 3
+
+/**
+ * @brief CORS headers added to every response.
+ */
+extern const HttpHeader http_cors_headers[HTTP_CORS_HEADER_COUNT];
+
+/**
+ * @brief Wraps an MHD connection in a request.
+ *
+ * @param request Request to fill in
+ * @param connection The MHD connection handle
+ * @param method HTTP method
+ * @param url Request URL path
+ * @param body Request body (NULL for none)
+ * @param body_len Body length in bytes
+ */
+void http_request_init_mhd(HttpRequest *request, struct MHD_Connection *connection,
+                           const char *method, const char *url,
+                           const char *body, size_t body_len);
+
+/**
+ * @brief Returns a query argument of the request.
+ *
+ * @param request The HTTP request
+ * @param key Argument name
+ * @return URL-decoded value, or NULL if absent
+ */
+const char *http_query_arg(HttpRequest *request, const char *key);
+
+/**
+ * @brief Returns a request header.
+ *
+ * @param request The HTTP request
+ * @param name Header name (case-insensitive)
+ * @return Header value, or NULL if absent
+ */
+const char *http_header(HttpRequest *request, const char *name);
+
+/**
+ * @brief Returns whether the client connected over the loopback interface.
+ *
+ * @param request Request being handled
+ * @return Non-zero for 127.0.0.0/8, ::1 and IPv4-mapped loopback
+ */
+int http_peer_is_local(HttpRequest *request);
+
+/**
+ * @brief Percent-decodes a string in place.
+ *
+ * @param s String to decode
+ * @param plus_is_space Non-zero to turn '+' into a space (query strings)
+ */
+void http_url_decode(char *s, int plus_is_space);
+
+/**
+ * @brief Splits and decodes a query string in place.
+ *
+ * Keys without '=' get a NULL value. Arguments past max_args are ignored.
+ *
+ * @param query Query string, without the '?'
+ * @param args Filled with key/value pairs pointing into query
+ * @param max_args Capacity of args
+ * @return Number of arguments stored
+ */
+int http_parse_query(char *query, const char *args[][2], int max_args);
+
 /**
  * @brief Sends a JSON response to the client.
  *
  * Sets Content-Type to application/json and adds CORS headers.
  * The response body is copied, so the caller can free json_body after.
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @param status_code HTTP status code (200, 400, 404, 500, etc.)
  * @param json_body JSON string to send as response body
  * @return MHD_YES on success, MHD_NO on failure
  */
 enum MHD_Result send_json_response(
-    struct MHD_Connection *connection,
+    HttpRequest *request,
     int status_code,
     const char *json_body
 );
 
+/**
+ * @brief Sends a JSON response with extra headers.
+ *
+ * @param request The HTTP request
+ * @param status_code HTTP status code
+ * @param json_body JSON string to send as response body
+ * @param headers Extra response headers
+ * @param header_count Entries in headers
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result send_json_response_with_headers(
+    HttpRequest *request,
+    int status_code,
+    const char *json_body,
+    const HttpHeader *headers,
+    int header_count
+);
+
 /**
  * @brief Sends a JSON error response to the client.
  *
  * Convenience wrapper that formats error message as:
  * {"success": false, "error": "<message>"}
+ * The message is escaped, so it may include text from the request.
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @param status_code HTTP status code (400, 404, 500, etc.)
  * @param error_message Error description to include in response
  * @return MHD_YES on success, MHD_NO on failure
  */
 enum MHD_Result send_error_response(
-    struct MHD_Connection *connection,
+    HttpRequest *request,
     int status_code,
     const char *error_message
 );
 
+/**
+ * @brief Sends a response whose body is produced by a content reader.
+ *
+ * Adds CORS headers. Takes ownership of reader_cls: free_cb is called
+ * even if the response cannot be sent. Front ends without streaming
+ * support answer 501.
+ *
+ * @param request The HTTP request
+ * @param status_code HTTP status code
+ * @param headers Response headers (Content-Type included)
+ * @param header_count Entries in headers
+ * @param reader Produces the body, HTTP_STREAM_BLOCK_SIZE bytes at most per call
+ * @param reader_cls Reader state
+ * @param free_cb Releases reader_cls
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result send_stream_response(
+    HttpRequest *request,
+    int status_code,
+    const HttpHeader *headers,
+    int header_count,
+    MHD_ContentReaderCallback reader,
+    void *reader_cls,
+    MHD_ContentReaderFreeCallback free_cb
+);
+
+/**
+ * @brief Sends a response whose body is a byte range of a file.
+ *
+ * Adds CORS headers. Front ends send the range with sendfile where they
+ * can. Takes ownership of fd: it is closed even if the response cannot
+ * be sent. Front ends without file support answer 501.
+ *
+ * @param request The HTTP request
+ * @param status_code HTTP status code
+ * @param headers Response headers (Content-Type included)
+ * @param header_count Entries in headers
+ * @param fd File to read the body from; must not change while being sent
+ * @param offset Offset of the body in fd
+ * @param size Body length in bytes
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result send_fd_response(
+    HttpRequest *request,
+    int status_code,
+    const HttpHeader *headers,
+    int header_count,
+    int fd,
+    uint64_t offset,
+    uint64_t size
+);
+
 #endif
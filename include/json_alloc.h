@@ -0,0 +1,76 @@
+/**
+ * @file json_alloc.h
+ * @brief Slab allocator for cJSON.
+ *
+ * Installed with cJSON_InitHooks() at startup. Every cJSON node and every
+ * string up to JSON_ALLOC_MAX_SMALL bytes comes from a size class (one
+ * sized for a cJSON item, plus small-string classes); larger buffers, such
+ * as printed documents, go to malloc(). Each thread keeps its own free
+ * lists and exchanges batches of blocks with a shared depot, so building
+ * and freeing a large DOM takes no lock per node. Slab memory is kept for
+ * reuse until json_alloc_cleanup().
+ *
+ * With hooks installed, strings returned by cJSON_Print*() must be
+ * released with cJSON_free(), not free().
+ */
+
+#ifndef JSON_ALLOC_H
+#define JSON_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Largest allocation served from a size class */
+#define JSON_ALLOC_MAX_SMALL 256
+
+/**
+ * @brief Allocator counters, summed over all threads.
+ */
+typedef struct {
+    int enabled;            /**< Non-zero if the slab hooks are installed */
+    int threads;            /**< Threads currently holding a cache */
+    uint64_t allocs;        /**< Allocations served from a size class */
+    uint64_t frees;         /**< Blocks returned to a size class */
+    uint64_t large_allocs;  /**< Allocations passed on to malloc() */
+    uint64_t refills;       /**< Batches a thread took from the depot */
+    uint64_t flushes;       /**< Batches a thread gave back to the depot */
+    size_t slab_bytes;      /**< Memory held in slabs */
+} JsonAllocStats;
+
+/**
+ * @brief Selects the cJSON allocator.
+ *
+ * Must be called before any cJSON call, from a single thread.
+ *
+ * @param use_slabs Non-zero for the slab allocator, zero for plain malloc()
+ * @return 0 on success
+ */
+int json_alloc_init(int use_slabs);
+
+/**
+ * @brief Sets how many free blocks per size class a thread keeps.
+ *
+ * Takes effect on each thread's next free; may be called at any time.
+ *
+ * @param blocks Limit, at least JSON_ALLOC_MIN_CACHE (config.h)
+ */
+void json_alloc_set_cache_limit(int blocks);
+
+/**
+ * @brief Reads the allocator counters.
+ *
+ * Counters of other threads are read without stopping them, so the
+ * totals may lag by the operations in flight.
+ *
+ * @param stats Filled in
+ */
+void json_alloc_stats(JsonAllocStats *stats);
+
+/**
+ * @brief Restores the default cJSON hooks and frees all slabs.
+ *
+ * Call at shutdown, once no thread uses cJSON any more.
+ */
+void json_alloc_cleanup(void);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file meal_planner.h
+ * @brief Generates a day of meals that hits nutrition targets.
+ *
+ * Foods and portions are chosen from the in-memory catalog with a
+ * randomized local search. Several worker threads search independently
+ * from different random starts, and the best plan found within the
+ * time budget is returned.
+ */
+
+#ifndef MEAL_PLANNER_H
+#define MEAL_PLANNER_H
+
+/** @brief Maximum number of meals in a plan */
+#define PLAN_MAX_MEALS 8
+
+/** @brief Maximum number of foods per meal */
+#define PLAN_MAX_ITEMS 6
+
+/** @brief Maximum number of allowed categories per meal */
+#define PLAN_MAX_CATEGORIES 32
+
+/**
+ * @brief Constraints for one meal of the plan.
+ */
+typedef struct {
+    char meal_type[16];                     /**< breakfast, lunch, dinner or snack */
+    int item_count;                         /**< Number of foods (1..PLAN_MAX_ITEMS) */
+    int snack_only;                         /**< Only use foods marked is_snack_suitable */
+    int category_count;                     /**< Number of allowed categories (0 for any) */
+    int category_ids[PLAN_MAX_CATEGORIES];  /**< Allowed food categories */
+} PlanMeal;
+
+/**
+ * @brief A plan generation request.
+ *
+ * Nutrient targets of 0 or less are not optimized for; calories must
+ * be positive.
+ */
+typedef struct {
+    float calories;             /**< Target kcal for the day */
+    float protein;              /**< Target protein grams */
+    float carbs;                /**< Target carbohydrate grams */
+    float fat;                  /**< Target fat grams */
+    int meal_count;             /**< Number of meals (1..PLAN_MAX_MEALS) */
+    PlanMeal meals[PLAN_MAX_MEALS];
+    int time_budget_ms;         /**< Search time (1..PLAN_BUDGET_MAX_MS) */
+    unsigned int seed;          /**< Random seed (0 picks one) */
+} PlanRequest;
+
+/**
+ * @brief One food of a generated plan.
+ */
+typedef struct {
+    int index;  /**< Catalog index of the food */
+    int grams;  /**< Portion in grams */
+} PlanItem;
+
+/**
+ * @brief A generated plan.
+ */
+typedef struct {
+    PlanItem items[PLAN_MAX_MEALS][PLAN_MAX_ITEMS]; /**< Foods per meal, see PlanMeal.item_count */
+    float calories;     /**< Plan total kcal */
+    float protein;      /**< Plan total protein grams */
+    float carbs;        /**< Plan total carbohydrate grams */
+    float fat;          /**< Plan total fat grams */
+    double score;       /**< Weighted squared relative error (0 is exact) */
+    long iterations;    /**< Search steps over all workers */
+    int threads;        /**< Worker threads used */
+} PlanResult;
+
+/** @brief meal_planner_generate() error: catalog not loaded */
+#define PLAN_ERROR_NO_CATALOG -1
+
+/** @brief meal_planner_generate() error: too few candidate foods to fill every slot once */
+#define PLAN_ERROR_NO_CANDIDATES -2
+
+/** @brief meal_planner_generate() error: out of memory or thread failure */
+#define PLAN_ERROR_INTERNAL -3
+
+/**
+ * @brief Searches for a plan matching the request.
+ *
+ * A food is used at most once per plan. Portions stay between half and
+ * twice the food's default portion, in 5 g steps.
+ *
+ * @param request Targets and constraints (must be validated by the caller)
+ * @param result Best plan found
+ * @return 0 on success, or a negative PLAN_ERROR_* code
+ */
+int meal_planner_generate(const PlanRequest *request, PlanResult *result);
+
+#endif
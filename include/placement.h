@@ -0,0 +1,157 @@
+/**
+ * @file placement.h
+ * @brief CPU affinity, NUMA placement and huge pages.
+ *
+ * Pins server threads to CPUs round-robin, runs work on a given NUMA
+ * node so that its memory is allocated there (first touch), and maps
+ * large read-only structures with transparent or explicit huge pages.
+ * Topology comes from /sys/devices/system/node; on other systems, or
+ * with everything disabled (the default), every call is a cheap no-op
+ * and there is a single node.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/** @brief Highest number of NUMA nodes handled */
+#define PLACEMENT_MAX_NODES 16
+
+/** @brief Highest number of CPUs handled */
+#define PLACEMENT_MAX_CPUS 1024
+
+/** @brief Threads placed by placement_pin_thread() */
+typedef enum {
+    PLACEMENT_ROLE_HTTP,    /**< libmicrohttpd connection threads */
+    PLACEMENT_ROLE_URING,   /**< io_uring workers */
+    PLACEMENT_ROLE_H2,      /**< HTTP/2 connection and handler threads */
+    PLACEMENT_ROLE_COUNT
+} PlacementRole;
+
+/** @brief How placement_alloc() backs memory */
+typedef enum {
+    PLACEMENT_HUGE_OFF,         /**< Regular pages */
+    PLACEMENT_HUGE_THP,         /**< 2 MB aligned, madvise(MADV_HUGEPAGE) */
+    PLACEMENT_HUGE_EXPLICIT     /**< MAP_HUGETLB from the reserved pool */
+} PlacementHugePages;
+
+/**
+ * @brief A live placement_alloc() region, as measured now.
+ */
+typedef struct {
+    const char *label;          /**< Name given to placement_alloc() */
+    const void *addr;           /**< Start of the region */
+    size_t size;                /**< Bytes requested */
+    int wanted_node;            /**< Node it was allocated for (-1 = any) */
+    int node;                   /**< Node holding its first page (-1 = unknown) */
+    PlacementHugePages pages;   /**< Backing actually obtained */
+    size_t huge_bytes;          /**< Bytes currently in huge pages (from smaps) */
+} PlacementRegion;
+
+/**
+ * @brief Placement settings and thread counters.
+ */
+typedef struct {
+    int pinning;                /**< Non-zero if threads are pinned */
+    int numa_shards;            /**< Non-zero if caches are replicated per node */
+    PlacementHugePages huge_pages; /**< Configured backing */
+    int nodes;                  /**< NUMA nodes seen */
+    int cpus;                   /**< CPUs threads are pinned to */
+    int pinned[PLACEMENT_ROLE_COUNT]; /**< Threads pinned so far, per role */
+    int cpu_threads[PLACEMENT_MAX_CPUS]; /**< Threads pinned to each CPU */
+    int node_threads[PLACEMENT_MAX_NODES]; /**< Threads pinned to each node */
+} PlacementStats;
+
+/**
+ * @brief Reads the topology and applies the settings.
+ *
+ * Must be called once at startup, before any thread is started.
+ *
+ * @param cpus CPUs to pin threads to: "" (no pinning), "all" (every CPU
+ *             the process may run on) or a list such as "0-7,16-23"
+ * @param numa_shards Non-zero to keep a copy of read-mostly caches on
+ *                    each node (see placement_node_count())
+ * @param huge_pages "off", "thp" or "explicit"
+ * @return 0 on success, -1 if a setting is malformed
+ */
+int placement_init(const char *cpus, int numa_shards, const char *huge_pages);
+
+/**
+ * @brief Pins the calling thread to the next CPU.
+ *
+ * Does nothing if pinning is off or the thread is already pinned, so it
+ * can be called on every request.
+ *
+ * @param role Kind of thread, for the counters
+ */
+void placement_pin_thread(PlacementRole role);
+
+/**
+ * @brief Returns the number of per-node cache copies to keep.
+ *
+ * @return Number of NUMA nodes with shards on, otherwise 1
+ */
+int placement_node_count(void);
+
+/**
+ * @brief Returns the node the calling thread is running on.
+ *
+ * @return Node number below placement_node_count()
+ */
+int placement_current_node(void);
+
+/**
+ * @brief Runs fn(arg) on a thread bound to the CPUs of a node, and waits.
+ *
+ * Memory that fn first touches is then allocated on that node.
+ *
+ * @return 0 if fn ran, -1 if the thread could not be started
+ */
+int placement_run_on_node(int node, void (*fn)(void *), void *arg);
+
+/**
+ * @brief Maps a zero-filled region with the configured page backing.
+ *
+ * Explicit huge pages fall back to transparent ones when the pool is
+ * empty. Pages are placed by first touch: fill the region from the node
+ * that will read it (see placement_run_on_node()).
+ *
+ * @param label Name reported by placement_regions() (static string)
+ * @param size Bytes needed
+ * @param node Node the caller intends it for, for reporting (-1 = any)
+ * @return Region (page aligned), or NULL on failure
+ */
+void *placement_alloc(const char *label, size_t size, int node);
+
+/**
+ * @brief Unmaps a region from placement_alloc().
+ *
+ * @param ptr Region (may be NULL)
+ */
+void placement_free(void *ptr);
+
+/**
+ * @brief Reads the settings and thread counters.
+ *
+ * @param stats Filled in
+ */
+void placement_stats(PlacementStats *stats);
+
+/**
+ * @brief Lists live regions with the node and huge pages backing them.
+ *
+ * Reads /proc/self/smaps, so it is meant for the metrics endpoint only.
+ *
+ * @param out Output array
+ * @param max Capacity of out
+ * @return Number of regions written
+ */
+int placement_regions(PlacementRegion *out, int max);
+
+/**
+ * @brief Returns the name of a huge page setting ("off", "thp", "explicit").
+ */
+const char *placement_huge_pages_name(PlacementHugePages pages);
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file rate_limit.h
+ * @brief Per-client token buckets, per route class.
+ *
+ * Each (client, class) pair has a bucket refilled at the class rate and
+ * holding up to RATE_LIMIT_BURST seconds of it. Buckets live in a fixed
+ * table of cache-line sized groups of four, indexed by hash and updated
+ * with compare-and-swap, so a check takes no lock and touches one cache
+ * line. When a group is full the least recently refilled bucket is
+ * reused, which gives its client a full bucket again.
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/** @brief Bucket groups in the table (four buckets each) */
+#define RATE_LIMIT_GROUPS 16384
+
+/** @brief Route classes with their own limit */
+typedef enum {
+    RATE_CLASS_NONE = -1,   /**< Not limited (health, metrics, admin, CORS preflight) */
+    RATE_CLASS_READ,        /**< Other reads (RATE_LIMIT_READ) */
+    RATE_CLASS_HEAVY,       /**< template-full, plan generation, exports, bundle (RATE_LIMIT_HEAVY) */
+    RATE_CLASS_WRITE,       /**< bulk-insert and import (RATE_LIMIT_WRITE) */
+    RATE_CLASS_COUNT
+} RateClass;
+
+/**
+ * @brief Rate limiter counters.
+ */
+typedef struct {
+    uint64_t limited[RATE_CLASS_COUNT]; /**< Requests refused, per class */
+    uint64_t evictions;                 /**< Buckets reused for another client */
+} RateLimitStats;
+
+/**
+ * @brief Returns the class of a request.
+ *
+ * @param method HTTP method
+ * @param path URL path (a prefix is enough)
+ */
+RateClass rate_limit_class(const char *method, const char *path);
+
+/**
+ * @brief Hashes a client identity.
+ *
+ * @param key API key header value, or NULL to use the address
+ * @param key_len Length of key
+ * @param addr Client address (used when key is NULL; may be NULL)
+ * @return Client hash
+ */
+uint64_t rate_limit_client(const char *key, size_t key_len, const struct sockaddr_storage *addr);
+
+/**
+ * @brief Takes a token from a client's bucket for a class.
+ *
+ * @param client Hash from rate_limit_client()
+ * @param cls Route class (not RATE_CLASS_NONE)
+ * @param rate Requests per second (0 = unlimited)
+ * @param burst_seconds Seconds of rate a full bucket holds
+ * @return 0 if admitted, otherwise seconds until a token is available
+ */
+int rate_limit_take(uint64_t client, RateClass cls, int rate, int burst_seconds);
+
+/**
+ * @brief Reads the counters.
+ *
+ * @param stats Filled in
+ */
+void rate_limit_stats(RateLimitStats *stats);
+
+/**
+ * @brief Returns the name of a class ("read", "heavy", "write").
+ */
+const char *rate_limit_class_name(RateClass cls);
+
+#endif
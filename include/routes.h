@@ -10,6 +10,8 @@
 #define ROUTES_H
 
 #include <microhttpd.h>
+#include "exporter.h"
+#include "http_helpers.h"
 
 /**
  * @brief Handles GET /health endpoint.
@@ -17,10 +19,63 @@
  * Returns server health status for monitoring/load balancers.
  * Response: {"status": "ok", "service": "diet-api-c"}
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_health(struct MHD_Connection *connection);
+enum MHD_Result handle_health(HttpRequest *request);
+
+/**
+ * @brief Handles GET /metrics endpoint.
+ *
+ * Reports where server threads and large caches were placed (pinned
+ * CPUs, NUMA nodes, huge pages), the database pool controller, replica
+ * hedging, template snapshots, rate limit refusals and the cJSON
+ * allocator counters.
+ * Response: {"placement": {...}, "db_pool": {...}, "db_replicas": {...},
+ *            "template_cache": {...}, "rate_limit": {...}, "json_alloc": {...}}
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_metrics(HttpRequest *request);
+
+/**
+ * @brief Handles GET /admin/config endpoint (loopback clients only).
+ *
+ * Lists every setting with its current value, where it came from and
+ * whether it can change without a restart. DB_PASSWORD is masked.
+ * Response: {"settings": [{"key", "value", "source", "reloadable"}, ...]}
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_get_config(HttpRequest *request);
+
+/**
+ * @brief Handles POST /admin/config endpoint (loopback clients only).
+ *
+ * Body: {"KEY": value, ...}. Values are validated together; reloadable
+ * ones take effect at once, the others are reported as needing a restart.
+ * Response: {"applied": [...], "restart_required": [...], "errors": [...]}
+ *
+ * @param request The HTTP request
+ * @param post_data Request body
+ * @param post_data_size Body length
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_set_config(HttpRequest *request,
+                                  const char *post_data, size_t post_data_size);
+
+/**
+ * @brief Handles POST /admin/config/reload endpoint (loopback clients only).
+ *
+ * Re-reads the environment and CONFIG_FILE, like SIGHUP.
+ * Response: as for POST /admin/config
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_reload_config(HttpRequest *request);
 
 /**
  * @brief Handles GET /api/categories endpoint.
@@ -28,10 +83,10 @@ enum MHD_Result handle_health(struct MHD_Connection *connection);
  * Returns all food categories ordered by sort_order.
  * Response: {"success": true, "categories": [...], "count": N}
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_list_categories(struct MHD_Connection *connection);
+enum MHD_Result handle_list_categories(HttpRequest *request);
 
 /**
  * @brief Handles GET /api/categories/{id} endpoint.
@@ -40,26 +95,48 @@ enum MHD_Result handle_list_categories(struct MHD_Connection *connection);
  * Response: {"success": true, "category": {...}}
  * Error: {"success": false, "error": "Category not found"} (404)
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @param id Category ID from URL path
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_get_category(struct MHD_Connection *connection, int id);
+enum MHD_Result handle_get_category(HttpRequest *request, int id);
 
 /**
  * @brief Handles GET /api/foods endpoint.
  *
  * Returns food items with optional filtering.
- * Query params: category_id, search, limit (default 100, max 1000)
+ * Query params: category_id, search, limit (default 100, max 1000),
+ * fuzzy (1/true: typo-tolerant search from the in-memory index; each
+ * food then also carries its edit "distance", results best match first)
  * Response: {"success": true, "foods": [...], "count": N}
  *
- * @param connection The MHD connection handle
+ * When the catalog is loaded, search is a case- and diacritic-insensitive
+ * substring match done in memory; otherwise it falls back to SQL LIKE.
+ *
+ * Nutrition filters (in memory only, 503 if the catalog is not loaded):
+ * min_/max_ calories, protein, carbs, fat (inclusive, per 100g) and
+ * sort=name|calories|protein|carbs|fat|protein_ratio ('-' prefix for
+ * descending). They combine with category_id and search but not fuzzy.
+ * Error: {"success": false, "error": "..."} (400) on malformed values
+ *
+ * @param request The HTTP request
  * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_list_foods(HttpRequest *request);
+
+/**
+ * @brief Handles GET /api/foods/suggest endpoint.
  *
- * @warning The search parameter is vulnerable to SQL injection.
- *          Use mysql_real_escape_string() before production.
+ * Returns the most popular foods whose name has a word starting with q,
+ * answered from the in-memory suggest index (no database access).
+ * Query params: q (required), limit (default 10, max 10)
+ * Response: {"success": true, "suggestions": [{id, name, category_id}], "count": N}
+ * Error: {"success": false, "error": "Catalog not loaded"} (503)
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_list_foods(struct MHD_Connection *connection);
+enum MHD_Result handle_suggest_foods(HttpRequest *request);
 
 /**
  * @brief Handles GET /api/foods/{id} endpoint.
@@ -68,23 +145,98 @@ enum MHD_Result handle_list_foods(struct MHD_Connection *connection);
  * Response: {"success": true, "food": {...}}
  * Error: {"success": false, "error": "Food not found"} (404)
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @param id Food item ID from URL path
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_get_food(struct MHD_Connection *connection, int id);
+enum MHD_Result handle_get_food(HttpRequest *request, int id);
+
+/**
+ * @brief Handles GET /api/templates/search endpoint.
+ *
+ * Finds templates by their computed average daily nutrition (from the
+ * in-memory template index, not calories_target).
+ * Query params: kcal, protein, carbs, fat as "min-max" ranges, and/or
+ * kcal_min, kcal_max, protein_min, ... bounds; limit (default 100, max 1000)
+ * Response: {"success": true, "templates": [{id, code, name, segment, type,
+ * duration_days, calories_target, daily: {calories, protein, carbs, fat}}],
+ * "count": N}, ordered by daily calories
+ * Error: {"success": false, "error": "..."} (400 malformed bound, 503 not loaded)
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_search_templates(HttpRequest *request);
+
+/**
+ * @brief Handles GET /api/export/foods and /api/export/templates endpoints.
+ *
+ * Streams the whole table in id order, gzip-compressed when the client
+ * sends Accept-Encoding: gzip.
+ * Query params: format (ndjson (default) or csv)
+ * Response: one JSON object per line, or CSV with a header row
+ * Error: 400 unknown format, 503 too many concurrent exports, 500 database error
+ *
+ * @param request The HTTP request
+ * @param table Table to export
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_export(HttpRequest *request, ExportTable table);
+
+/**
+ * @brief Handles GET /api/catalog/bundle endpoint.
+ *
+ * Serves the whole in-memory catalog as one binary bundle (columnar
+ * nutrition arrays, string table, category table; see catalog_bundle.h),
+ * gzip-compressed when the client sends Accept-Encoding: gzip. The body
+ * is built once per catalog version and its ETag changes only with the
+ * content, so clients revalidate with If-None-Match.
+ * Response: application/octet-stream bundle, or 304 Not Modified
+ * Error: 503 catalog not loaded, 500 build failed
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_catalog_bundle(HttpRequest *request);
 
 /**
  * @brief Handles GET /api/templates/{id}/full endpoint.
  *
  * Returns complete template with nested days, meals, and food items.
+ * TEMPLATE_FULL_STRATEGY, or the strategy query argument ("c" or
+ * "mysql"), chooses whether the document is assembled here or by MySQL.
+ * With TEMPLATE_DOCUMENTS=1 and no strategy argument the stored document
+ * is sent as it is, and the template object also carries its "version".
+ * TEMPLATE_CACHE=1 takes precedence: the in-memory snapshot is sent with
+ * its version, and an ETag naming it; If-None-Match with that ETag gets
+ * an empty 304.
  * Response: {"success": true, "template": {id, name, days: [{meals: [{items: [...]}]}]}}
+ * Error: 400 unknown strategy, 404 template not found, 500 database error
+ *
+ * @param request The HTTP request
+ * @param id Template ID from URL path
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_get_template_full(HttpRequest *request, int id);
+
+/**
+ * @brief Handles GET /api/templates/{id}/changes?since=<version> endpoint.
  *
- * @param connection The MHD connection handle
+ * Returns what changed in a template since the version a client holds,
+ * as RFC 6902 JSON Patch operations on the template-full response, from
+ * an in-memory log of recent meal changes (needs TEMPLATE_CACHE=1). When
+ * since is no longer covered by the log, the patch replaces the whole
+ * /template object and "full" is true.
+ * Response: {"success": true, "since": N, "version": N, "full": false,
+ *            "patch": [{"op": "replace", "path": "/template/days/0/meals/1", "value": {...}}, ...]}
+ * Error: 400 since missing or not a version, 404 template not found,
+ *        503 template cache disabled, 500 database error
+ *
+ * @param request The HTTP request
  * @param id Template ID from URL path
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_get_template_full(struct MHD_Connection *connection, int id);
+enum MHD_Result handle_get_template_changes(HttpRequest *request, int id);
 
 /**
  * @brief Handles POST /api/benchmark/bulk-insert endpoint.
@@ -93,12 +245,99 @@ enum MHD_Result handle_get_template_full(struct MHD_Connection *connection, int
  * Request: {"meal_id": N, "items": [{food_item_id, portion_grams_min, ...}]}
  * Response: {"success": true, "inserted_count": N}
  *
- * @param connection The MHD connection handle
+ * @param request The HTTP request
  * @param post_data JSON body data
  * @param post_data_size Size of POST data
  * @return MHD_YES on success, MHD_NO on failure
  */
-enum MHD_Result handle_bulk_insert(struct MHD_Connection *connection,
+enum MHD_Result handle_bulk_insert(HttpRequest *request,
                                    const char *post_data, size_t post_data_size);
 
+/**
+ * @brief Handles POST /api/plans/generate endpoint.
+ *
+ * Builds a day of meals close to the given targets from the in-memory
+ * catalog (randomized local search across worker threads).
+ * Request: {"calories": N, "protein": N, "carbs": N, "fat": N,
+ * "meals": [{"meal_type", "items", "category_ids", "snack_only"}],
+ * "category_ids": [...], "time_budget_ms": N, "seed": N}
+ * Only calories is required. meals defaults to breakfast, lunch and dinner
+ * with 3 items and one snack item; snack meals use snack-suitable foods.
+ * Response: {"success": true, "plan": {"meals": [{meal_type, items: [{food_item_id,
+ * name, grams, calories, protein, carbs, fat}]}], "totals": {...}},
+ * "search": {score, iterations, threads, elapsed_ms}}
+ * Error: 400 invalid request, 422 too few matching foods, 503 catalog not loaded
+ *
+ * @param request The HTTP request
+ * @param post_data JSON body data
+ * @param post_data_size Size of POST data
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_generate_plan(HttpRequest *request,
+                                     const char *post_data, size_t post_data_size);
+
+/**
+ * @brief Handles POST /api/foods/import endpoint.
+ *
+ * Validates the records in parallel and upserts them in batches; rows
+ * with an id replace that food, rows without one are added. Invalid
+ * rows are skipped. The in-memory catalog and search indexes are
+ * refreshed with the committed rows.
+ * Query params: format (ndjson (default) or csv; text/csv Content-Type
+ * also selects csv), dry_run (1 to validate only)
+ * Request: food_items columns as written by /api/export/foods (body up to 64MB)
+ * Response: {"success": true, "dry_run": false, "received": N, "imported": N,
+ * "failed": N, "catalog_updated": true, "errors": [{line, message}],
+ * "threads": N, "elapsed_ms": N} (at most 100 errors)
+ * Error: 400 bad format or CSV header, 503 import already running,
+ * 500 database error (counts included when rows were processed)
+ *
+ * @param request The HTTP request
+ * @param post_data NDJSON or CSV body
+ * @param post_data_size Size of POST data
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result handle_import_foods(HttpRequest *request,
+                                    const char *post_data, size_t post_data_size);
+
+/**
+ * @brief Returns the largest request body accepted for a URL.
+ *
+ * @param url Request URL path
+ * @return IMPORT_MAX_BODY_SIZE for /api/foods/import, MAX_BODY_SIZE otherwise
+ */
+size_t routes_max_body_size(const char *url);
+
+/**
+ * @brief Applies the per-client rate limit of a request's route class.
+ *
+ * Needs only the method, URL and headers, so front ends call it before
+ * reading the body. The client is the RATE_LIMIT_KEY_HEADER value if
+ * configured and present, otherwise the peer address.
+ *
+ * @param request Request (the body may be empty)
+ * @return 0 if admitted, otherwise seconds to wait (see send_rate_limited())
+ */
+int routes_rate_limit(HttpRequest *request);
+
+/**
+ * @brief Answers 429 Too Many Requests with a Retry-After header.
+ *
+ * @param request The HTTP request
+ * @param retry_after Seconds from routes_rate_limit()
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result send_rate_limited(HttpRequest *request, int retry_after);
+
+/**
+ * @brief Routes a complete request to its handler.
+ *
+ * Called by the HTTP front ends once the whole body has been received.
+ * Answers CORS preflight requests and unknown routes itself.
+ *
+ * @param request The HTTP request
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+enum MHD_Result routes_dispatch(HttpRequest *request);
+
 #endif
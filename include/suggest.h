@@ -0,0 +1,75 @@
+/**
+ * @file suggest.h
+ * @brief Prefix autocomplete index over food names.
+ *
+ * A compact trie built from the in-memory catalog. Every word start of
+ * a normalized food name is inserted, and each node stores the most
+ * popular foods below it, so a lookup is one walk down the trie.
+ */
+
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include "catalog.h"
+
+/** @brief Number of suggestions precomputed per trie node */
+#define SUGGEST_TOP_K 10
+
+/** @brief A built autocomplete index */
+typedef struct suggest_index SuggestIndex;
+
+/**
+ * @brief Builds the autocomplete index from a catalog and installs it.
+ *
+ * Replaces any previously built index. Equivalent to suggest_prepare()
+ * followed by suggest_install().
+ *
+ * @param cat Loaded catalog
+ * @return 0 on success, -1 on failure
+ */
+int suggest_build(const Catalog *cat);
+
+/**
+ * @brief Builds an autocomplete index without installing it.
+ *
+ * @param cat Catalog to index (typically not yet installed)
+ * @return New index, or NULL on failure
+ */
+SuggestIndex *suggest_prepare(const Catalog *cat);
+
+/**
+ * @brief Replaces the installed index, freeing the previous one.
+ *
+ * Must be called with the catalog write lock held, together with
+ * installing the catalog the index was built from.
+ *
+ * @param idx Index from suggest_prepare() (ownership is taken)
+ */
+void suggest_install(SuggestIndex *idx);
+
+/**
+ * @brief Frees an index that was never installed.
+ *
+ * @param idx Index to free (may be NULL)
+ */
+void suggest_discard(SuggestIndex *idx);
+
+/**
+ * @brief Looks up the most popular foods matching a prefix.
+ *
+ * The prefix is folded with text_fold() before lookup.
+ * Results are ordered by popularity (descending), then by name.
+ *
+ * @param prefix Raw query string
+ * @param out Output array of catalog indices
+ * @param max_results Capacity of out (at most SUGGEST_TOP_K are used)
+ * @return Number of results written, or -1 if the index is not built
+ */
+int suggest_lookup(const char *prefix, int *out, int max_results);
+
+/**
+ * @brief Frees the autocomplete index.
+ */
+void suggest_cleanup(void);
+
+#endif
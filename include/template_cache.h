@@ -0,0 +1,215 @@
+/**
+ * @file template_cache.h
+ * @brief Immutable, versioned in-memory snapshots of templates.
+ *
+ * With TEMPLATE_CACHE=1 each template read is served from a snapshot:
+ * a tree of days, meals and items that never changes once published,
+ * each day and meal holding its own serialized JSON. A write builds a
+ * new snapshot with the next version, sharing every day and meal it did
+ * not touch with the previous one (nodes are reference counted), and
+ * publishes it with one atomic exchange. Readers take a reference
+ * without locking and keep their version for as long as they need it;
+ * a version, and the nodes only it used, are freed when the last
+ * reference goes. Responses carry the version in the body and in an
+ * ETag, so caches key on (id, version).
+ */
+
+#ifndef TEMPLATE_CACHE_H
+#define TEMPLATE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Templates the cache can hold */
+#define TEMPLATE_CACHE_SLOTS 4096
+
+/**
+ * @brief A meal item.
+ */
+typedef struct {
+    int id;                     /**< diet_meal_items.id */
+    int food_item_id;
+    char *food_name;
+    int portion_grams_min;
+    int portion_grams_max;
+} TemplateItem;
+
+/**
+ * @brief A meal, shared by every snapshot in which it is unchanged.
+ */
+typedef struct {
+    int refs;                   /**< Snapshots and days holding it */
+    int id;                     /**< diet_meals.id */
+    char *meal_type;
+    int meal_order;
+    char *time_suggestion;
+    int item_count;
+    TemplateItem *items;
+    char *json;                 /**< Serialized meal object */
+    size_t json_len;
+} TemplateMeal;
+
+/**
+ * @brief A day, shared by every snapshot in which it is unchanged.
+ */
+typedef struct {
+    int refs;                   /**< Snapshots holding it */
+    int id;                     /**< diet_days.id */
+    int day_number;
+    char *day_name;
+    int meal_count;
+    TemplateMeal **meals;
+    char *json;                 /**< Serialized day object, meals included */
+    size_t json_len;
+} TemplateDay;
+
+/**
+ * @brief One version of a template. Never modified once published.
+ */
+typedef struct {
+    int refs;                   /**< Readers, plus one while published */
+    int id;                     /**< diet_templates.id */
+    uint64_t version;           /**< Increases with every write */
+    char *code;
+    char *name;
+    char *description;
+    char *segment;
+    char *type;
+    int duration_days;
+    int calories_target;
+    int day_count;
+    TemplateDay **days;
+    char *head;                 /**< Response up to the days array */
+    size_t head_len;
+    size_t *offsets;            /**< Body offset of the head, each day, and the tail */
+    size_t body_len;            /**< Length of the template-full response */
+} TemplateSnapshot;
+
+/**
+ * @brief Cache counters.
+ */
+typedef struct {
+    int enabled;                /**< TEMPLATE_CACHE */
+    int templates;              /**< Templates with a published snapshot */
+    long snapshots;             /**< Snapshots alive, published or still read */
+    long days;                  /**< Day nodes alive */
+    long meals;                 /**< Meal nodes alive */
+    uint64_t loads;             /**< Snapshots built from the database */
+    uint64_t updates;           /**< Versions built from a previous one */
+    uint64_t invalidations;     /**< Snapshots dropped (reloaded on next read) */
+    uint64_t serialized_bytes;  /**< JSON printed for meals, days and template fields */
+    uint64_t patches;           /**< Change requests answered from the change log */
+    uint64_t full_patches;      /**< Change requests answered with the whole template */
+} TemplateCacheStats;
+
+/**
+ * @brief Changes to a template since a version, as an RFC 6902 JSON Patch.
+ */
+typedef struct {
+    char *patch;                /**< JSON array of operations (caller frees with free()) */
+    size_t patch_len;
+    uint64_t version;           /**< Version the patch leads to */
+    int full;                   /**< 1 if the patch replaces the whole template */
+} TemplateChanges;
+
+/**
+ * @brief Enables the cache if TEMPLATE_CACHE is set.
+ *
+ * Versions start from the current time in microseconds, so they keep
+ * increasing across restarts.
+ */
+void template_cache_init(void);
+
+/**
+ * @brief Returns whether the cache is enabled.
+ */
+int template_cache_enabled(void);
+
+/**
+ * @brief Gets the current snapshot of a template, loading it if needed.
+ *
+ * Never waits for a writer unless the template has to be loaded.
+ *
+ * @param id Template ID
+ * @param snapshot Set to a referenced snapshot (release with template_cache_release())
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_cache_get(int id, TemplateSnapshot **snapshot);
+
+/**
+ * @brief Drops a reference taken by template_cache_get().
+ */
+void template_cache_release(TemplateSnapshot *snapshot);
+
+/**
+ * @brief Copies part of a snapshot's template-full response.
+ *
+ * The response is never stored whole: it is the template fields, then
+ * the serialized days (each made of its serialized meals), found through
+ * the snapshot's offset index. A write re-serializes only the meal it
+ * changed and that meal's day.
+ *
+ * @param snapshot Snapshot
+ * @param pos Offset in the response
+ * @param buf Destination
+ * @param max Bytes wanted
+ * @return Bytes copied, 0 at the end
+ */
+size_t template_cache_read(const TemplateSnapshot *snapshot, size_t pos, char *buf, size_t max);
+
+/**
+ * @brief Copies a snapshot's whole template-full response.
+ *
+ * @return NUL-terminated response (caller frees with free()), or NULL if out of memory
+ */
+char *template_cache_body(const TemplateSnapshot *snapshot);
+
+/**
+ * @brief Publishes a new version after a meal's items changed.
+ *
+ * Call after the write committed. Re-reads only that meal; the other
+ * meals and days are shared with the previous version. Does nothing if
+ * the template is not cached.
+ *
+ * @param template_id Template the meal belongs to
+ * @param meal_id Changed meal
+ * @return 0 on success, -1 if the snapshot had to be dropped instead
+ */
+int template_cache_meal_changed(int template_id, int meal_id);
+
+/**
+ * @brief Describes how a template changed since a version.
+ *
+ * Each template keeps a log of its last TEMPLATE_CHANGE_LOG meal
+ * replacements. When since is still covered by it, the patch replaces
+ * each changed meal (once, with its latest value) under
+ * /template/days/{d}/meals/{m}, then /template/version; it is empty if
+ * since is the current version. Otherwise (too old, unknown, or the log
+ * was reset by a reload) the patch is one operation replacing /template
+ * with the whole current template.
+ *
+ * @param id Template ID
+ * @param since Version the client has
+ * @param changes Filled in on success
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_cache_changes(int id, uint64_t since, TemplateChanges *changes);
+
+/**
+ * @brief Drops every snapshot, for changes not tracked per meal (food names).
+ */
+void template_cache_invalidate(void);
+
+/**
+ * @brief Reads the counters.
+ *
+ * @param stats Filled in
+ */
+void template_cache_stats(TemplateCacheStats *stats);
+
+/**
+ * @brief Drops every snapshot; those still being read are freed by their readers.
+ */
+void template_cache_cleanup(void);
+
+#endif
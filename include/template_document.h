@@ -0,0 +1,123 @@
+/**
+ * @file template_document.h
+ * @brief Template-full documents, assembled or stored pre-rendered.
+ *
+ * template_document_build() assembles the template-full response from
+ * diet_templates, diet_days, diet_meals and diet_meal_items. With
+ * TEMPLATE_DOCUMENTS=1 the rendered response is also kept in the
+ * diet_template_documents table with a version, and rebuilt inside the
+ * transaction of every write that changes the template, so a read is a
+ * single primary-key lookup returning the stored body.
+ *
+ * template_document_fetch_json() has MySQL assemble the same document
+ * with JSON_OBJECT and JSON_ARRAYAGG and return it as a single cell, for
+ * comparing both places of assembly (TEMPLATE_FULL_STRATEGY).
+ */
+
+#ifndef TEMPLATE_DOCUMENT_H
+#define TEMPLATE_DOCUMENT_H
+
+#include <stddef.h>
+#include <mysql/mysql.h>
+#include <cjson/cJSON.h>
+
+/** @brief Template does not exist */
+#define TEMPLATE_DOCUMENT_NOT_FOUND (-2)
+
+/**
+ * @brief Runs a query for template_document_build().
+ *
+ * @param ctx Caller context
+ * @param query SQL query
+ * @return Result set (freed by the builder), or NULL on error
+ */
+typedef MYSQL_RES *(*TemplateFetch)(void *ctx, const char *query);
+
+/**
+ * @brief Creates diet_template_documents if TEMPLATE_DOCUMENTS is set.
+ *
+ * Must be called after db_init().
+ *
+ * @return 0 on success, -1 if the table can not be created (documents stay off)
+ */
+int template_document_init(void);
+
+/**
+ * @brief Returns whether documents are stored (TEMPLATE_DOCUMENTS=1 and the table exists).
+ */
+int template_document_enabled(void);
+
+/**
+ * @brief Assembles the template-full response.
+ *
+ * @param id Template ID
+ * @param version Document version to include, or 0 for none
+ * @param fetch Query function
+ * @param ctx Passed to fetch
+ * @param root Set to {"success": true, "template": {...}} on success
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_document_build(int id, unsigned long long version, TemplateFetch fetch, void *ctx,
+                            cJSON **root);
+
+/**
+ * @brief Has MySQL assemble the template-full response.
+ *
+ * The body is the only cell of the only row. Arrays come in the same
+ * order as from template_document_build(), but MySQL orders object keys
+ * its own way, so keys differ in order.
+ * Needs MySQL 8.0.14 or later (derived tables referencing outer columns).
+ *
+ * @param id Template ID
+ * @param result Set to the result set on success (caller frees with mysql_free_result)
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_document_fetch_json(int id, MYSQL_RES **result);
+
+/**
+ * @brief Re-renders a template's stored document inside a transaction.
+ *
+ * Locks the document row, so concurrent writers of a template are
+ * serialized, and stores the new body with the version incremented.
+ *
+ * @param conn Connection with an open transaction (see db_begin())
+ * @param id Template ID
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_document_rebuild(MYSQL *conn, int id);
+
+/**
+ * @brief Finds the template a meal belongs to.
+ *
+ * @param conn Connection with an open transaction
+ * @param meal_id diet_meals.id
+ * @return Template ID, or -1 if the meal does not exist or on a database error
+ */
+int template_document_meal_template(MYSQL *conn, int meal_id);
+
+/**
+ * @brief Marks the documents of templates using some foods as stale.
+ *
+ * Documents embed food names, so a food update bumps their version and
+ * clears their body; the next read renders them again.
+ *
+ * @param conn Connection with an open transaction
+ * @param food_ids Updated food IDs
+ * @param count Entries in food_ids
+ * @return 0 on success, -1 on a database error
+ */
+int template_document_invalidate_foods(MYSQL *conn, const int *food_ids, size_t count);
+
+/**
+ * @brief Reads a stored document, rendering it first if missing or stale.
+ *
+ * Reads the primary, never a replica, so a client reading a template
+ * back after a write sees that write.
+ *
+ * @param id Template ID
+ * @param body Set to the response body on success (caller frees with free())
+ * @return 0 on success, TEMPLATE_DOCUMENT_NOT_FOUND, or -1 on a database error
+ */
+int template_document_get(int id, char **body);
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file template_index.h
+ * @brief In-memory daily nutrition profiles of diet templates.
+ *
+ * Each template's meal items are summed once at load time into an
+ * average per-day profile (portion midpoint x food nutrition), so
+ * template search never joins days, meals, items and foods per request.
+ * Bulk-insert refreshes the profile of the template it changed; a food
+ * import reloads the whole index, as any template may use the foods.
+ */
+
+#ifndef TEMPLATE_INDEX_H
+#define TEMPLATE_INDEX_H
+
+/**
+ * @brief Nutrition profile and summary of one diet template.
+ */
+typedef struct {
+    int id;                 /**< diet_templates.id */
+    char *code;             /**< diet_templates.code */
+    char *name;             /**< diet_templates.name */
+    char *segment;          /**< diet_templates.segment */
+    char *type;             /**< diet_templates.type */
+    int duration_days;      /**< diet_templates.duration_days */
+    int calories_target;    /**< diet_templates.calories_target (hand-entered) */
+    int day_count;          /**< Number of diet_days rows */
+    float calories;         /**< Average kcal per day */
+    float protein;          /**< Average protein grams per day */
+    float carbs;            /**< Average carbohydrate grams per day */
+    float fat;              /**< Average fat grams per day */
+} TemplateProfile;
+
+/**
+ * @brief Inclusive bounds for a template search.
+ *
+ * Unused bounds are -INFINITY / INFINITY (see template_query_init()).
+ */
+typedef struct {
+    float calories_min, calories_max;
+    float protein_min, protein_max;
+    float carbs_min, carbs_max;
+    float fat_min, fat_max;
+} TemplateQuery;
+
+/**
+ * @brief Computes template profiles from the database.
+ *
+ * Must be called after db_init(). Replaces any previously loaded index.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int template_index_load(void);
+
+/**
+ * @brief Recomputes one template's profile after a committed write.
+ *
+ * Adds the template if it is new and drops it if it no longer exists.
+ * Does nothing if the index is not loaded.
+ *
+ * @param template_id Template ID
+ * @return 0 on success, -1 on failure (the old profile stays)
+ */
+int template_index_refresh(int template_id);
+
+/**
+ * @brief Takes the index lock for reading.
+ *
+ * Hold it while searching and using the profiles found, so a refresh or
+ * reload cannot change them underneath the caller.
+ */
+void template_index_read_lock(void);
+
+/** @brief Releases a lock taken with template_index_read_lock() */
+void template_index_read_unlock(void);
+
+/**
+ * @brief Resets a query to match every template.
+ *
+ * @param query Query to initialize
+ */
+void template_query_init(TemplateQuery *query);
+
+/**
+ * @brief Finds templates whose daily profile is within the query bounds.
+ *
+ * Results are ordered by daily calories, then template id.
+ *
+ * @param query Bounds to match
+ * @param out Output array of profiles (valid while the read lock is held)
+ * @param max_results Capacity of out
+ * @return Number of matches written, or -1 if the index is not loaded
+ */
+int template_index_search(const TemplateQuery *query, const TemplateProfile **out, int max_results);
+
+/**
+ * @brief Frees the template index.
+ */
+void template_index_cleanup(void);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file text_fold.h
+ * @brief Case and diacritic folding for in-process search.
+ *
+ * Names and queries are folded the same way (Unicode case fold plus
+ * diacritic stripping, punctuation collapsed to single spaces) so that
+ * matching reduces to plain byte comparison.
+ */
+
+#ifndef TEXT_FOLD_H
+#define TEXT_FOLD_H
+
+#include <stddef.h>
+
+/**
+ * @brief Folds UTF-8 text into its search form.
+ *
+ * - ASCII letters are lowercased; other ASCII bytes are separators.
+ * - Latin-1, Latin Extended-A/B letters lose their diacritics
+ *   ("Crème brûlée" -> "creme brulee", "ß" -> "ss", "ș" -> "s").
+ * - Greek and Cyrillic letters are lowercased and stripped of accents.
+ * - Combining marks (decomposed input) are dropped.
+ * - Runs of separators become one space; leading and trailing spaces
+ *   are removed.
+ *
+ * Invalid UTF-8 bytes are copied unchanged. Output is always
+ * NUL-terminated and never ends in a partial character.
+ *
+ * @param src Input string (UTF-8)
+ * @param dst Output buffer
+ * @param dst_size Size of output buffer
+ * @return Length of the folded string
+ */
+size_t text_fold(const char *src, char *dst, size_t dst_size);
+
+/**
+ * @brief Finds the first occurrence of needle in haystack.
+ *
+ * Compares 16 candidate positions at once (first and last needle byte)
+ * using compiler vector extensions, falling back to a scalar loop.
+ *
+ * @param haystack Text to search
+ * @param hlen Length of haystack
+ * @param needle Bytes to find
+ * @param nlen Length of needle (0 matches at offset 0)
+ * @return Pointer to the match, or NULL if not found
+ */
+const char *text_find(const char *haystack, size_t hlen, const char *needle, size_t nlen);
+
+#endif
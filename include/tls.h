@@ -0,0 +1,50 @@
+/**
+ * @file tls.h
+ * @brief Server-side TLS context (OpenSSL).
+ *
+ * Used by the listeners that terminate TLS in-process. Resumption uses
+ * stateless session tickets: ticket keys live only in memory and rotate
+ * every TLS_TICKET_KEY_LIFETIME seconds, and the previous key is still
+ * accepted (and its tickets renewed) for one more period. When the
+ * kernel and OpenSSL support it, record encryption moves into the kernel
+ * (kTLS) after the handshake, so file-backed bodies can go out with
+ * SSL_sendfile() without passing through user space. Built only with
+ * "make HTTP2=1".
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/ssl.h>
+
+/** @brief Seconds a ticket key is used to issue tickets */
+#define TLS_TICKET_KEY_LIFETIME 3600
+
+/**
+ * @brief Creates a server context with session tickets enabled.
+ *
+ * Accepts TLS 1.2 and 1.3 only, without compression or renegotiation.
+ *
+ * @param cert_file PEM certificate chain
+ * @param key_file PEM private key
+ * @param ktls Non-zero to let OpenSSL enable kernel TLS when it can
+ * @return The context, or NULL (errors are printed to stderr)
+ */
+SSL_CTX *tls_context_new(const char *cert_file, const char *key_file, int ktls);
+
+/**
+ * @brief Frees a context and the ticket keys.
+ *
+ * @param ctx Context from tls_context_new()
+ */
+void tls_context_free(SSL_CTX *ctx);
+
+/**
+ * @brief Returns whether records sent on ssl are encrypted by the kernel.
+ *
+ * @param ssl Connection after a completed handshake
+ * @return Non-zero if SSL_sendfile() can be used
+ */
+int tls_ktls_send(SSL *ssl);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file uring_server.h
+ * @brief Optional io_uring HTTP/1.1 front end.
+ *
+ * An alternative to libmicrohttpd for measuring syscall overhead. Each
+ * worker thread owns an io_uring and a SO_REUSEPORT listening socket,
+ * accepts and receives with multishot requests into a provided buffer
+ * ring, and submits a whole batch of completions with one syscall.
+ * Requests go to routes_dispatch() on the worker thread.
+ *
+ * Supports keep-alive, pipelining and Content-Length bodies; chunked
+ * request bodies are refused. Routes that stream MHD responses (exports,
+ * catalog bundle) answer 501. Applies HTTP_CONNECTION_LIMIT,
+ * HTTP_PER_IP_CONNECTION_LIMIT, HTTP_IDLE_TIMEOUT and HTTP_BODY_TIMEOUT. Needs liburing 2.4 and Linux 5.19 or later;
+ * built only with "make URING=1".
+ */
+
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+/** @brief Receive buffers per worker */
+#define URING_RECV_BUFFERS 512
+
+/** @brief Size of each receive buffer */
+#define URING_RECV_BUFFER_SIZE 4096
+
+/** @brief Maximum size of a request line plus headers */
+#define URING_MAX_HEADER_SIZE (16 * 1024)
+
+/** @brief uring_server_start() error: built without liburing */
+#define URING_ERROR_UNAVAILABLE -1
+
+/** @brief uring_server_start() error: socket, ring or thread setup failed */
+#define URING_ERROR_SETUP -2
+
+/**
+ * @brief Starts the worker threads.
+ *
+ * @param port TCP port to listen on
+ * @param threads Worker threads (0 = one per CPU)
+ * @return 0 once every worker is listening, or a negative URING_ERROR_* code
+ */
+int uring_server_start(int port, int threads);
+
+/**
+ * @brief Stops the workers and closes their connections.
+ */
+void uring_server_stop(void);
+
+#endif
@@ -0,0 +1,516 @@
+/**
+ * @file catalog.c
+ * @brief In-memory food catalog loaded from MySQL.
+ *
+ * The catalog is read once at startup. Names are copied into a single
+ * string pool together with their folded form (text_fold()), and rows
+ * are sorted by folded name so that prefix structures can be built from
+ * it in one pass and substring search is plain byte matching.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "catalog.h"
+#include "db.h"
+#include "placement.h"
+#include "text_fold.h"
+
+/** @brief Currently loaded catalog (NULL until catalog_load succeeds) */
+static Catalog *catalog = NULL;
+
+/** @brief Copies of catalog on each NUMA node (NULL when shards are off) */
+static Catalog *replicas[PLACEMENT_MAX_NODES];
+
+/** @brief Guards catalog (and indexes built from it) against replacement */
+static pthread_rwlock_t catalog_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** @brief Row used while sorting during load or merge */
+struct catalog_row {
+    int id;
+    int category_id;
+    unsigned int popularity;
+    float calories;
+    float protein;
+    float carbs;
+    float fat;
+    unsigned char snack_suitable;
+    unsigned short default_portion;
+    const char *name;
+    const char *norm_name;
+};
+
+/**
+ * @brief qsort comparator ordering rows by normalized name, then id.
+ */
+static int compare_rows(const void *a, const void *b) {
+    const struct catalog_row *ra = a;
+    const struct catalog_row *rb = b;
+    int cmp = strcmp(ra->norm_name, rb->norm_name);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+/**
+ * @brief qsort comparator ordering rows by id.
+ */
+static int compare_row_ids(const void *a, const void *b) {
+    const struct catalog_row *ra = a;
+    const struct catalog_row *rb = b;
+    return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+/**
+ * @brief Binary search for an id in rows sorted by compare_row_ids().
+ *
+ * @return Matching row, or NULL
+ */
+static struct catalog_row *find_row_id(struct catalog_row *rows, int count, int id) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (rows[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < count && rows[lo].id == id ? &rows[lo] : NULL;
+}
+
+void catalog_destroy(Catalog *cat) {
+    if (cat == NULL) {
+        return;
+    }
+    placement_free(cat->arena);
+    free(cat);
+}
+
+/**
+ * @brief Reserves a cache-line aligned column in the catalog block.
+ *
+ * @return Offset of the column
+ */
+static size_t reserve_column(size_t *size, size_t bytes) {
+    size_t at = (*size + 63) & ~(size_t)63;
+    *size = at + bytes;
+    return at;
+}
+
+/**
+ * @brief Builds a catalog from rows already sorted by compare_rows().
+ *
+ * Strings are copied into the catalog's pool; rows keep ownership.
+ *
+ * @return New catalog, or NULL if out of memory
+ */
+static Catalog *catalog_build(const struct catalog_row *rows, size_t n) {
+    size_t pool_size = 0, pool_used = 0;
+    Catalog *cat;
+
+    for (size_t i = 0; i < n; i++) {
+        pool_size += strlen(rows[i].name) + strlen(rows[i].norm_name) + 2;
+    }
+
+    size_t slots = n > 0 ? n : 1;
+    size_t padded = (n + CATALOG_BLOCK - 1) / CATALOG_BLOCK * CATALOG_BLOCK;
+    if (padded == 0) {
+        padded = CATALOG_BLOCK;
+    }
+    size_t size = 0;
+    size_t ids_at = reserve_column(&size, slots * sizeof(int));
+    size_t category_ids_at = reserve_column(&size, padded * sizeof(int));
+    size_t popularity_at = reserve_column(&size, slots * sizeof(unsigned int));
+    size_t calories_at = reserve_column(&size, padded * sizeof(float));
+    size_t protein_at = reserve_column(&size, padded * sizeof(float));
+    size_t carbs_at = reserve_column(&size, padded * sizeof(float));
+    size_t fat_at = reserve_column(&size, padded * sizeof(float));
+    size_t snack_at = reserve_column(&size, slots);
+    size_t portions_at = reserve_column(&size, slots * sizeof(unsigned short));
+    size_t names_at = reserve_column(&size, slots * sizeof(char *));
+    size_t norm_names_at = reserve_column(&size, slots * sizeof(char *));
+    size_t norm_lengths_at = reserve_column(&size, slots * sizeof(unsigned short));
+    size_t pool_at = reserve_column(&size, pool_size > 0 ? pool_size : 1);
+
+    cat = calloc(1, sizeof(Catalog));
+    if (cat == NULL) {
+        return NULL;
+    }
+    cat->arena = placement_alloc("catalog", size, -1);
+    if (cat->arena == NULL) {
+        free(cat);
+        return NULL;
+    }
+    cat->arena_size = size;
+
+    char *base = cat->arena;
+    cat->ids = (int *)(base + ids_at);
+    cat->category_ids = (int *)(base + category_ids_at);
+    cat->popularity = (unsigned int *)(base + popularity_at);
+    cat->calories = (float *)(base + calories_at);
+    cat->protein = (float *)(base + protein_at);
+    cat->carbs = (float *)(base + carbs_at);
+    cat->fat = (float *)(base + fat_at);
+    cat->snack_suitable = (unsigned char *)(base + snack_at);
+    cat->default_portions = (unsigned short *)(base + portions_at);
+    cat->names = (char **)(base + names_at);
+    cat->norm_names = (char **)(base + norm_names_at);
+    cat->norm_lengths = (unsigned short *)(base + norm_lengths_at);
+    cat->name_pool = base + pool_at;
+
+    /* Folded names first, back to back, so search can scan them in one pass */
+    for (size_t i = 0; i < n; i++) {
+        size_t norm_len = strlen(rows[i].norm_name) + 1;
+        cat->norm_names[i] = memcpy(cat->name_pool + pool_used, rows[i].norm_name, norm_len);
+        cat->norm_lengths[i] = (unsigned short)(norm_len - 1);
+        pool_used += norm_len;
+    }
+    cat->norm_pool_size = pool_used;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t name_len = strlen(rows[i].name) + 1;
+
+        cat->ids[i] = rows[i].id;
+        cat->category_ids[i] = rows[i].category_id;
+        cat->popularity[i] = rows[i].popularity;
+        cat->calories[i] = rows[i].calories;
+        cat->protein[i] = rows[i].protein;
+        cat->carbs[i] = rows[i].carbs;
+        cat->fat[i] = rows[i].fat;
+        cat->snack_suitable[i] = rows[i].snack_suitable;
+        cat->default_portions[i] = rows[i].default_portion;
+
+        cat->names[i] = memcpy(cat->name_pool + pool_used, rows[i].name, name_len);
+        pool_used += name_len;
+    }
+    cat->count = (int)n;
+
+    /* Padding rows never satisfy a range predicate (NaN compares false) */
+    for (size_t i = n; i % CATALOG_BLOCK != 0 || i == 0; i++) {
+        cat->category_ids[i] = 0;
+        cat->calories[i] = NAN;
+        cat->protein[i] = NAN;
+        cat->carbs[i] = NAN;
+        cat->fat[i] = NAN;
+    }
+    return cat;
+}
+
+int catalog_load(void) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    struct catalog_row *rows;
+    size_t row_count;
+    Catalog *cat;
+    char norm[256];
+
+    result = db_query(
+        "SELECT f.id, f.name, f.category_id, COUNT(mi.id), "
+        "f.calories_per_100g, f.protein_per_100g, f.carbs_per_100g, f.fat_per_100g, "
+        "f.is_snack_suitable, f.default_portion_grams "
+        "FROM food_items f "
+        "LEFT JOIN diet_meal_items mi ON mi.food_item_id = f.id "
+        "GROUP BY f.id"
+    );
+    if (result == NULL) {
+        fprintf(stderr, "Failed to load food catalog\n");
+        return -1;
+    }
+
+    row_count = (size_t)mysql_num_rows(result);
+    rows = calloc(row_count > 0 ? row_count : 1, sizeof(struct catalog_row));
+    if (rows == NULL) {
+        mysql_free_result(result);
+        return -1;
+    }
+
+    /* Copy rows and compute normalized names */
+    size_t n = 0;
+    while ((row = mysql_fetch_row(result)) != NULL && n < row_count) {
+        const char *name = row[1] ? row[1] : "";
+        char *name_copy, *norm_copy;
+
+        text_fold(name, norm, sizeof(norm));
+        name_copy = strdup(name);
+        norm_copy = strdup(norm);
+        if (name_copy == NULL || norm_copy == NULL) {
+            free(name_copy);
+            free(norm_copy);
+            break;
+        }
+
+        rows[n].id = atoi(row[0]);
+        rows[n].category_id = row[2] ? atoi(row[2]) : 0;
+        rows[n].popularity = row[3] ? (unsigned int)strtoul(row[3], NULL, 10) : 0;
+        rows[n].calories = row[4] ? strtof(row[4], NULL) : 0;
+        rows[n].protein = row[5] ? strtof(row[5], NULL) : 0;
+        rows[n].carbs = row[6] ? strtof(row[6], NULL) : 0;
+        rows[n].fat = row[7] ? strtof(row[7], NULL) : 0;
+        rows[n].snack_suitable = row[8] && atoi(row[8]) != 0;
+        rows[n].default_portion = row[9] ? (unsigned short)atoi(row[9]) : 100;
+        rows[n].name = name_copy;
+        rows[n].norm_name = norm_copy;
+        n++;
+    }
+    mysql_free_result(result);
+
+    qsort(rows, n, sizeof(struct catalog_row), compare_rows);
+    cat = catalog_build(rows, n);
+
+    for (size_t i = 0; i < n; i++) {
+        free((char *)rows[i].name);
+        free((char *)rows[i].norm_name);
+    }
+    free(rows);
+
+    if (cat == NULL) {
+        return -1;
+    }
+
+    catalog_write_lock();
+    catalog_install(cat);
+    catalog_write_unlock();
+
+    printf("Loaded food catalog: %d items\n", cat->count);
+    return 0;
+}
+
+Catalog *catalog_merge(const CatalogFood *foods, int count) {
+    const Catalog *base = catalog;
+    struct catalog_row *added = NULL, *rows = NULL;
+    char *norm_pool = NULL;
+    int base_count = base != NULL ? base->count : 0;
+    Catalog *cat = NULL;
+
+    added = calloc(count > 0 ? (size_t)count : 1, sizeof(struct catalog_row));
+    norm_pool = malloc(count > 0 ? (size_t)count * 256 : 1);
+    rows = malloc(((size_t)base_count + (size_t)count + 1) * sizeof(struct catalog_row));
+    if (added == NULL || norm_pool == NULL || rows == NULL) {
+        goto done;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char *norm = norm_pool + (size_t)i * 256;
+        text_fold(foods[i].name, norm, 256);
+
+        added[i].id = foods[i].id;
+        added[i].category_id = foods[i].category_id;
+        added[i].calories = foods[i].calories;
+        added[i].protein = foods[i].protein;
+        added[i].carbs = foods[i].carbs;
+        added[i].fat = foods[i].fat;
+        added[i].snack_suitable = foods[i].snack_suitable;
+        added[i].default_portion = foods[i].default_portion;
+        added[i].name = foods[i].name;
+        added[i].norm_name = norm;
+    }
+
+    /* Replaced rows hand their popularity to the new version */
+    qsort(added, (size_t)count, sizeof(struct catalog_row), compare_row_ids);
+    for (int i = 0; i < base_count; i++) {
+        struct catalog_row *match = find_row_id(added, count, base->ids[i]);
+        if (match != NULL) {
+            match->popularity = base->popularity[i];
+        }
+    }
+
+    /* Merge the sorted base, minus replaced rows, with the sorted additions */
+    struct catalog_row *by_name = rows + base_count;
+    memcpy(by_name, added, (size_t)count * sizeof(struct catalog_row));
+    qsort(by_name, (size_t)count, sizeof(struct catalog_row), compare_rows);
+
+    size_t n = 0;
+    int a = 0;
+    for (int i = 0; i < base_count; i++) {
+        struct catalog_row r;
+
+        if (find_row_id(added, count, base->ids[i]) != NULL) {
+            continue;
+        }
+        r.id = base->ids[i];
+        r.category_id = base->category_ids[i];
+        r.popularity = base->popularity[i];
+        r.calories = base->calories[i];
+        r.protein = base->protein[i];
+        r.carbs = base->carbs[i];
+        r.fat = base->fat[i];
+        r.snack_suitable = base->snack_suitable[i];
+        r.default_portion = base->default_portions[i];
+        r.name = base->names[i];
+        r.norm_name = base->norm_names[i];
+
+        while (a < count && compare_rows(&by_name[a], &r) < 0) {
+            rows[n++] = by_name[a++];
+        }
+        rows[n++] = r;
+    }
+    /* n <= base_count + a here, so the remaining additions are never overwritten */
+    while (a < count) {
+        rows[n++] = by_name[a++];
+    }
+
+    cat = catalog_build(rows, n);
+
+done:
+    free(rows);
+    free(norm_pool);
+    free(added);
+    return cat;
+}
+
+/**
+ * @brief A copy of a catalog to be made on a node.
+ */
+struct replica_job {
+    const Catalog *source;
+    int node;
+    Catalog *copy;          /**< Result, NULL on failure */
+};
+
+/**
+ * @brief Copies a catalog into a new block, relocating its pointers.
+ *
+ * Runs on the target node, so the copy is first touched there.
+ */
+static void replicate(void *arg) {
+    struct replica_job *job = arg;
+    const Catalog *src = job->source;
+    Catalog *cat = malloc(sizeof(Catalog));
+    char *base;
+
+    if (cat == NULL) {
+        return;
+    }
+    *cat = *src;
+    cat->arena = placement_alloc("catalog-replica", src->arena_size, job->node);
+    if (cat->arena == NULL) {
+        free(cat);
+        return;
+    }
+    memcpy(cat->arena, src->arena, src->arena_size);
+
+    base = cat->arena;
+#define RELOCATE(p) ((p) = (void *)(base + ((const char *)(p) - (const char *)src->arena)))
+    RELOCATE(cat->ids);
+    RELOCATE(cat->category_ids);
+    RELOCATE(cat->popularity);
+    RELOCATE(cat->calories);
+    RELOCATE(cat->protein);
+    RELOCATE(cat->carbs);
+    RELOCATE(cat->fat);
+    RELOCATE(cat->snack_suitable);
+    RELOCATE(cat->default_portions);
+    RELOCATE(cat->names);
+    RELOCATE(cat->norm_names);
+    RELOCATE(cat->norm_lengths);
+    RELOCATE(cat->name_pool);
+    for (int i = 0; i < cat->count; i++) {
+        RELOCATE(cat->names[i]);
+        RELOCATE(cat->norm_names[i]);
+    }
+#undef RELOCATE
+    job->copy = cat;
+}
+
+static void replicas_destroy(void) {
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        catalog_destroy(replicas[node]);
+        replicas[node] = NULL;
+    }
+}
+
+void catalog_install(Catalog *cat) {
+    static unsigned long last_version = 0;
+    int nodes = placement_node_count();
+
+    cat->version = ++last_version;
+    replicas_destroy();
+    catalog_destroy(catalog);
+    catalog = cat;
+
+    /* A node whose copy fails reads the primary */
+    for (int node = 0; nodes > 1 && node < nodes; node++) {
+        struct replica_job job = { cat, node, NULL };
+        if (placement_run_on_node(node, replicate, &job) == 0) {
+            replicas[node] = job.copy;
+        }
+    }
+}
+
+void catalog_read_lock(void) {
+    pthread_rwlock_rdlock(&catalog_lock);
+}
+
+void catalog_read_unlock(void) {
+    pthread_rwlock_unlock(&catalog_lock);
+}
+
+void catalog_write_lock(void) {
+    pthread_rwlock_wrlock(&catalog_lock);
+}
+
+void catalog_write_unlock(void) {
+    pthread_rwlock_unlock(&catalog_lock);
+}
+
+const Catalog *catalog_get(void) {
+    Catalog *local = replicas[placement_current_node()];
+    return local != NULL ? local : catalog;
+}
+
+int catalog_search(const char *query, int category_id, int *out, int max_results) {
+    const Catalog *cat = catalog_get();
+    char needle[256];
+    size_t needle_len;
+    int found = 0;
+
+    if (cat == NULL) {
+        return -1;
+    }
+    if (cat->count == 0) {
+        return 0;
+    }
+
+    needle_len = text_fold(query, needle, sizeof(needle));
+
+    /*
+     * Scan all folded names as one buffer. NUL separators never occur in
+     * a folded needle, so a hit always lies inside a single name.
+     */
+    const char *p = cat->norm_names[0];
+    const char *end = cat->name_pool + cat->norm_pool_size;
+
+    while (found < max_results && p < end) {
+        const char *hit = text_find(p, (size_t)(end - p), needle, needle_len);
+        if (hit == NULL) {
+            break;
+        }
+
+        /* Last name starting at or before the hit */
+        int lo = 0, hi = cat->count - 1;
+        while (lo < hi) {
+            int mid = lo + (hi - lo + 1) / 2;
+            if (cat->norm_names[mid] <= hit) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+
+        if (category_id <= 0 || cat->category_ids[lo] == category_id) {
+            out[found++] = lo;
+        }
+        p = cat->norm_names[lo] + cat->norm_lengths[lo] + 1;
+    }
+    return found;
+}
+
+void catalog_cleanup(void) {
+    replicas_destroy();
+    catalog_destroy(catalog);
+    catalog = NULL;
+}
@@ -0,0 +1,476 @@
+/**
+ * @file catalog_bundle.c
+ * @brief Whole-catalog binary bundle for offline clients.
+ *
+ * The bundle is encoded from the in-memory catalog plus the category
+ * table into two sealed in-memory files (plain and gzip), which every
+ * request until the catalog version changes is served from with
+ * sendfile. libmicrohttpd gets shared responses over duplicates of the
+ * files; other front ends get a duplicate per request. Either way a file
+ * lives until its last reader is done, so replacing the bundle never
+ * pulls a body from under a response still being sent.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "catalog_bundle.h"
+#include "catalog.h"
+#include "db.h"
+
+/** @brief Size of the bundle header in bytes */
+#define BUNDLE_HEADER_SIZE 24
+
+/** @brief The cached bundle */
+struct bundle {
+    unsigned long version;              /**< Catalog version it encodes (0 if none) */
+    char tag[24];                       /**< Content hash, unquoted */
+    int plain_fd;                       /**< Uncompressed body file (-1 if none) */
+    uint64_t plain_size;                /**< Bytes in plain_fd */
+    int compressed_fd;                  /**< gzip body file (-1 if none) */
+    uint64_t compressed_size;           /**< Bytes in compressed_fd */
+    struct MHD_Response *plain;         /**< Uncompressed body */
+    struct MHD_Response *compressed;    /**< gzip body */
+    struct MHD_Response *not_modified;  /**< Empty 304 body */
+};
+
+/** @brief Bundle of the most recent catalog version requested */
+static struct bundle current = { .plain_fd = -1, .compressed_fd = -1 };
+
+/** @brief Guards current (rebuilds happen at most once per version) */
+static pthread_mutex_t bundle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void put_u32(unsigned char **p, uint32_t v) {
+    (*p)[0] = (unsigned char)v;
+    (*p)[1] = (unsigned char)(v >> 8);
+    (*p)[2] = (unsigned char)(v >> 16);
+    (*p)[3] = (unsigned char)(v >> 24);
+    *p += 4;
+}
+
+static void put_u16(unsigned char **p, uint16_t v) {
+    (*p)[0] = (unsigned char)v;
+    (*p)[1] = (unsigned char)(v >> 8);
+    *p += 2;
+}
+
+static void put_f32(unsigned char **p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(p, bits);
+}
+
+/**
+ * @brief Zero-pads the output to a multiple of four bytes from base.
+ */
+static void pad4(unsigned char **p, const unsigned char *base) {
+    while ((size_t)(*p - base) % 4 != 0) {
+        *(*p)++ = 0;
+    }
+}
+
+static size_t align4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+/**
+ * @brief Destroys the responses of a bundle.
+ */
+static void bundle_free(struct bundle *b) {
+    if (b->plain != NULL) {
+        MHD_destroy_response(b->plain);
+    }
+    if (b->compressed != NULL) {
+        MHD_destroy_response(b->compressed);
+    }
+    if (b->not_modified != NULL) {
+        MHD_destroy_response(b->not_modified);
+    }
+    if (b->plain_fd >= 0) {
+        close(b->plain_fd);
+    }
+    if (b->compressed_fd >= 0) {
+        close(b->compressed_fd);
+    }
+    memset(b, 0, sizeof(*b));
+    b->plain_fd = -1;
+    b->compressed_fd = -1;
+}
+
+/**
+ * @brief Stores a body in an anonymous, read-only file.
+ *
+ * @return The file descriptor, or -1 on failure
+ */
+static int bundle_file(const unsigned char *data, size_t size) {
+    size_t written = 0;
+    int fd;
+
+#ifdef __linux__
+    fd = memfd_create("catalog-bundle", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    char path[] = "/tmp/catalog-bundle-XXXXXX";
+
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+#endif
+    if (fd < 0) {
+        return -1;
+    }
+
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        written += (size_t)n;
+    }
+#ifdef __linux__
+    /* Readers share the file, so it must never change under them */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+/**
+ * @brief Encodes the catalog and the category table.
+ *
+ * @param out Set to the malloc'ed bundle
+ * @param out_size Set to its size
+ * @param version Set to the version of the encoded catalog
+ * @return 0 on success, or a negative BUNDLE_ERROR_* code
+ */
+static int bundle_encode(unsigned char **out, size_t *out_size, unsigned long *version) {
+    MYSQL_RES *result;
+    MYSQL_ROW row, *categories;
+    const Catalog *cat;
+    unsigned char *buf, *p;
+    size_t category_count = 0, string_bytes = 0, size, n;
+    uint32_t offset = 0;
+
+    result = db_query("SELECT id, name FROM food_categories ORDER BY id");
+    if (result == NULL) {
+        return BUNDLE_ERROR_BUILD;
+    }
+    categories = malloc(((size_t)mysql_num_rows(result) + 1) * sizeof(MYSQL_ROW));
+    if (categories == NULL) {
+        mysql_free_result(result);
+        return BUNDLE_ERROR_BUILD;
+    }
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        categories[category_count++] = row;
+        string_bytes += row[1] ? strlen(row[1]) : 0;
+    }
+
+    catalog_read_lock();
+    cat = catalog_get();
+    if (cat == NULL) {
+        catalog_read_unlock();
+        free(categories);
+        mysql_free_result(result);
+        return BUNDLE_ERROR_NO_CATALOG;
+    }
+
+    n = (size_t)cat->count;
+    for (size_t i = 0; i < n; i++) {
+        string_bytes += strlen(cat->names[i]);
+    }
+    size = BUNDLE_HEADER_SIZE + 6 * 4 * n + align4(2 * n) + align4(n) + 4 * (n + 1) +
+           4 * category_count + 4 * (category_count + 1) + string_bytes;
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        catalog_read_unlock();
+        free(categories);
+        mysql_free_result(result);
+        return BUNDLE_ERROR_BUILD;
+    }
+
+    p = buf;
+    memcpy(p, "DCAT", 4);
+    p += 4;
+    put_u32(&p, CATALOG_BUNDLE_FORMAT);
+    put_u32(&p, (uint32_t)n);
+    put_u32(&p, (uint32_t)category_count);
+    put_u32(&p, (uint32_t)string_bytes);
+    put_u32(&p, 0);     /* crc32, filled in below */
+
+    for (size_t i = 0; i < n; i++) {
+        put_u32(&p, (uint32_t)cat->ids[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_u32(&p, (uint32_t)cat->category_ids[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_f32(&p, cat->calories[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_f32(&p, cat->protein[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_f32(&p, cat->carbs[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_f32(&p, cat->fat[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        put_u16(&p, cat->default_portions[i]);
+    }
+    pad4(&p, buf);
+    memcpy(p, cat->snack_suitable, n);
+    p += n;
+    pad4(&p, buf);
+
+    for (size_t i = 0; i < n; i++) {
+        put_u32(&p, offset);
+        offset += (uint32_t)strlen(cat->names[i]);
+    }
+    put_u32(&p, offset);
+    for (size_t i = 0; i < category_count; i++) {
+        put_u32(&p, (uint32_t)atoi(categories[i][0]));
+    }
+    for (size_t i = 0; i < category_count; i++) {
+        put_u32(&p, offset);
+        offset += categories[i][1] ? (uint32_t)strlen(categories[i][1]) : 0;
+    }
+    put_u32(&p, offset);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(cat->names[i]);
+        memcpy(p, cat->names[i], len);
+        p += len;
+    }
+    *version = cat->version;
+    catalog_read_unlock();
+
+    for (size_t i = 0; i < category_count; i++) {
+        if (categories[i][1] != NULL) {
+            size_t len = strlen(categories[i][1]);
+            memcpy(p, categories[i][1], len);
+            p += len;
+        }
+    }
+    free(categories);
+    mysql_free_result(result);
+
+    unsigned char *crc_at = buf + 20;
+    put_u32(&crc_at, (uint32_t)crc32(0L, buf + BUNDLE_HEADER_SIZE,
+                                     (uInt)(size - BUNDLE_HEADER_SIZE)));
+
+    *out = buf;
+    *out_size = size;
+    return 0;
+}
+
+/**
+ * @brief gzip-compresses a buffer.
+ *
+ * @return malloc'ed compressed data, or NULL on failure
+ */
+static unsigned char *gzip_buffer(const unsigned char *data, size_t size, size_t *out_size) {
+    z_stream zs;
+    unsigned char *out;
+    uLong bound;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    bound = deflateBound(&zs, (uLong)size);
+    out = malloc(bound);
+    if (out == NULL) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = (uInt)size;
+    zs.next_out = out;
+    zs.avail_out = (uInt)bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        free(out);
+        return NULL;
+    }
+    *out_size = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+/**
+ * @brief Adds the headers shared by all bundle responses.
+ */
+static void add_common_headers(struct MHD_Response *response, const char *etag) {
+    MHD_add_response_header(response, "ETag", etag);
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    MHD_add_response_header(response, "Access-Control-Expose-Headers", "ETag");
+}
+
+/**
+ * @brief Creates an MHD response over a duplicate of a bundle file.
+ */
+static struct MHD_Response *response_from_file(int fd, uint64_t size) {
+    struct MHD_Response *response;
+    int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    if (dup_fd < 0) {
+        return NULL;
+    }
+    response = MHD_create_response_from_fd64(size, dup_fd);
+    if (response == NULL) {
+        close(dup_fd);
+    }
+    return response;
+}
+
+/**
+ * @brief Sends the bundle through a front end other than libmicrohttpd.
+ */
+static enum MHD_Result send_bundle_file(HttpRequest *request, const struct bundle *b,
+                                        int gzip, int not_modified) {
+    HttpHeader headers[6];
+    char etag[32];
+    int count = 0, fd;
+
+    snprintf(etag, sizeof(etag), gzip && !not_modified ? "\"%s-gz\"" : "\"%s\"", b->tag);
+    headers[count++] = (HttpHeader){ "ETag", etag };
+    headers[count++] = (HttpHeader){ "Cache-Control", "no-cache" };
+    headers[count++] = (HttpHeader){ "Vary", "Accept-Encoding" };
+    headers[count++] = (HttpHeader){ "Access-Control-Expose-Headers", "ETag" };
+    if (!not_modified) {
+        headers[count++] = (HttpHeader){ "Content-Type", "application/octet-stream" };
+        if (gzip) {
+            headers[count++] = (HttpHeader){ "Content-Encoding", "gzip" };
+        }
+    }
+
+    fd = fcntl(gzip ? b->compressed_fd : b->plain_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        return send_error_response(request, 500, "Failed to send catalog bundle");
+    }
+    return send_fd_response(request, not_modified ? 304 : 200, headers, count, fd, 0,
+                            not_modified ? 0 : gzip ? b->compressed_size : b->plain_size);
+}
+
+/**
+ * @brief Builds the bundle of the current catalog.
+ *
+ * @return 0 on success, or a negative BUNDLE_ERROR_* code
+ */
+static int bundle_build(struct bundle *b) {
+    unsigned char *data, *gz;
+    size_t size, gz_size;
+    char etag[32];
+    int rc;
+
+    memset(b, 0, sizeof(*b));
+    b->plain_fd = -1;
+    b->compressed_fd = -1;
+    rc = bundle_encode(&data, &size, &b->version);
+    if (rc != 0) {
+        return rc;
+    }
+    gz = gzip_buffer(data, size, &gz_size);
+    if (gz == NULL) {
+        free(data);
+        return BUNDLE_ERROR_BUILD;
+    }
+
+    snprintf(b->tag, sizeof(b->tag), "%08lx%08zx", crc32(0L, data, (uInt)size), size);
+
+    b->plain_fd = bundle_file(data, size);
+    b->plain_size = size;
+    b->compressed_fd = bundle_file(gz, gz_size);
+    b->compressed_size = gz_size;
+    free(data);
+    free(gz);
+    if (b->plain_fd < 0 || b->compressed_fd < 0) {
+        bundle_free(b);
+        return BUNDLE_ERROR_BUILD;
+    }
+
+    /* MHD closes its duplicates once the last connection using them is done */
+    b->plain = response_from_file(b->plain_fd, b->plain_size);
+    b->compressed = response_from_file(b->compressed_fd, b->compressed_size);
+    b->not_modified = MHD_create_response_from_buffer(0, (void *)"", MHD_RESPMEM_PERSISTENT);
+    if (b->plain == NULL || b->compressed == NULL || b->not_modified == NULL) {
+        bundle_free(b);
+        return BUNDLE_ERROR_BUILD;
+    }
+
+    snprintf(etag, sizeof(etag), "\"%s\"", b->tag);
+    add_common_headers(b->plain, etag);
+    add_common_headers(b->not_modified, etag);
+    MHD_add_response_header(b->plain, "Content-Type", "application/octet-stream");
+
+    snprintf(etag, sizeof(etag), "\"%s-gz\"", b->tag);
+    add_common_headers(b->compressed, etag);
+    MHD_add_response_header(b->compressed, "Content-Type", "application/octet-stream");
+    MHD_add_response_header(b->compressed, "Content-Encoding", "gzip");
+
+    printf("Built catalog bundle: %zu bytes, %zu gzipped\n", size, gz_size);
+    return 0;
+}
+
+int catalog_bundle_send(HttpRequest *request, int gzip,
+                        const char *if_none_match, enum MHD_Result *ret) {
+    unsigned long version;
+    int rc = 0;
+
+    catalog_read_lock();
+    version = catalog_get() != NULL ? catalog_get()->version : 0;
+    catalog_read_unlock();
+    if (version == 0) {
+        return BUNDLE_ERROR_NO_CATALOG;
+    }
+
+    pthread_mutex_lock(&bundle_mutex);
+    if (current.version != version) {
+        struct bundle fresh;
+
+        rc = bundle_build(&fresh);
+        if (rc == 0) {
+            bundle_free(&current);
+            current = fresh;
+        }
+    }
+    if (rc == 0) {
+        /* Either encoding's ETag names the same content */
+        int match = if_none_match != NULL &&
+                    (strcmp(if_none_match, "*") == 0 || strstr(if_none_match, current.tag) != NULL);
+
+        if (request->mhd == NULL) {
+            *ret = send_bundle_file(request, &current, gzip, match);
+        } else if (match) {
+            *ret = MHD_queue_response(request->mhd, 304, current.not_modified);
+        } else {
+            *ret = MHD_queue_response(request->mhd, 200, gzip ? current.compressed : current.plain);
+        }
+    }
+    pthread_mutex_unlock(&bundle_mutex);
+    return rc;
+}
+
+void catalog_bundle_cleanup(void) {
+    pthread_mutex_lock(&bundle_mutex);
+    bundle_free(&current);
+    pthread_mutex_unlock(&bundle_mutex);
+}
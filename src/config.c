@@ -1,8 +1,11 @@
 /**
  * @file config.c
- * @brief Implementation of configuration loading from environment variables.
+ * @brief Typed configuration from defaults, environment and a config file.
  */
 
+#include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,54 +14,375 @@
 /** @brief Global configuration instance */
 Config config = {0};
 
+#define STRING_OPTION(key, field, def, choices, reloadable) \
+    { key, CONFIG_STRING, offsetof(Config, field), def, 0, 0, 0, choices, reloadable, 0 }
+#define INT_OPTION(key, field, def, min, max, reloadable) \
+    { key, CONFIG_INT, offsetof(Config, field), NULL, def, min, max, NULL, reloadable, 0 }
+
+const ConfigOption config_options[] = {
+    STRING_OPTION("DB_HOST", db_host, "localhost", NULL, 0),
+    STRING_OPTION("DB_USER", db_user, "root", NULL, 0),
+    { "DB_PASSWORD", CONFIG_STRING, offsetof(Config, db_password), "", 0, 0, 0, NULL, 0, 1 },
+    STRING_OPTION("DB_NAME", db_name, "diet_api", NULL, 0),
+    INT_OPTION("DB_PORT", db_port, 3306, 1, 65535, 0),
+    INT_OPTION("DB_POOL_MIN", db_pool_min, 2, 1, DB_POOL_HARD_MAX, 1),
+    INT_OPTION("DB_POOL_MAX", db_pool_max, 16, 1, DB_POOL_HARD_MAX, 1),
+    STRING_OPTION("DB_REPLICAS", db_replicas, "", NULL, 0),
+    INT_OPTION("DB_HEDGE_PERCENT", db_hedge_percent, 5, 0, 100, 1),
+    INT_OPTION("TEMPLATE_DOCUMENTS", template_documents, 0, 0, 1, 0),
+    STRING_OPTION("TEMPLATE_FULL_STRATEGY", template_full_strategy, "c", "c|mysql", 0),
+    INT_OPTION("TEMPLATE_CACHE", template_cache, 0, 0, 1, 0),
+    INT_OPTION("TEMPLATE_CHANGE_LOG", template_change_log, 64, 0, 4096, 0),
+    INT_OPTION("PORT", server_port, 8080, 1, 65535, 0),
+    STRING_OPTION("HTTP_FRONTEND", http_frontend, "mhd", "mhd|uring", 0),
+    INT_OPTION("URING_THREADS", uring_threads, 0, 0, 1024, 0),
+    INT_OPTION("H2_PORT", h2_port, 0, 0, 65535, 0),
+    INT_OPTION("H2_THREADS", h2_threads, 0, 0, 1024, 1),
+    STRING_OPTION("TLS_CERT_FILE", tls_cert_file, "", NULL, 0),
+    STRING_OPTION("TLS_KEY_FILE", tls_key_file, "", NULL, 0),
+    INT_OPTION("TLS_KTLS", tls_ktls, 1, 0, 1, 0),
+    INT_OPTION("JSON_SLAB", json_slab, 1, 0, 1, 0),
+    INT_OPTION("JSON_SLAB_THREAD_CACHE", json_slab_cache, 512, JSON_ALLOC_MIN_CACHE, 65536, 1),
+    STRING_OPTION("CPU_AFFINITY", cpu_affinity, "", NULL, 0),
+    INT_OPTION("NUMA_SHARDS", numa_shards, 0, 0, 1, 0),
+    STRING_OPTION("HUGE_PAGES", huge_pages, "off", "off|thp|explicit", 0),
+    INT_OPTION("RATE_LIMIT_READ", rate_limit_read, 0, 0, 1000000, 1),
+    INT_OPTION("RATE_LIMIT_HEAVY", rate_limit_heavy, 0, 0, 1000000, 1),
+    INT_OPTION("RATE_LIMIT_WRITE", rate_limit_write, 0, 0, 1000000, 1),
+    INT_OPTION("RATE_LIMIT_BURST", rate_limit_burst, 2, 1, 3600, 1),
+    STRING_OPTION("RATE_LIMIT_KEY_HEADER", rate_limit_key_header, "", NULL, 0),
+    INT_OPTION("HTTP_IDLE_TIMEOUT", http_idle_timeout, 30, 0, 86400, 1),
+    INT_OPTION("HTTP_BODY_TIMEOUT", http_body_timeout, 60, 0, 86400, 1),
+    INT_OPTION("HTTP_CONNECTION_LIMIT", http_connection_limit, 1000, 1, 1000000, 0),
+    INT_OPTION("HTTP_PER_IP_CONNECTION_LIMIT", http_per_ip_connection_limit, 64, 0, 1000000, 0),
+    INT_OPTION("MAX_BODY_SIZE", max_body_size, MAX_POST_SIZE, 1024, MAX_IMPORT_SIZE, 1),
+    INT_OPTION("IMPORT_MAX_BODY_SIZE", import_max_body_size, MAX_IMPORT_SIZE, 1024,
+               MAX_IMPORT_SIZE, 1),
+    INT_OPTION("PLAN_THREADS", plan_threads, 0, 0, 16, 1),
+    INT_OPTION("PLAN_BUDGET_MAX_MS", plan_budget_max_ms, PLAN_MAX_BUDGET_MS, 1,
+               PLAN_MAX_BUDGET_MS, 1),
+    INT_OPTION("EXPORT_CONCURRENCY", export_concurrency, EXPORT_MAX_CONCURRENT, 1, 64, 1),
+};
+
+const int config_option_count = (int)(sizeof(config_options) / sizeof(config_options[0]));
+
+#define OPTION_COUNT (sizeof(config_options) / sizeof(config_options[0]))
+
+/** @brief Where each current value came from */
+static const char *sources[OPTION_COUNT];
+
+/** @brief Path from CONFIG_FILE at startup (NULL = none) */
+static char *config_file = NULL;
+
+/** @brief Most listeners config_subscribe() accepts */
+#define MAX_LISTENERS 8
+
+static ConfigListener listeners[MAX_LISTENERS];
+static int listener_count = 0;
+
+/** @brief Serializes updates and their listeners */
+static pthread_mutex_t update_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_error(ConfigUpdate *update, const char *fmt, ...) {
+    va_list ap;
+
+    if (update->error_count < CONFIG_MAX_MESSAGES) {
+        va_start(ap, fmt);
+        vsnprintf(update->errors[update->error_count], sizeof(update->errors[0]), fmt, ap);
+        va_end(ap);
+    }
+    update->error_count++;
+}
+
+static int *int_field(const ConfigOption *option, Config *cfg) {
+    return (int *)((char *)cfg + option->offset);
+}
+
+static char **string_field(const ConfigOption *option, Config *cfg) {
+    return (char **)((char *)cfg + option->offset);
+}
+
+/**
+ * @brief Returns whether value is one of the '|'-separated choices.
+ */
+static int is_choice(const char *choices, const char *value) {
+    size_t len = strlen(value);
+
+    for (const char *p = choices; *p != '\0';) {
+        const char *end = strchr(p, '|');
+        size_t n = end != NULL ? (size_t)(end - p) : strlen(p);
+
+        if (n == len && strncmp(p, value, n) == 0) {
+            return 1;
+        }
+        p += n + (end != NULL);
+    }
+    return 0;
+}
+
 /**
- * @brief Gets an environment variable or returns a default value.
+ * @brief Validates text and stores it in cfg.
  *
- * @param name Environment variable name
- * @param default_val Default value if variable is not set or empty
- * @return Newly allocated string (caller must free)
+ * @return 0 on success, -1 if invalid (an error is added to update)
+ */
+static int parse_value(const ConfigOption *option, const char *text, Config *cfg,
+                       ConfigUpdate *update) {
+    if (option->type == CONFIG_INT) {
+        char *end;
+        long value = strtol(text, &end, 10);
+
+        while (isspace((unsigned char)*end)) {
+            end++;
+        }
+        if (end == text || *end != '\0' || value < option->min || value > option->max) {
+            add_error(update, "%s: \"%s\" is not a number from %ld to %ld",
+                      option->key, text, option->min, option->max);
+            return -1;
+        }
+        *int_field(option, cfg) = (int)value;
+        return 0;
+    }
+
+    if (option->choices != NULL && !is_choice(option->choices, text)) {
+        add_error(update, "%s: \"%s\" is not one of %s", option->key, text, option->choices);
+        return -1;
+    }
+    char *copy = strdup(text);
+    if (copy == NULL) {
+        add_error(update, "%s: out of memory", option->key);
+        return -1;
+    }
+    free(*string_field(option, cfg));
+    *string_field(option, cfg) = copy;
+    return 0;
+}
+
+static const ConfigOption *find_option(const char *key, size_t key_len) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (strlen(config_options[i].key) == key_len &&
+            strncmp(config_options[i].key, key, key_len) == 0) {
+            return &config_options[i];
+        }
+    }
+    return NULL;
+}
+
+static void free_strings(Config *cfg) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (config_options[i].type == CONFIG_STRING) {
+            free(*string_field(&config_options[i], cfg));
+            *string_field(&config_options[i], cfg) = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Applies KEY=VALUE lines of a file; unknown keys are ignored.
+ */
+static void read_file(const char *path, Config *cfg, const char **source, ConfigUpdate *update) {
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int line_no = 0;
+
+    if (f == NULL) {
+        add_error(update, "CONFIG_FILE: cannot read %s", path);
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *key = line, *eq, *value, *end;
+        const ConfigOption *option;
+
+        line_no++;
+        while (isspace((unsigned char)*key)) {
+            key++;
+        }
+        if (*key == '#' || *key == '\0') {
+            continue;
+        }
+        if (strncmp(key, "export ", 7) == 0) {
+            key += 7;
+        }
+        eq = strchr(key, '=');
+        if (eq == NULL) {
+            add_error(update, "%s:%d: expected KEY=VALUE", path, line_no);
+            continue;
+        }
+        for (end = eq; end > key && isspace((unsigned char)end[-1]); end--) {
+        }
+        option = find_option(key, (size_t)(end - key));
+
+        value = eq + 1;
+        while (isspace((unsigned char)*value)) {
+            value++;
+        }
+        end = value + strlen(value);
+        while (end > value && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        if (end - value >= 2 && (*value == '"' || *value == '\'') && end[-1] == *value) {
+            end[-1] = '\0';
+            value++;
+        }
+
+        if (option != NULL && value[0] != '\0' && parse_value(option, value, cfg, update) == 0) {
+            source[option - config_options] = "file";
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * @brief Fills cfg from defaults, then the environment, then the config file.
  */
-static char *get_env_or_default(const char *name, const char *default_val) {
-    const char *val = getenv(name);
-    if (val == NULL || val[0] == '\0') {
-        val = default_val;
+static void read_sources(Config *cfg, const char **source, ConfigUpdate *update) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const ConfigOption *option = &config_options[i];
+        const char *env = getenv(option->key);
+
+        if (option->type == CONFIG_INT) {
+            *int_field(option, cfg) = (int)option->default_int;
+        } else {
+            *string_field(option, cfg) = strdup(option->default_value);
+        }
+        source[i] = "default";
+        if (env != NULL && env[0] != '\0' && parse_value(option, env, cfg, update) == 0) {
+            source[i] = "env";
+        }
+    }
+    if (config_file != NULL) {
+        read_file(config_file, cfg, source, update);
     }
-    return strdup(val);
 }
 
 /**
- * @brief Gets an environment variable as integer or returns a default.
+ * @brief Moves the changes of a validated candidate into config.
  *
- * @param name Environment variable name
- * @param default_val Default value if variable is not set or empty
- * @return Integer value of environment variable or default
+ * Reloadable settings are stored; the others are reported as needing
+ * a restart. The candidate's strings are freed.
+ *
+ * @note Caller must hold update_mutex
  */
-static int get_env_int_or_default(const char *name, int default_val) {
-    const char *val = getenv(name);
-    if (val == NULL || val[0] == '\0') {
-        return default_val;
+static void apply(Config *candidate, const char **source, ConfigUpdate *update) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const ConfigOption *option = &config_options[i];
+        int changed;
+
+        if (option->type == CONFIG_INT) {
+            changed = *int_field(option, candidate) != *int_field(option, &config);
+        } else {
+            changed = strcmp(*string_field(option, candidate), *string_field(option, &config)) != 0;
+        }
+        if (!changed) {
+            continue;
+        }
+        if (!option->reloadable) {
+            if (update->restart_count < CONFIG_MAX_MESSAGES) {
+                update->restart[update->restart_count++] = option->key;
+            }
+            continue;
+        }
+
+        /* Only int settings are reloadable, so readers never see a freed string */
+        __atomic_store_n(int_field(option, &config), *int_field(option, candidate),
+                         __ATOMIC_RELAXED);
+        sources[i] = source[i];
+        if (update->applied_count < CONFIG_MAX_MESSAGES) {
+            update->applied[update->applied_count++] = option->key;
+        }
+    }
+
+    if (update->applied_count > 0) {
+        for (int i = 0; i < listener_count; i++) {
+            listeners[i]();
+        }
     }
-    return atoi(val);
 }
 
 int load_config(void) {
-    config.db_host = get_env_or_default("DB_HOST", "localhost");
-    config.db_user = get_env_or_default("DB_USER", "root");
-    config.db_password = get_env_or_default("DB_PASSWORD", "");
-    config.db_name = get_env_or_default("DB_NAME", "diet_api");
-    config.db_port = get_env_int_or_default("DB_PORT", 3306);
-    config.server_port = get_env_int_or_default("PORT", 8080);
+    ConfigUpdate update;
+    const char *path = getenv("CONFIG_FILE");
 
-    return 0;
+    memset(&update, 0, sizeof(update));
+    if (path != NULL && path[0] != '\0') {
+        config_file = strdup(path);
+    }
+    read_sources(&config, sources, &update);
+
+    for (int i = 0; i < update.error_count && i < CONFIG_MAX_MESSAGES; i++) {
+        fprintf(stderr, "Config: %s\n", update.errors[i]);
+    }
+    return update.error_count == 0 ? 0 : -1;
+}
+
+void config_subscribe(ConfigListener listener) {
+    pthread_mutex_lock(&update_mutex);
+    if (listener_count < MAX_LISTENERS) {
+        listeners[listener_count++] = listener;
+    }
+    pthread_mutex_unlock(&update_mutex);
+}
+
+int config_reload(ConfigUpdate *update) {
+    Config candidate = {0};
+    const char *source[OPTION_COUNT];
+
+    memset(update, 0, sizeof(*update));
+    pthread_mutex_lock(&update_mutex);
+    read_sources(&candidate, source, update);
+    if (update->error_count == 0) {
+        apply(&candidate, source, update);
+    }
+    pthread_mutex_unlock(&update_mutex);
+    free_strings(&candidate);
+    return update->error_count == 0 ? 0 : -1;
+}
+
+int config_set(const char *const pairs[][2], int count, ConfigUpdate *update) {
+    Config candidate = config;
+    const char *source[OPTION_COUNT];
+
+    memset(update, 0, sizeof(*update));
+    pthread_mutex_lock(&update_mutex);
+    memcpy(source, sources, sizeof(source));
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const ConfigOption *option = &config_options[i];
+        if (option->type == CONFIG_STRING) {
+            *string_field(option, &candidate) = strdup(*string_field(option, &config));
+        } else {
+            *int_field(option, &candidate) = __atomic_load_n(int_field(option, &config),
+                                                             __ATOMIC_RELAXED);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        const ConfigOption *option = find_option(pairs[i][0], strlen(pairs[i][0]));
+
+        if (option == NULL) {
+            add_error(update, "%s: unknown setting", pairs[i][0]);
+        } else if (parse_value(option, pairs[i][1], &candidate, update) == 0) {
+            source[option - config_options] = "admin";
+        }
+    }
+    if (update->error_count == 0) {
+        apply(&candidate, source, update);
+    }
+    pthread_mutex_unlock(&update_mutex);
+    free_strings(&candidate);
+    return update->error_count == 0 ? 0 : -1;
+}
+
+const char *config_format(const ConfigOption *option, char *buf, size_t size) {
+    if (option->type == CONFIG_INT) {
+        snprintf(buf, size, "%d", __atomic_load_n(int_field(option, &config), __ATOMIC_RELAXED));
+    } else {
+        const char *value = *string_field(option, &config);
+        snprintf(buf, size, "%s", option->secret && value[0] != '\0' ? "********" : value);
+    }
+    return sources[option - config_options];
 }
 
 void free_config(void) {
-    free(config.db_host);
-    free(config.db_user);
-    free(config.db_password);
-    free(config.db_name);
-    config.db_host = NULL;
-    config.db_user = NULL;
-    config.db_password = NULL;
-    config.db_name = NULL;
+    free_strings(&config);
+    free(config_file);
+    config_file = NULL;
 }
@@ -2,46 +2,169 @@
  * @file db.c
  * @brief MySQL database connection implementation.
  *
- * Uses a mutex to protect the single MySQL connection for thread-safety
- * with libmicrohttpd's thread-per-connection model.
+ * Queries run on a pool of connections shared by the request threads.
+ * The pool size is adjusted by a controller that runs at most once per
+ * DB_POOL_INTERVAL_MS, in the thread returning a connection, from the
+ * wait and execution times measured since its last run.
  */
 
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "config.h"
 #include "db.h"
 
-/** @brief Single MySQL connection handle */
+/** @brief Headroom over the measured concurrency when growing */
+#define POOL_HEADROOM 1.25
+
+/** @brief Largest growth step */
+#define POOL_MAX_STEP 4
+
+/** @brief Queries wait if the mean wait exceeds this share of the execution time */
+#define POOL_WAIT_RATIO 0.10
+
+/** @brief Consecutive waiting intervals before growing */
+#define POOL_GROW_INTERVALS 2
+
+/** @brief Consecutive calm intervals before shrinking */
+#define POOL_SHRINK_INTERVALS 5
+
+/** @brief Intervals a saturation ceiling is kept before probing again */
+#define POOL_CEILING_INTERVALS 60
+
+/** @brief Intervals between Threads_running samples */
+#define POOL_SAMPLE_INTERVALS 5
+
+/** @brief Connection used by db_get_connection(); never pooled, never runs queries */
 static MYSQL *db_conn = NULL;
 
-/** @brief Mutex to protect database access across threads */
-static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** @brief Guards everything below */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-int db_init(void) {
-    db_conn = mysql_init(NULL);
-    if (db_conn == NULL) {
+/** @brief Signalled when a connection is returned or the target grows */
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Connections not in use */
+static MYSQL *idle[DB_POOL_HARD_MAX];
+static int idle_count = 0;
+
+/** @brief Connections open, plus those being opened */
+static int open_count = 0;
+
+/** @brief Threads waiting in pool_acquire() */
+static int waiting = 0;
+
+/** @brief Pool size the controller wants */
+static int target = 0;
+
+/** @brief Size above which MySQL was saturated */
+static int ceiling = DB_POOL_HARD_MAX;
+static int ceiling_age = 0;
+
+/** @brief Consecutive intervals with waits, and without */
+static int pressure = 0;
+static int calm = 0;
+
+/** @brief A growth step whose effect the next interval checks */
+static struct {
+    int pending;
+    int size;                   /**< Size before the step */
+    double queries_per_sec;
+    double mean_exec_us;
+} probe;
+
+/** @brief Measurements of the current interval */
+static uint64_t window_start_us = 0;
+static uint64_t window_queries = 0;
+static uint64_t window_wait_us = 0;
+static uint64_t window_exec_us = 0;
+static int intervals = 0;
+
+/** @brief A thread should sample Threads_running on its connection */
+static int sample_due = 0;
+
+/** @brief Counters and results of the last interval */
+static DbPoolStats stats = { .mysql_threads_running = -1 };
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief Reads DB_POOL_MIN and DB_POOL_MAX, which may change at any time.
+ */
+static void pool_bounds(int *min, int *max) {
+    *max = CONFIG_LIVE(db_pool_max);
+    *min = CONFIG_LIVE(db_pool_min);
+    if (*min > *max) {
+        *min = *max;
+    }
+}
+
+MYSQL *db_connect(void) {
+    return db_connect_host(config.db_host, config.db_port);
+}
+
+MYSQL *db_connect_host(const char *host, int port) {
+    MYSQL *conn = mysql_init(NULL);
+    if (conn == NULL) {
         fprintf(stderr, "mysql_init() failed\n");
-        return -1;
+        return NULL;
     }
 
-    if (mysql_real_connect(db_conn,
-                           config.db_host,
+    if (mysql_real_connect(conn,
+                           host,
                            config.db_user,
                            config.db_password,
                            config.db_name,
-                           config.db_port,
+                           port,
                            NULL, 0) == NULL) {
-        fprintf(stderr, "mysql_real_connect() failed: %s\n",
-                mysql_error(db_conn));
+        fprintf(stderr, "mysql_real_connect() failed (%s:%d): %s\n",
+                host, port, mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+int db_init(void) {
+    int min, max;
+
+    pool_bounds(&min, &max);
+    db_conn = db_connect();
+    if (db_conn == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    target = min > 1 ? min : 1;
+    while (open_count < target) {
+        MYSQL *conn = db_connect();
+        if (conn == NULL) {
+            break;
+        }
+        idle[idle_count++] = conn;
+        open_count++;
+    }
+    window_start_us = now_us();
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (open_count == 0) {
         mysql_close(db_conn);
         db_conn = NULL;
         return -1;
     }
 
-    printf("Connected to MySQL: %s@%s:%d/%s\n",
-           config.db_user, config.db_host, config.db_port, config.db_name);
+    printf("Connected to MySQL: %s@%s:%d/%s (pool of %d-%d connections)\n",
+           config.db_user, config.db_host, config.db_port, config.db_name, min, max);
 
     return 0;
 }
@@ -50,53 +173,316 @@ MYSQL *db_get_connection(void) {
     return db_conn;
 }
 
-MYSQL_RES *db_query(const char *query) {
+/**
+ * @brief Takes an idle connection, opening one if the pool is below target.
+ *
+ * @param wait_us Set to the time spent waiting
+ * @return Connection, or NULL if none is open and none can be opened
+ */
+static MYSQL *pool_acquire(uint64_t *wait_us) {
+    uint64_t start = now_us();
+    MYSQL *conn = NULL;
+    int waited = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (;;) {
+        if (idle_count > 0) {
+            conn = idle[--idle_count];
+            break;
+        }
+        if (open_count < target) {
+            open_count++;
+            pthread_mutex_unlock(&pool_mutex);
+            conn = db_connect();
+            pthread_mutex_lock(&pool_mutex);
+            if (conn != NULL) {
+                break;
+            }
+            open_count--;
+            if (open_count == 0) {
+                break;
+            }
+        }
+        if (open_count == 0) {
+            break;
+        }
+        waited = 1;
+        waiting++;
+        pthread_cond_wait(&pool_cond, &pool_mutex);
+        waiting--;
+    }
+    if (waited) {
+        stats.waits++;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    *wait_us = now_us() - start;
+    return conn;
+}
+
+/**
+ * @brief Reads the Threads_running status variable.
+ *
+ * @return Value, or -1 on failure
+ */
+static int sample_threads_running(MYSQL *conn) {
     MYSQL_RES *result;
+    MYSQL_ROW row;
+    int value = -1;
+
+    if (mysql_query(conn, "SHOW GLOBAL STATUS LIKE 'Threads_running'") != 0 ||
+        (result = mysql_store_result(conn)) == NULL) {
+        return -1;
+    }
+    row = mysql_fetch_row(result);
+    if (row != NULL && row[1] != NULL) {
+        value = atoi(row[1]);
+    }
+    mysql_free_result(result);
+    return value;
+}
+
+/**
+ * @brief Ends a controller interval and moves the target.
+ *
+ * @note Caller must hold pool_mutex
+ */
+static void pool_adjust(uint64_t now) {
+    double elapsed = (double)(now - window_start_us);
+    double rate, exec, wait, busy;
+    int min, max, old_target = target;
 
-    pthread_mutex_lock(&db_mutex);
+    pool_bounds(&min, &max);
+    if (++ceiling_age >= POOL_CEILING_INTERVALS) {
+        ceiling = DB_POOL_HARD_MAX;
+        ceiling_age = 0;
+    }
+    if (++intervals % POOL_SAMPLE_INTERVALS == 0) {
+        sample_due = 1;
+    }
 
-    if (db_conn == NULL) {
+    rate = (double)window_queries * 1e6 / elapsed;
+    exec = window_queries > 0 ? (double)window_exec_us / (double)window_queries : 0;
+    wait = window_queries > 0 ? (double)window_wait_us / (double)window_queries : 0;
+    busy = rate * exec / 1e6;
+
+    stats.queries_per_sec = rate;
+    stats.mean_exec_us = exec;
+    stats.mean_wait_us = wait;
+    stats.busy = busy;
+    window_start_us = now;
+    window_queries = window_wait_us = window_exec_us = 0;
+
+    /* Undo a step that only made queries slower */
+    if (probe.pending) {
+        probe.pending = 0;
+        if (rate < probe.queries_per_sec * 1.05 && exec > probe.mean_exec_us * 1.10) {
+            ceiling = probe.size;
+            ceiling_age = 0;
+            target = probe.size;
+            stats.saturations++;
+        }
+    }
+
+    if (rate > 0 && wait > exec * POOL_WAIT_RATIO) {
+        pressure++;
+        calm = 0;
+    } else {
+        pressure = 0;
+        calm = busy * POOL_HEADROOM + 1 < target ? calm + 1 : 0;
+    }
+
+    if (pressure >= POOL_GROW_INTERVALS && target < max && target < ceiling &&
+        (stats.mysql_threads_running < 0 || stats.mysql_threads_running <= 2 * target)) {
+        int step = (int)(busy * POOL_HEADROOM) + 1 - target;
+
+        step = step < 1 ? 1 : step > POOL_MAX_STEP ? POOL_MAX_STEP : step;
+        probe.pending = 1;
+        probe.size = target;
+        probe.queries_per_sec = rate;
+        probe.mean_exec_us = exec;
+        target += step;
+        if (target > ceiling) {
+            target = ceiling;
+        }
+        pressure = 0;
+    } else if (calm >= POOL_SHRINK_INTERVALS && target > min) {
+        target--;
+        calm = 0;
+    }
+
+    if (target > max) {
+        target = max;
+    }
+    if (target < min) {
+        target = min;
+    }
+    if (target < 1) {
+        target = 1;
+    }
+    if (target > old_target) {
+        stats.grows++;
+        pthread_cond_broadcast(&pool_cond);
+    } else if (target < old_target) {
+        stats.shrinks++;
+    }
+}
+
+/**
+ * @brief Returns a connection to the pool and records its timings.
+ *
+ * Broken connections and those above the target are closed.
+ */
+static void pool_release(MYSQL *conn, uint64_t wait_us, uint64_t exec_us) {
+    MYSQL *surplus[DB_POOL_HARD_MAX];
+    int surplus_count = 0;
+    unsigned int err = mysql_errno(conn);
+    int sample = 0;
+    uint64_t now = now_us();
+
+    pthread_mutex_lock(&pool_mutex);
+    stats.queries++;
+    window_queries++;
+    window_wait_us += wait_us;
+    window_exec_us += exec_us;
+    if (now - window_start_us >= DB_POOL_INTERVAL_MS * 1000u) {
+        pool_adjust(now);
+    }
+    if (sample_due) {
+        sample_due = 0;
+        sample = 1;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (sample && err == 0) {
+        int running = sample_threads_running(conn);
+        pthread_mutex_lock(&pool_mutex);
+        stats.mysql_threads_running = running;
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST || open_count > target) {
+        surplus[surplus_count++] = conn;
+        open_count--;
+    } else {
+        idle[idle_count++] = conn;
+        pthread_cond_signal(&pool_cond);
+    }
+    while (idle_count > 0 && open_count > target) {
+        surplus[surplus_count++] = idle[--idle_count];
+        open_count--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (int i = 0; i < surplus_count; i++) {
+        mysql_close(surplus[i]);
+    }
+}
+
+MYSQL_RES *db_query(const char *query) {
+    MYSQL_RES *result;
+    MYSQL *conn;
+    uint64_t wait_us, start;
+
+    conn = pool_acquire(&wait_us);
+    if (conn == NULL) {
         fprintf(stderr, "Database not connected\n");
-        pthread_mutex_unlock(&db_mutex);
         return NULL;
     }
 
-    if (mysql_query(db_conn, query) != 0) {
-        fprintf(stderr, "Query failed: %s\n", mysql_error(db_conn));
-        pthread_mutex_unlock(&db_mutex);
+    start = now_us();
+    if (mysql_query(conn, query) != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(conn));
+        pool_release(conn, wait_us, now_us() - start);
         return NULL;
     }
 
-    result = mysql_store_result(db_conn);
-    pthread_mutex_unlock(&db_mutex);
+    result = mysql_store_result(conn);
+    pool_release(conn, wait_us, now_us() - start);
 
     return result;
 }
 
 int db_execute(const char *query) {
     int affected_rows;
+    MYSQL *conn;
+    uint64_t wait_us, start;
 
-    pthread_mutex_lock(&db_mutex);
-
-    if (db_conn == NULL) {
+    conn = pool_acquire(&wait_us);
+    if (conn == NULL) {
         fprintf(stderr, "Database not connected\n");
-        pthread_mutex_unlock(&db_mutex);
         return -1;
     }
 
-    if (mysql_query(db_conn, query) != 0) {
-        fprintf(stderr, "Execute failed: %s\n", mysql_error(db_conn));
-        pthread_mutex_unlock(&db_mutex);
+    start = now_us();
+    if (mysql_query(conn, query) != 0) {
+        fprintf(stderr, "Execute failed: %s\n", mysql_error(conn));
+        pool_release(conn, wait_us, now_us() - start);
         return -1;
     }
 
-    affected_rows = (int)mysql_affected_rows(db_conn);
-    pthread_mutex_unlock(&db_mutex);
+    affected_rows = (int)mysql_affected_rows(conn);
+    pool_release(conn, wait_us, now_us() - start);
 
     return affected_rows;
 }
 
+int db_begin(DbTransaction *txn) {
+    txn->conn = pool_acquire(&txn->wait_us);
+    if (txn->conn == NULL) {
+        fprintf(stderr, "Database not connected\n");
+        return -1;
+    }
+
+    txn->start_us = now_us();
+    if (mysql_query(txn->conn, "START TRANSACTION") != 0) {
+        fprintf(stderr, "Begin failed: %s\n", mysql_error(txn->conn));
+        pool_release(txn->conn, txn->wait_us, now_us() - txn->start_us);
+        txn->conn = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int db_end(DbTransaction *txn, int commit) {
+    int rc = 0;
+
+    if (commit && mysql_query(txn->conn, "COMMIT") != 0) {
+        fprintf(stderr, "Commit failed: %s\n", mysql_error(txn->conn));
+        rc = -1;
+    }
+    if (!commit || rc != 0) {
+        mysql_query(txn->conn, "ROLLBACK");
+    }
+
+    /* The whole transaction counts as one query for the controller */
+    pool_release(txn->conn, txn->wait_us, now_us() - txn->start_us);
+    txn->conn = NULL;
+    return rc;
+}
+
+void db_pool_stats(DbPoolStats *out) {
+    pthread_mutex_lock(&pool_mutex);
+    *out = stats;
+    pool_bounds(&out->min, &out->max);
+    out->target = target;
+    out->ceiling = ceiling < out->max ? ceiling : out->max;
+    out->open = open_count;
+    out->idle = idle_count;
+    out->waiting = waiting;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
 void db_cleanup(void) {
+    pthread_mutex_lock(&pool_mutex);
+    while (idle_count > 0) {
+        mysql_close(idle[--idle_count]);
+    }
+    open_count = 0;
+    target = 0;
+    pthread_mutex_unlock(&pool_mutex);
+
     if (db_conn != NULL) {
         mysql_close(db_conn);
         db_conn = NULL;
@@ -0,0 +1,561 @@
+/**
+ * @file db_replica.c
+ * @brief Replica reads with latency hedging.
+ *
+ * A read is sent with mysql_send_query() and its socket polled until the
+ * route's p95, so that a slow replica can be raced by another without a
+ * thread per query. The loser's connection goes to the cancel thread,
+ * which kills its query from a second connection to the same replica and
+ * reads the aborted answer, leaving the connection usable.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "db.h"
+#include "db_replica.h"
+
+/** @brief Idle connections kept per replica */
+#define REPLICA_IDLE_MAX 32
+
+/** @brief Latency buckets, four per power of two of microseconds */
+#define HIST_BUCKETS 128
+
+/** @brief Reads after which a route's p95 is recomputed */
+#define WINDOW_SAMPLES 1000
+
+/** @brief Time after which it is recomputed from fewer reads */
+#define WINDOW_US 10000000u
+
+/** @brief Fewest reads a p95 is computed from */
+#define WINDOW_MIN_SAMPLES 50
+
+/** @brief Shortest hedge delay, below which a second query costs more than it saves */
+#define HEDGE_MIN_DELAY_US 1000
+
+/** @brief Hedges the budget can save up */
+#define HEDGE_BURST 10
+
+/** @brief Losing queries waiting for the cancel thread */
+#define CANCEL_QUEUE 64
+
+struct replica {
+    char host[256];
+    int port;
+    MYSQL *idle[REPLICA_IDLE_MAX];
+    int idle_count;
+};
+
+struct route {
+    const char *name;
+    uint32_t hist[HIST_BUCKETS];
+    uint32_t samples;
+    uint64_t window_start;
+    uint64_t p95_us;
+    uint64_t reads;
+    uint64_t hedges;
+    uint64_t hedge_wins;
+};
+
+/** @brief A losing query to cancel */
+struct loser {
+    MYSQL *conn;
+    int replica;
+};
+
+static struct replica replicas[DB_MAX_REPLICAS];
+static int replica_count = 0;
+
+/** @brief Replica of the next read, round robin */
+static unsigned int next_replica = 0;
+
+/** @brief Guards everything below, and the idle lists of replicas */
+static pthread_mutex_t replica_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct route routes[DB_MAX_READ_ROUTES];
+static int route_count = 0;
+
+/** @brief Hedges allowed, in hundredths */
+static int budget = 0;
+
+static uint64_t over_budget = 0;
+static uint64_t cancelled = 0;
+static uint64_t fallbacks = 0;
+
+/** @brief Guards the cancel queue */
+static pthread_mutex_t cancel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cancel_cond = PTHREAD_COND_INITIALIZER;
+static struct loser cancel_queue[CANCEL_QUEUE];
+static int cancel_count = 0;
+static int cancel_stop = 0;
+static int cancel_running = 0;
+static pthread_t cancel_thread;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static int bucket_of(uint64_t us) {
+    int log;
+    int index;
+
+    if (us < 4) {
+        return (int)us;
+    }
+    log = 63 - __builtin_clzll(us);
+    index = log * 4 + (int)((us >> (log - 2)) & 3);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Returns the smallest latency above a bucket.
+ */
+static uint64_t bucket_limit(int index) {
+    if (index < 4) {
+        return (uint64_t)index + 1;
+    }
+    return (uint64_t)(4 + index % 4 + 1) << (index / 4 - 2);
+}
+
+/**
+ * @brief Finds or adds a route.
+ *
+ * @return Index, or -1 if the table is full
+ * @note Caller must hold replica_mutex
+ */
+static int route_find(const char *name) {
+    for (int i = 0; i < route_count; i++) {
+        if (routes[i].name == name || strcmp(routes[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (route_count == DB_MAX_READ_ROUTES) {
+        return -1;
+    }
+    memset(&routes[route_count], 0, sizeof(routes[0]));
+    routes[route_count].name = name;
+    routes[route_count].window_start = now_us();
+    return route_count++;
+}
+
+/**
+ * @brief Adds a latency and closes the window when it is complete.
+ *
+ * @note Caller must hold replica_mutex
+ */
+static void route_record(struct route *r, uint64_t latency_us) {
+    uint64_t now = now_us();
+
+    r->hist[bucket_of(latency_us)]++;
+    r->samples++;
+    if (r->samples < WINDOW_SAMPLES &&
+        (now - r->window_start < WINDOW_US || r->samples < WINDOW_MIN_SAMPLES)) {
+        return;
+    }
+
+    uint32_t rank = r->samples - r->samples / 20, seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += r->hist[i];
+        if (seen >= rank) {
+            r->p95_us = bucket_limit(i);
+            break;
+        }
+    }
+    memset(r->hist, 0, sizeof(r->hist));
+    r->samples = 0;
+    r->window_start = now;
+}
+
+/**
+ * @brief Takes an idle connection to a replica, or opens one.
+ */
+static MYSQL *replica_acquire(int index) {
+    struct replica *rep = &replicas[index];
+    MYSQL *conn = NULL;
+
+    pthread_mutex_lock(&replica_mutex);
+    if (rep->idle_count > 0) {
+        conn = rep->idle[--rep->idle_count];
+    }
+    pthread_mutex_unlock(&replica_mutex);
+
+    if (conn == NULL) {
+        conn = db_connect_host(rep->host, rep->port);
+    }
+    return conn;
+}
+
+/**
+ * @brief Returns a connection, closing it if broken or surplus.
+ */
+static void replica_release(int index, MYSQL *conn) {
+    struct replica *rep = &replicas[index];
+
+    if (mysql_errno(conn) < CR_MIN_ERROR) {
+        pthread_mutex_lock(&replica_mutex);
+        if (rep->idle_count < REPLICA_IDLE_MAX) {
+            rep->idle[rep->idle_count++] = conn;
+            conn = NULL;
+        }
+        pthread_mutex_unlock(&replica_mutex);
+    }
+    if (conn != NULL) {
+        mysql_close(conn);
+    }
+}
+
+/**
+ * @brief Sends a query to a replica without waiting for the answer.
+ *
+ * @return Connection the answer will arrive on, or NULL on failure
+ */
+static MYSQL *replica_send(int index, const char *query, unsigned long length) {
+    MYSQL *conn = replica_acquire(index);
+
+    if (conn != NULL && mysql_send_query(conn, query, length) != 0) {
+        fprintf(stderr, "Replica %s:%d: %s\n", replicas[index].host, replicas[index].port,
+                mysql_error(conn));
+        replica_release(index, conn);
+        conn = NULL;
+    }
+    return conn;
+}
+
+/**
+ * @brief Waits until one of the connections has an answer.
+ *
+ * @param timeout_us Longest wait (0 = no limit)
+ * @return Index of the first connection with an answer, -1 on timeout
+ */
+static int wait_answer(MYSQL *const conns[], int count, uint64_t timeout_us) {
+    struct pollfd fds[2];
+    struct timespec ts = {
+        .tv_sec = (time_t)(timeout_us / 1000000u),
+        .tv_nsec = (long)(timeout_us % 1000000u) * 1000
+    };
+    int n;
+
+    for (int i = 0; i < count; i++) {
+        fds[i].fd = conns[i]->net.fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    do {
+        n = ppoll(fds, (nfds_t)count, timeout_us > 0 ? &ts : NULL, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n == 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (fds[i].revents != 0) {
+            return i;
+        }
+    }
+    /* poll failed: block on the first */
+    return 0;
+}
+
+/**
+ * @brief Kills a losing query and reads what is left of its answer.
+ */
+static void cancel_query(const struct loser *loser) {
+    MYSQL *killer = replica_acquire(loser->replica);
+    char sql[64];
+
+    if (killer != NULL) {
+        snprintf(sql, sizeof(sql), "KILL QUERY %lu", mysql_thread_id(loser->conn));
+        if (mysql_query(killer, sql) != 0) {
+            fprintf(stderr, "Replica %s:%d: %s\n", replicas[loser->replica].host,
+                    replicas[loser->replica].port, mysql_error(killer));
+        }
+        replica_release(loser->replica, killer);
+    }
+
+    /* Usually ER_QUERY_INTERRUPTED; the query may also have finished first */
+    if (mysql_read_query_result(loser->conn) == 0) {
+        MYSQL_RES *result = mysql_store_result(loser->conn);
+        if (result != NULL) {
+            mysql_free_result(result);
+        }
+    }
+    replica_release(loser->replica, loser->conn);
+}
+
+static void *cancel_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&cancel_mutex);
+    for (;;) {
+        while (cancel_count == 0 && !cancel_stop) {
+            pthread_cond_wait(&cancel_cond, &cancel_mutex);
+        }
+        if (cancel_count == 0) {
+            break;
+        }
+        struct loser loser = cancel_queue[--cancel_count];
+        pthread_mutex_unlock(&cancel_mutex);
+
+        cancel_query(&loser);
+        pthread_mutex_lock(&replica_mutex);
+        cancelled++;
+        pthread_mutex_unlock(&replica_mutex);
+
+        pthread_mutex_lock(&cancel_mutex);
+    }
+    pthread_mutex_unlock(&cancel_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Hands a losing query to the cancel thread.
+ *
+ * If the thread is behind (a replica not answering even KILL), the
+ * connection is closed instead, which MySQL notices when the query
+ * next writes to it.
+ */
+static void cancel_later(MYSQL *conn, int replica) {
+    int queued = 0;
+
+    pthread_mutex_lock(&cancel_mutex);
+    if (cancel_running && cancel_count < CANCEL_QUEUE) {
+        cancel_queue[cancel_count].conn = conn;
+        cancel_queue[cancel_count].replica = replica;
+        cancel_count++;
+        queued = 1;
+        pthread_cond_signal(&cancel_cond);
+    }
+    pthread_mutex_unlock(&cancel_mutex);
+
+    if (!queued) {
+        mysql_close(conn);
+    }
+}
+
+/**
+ * @brief Adds a read's share to the hedge budget.
+ *
+ * @note Caller must hold replica_mutex
+ */
+static void budget_refill(void) {
+    budget += CONFIG_LIVE(db_hedge_percent);
+    if (budget > HEDGE_BURST * 100) {
+        budget = HEDGE_BURST * 100;
+    }
+}
+
+static int budget_take(void) {
+    int granted = 0;
+
+    pthread_mutex_lock(&replica_mutex);
+    if (budget >= 100) {
+        budget -= 100;
+        granted = 1;
+    } else {
+        over_budget++;
+    }
+    pthread_mutex_unlock(&replica_mutex);
+    return granted;
+}
+
+int db_replica_init(void) {
+    char *list, *item, *save = NULL;
+    int rc = 0;
+
+    if (config.db_replicas == NULL || config.db_replicas[0] == '\0') {
+        return 0;
+    }
+    list = strdup(config.db_replicas);
+    if (list == NULL) {
+        return -1;
+    }
+
+    for (item = strtok_r(list, ", ", &save); item != NULL; item = strtok_r(NULL, ", ", &save)) {
+        struct replica *rep;
+        char *colon = strrchr(item, ':');
+        int port = config.db_port;
+
+        if (replica_count == DB_MAX_REPLICAS) {
+            fprintf(stderr, "DB_REPLICAS: more than %d replicas\n", DB_MAX_REPLICAS);
+            rc = -1;
+            break;
+        }
+        if (colon != NULL) {
+            char *end;
+            long value = strtol(colon + 1, &end, 10);
+
+            if (end == colon + 1 || *end != '\0' || value < 1 || value > 65535) {
+                fprintf(stderr, "DB_REPLICAS: bad port in \"%s\"\n", item);
+                rc = -1;
+                break;
+            }
+            *colon = '\0';
+            port = (int)value;
+        }
+        if (item[0] == '\0' || strlen(item) >= sizeof(replicas[0].host)) {
+            fprintf(stderr, "DB_REPLICAS: bad host in \"%s\"\n", config.db_replicas);
+            rc = -1;
+            break;
+        }
+
+        rep = &replicas[replica_count++];
+        strcpy(rep->host, item);
+        rep->port = port;
+        rep->idle_count = 0;
+    }
+    free(list);
+
+    if (rc != 0) {
+        replica_count = 0;
+        return rc;
+    }
+
+    for (int i = 0; i < replica_count; i++) {
+        MYSQL *conn = db_connect_host(replicas[i].host, replicas[i].port);
+        if (conn != NULL) {
+            replica_release(i, conn);
+        }
+    }
+    if (replica_count > 1) {
+        cancel_stop = 0;
+        cancel_running = pthread_create(&cancel_thread, NULL, cancel_main, NULL) == 0;
+    }
+
+    printf("Template-full reads on %d replica(s), hedging up to %d%%\n",
+           replica_count, replica_count > 1 ? CONFIG_LIVE(db_hedge_percent) : 0);
+    return 0;
+}
+
+MYSQL_RES *db_query_read(const char *route, const char *query) {
+    unsigned long length = strlen(query);
+    MYSQL *conns[2] = { NULL, NULL };
+    int which[2];
+    int r = -1, winner = 0, hedged = 0;
+    uint64_t start, delay = 0;
+    MYSQL_RES *result = NULL;
+    MYSQL *conn;
+
+    if (replica_count == 0) {
+        return db_query(query);
+    }
+
+    which[0] = (int)(__atomic_fetch_add(&next_replica, 1, __ATOMIC_RELAXED) % (unsigned)replica_count);
+    which[1] = (which[0] + 1) % replica_count;
+    start = now_us();
+    conns[0] = replica_send(which[0], query, length);
+    if (conns[0] == NULL) {
+        goto fallback;
+    }
+
+    pthread_mutex_lock(&replica_mutex);
+    r = route_find(route);
+    if (r >= 0) {
+        routes[r].reads++;
+        delay = routes[r].p95_us;
+    }
+    budget_refill();
+    pthread_mutex_unlock(&replica_mutex);
+
+    /* No hedge until the route has a p95 */
+    if (replica_count > 1 && delay > 0 && CONFIG_LIVE(db_hedge_percent) > 0) {
+        if (delay < HEDGE_MIN_DELAY_US) {
+            delay = HEDGE_MIN_DELAY_US;
+        }
+        if (wait_answer(conns, 1, delay) < 0 && budget_take()) {
+            conns[1] = replica_send(which[1], query, length);
+            if (conns[1] != NULL) {
+                hedged = 1;
+                winner = wait_answer(conns, 2, 0);
+                if (winner < 0) {
+                    winner = 0;
+                }
+            }
+        }
+    }
+
+    conn = conns[winner];
+    if (mysql_read_query_result(conn) == 0) {
+        result = mysql_store_result(conn);
+    }
+    if (result == NULL) {
+        fprintf(stderr, "Replica query failed: %s\n", mysql_error(conn));
+    }
+
+    pthread_mutex_lock(&replica_mutex);
+    if (r >= 0) {
+        if (result != NULL) {
+            route_record(&routes[r], now_us() - start);
+        }
+        routes[r].hedges += hedged;
+        routes[r].hedge_wins += hedged && winner == 1;
+    }
+    pthread_mutex_unlock(&replica_mutex);
+
+    if (hedged) {
+        cancel_later(conns[!winner], which[!winner]);
+    }
+
+    /* Lost connection: the primary answers instead */
+    if (result == NULL && mysql_errno(conn) >= CR_MIN_ERROR) {
+        replica_release(which[winner], conn);
+        goto fallback;
+    }
+    replica_release(which[winner], conn);
+    return result;
+
+fallback:
+    pthread_mutex_lock(&replica_mutex);
+    fallbacks++;
+    pthread_mutex_unlock(&replica_mutex);
+    return db_query(query);
+}
+
+void db_replica_stats(DbReplicaStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&replica_mutex);
+    stats->replicas = replica_count;
+    stats->hedge_percent = replica_count > 1 ? CONFIG_LIVE(db_hedge_percent) : 0;
+    stats->over_budget = over_budget;
+    stats->cancelled = cancelled;
+    stats->fallbacks = fallbacks;
+    stats->route_count = route_count;
+    for (int i = 0; i < route_count; i++) {
+        stats->routes[i].name = routes[i].name;
+        stats->routes[i].p95_us = routes[i].p95_us;
+        stats->routes[i].reads = routes[i].reads;
+        stats->routes[i].hedges = routes[i].hedges;
+        stats->routes[i].hedge_wins = routes[i].hedge_wins;
+    }
+    pthread_mutex_unlock(&replica_mutex);
+}
+
+void db_replica_cleanup(void) {
+    if (cancel_running) {
+        pthread_mutex_lock(&cancel_mutex);
+        cancel_stop = 1;
+        pthread_cond_signal(&cancel_cond);
+        pthread_mutex_unlock(&cancel_mutex);
+        pthread_join(cancel_thread, NULL);
+        cancel_running = 0;
+    }
+
+    pthread_mutex_lock(&replica_mutex);
+    for (int i = 0; i < replica_count; i++) {
+        while (replicas[i].idle_count > 0) {
+            mysql_close(replicas[i].idle[--replicas[i].idle_count]);
+        }
+    }
+    replica_count = 0;
+    pthread_mutex_unlock(&replica_mutex);
+}
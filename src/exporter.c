@@ -0,0 +1,461 @@
+/**
+ * @file exporter.c
+ * @brief Streaming full-table exports as NDJSON or CSV.
+ *
+ * Each export owns a MySQL connection and an unbuffered result set.
+ * The front end pulls the body through export_read(): rows are encoded
+ * into a chunk buffer (and optionally deflated) only when the client can
+ * take more data, so a slow client simply slows down the row fetches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "exporter.h"
+#include "config.h"
+#include "db.h"
+
+/** @brief Encoded bytes gathered before handing a chunk to the front end or zlib */
+#define EXPORT_CHUNK HTTP_STREAM_BLOCK_SIZE
+
+/** @brief Nice value for threads serving exports */
+#define EXPORT_NICE 10
+
+/** @brief How a column value is encoded */
+enum column_kind {
+    COLUMN_NUMBER,  /**< Emitted as-is (MySQL integer/decimal text) */
+    COLUMN_STRING,  /**< Quoted and escaped */
+    COLUMN_BOOL     /**< 0/1 as false/true */
+};
+
+/** @brief Exported column */
+struct column {
+    const char *name;
+    enum column_kind kind;
+};
+
+/** @brief Exported table: its query and column layout */
+struct table_spec {
+    const char *name;
+    const char *query;
+    const struct column *columns;
+    unsigned int column_count;
+};
+
+static const struct column food_columns[] = {
+    {"id", COLUMN_NUMBER},
+    {"category_id", COLUMN_NUMBER},
+    {"name", COLUMN_STRING},
+    {"description", COLUMN_STRING},
+    {"default_portion_grams", COLUMN_NUMBER},
+    {"calories_per_100g", COLUMN_NUMBER},
+    {"protein_per_100g", COLUMN_NUMBER},
+    {"carbs_per_100g", COLUMN_NUMBER},
+    {"fat_per_100g", COLUMN_NUMBER},
+    {"fiber_per_100g", COLUMN_NUMBER},
+    {"is_snack_suitable", COLUMN_BOOL},
+    {"status", COLUMN_STRING},
+};
+
+static const struct column template_columns[] = {
+    {"id", COLUMN_NUMBER},
+    {"code", COLUMN_STRING},
+    {"name", COLUMN_STRING},
+    {"description", COLUMN_STRING},
+    {"segment", COLUMN_STRING},
+    {"type", COLUMN_STRING},
+    {"duration_days", COLUMN_NUMBER},
+    {"calories_target", COLUMN_NUMBER},
+};
+
+/** @brief Table specs, indexed by ExportTable */
+static const struct table_spec tables[] = {
+    {
+        "foods",
+        "SELECT id, category_id, name, description, default_portion_grams, "
+        "calories_per_100g, protein_per_100g, carbs_per_100g, fat_per_100g, "
+        "fiber_per_100g, is_snack_suitable, status "
+        "FROM food_items ORDER BY id",
+        food_columns, sizeof(food_columns) / sizeof(food_columns[0])
+    },
+    {
+        "templates",
+        "SELECT id, code, name, description, segment, type, duration_days, calories_target "
+        "FROM diet_templates ORDER BY id",
+        template_columns, sizeof(template_columns) / sizeof(template_columns[0])
+    },
+};
+
+/** @brief Number of exports currently streaming */
+static int active_exports = 0;
+
+/** @brief State of one export */
+struct export_stream {
+    const struct table_spec *table;
+    char disposition[64];   /**< Content-Disposition header value */
+    ExportFormat format;
+    MYSQL *conn;
+    MYSQL_RES *result;
+    int eof;                /**< All rows fetched */
+    int finished;           /**< Body fully produced */
+    int header_written;     /**< CSV header emitted */
+    int priority_lowered;   /**< Thread nice value already raised */
+
+    char *raw;              /**< Encoded rows */
+    size_t raw_len;
+    size_t raw_cap;
+
+    int gzip;
+    z_stream zs;
+    unsigned char zbuf[EXPORT_CHUNK];
+
+    const char *out;        /**< Bytes waiting to be handed to the front end */
+    size_t out_len;
+    size_t out_pos;
+};
+
+/**
+ * @brief Makes room for extra bytes in the raw buffer.
+ *
+ * The buffer only grows past EXPORT_CHUNK for rows larger than that.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int raw_reserve(struct export_stream *st, size_t extra) {
+    if (st->raw_len + extra <= st->raw_cap) {
+        return 0;
+    }
+    size_t cap = st->raw_cap * 2;
+    while (cap < st->raw_len + extra) {
+        cap *= 2;
+    }
+    char *grown = realloc(st->raw, cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    st->raw = grown;
+    st->raw_cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Appends bytes to the raw buffer.
+ */
+static int raw_append(struct export_stream *st, const char *data, size_t len) {
+    if (raw_reserve(st, len) != 0) {
+        return -1;
+    }
+    memcpy(st->raw + st->raw_len, data, len);
+    st->raw_len += len;
+    return 0;
+}
+
+/**
+ * @brief Appends a JSON string literal (quoted and escaped).
+ */
+static int append_json_string(struct export_stream *st, const char *s, size_t len) {
+    /* Worst case every byte becomes \u00XX */
+    if (raw_reserve(st, len * 6 + 2) != 0) {
+        return -1;
+    }
+    char *p = st->raw + st->raw_len;
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else if (c == '\r') {
+            *p++ = '\\';
+            *p++ = 'r';
+        } else if (c == '\t') {
+            *p++ = '\\';
+            *p++ = 't';
+        } else if (c < 0x20) {
+            p += sprintf(p, "\\u%04x", c);
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    st->raw_len = (size_t)(p - st->raw);
+    return 0;
+}
+
+/**
+ * @brief Appends a CSV field, quoting it only when needed.
+ */
+static int append_csv_field(struct export_stream *st, const char *s, size_t len) {
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        return raw_append(st, s, len);
+    }
+    if (raw_reserve(st, len * 2 + 2) != 0) {
+        return -1;
+    }
+    char *p = st->raw + st->raw_len;
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '"') {
+            *p++ = '"';
+        }
+        *p++ = s[i];
+    }
+    *p++ = '"';
+    st->raw_len = (size_t)(p - st->raw);
+    return 0;
+}
+
+/**
+ * @brief Encodes one row in the export format.
+ */
+static int append_row(struct export_stream *st, MYSQL_ROW row, const unsigned long *lengths) {
+    const struct table_spec *t = st->table;
+
+    for (unsigned int c = 0; c < t->column_count; c++) {
+        const struct column *col = &t->columns[c];
+        const char *value = row[c];
+        size_t len = value != NULL ? lengths[c] : 0;
+        int rc;
+
+        if (st->format == EXPORT_CSV) {
+            if (c > 0 && raw_append(st, ",", 1) != 0) {
+                return -1;
+            }
+            if (value == NULL) {
+                continue;
+            }
+            if (col->kind == COLUMN_BOOL) {
+                rc = raw_append(st, atoi(value) ? "true" : "false", atoi(value) ? 4 : 5);
+            } else {
+                rc = append_csv_field(st, value, len);
+            }
+        } else {
+            if (raw_append(st, c == 0 ? "{\"" : ",\"", 2) != 0 ||
+                raw_append(st, col->name, strlen(col->name)) != 0 ||
+                raw_append(st, "\":", 2) != 0) {
+                return -1;
+            }
+            if (value == NULL) {
+                rc = raw_append(st, "null", 4);
+            } else if (col->kind == COLUMN_BOOL) {
+                rc = raw_append(st, atoi(value) ? "true" : "false", atoi(value) ? 4 : 5);
+            } else if (col->kind == COLUMN_NUMBER) {
+                rc = raw_append(st, value, len);
+            } else {
+                rc = append_json_string(st, value, len);
+            }
+        }
+        if (rc != 0) {
+            return -1;
+        }
+    }
+
+    if (st->format == EXPORT_CSV) {
+        return raw_append(st, "\r\n", 2);
+    }
+    return raw_append(st, "}\n", 2);
+}
+
+/**
+ * @brief Refills the raw buffer with roughly EXPORT_CHUNK bytes of rows.
+ *
+ * Sets eof once the result set is exhausted.
+ *
+ * @return 0 on success, -1 on a fetch or memory error
+ */
+static int export_fill(struct export_stream *st) {
+    MYSQL_ROW row;
+
+    st->raw_len = 0;
+
+    if (st->format == EXPORT_CSV && !st->header_written) {
+        for (unsigned int c = 0; c < st->table->column_count; c++) {
+            if ((c > 0 && raw_append(st, ",", 1) != 0) ||
+                raw_append(st, st->table->columns[c].name,
+                           strlen(st->table->columns[c].name)) != 0) {
+                return -1;
+            }
+        }
+        if (raw_append(st, "\r\n", 2) != 0) {
+            return -1;
+        }
+        st->header_written = 1;
+    }
+
+    while (st->raw_len < EXPORT_CHUNK) {
+        row = mysql_fetch_row(st->result);
+        if (row == NULL) {
+            if (mysql_errno(st->conn) != 0) {
+                fprintf(stderr, "Export of %s failed: %s\n", st->table->name, mysql_error(st->conn));
+                return -1;
+            }
+            st->eof = 1;
+            break;
+        }
+        if (append_row(st, row, mysql_fetch_lengths(st->result)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+ssize_t export_read(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct export_stream *st = cls;
+    (void)pos;
+
+#ifdef __linux__
+    /* Runs in a thread serving only this export; nice applies per thread on Linux */
+    if (!st->priority_lowered) {
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), EXPORT_NICE);
+        st->priority_lowered = 1;
+    }
+#endif
+
+    while (st->out_pos == st->out_len) {
+        if (st->finished) {
+            return MHD_CONTENT_READER_END_OF_STREAM;
+        }
+
+        if (!st->gzip) {
+            if (st->eof) {
+                st->finished = 1;
+                continue;
+            }
+            if (export_fill(st) != 0) {
+                return MHD_CONTENT_READER_END_WITH_ERROR;
+            }
+            st->out = st->raw;
+            st->out_len = st->raw_len;
+            st->out_pos = 0;
+            continue;
+        }
+
+        /* Feed zlib a new chunk once it has consumed the previous one */
+        if (st->zs.avail_in == 0 && !st->eof) {
+            if (export_fill(st) != 0) {
+                return MHD_CONTENT_READER_END_WITH_ERROR;
+            }
+            st->zs.next_in = (unsigned char *)st->raw;
+            st->zs.avail_in = (uInt)st->raw_len;
+        }
+
+        st->zs.next_out = st->zbuf;
+        st->zs.avail_out = sizeof(st->zbuf);
+        int rc = deflate(&st->zs, st->eof ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            st->finished = 1;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+        st->out = (const char *)st->zbuf;
+        st->out_len = sizeof(st->zbuf) - st->zs.avail_out;
+        st->out_pos = 0;
+    }
+
+    size_t n = st->out_len - st->out_pos;
+    if (n > max) {
+        n = max;
+    }
+    memcpy(buf, st->out + st->out_pos, n);
+    st->out_pos += n;
+    return (ssize_t)n;
+}
+
+void export_close(void *cls) {
+    struct export_stream *st = cls;
+    char sql[64];
+
+    if (st->result != NULL) {
+        /*
+         * Freeing an unfinished unbuffered result reads the remaining
+         * rows; killing the query first makes an aborted export stop
+         * after what is already in flight.
+         */
+        if (!st->eof) {
+            snprintf(sql, sizeof(sql), "KILL QUERY %lu", mysql_thread_id(st->conn));
+            db_execute(sql);
+        }
+        mysql_free_result(st->result);
+    }
+    if (st->conn != NULL) {
+        mysql_close(st->conn);
+    }
+    if (st->gzip) {
+        deflateEnd(&st->zs);
+    }
+    free(st->raw);
+    free(st);
+
+    __atomic_sub_fetch(&active_exports, 1, __ATOMIC_RELAXED);
+}
+
+int export_open(ExportTable table, ExportFormat format, int gzip,
+                ExportStream **stream, HttpHeader *headers) {
+    struct export_stream *st;
+    int count = 0;
+
+    if (__atomic_add_fetch(&active_exports, 1, __ATOMIC_RELAXED) > CONFIG_LIVE(export_concurrency)) {
+        __atomic_sub_fetch(&active_exports, 1, __ATOMIC_RELAXED);
+        return EXPORT_ERROR_BUSY;
+    }
+
+    st = calloc(1, sizeof(struct export_stream));
+    if (st == NULL) {
+        __atomic_sub_fetch(&active_exports, 1, __ATOMIC_RELAXED);
+        return EXPORT_ERROR_DB;
+    }
+    st->table = &tables[table];
+    st->format = format;
+    st->raw_cap = EXPORT_CHUNK * 2;
+    st->raw = malloc(st->raw_cap);
+
+    /* windowBits 15 + 16 selects the gzip wrapper; level 1 keeps up with the network */
+    if (st->raw == NULL ||
+        (gzip && deflateInit2(&st->zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                              Z_DEFAULT_STRATEGY) != Z_OK)) {
+        export_close(st);
+        return EXPORT_ERROR_DB;
+    }
+    st->gzip = gzip;
+
+    /* A dedicated connection keeps the shared one free for foreground queries */
+    st->conn = db_connect();
+    if (st->conn == NULL) {
+        export_close(st);
+        return EXPORT_ERROR_DB;
+    }
+
+    /* The server waits on us while the client reads; allow slow clients */
+    if (mysql_query(st->conn, "SET SESSION net_write_timeout = 3600") != 0 ||
+        mysql_query(st->conn, st->table->query) != 0 ||
+        (st->result = mysql_use_result(st->conn)) == NULL) {
+        fprintf(stderr, "Export of %s failed: %s\n", st->table->name, mysql_error(st->conn));
+        export_close(st);
+        return EXPORT_ERROR_DB;
+    }
+
+    snprintf(st->disposition, sizeof(st->disposition), "attachment; filename=\"%s.%s\"",
+             st->table->name, format == EXPORT_CSV ? "csv" : "ndjson");
+    headers[count++] = (HttpHeader){ "Content-Type", format == EXPORT_CSV
+                                                     ? "text/csv; charset=utf-8"
+                                                     : "application/x-ndjson" };
+    headers[count++] = (HttpHeader){ "Content-Disposition", st->disposition };
+    headers[count++] = (HttpHeader){ "Vary", "Accept-Encoding" };
+    if (gzip) {
+        headers[count++] = (HttpHeader){ "Content-Encoding", "gzip" };
+    }
+    /* End the connection (and its lowered-priority thread) after the export */
+    headers[count++] = (HttpHeader){ "Connection", "close" };
+
+    *stream = st;
+    return count;
+}
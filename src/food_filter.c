@@ -0,0 +1,319 @@
+/**
+ * @file food_filter.c
+ * @brief Nutrition range filtering and sorting over the food catalog.
+ *
+ * The catalog is scanned one block of CATALOG_BLOCK rows at a time. Each
+ * predicate is a plain loop over a column block that the compiler
+ * vectorizes at -O2; its per-row results are packed into a 64-bit
+ * selection word and ANDed with the previous predicates, and a block is
+ * dropped as soon as its word is empty. Name-ordered queries stop at the
+ * first full page; sorted queries keep the best rows in a bounded heap.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "food_filter.h"
+#include "text_fold.h"
+
+/** @brief Number of CATALOG_BLOCK blocks covering n rows */
+#define BLOCK_COUNT(n) (((size_t)(n) + CATALOG_BLOCK - 1) / CATALOG_BLOCK)
+
+/** @brief Query parameter suffixes, indexed by Nutrient */
+static const char *const nutrient_names[NUTRIENT_COUNT] = {
+    "calories", "protein", "carbs", "fat"
+};
+
+/** @brief Sort parameter values, indexed by FoodSortKey */
+static const char *const sort_names[] = {
+    "name", "calories", "protein", "carbs", "fat", "protein_ratio"
+};
+
+/** @brief Heap entry for top-k selection */
+struct ranked {
+    float key;
+    int index;
+};
+
+void food_filter_init(FoodFilter *filter) {
+    for (int n = 0; n < NUTRIENT_COUNT; n++) {
+        filter->min[n] = -INFINITY;
+        filter->max[n] = INFINITY;
+    }
+    filter->category_id = 0;
+    filter->search = NULL;
+    filter->sort = FOOD_SORT_NAME;
+    filter->descending = 0;
+}
+
+const char *food_filter_nutrient_name(Nutrient nutrient) {
+    return nutrient_names[nutrient];
+}
+
+int food_filter_parse_sort(const char *value, FoodFilter *filter) {
+    int descending = 0;
+
+    if (value[0] == '-') {
+        descending = 1;
+        value++;
+    }
+    for (size_t i = 0; i < sizeof(sort_names) / sizeof(sort_names[0]); i++) {
+        if (strcmp(value, sort_names[i]) == 0) {
+            filter->sort = (FoodSortKey)i;
+            filter->descending = descending;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Packs 64 one-byte flags (0 or 1) into a bitmap word.
+ *
+ * Multiplying eight flag bytes by 0x0102040810204080 gathers them into
+ * the top byte of the product, flag k at bit 56 + k.
+ */
+static uint64_t pack_flags(const unsigned char *flags) {
+    uint64_t bits = 0;
+
+    for (int j = 0; j < CATALOG_BLOCK; j += 8) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (int k = 0; k < 8; k++) {
+            bits |= (uint64_t)flags[j + k] << (j + k);
+        }
+#else
+        uint64_t word;
+        memcpy(&word, flags + j, sizeof(word));
+        bits |= ((word * 0x0102040810204080ULL) >> 56) << j;
+#endif
+    }
+    return bits;
+}
+
+/**
+ * @brief Selects the rows of a block with lo <= value <= hi.
+ */
+static uint64_t block_range(const float *block, float lo, float hi) {
+    unsigned char flags[CATALOG_BLOCK];
+
+    for (int j = 0; j < CATALOG_BLOCK; j++) {
+        flags[j] = (block[j] >= lo) & (block[j] <= hi);
+    }
+    return pack_flags(flags);
+}
+
+/**
+ * @brief Selects the rows of a block with value == wanted.
+ */
+static uint64_t block_equal(const int *block, int wanted) {
+    unsigned char flags[CATALOG_BLOCK];
+
+    for (int j = 0; j < CATALOG_BLOCK; j++) {
+        flags[j] = block[j] == wanted;
+    }
+    return pack_flags(flags);
+}
+
+/**
+ * @brief Clears selected rows whose folded name does not contain the needle.
+ *
+ * Runs after the numeric predicates, so only surviving rows are matched.
+ */
+static uint64_t block_substring(uint64_t bits, const Catalog *cat, size_t base,
+                                const char *needle, size_t needle_len) {
+    uint64_t pending = bits;
+
+    while (pending != 0) {
+        int bit = __builtin_ctzll(pending);
+        size_t i = base + (size_t)bit;
+        if (text_find(cat->norm_names[i], cat->norm_lengths[i], needle, needle_len) == NULL) {
+            bits &= ~(1ULL << bit);
+        }
+        pending &= pending - 1;
+    }
+    return bits;
+}
+
+/**
+ * @brief Returns the sort key of a row, negated for descending order.
+ */
+static float sort_key(const Catalog *cat, const FoodFilter *filter, int i) {
+    float key;
+
+    switch (filter->sort) {
+    case FOOD_SORT_CALORIES:
+        key = cat->calories[i];
+        break;
+    case FOOD_SORT_PROTEIN:
+        key = cat->protein[i];
+        break;
+    case FOOD_SORT_CARBS:
+        key = cat->carbs[i];
+        break;
+    case FOOD_SORT_FAT:
+        key = cat->fat[i];
+        break;
+    case FOOD_SORT_PROTEIN_RATIO:
+        key = cat->calories[i] > 0 ? cat->protein[i] * 100.0f / cat->calories[i] : 0.0f;
+        break;
+    default:
+        key = 0.0f;
+        break;
+    }
+    return filter->descending ? -key : key;
+}
+
+/**
+ * @brief Returns non-zero if a ranks after b (larger key, then later name).
+ */
+static int ranked_after(const struct ranked *a, const struct ranked *b) {
+    if (a->key != b->key) {
+        return a->key > b->key;
+    }
+    return a->index > b->index;
+}
+
+/**
+ * @brief Restores the max-heap property below position pos.
+ */
+static void heap_sift_down(struct ranked *heap, int size, int pos) {
+    for (;;) {
+        int largest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+
+        if (left < size && ranked_after(&heap[left], &heap[largest])) {
+            largest = left;
+        }
+        if (right < size && ranked_after(&heap[right], &heap[largest])) {
+            largest = right;
+        }
+        if (largest == pos) {
+            return;
+        }
+        struct ranked tmp = heap[pos];
+        heap[pos] = heap[largest];
+        heap[largest] = tmp;
+        pos = largest;
+    }
+}
+
+/**
+ * @brief Offers a row to a bounded max-heap of the k best rows.
+ *
+ * The heap root is the worst row kept so far; a row only enters once
+ * the heap is full if it ranks before the root.
+ */
+static void heap_offer(struct ranked *heap, int *size, int k, struct ranked r) {
+    if (*size < k) {
+        int pos = (*size)++;
+        while (pos > 0 && ranked_after(&r, &heap[(pos - 1) / 2])) {
+            heap[pos] = heap[(pos - 1) / 2];
+            pos = (pos - 1) / 2;
+        }
+        heap[pos] = r;
+    } else if (ranked_after(&heap[0], &r)) {
+        heap[0] = r;
+        heap_sift_down(heap, *size, 0);
+    }
+}
+
+/**
+ * @brief Evaluates every predicate of a filter over one block.
+ *
+ * Stops as soon as no row of the block is left.
+ */
+static uint64_t select_block(const Catalog *cat, const FoodFilter *filter,
+                             const float *const *columns, size_t w,
+                             const char *needle, size_t needle_len) {
+    size_t base = w * CATALOG_BLOCK;
+    uint64_t bits = ~0ULL;
+
+    if ((size_t)cat->count - base < CATALOG_BLOCK) {
+        bits = (1ULL << (cat->count - base)) - 1;
+    }
+    if (filter->category_id > 0) {
+        bits &= block_equal(cat->category_ids + base, filter->category_id);
+    }
+    for (int n = 0; n < NUTRIENT_COUNT && bits != 0; n++) {
+        if (filter->min[n] != -INFINITY || filter->max[n] != INFINITY) {
+            bits &= block_range(columns[n] + base, filter->min[n], filter->max[n]);
+        }
+    }
+    if (needle != NULL && bits != 0) {
+        bits = block_substring(bits, cat, base, needle, needle_len);
+    }
+    return bits;
+}
+
+int food_filter_run(const FoodFilter *filter, int *out, int max_results) {
+    const Catalog *cat = catalog_get();
+    const float *columns[NUTRIENT_COUNT];
+    const char *needle = NULL;
+    char folded[256];
+    size_t needle_len = 0;
+    size_t blocks;
+    int found = 0;
+
+    if (cat == NULL) {
+        return -1;
+    }
+    if (cat->count == 0 || max_results <= 0) {
+        return 0;
+    }
+
+    columns[NUTRIENT_CALORIES] = cat->calories;
+    columns[NUTRIENT_PROTEIN] = cat->protein;
+    columns[NUTRIENT_CARBS] = cat->carbs;
+    columns[NUTRIENT_FAT] = cat->fat;
+
+    if (filter->search != NULL && filter->search[0] != '\0') {
+        needle_len = text_fold(filter->search, folded, sizeof(folded));
+        needle = folded;
+    }
+
+    blocks = BLOCK_COUNT(cat->count);
+
+    if (filter->sort == FOOD_SORT_NAME) {
+        /* Rows are already in name order: emit blocks until the page is full */
+        for (size_t step = 0; step < blocks && found < max_results; step++) {
+            size_t w = filter->descending ? blocks - 1 - step : step;
+            uint64_t bits = select_block(cat, filter, columns, w, needle, needle_len);
+
+            while (bits != 0 && found < max_results) {
+                int bit = filter->descending ? 63 - __builtin_clzll(bits) : __builtin_ctzll(bits);
+                out[found++] = (int)(w * CATALOG_BLOCK) + bit;
+                bits &= ~(1ULL << bit);
+            }
+        }
+        return found;
+    }
+
+    struct ranked *heap = malloc((size_t)max_results * sizeof(struct ranked));
+    if (heap == NULL) {
+        return -1;
+    }
+
+    for (size_t w = 0; w < blocks; w++) {
+        uint64_t bits = select_block(cat, filter, columns, w, needle, needle_len);
+
+        while (bits != 0) {
+            struct ranked r;
+            r.index = (int)(w * CATALOG_BLOCK) + __builtin_ctzll(bits);
+            r.key = sort_key(cat, filter, r.index);
+            heap_offer(heap, &found, max_results, r);
+            bits &= bits - 1;
+        }
+    }
+
+    /* Heap sort: repeatedly move the worst remaining row to the back */
+    for (int size = found; size > 0;) {
+        out[--size] = heap[0].index;
+        heap[0] = heap[size];
+        heap_sift_down(heap, size, 0);
+    }
+
+    free(heap);
+    return found;
+}
@@ -0,0 +1,1248 @@
+/**
+ * @file food_import.c
+ * @brief Bulk import of food items from NDJSON or CSV.
+ *
+ * The body is first cut into records (a quote-aware scan for CSV), then
+ * worker threads parse and validate contiguous slices of records. Valid
+ * rows are written from one connection in multi-row statements; when a
+ * statement fails, its rows are retried one at a time so that only the
+ * offending rows are rejected.
+ */
+
+#include <cjson/cJSON.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "food_import.h"
+#include "catalog.h"
+#include "suggest.h"
+#include "fuzzy.h"
+#include "db.h"
+#include "template_cache.h"
+#include "template_index.h"
+#include "template_document.h"
+
+/** @brief Upper bound on validation threads */
+#define IMPORT_MAX_THREADS 8
+
+/** @brief Records per validation thread below which fewer threads are used */
+#define IMPORT_RECORDS_PER_THREAD 2000
+
+/** @brief Imported fields, in food_items column order */
+enum field {
+    FIELD_ID,
+    FIELD_CATEGORY_ID,
+    FIELD_NAME,
+    FIELD_DESCRIPTION,
+    FIELD_PORTION,
+    FIELD_CALORIES,
+    FIELD_PROTEIN,
+    FIELD_CARBS,
+    FIELD_FAT,
+    FIELD_FIBER,
+    FIELD_SNACK,
+    FIELD_STATUS,
+    FIELD_COUNT
+};
+
+/** @brief How a field value is parsed */
+enum field_kind {
+    KIND_INT,
+    KIND_DECIMAL,
+    KIND_TEXT,
+    KIND_BOOL
+};
+
+/** @brief Name and allowed values of an imported field */
+struct field_spec {
+    const char *name;
+    enum field_kind kind;
+    int required;
+    double min;     /**< Smallest value, or shortest length in characters */
+    double max;     /**< Largest value, or longest length in characters */
+};
+
+/** @brief Field specs, indexed by enum field (ranges follow the column types) */
+static const struct field_spec fields[FIELD_COUNT] = {
+    {"id", KIND_INT, 0, 1, INT_MAX},
+    {"category_id", KIND_INT, 1, 1, INT_MAX},
+    {"name", KIND_TEXT, 1, 1, 100},
+    {"description", KIND_TEXT, 0, 0, 255},
+    {"default_portion_grams", KIND_INT, 0, 1, 10000},
+    {"calories_per_100g", KIND_DECIMAL, 1, 0, 9999.99},
+    {"protein_per_100g", KIND_DECIMAL, 1, 0, 100},
+    {"carbs_per_100g", KIND_DECIMAL, 1, 0, 100},
+    {"fat_per_100g", KIND_DECIMAL, 1, 0, 100},
+    {"fiber_per_100g", KIND_DECIMAL, 0, 0, 100},
+    {"is_snack_suitable", KIND_BOOL, 0, 0, 1},
+    {"status", KIND_INT, 0, 0, 1},
+};
+
+/** @brief A record's bytes within the request body */
+struct record {
+    const char *start;
+    size_t len;
+    long line;
+};
+
+/** @brief Lifecycle of an imported row */
+enum row_state {
+    ROW_INVALID,    /**< Rejected by validation */
+    ROW_VALID,      /**< Ready to be written */
+    ROW_WRITTEN,    /**< Written in the open transaction */
+    ROW_COMMITTED,  /**< Durable */
+    ROW_FAILED      /**< Rejected by the database or rolled back */
+};
+
+/** @brief A parsed record */
+struct import_row {
+    long line;
+    enum row_state state;
+    int error_field;        /**< Field the error is about, or -1 */
+    const char *error;      /**< Why validation failed */
+    int id;                 /**< 0 until the database assigns one */
+    int category_id;
+    int portion;
+    int snack;
+    int status;
+    int has_fiber;
+    double calories;
+    double protein;
+    double carbs;
+    double fat;
+    double fiber;
+    char *name;
+    char *description;      /**< NULL for SQL NULL */
+};
+
+/** @brief A field value as found in the input */
+struct value {
+    const char *text;   /**< NUL-terminated string form, when not is_number */
+    double number;      /**< Numeric form, when is_number */
+    int is_number;
+};
+
+/** @brief Shared, read-only inputs of the validation workers */
+struct import_job {
+    ImportFormat format;
+    const struct record *records;
+    struct import_row *rows;
+    const int *categories;      /**< Sorted food_categories ids */
+    size_t category_count;
+    const int *columns;         /**< CSV column -> enum field, or -1 to ignore */
+    int column_count;
+};
+
+/** @brief A validation thread and its slice of records */
+struct worker {
+    const struct import_job *job;
+    pthread_t thread;
+    size_t first;
+    size_t last;
+    int failed;                 /**< Ran out of memory */
+};
+
+/** @brief Growable SQL statement */
+struct sql_buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/** @brief State of the write phase */
+struct writer {
+    MYSQL *conn;
+    struct sql_buffer sql;
+    struct import_row **pending;    /**< Rows written since the last commit */
+    size_t pending_count;
+    unsigned long id_step;          /**< @@auto_increment_increment */
+    ImportResult *result;
+};
+
+/** @brief Serializes imports (catalog_merge() must not run concurrently) */
+static pthread_mutex_t import_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Row error meaning the worker ran out of memory */
+static const char error_no_memory[] = "out of memory";
+
+/**
+ * @brief qsort/bsearch comparator for ints.
+ */
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Appends an error to the result, if there is room.
+ */
+static void add_error(ImportResult *result, long line, const char *fmt, ...) {
+    va_list ap;
+
+    if (result->error_count >= IMPORT_MAX_ERRORS) {
+        return;
+    }
+    ImportError *e = &result->errors[result->error_count++];
+    e->line = line;
+    va_start(ap, fmt);
+    vsnprintf(e->message, sizeof(e->message), fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * @brief Counts the characters of a UTF-8 string.
+ *
+ * @return Number of code points, or -1 if the string is not valid UTF-8
+ */
+static long utf8_length(const char *s) {
+    const unsigned char *p = (const unsigned char *)s;
+    long count = 0;
+
+    while (*p != '\0') {
+        int extra = *p < 0x80 ? 0 : (*p & 0xE0) == 0xC0 ? 1 :
+                    (*p & 0xF0) == 0xE0 ? 2 : (*p & 0xF8) == 0xF0 ? 3 : -1;
+        if (extra < 0) {
+            return -1;
+        }
+        p++;
+        for (int i = 0; i < extra; i++, p++) {
+            if ((*p & 0xC0) != 0x80) {
+                return -1;
+            }
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Finds a field by name.
+ *
+ * @return enum field value, or -1 for unknown names
+ */
+static int field_lookup(const char *name) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (strcmp(fields[f].name, name) == 0) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Stores one field value in a row.
+ *
+ * @return NULL on success, or a static description of the problem
+ *         (error_no_memory if a copy could not be allocated)
+ */
+static const char *set_field(struct import_row *row, enum field f, const struct value *v,
+                             const struct import_job *job) {
+    const struct field_spec *spec = &fields[f];
+    double number = v->number;
+
+    if (spec->kind == KIND_TEXT) {
+        if (v->is_number) {
+            return "must be a string";
+        }
+        long length = utf8_length(v->text);
+        if (length < 0) {
+            return "is not valid UTF-8";
+        }
+        if (length < spec->min || length > spec->max) {
+            return f == FIELD_NAME ? "must be 1 to 100 characters" : "must be at most 255 characters";
+        }
+        char *copy = strdup(v->text);
+        if (copy == NULL) {
+            return error_no_memory;
+        }
+        char **slot = f == FIELD_NAME ? &row->name : &row->description;
+        free(*slot);
+        *slot = copy;
+        return NULL;
+    }
+
+    if (!v->is_number) {
+        char *end;
+
+        if (spec->kind == KIND_BOOL && (strcmp(v->text, "true") == 0 || strcmp(v->text, "false") == 0)) {
+            number = v->text[0] == 't';
+        } else {
+            number = strtod(v->text, &end);
+            if (end == v->text || *end != '\0') {
+                return spec->kind == KIND_BOOL ? "must be true or false" : "must be a number";
+            }
+        }
+    }
+    if (!isfinite(number) || number < spec->min || number > spec->max) {
+        return spec->kind == KIND_BOOL ? "must be true or false" : "is out of range";
+    }
+    if (spec->kind != KIND_DECIMAL && number != floor(number)) {
+        return spec->kind == KIND_BOOL ? "must be true or false" : "must be an integer";
+    }
+
+    switch (f) {
+    case FIELD_ID:          row->id = (int)number; break;
+    case FIELD_CATEGORY_ID:
+        row->category_id = (int)number;
+        if (bsearch(&row->category_id, job->categories, job->category_count, sizeof(int),
+                    compare_ints) == NULL) {
+            return "is not an existing category";
+        }
+        break;
+    case FIELD_PORTION:     row->portion = (int)number; break;
+    case FIELD_CALORIES:    row->calories = number; break;
+    case FIELD_PROTEIN:     row->protein = number; break;
+    case FIELD_CARBS:       row->carbs = number; break;
+    case FIELD_FAT:         row->fat = number; break;
+    case FIELD_FIBER:       row->fiber = number; row->has_fiber = 1; break;
+    case FIELD_SNACK:       row->snack = (int)number; break;
+    case FIELD_STATUS:      row->status = (int)number; break;
+    default:                break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Checks required fields and the ranges that span several fields.
+ *
+ * @param seen Bit mask of the fields present in the record
+ */
+static void finish_row(struct import_row *row, unsigned int seen) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (fields[f].required && (seen & (1u << f)) == 0) {
+            row->error_field = f;
+            row->error = "is required";
+            return;
+        }
+    }
+    if (row->protein + row->carbs + row->fat > 100.0) {
+        row->error_field = -1;
+        row->error = "has more than 100 g of protein, carbs and fat per 100 g";
+        return;
+    }
+    row->state = ROW_VALID;
+}
+
+/**
+ * @brief Parses and validates one NDJSON record.
+ */
+static void parse_json_record(const struct import_job *job, const struct record *rec,
+                              struct import_row *row) {
+    cJSON *obj = cJSON_ParseWithLength(rec->start, rec->len);
+    const cJSON *item;
+    unsigned int seen = 0;
+
+    if (obj == NULL || !cJSON_IsObject(obj)) {
+        row->error = "is not a JSON object";
+        cJSON_Delete(obj);
+        return;
+    }
+
+    cJSON_ArrayForEach(item, obj) {
+        int f = item->string != NULL ? field_lookup(item->string) : -1;
+        struct value v = {NULL, 0, 0};
+
+        if (f < 0 || cJSON_IsNull(item)) {
+            continue;
+        }
+        if (cJSON_IsNumber(item)) {
+            v.number = item->valuedouble;
+            v.is_number = 1;
+        } else if (cJSON_IsBool(item)) {
+            v.number = cJSON_IsTrue(item) ? 1 : 0;
+            v.is_number = 1;
+        } else if (cJSON_IsString(item)) {
+            v.text = item->valuestring;
+        } else {
+            row->error_field = f;
+            row->error = "must be a number or string";
+            break;
+        }
+
+        row->error = set_field(row, (enum field)f, &v, job);
+        if (row->error != NULL) {
+            row->error_field = f;
+            break;
+        }
+        seen |= 1u << f;
+    }
+    cJSON_Delete(obj);
+
+    if (row->error == NULL) {
+        finish_row(row, seen);
+    }
+}
+
+/**
+ * @brief Splits a CSV record into unquoted, NUL-terminated fields.
+ *
+ * @param buf Output storage of at least 2 * len + 1 bytes
+ * @param values Set to the first max_values fields
+ * @return Number of fields in the record, or -1 if quoting is malformed
+ */
+static int csv_split(const char *p, size_t len, char *buf, const char **values, int max_values) {
+    const char *end = p + len;
+    int count = 0;
+
+    for (;;) {
+        if (count < max_values) {
+            values[count] = buf;
+        }
+        count++;
+
+        if (p < end && *p == '"') {
+            p++;
+            for (;;) {
+                if (p >= end) {
+                    return -1;
+                }
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        *buf++ = '"';
+                        p += 2;
+                        continue;
+                    }
+                    p++;
+                    break;
+                }
+                *buf++ = *p++;
+            }
+            if (p < end && *p != ',') {
+                return -1;
+            }
+        } else {
+            while (p < end && *p != ',') {
+                if (*p == '"') {
+                    return -1;
+                }
+                *buf++ = *p++;
+            }
+        }
+        *buf++ = '\0';
+
+        if (p >= end) {
+            return count;
+        }
+        p++;    /* Skip the comma */
+    }
+}
+
+/**
+ * @brief Parses and validates one CSV record.
+ *
+ * @param buf Scratch space of at least 2 * rec->len + 1 bytes
+ * @param values Scratch array of job->column_count pointers
+ */
+static void parse_csv_record(const struct import_job *job, const struct record *rec,
+                             struct import_row *row, char *buf, const char **values) {
+    unsigned int seen = 0;
+    int count = csv_split(rec->start, rec->len, buf, values, job->column_count);
+
+    if (count < 0) {
+        row->error = "has malformed quoting";
+        return;
+    }
+    if (count != job->column_count) {
+        row->error = "has a different number of fields than the header";
+        return;
+    }
+
+    for (int c = 0; c < count; c++) {
+        int f = job->columns[c];
+        struct value v = {values[c], 0, 0};
+
+        /* An empty field is NULL */
+        if (f < 0 || values[c][0] == '\0') {
+            continue;
+        }
+        row->error = set_field(row, (enum field)f, &v, job);
+        if (row->error != NULL) {
+            row->error_field = f;
+            return;
+        }
+        seen |= 1u << f;
+    }
+    finish_row(row, seen);
+}
+
+/**
+ * @brief Thread entry point: validates records [first, last).
+ */
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    const struct import_job *job = w->job;
+    char *buf = NULL;
+    const char **values = NULL;
+
+    if (job->format == IMPORT_CSV) {
+        size_t longest = 0;
+        for (size_t i = w->first; i < w->last; i++) {
+            if (job->records[i].len > longest) {
+                longest = job->records[i].len;
+            }
+        }
+        buf = malloc(2 * longest + 1);
+        values = malloc((size_t)job->column_count * sizeof(char *));
+        if (buf == NULL || values == NULL) {
+            w->failed = 1;
+            free(buf);
+            free(values);
+            return NULL;
+        }
+    }
+
+    for (size_t i = w->first; i < w->last; i++) {
+        struct import_row *row = &job->rows[i];
+
+        row->line = job->records[i].line;
+        row->error_field = -1;
+        row->portion = 100;
+        row->status = 1;
+        if (job->format == IMPORT_CSV) {
+            parse_csv_record(job, &job->records[i], row, buf, values);
+        } else {
+            parse_json_record(job, &job->records[i], row);
+        }
+        if (row->error == error_no_memory) {
+            w->failed = 1;
+        }
+    }
+
+    free(buf);
+    free(values);
+    return NULL;
+}
+
+/**
+ * @brief Appends a record to a growable array.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int push_record(struct record **records, size_t *count, size_t *cap,
+                       const char *start, size_t len, long line) {
+    if (*count == *cap) {
+        size_t grown_cap = *cap > 0 ? *cap * 2 : 1024;
+        struct record *grown = realloc(*records, grown_cap * sizeof(struct record));
+        if (grown == NULL) {
+            return -1;
+        }
+        *records = grown;
+        *cap = grown_cap;
+    }
+    (*records)[*count].start = start;
+    (*records)[*count].len = len;
+    (*records)[*count].line = line;
+    (*count)++;
+    return 0;
+}
+
+/**
+ * @brief Cuts the body into records, skipping blank lines.
+ *
+ * For CSV, newlines inside quoted fields do not end a record. A
+ * trailing carriage return is dropped from each record.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int split_records(const char *data, size_t size, ImportFormat format,
+                         struct record **records, size_t *count) {
+    const char *p = data, *end = data + size;
+    size_t cap = 0;
+    long line = 1;
+
+    *records = NULL;
+    *count = 0;
+
+    /* UTF-8 byte order mark */
+    if (size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+        p += 3;
+    }
+
+    while (p < end) {
+        const char *start = p, *closed = NULL;
+        long start_line = line;
+        int in_quotes = 0;
+
+        for (;;) {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            const char *stop = nl != NULL ? nl : end;
+
+            /*
+             * Only a quote at the start of a field opens a quoted field
+             * (or reopens it, for a doubled quote); a stray quote must
+             * not swallow the rest of the body.
+             */
+            if (format == IMPORT_CSV) {
+                for (const char *q = memchr(p, '"', (size_t)(stop - p)); q != NULL;
+                     q = memchr(q + 1, '"', (size_t)(stop - q - 1))) {
+                    if (in_quotes) {
+                        in_quotes = 0;
+                        closed = q;
+                    } else if (q == start || q[-1] == ',' || q == closed + 1) {
+                        in_quotes = 1;
+                    }
+                }
+            }
+            p = stop;
+            if (nl == NULL || !in_quotes) {
+                break;
+            }
+            p++;
+            line++;
+        }
+
+        const char *stop = p;
+        if (p < end) {
+            p++;
+            line++;
+        }
+        if (stop > start && stop[-1] == '\r') {
+            stop--;
+        }
+
+        /* Blank lines are not records */
+        const char *c = start;
+        while (c < stop && (*c == ' ' || *c == '\t')) {
+            c++;
+        }
+        if (c == stop) {
+            continue;
+        }
+        if (*count > IMPORT_MAX_RECORDS) {
+            return 0;   /* The caller rejects the body */
+        }
+        if (push_record(records, count, &cap, start, (size_t)(stop - start), start_line) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Maps the CSV header to fields.
+ *
+ * @param columns Set to a malloc'ed column -> field map
+ * @param column_count Set to the number of columns
+ * @return 0 on success, -1 if out of memory, -2 if the header is unusable
+ *         (with the reason added to result)
+ */
+static int parse_header(const struct record *header, int **columns, int *column_count,
+                        ImportResult *result) {
+    char *buf = malloc(2 * header->len + 1);
+    const char **values = malloc((header->len + 1) * sizeof(char *));
+    unsigned int seen = 0;
+    int count, rc = 0;
+
+    *columns = NULL;
+    if (buf == NULL || values == NULL) {
+        rc = -1;
+        goto done;
+    }
+
+    count = csv_split(header->start, header->len, buf, values, (int)header->len + 1);
+    if (count < 0) {
+        add_error(result, header->line, "header: malformed quoting");
+        rc = -2;
+        goto done;
+    }
+
+    *columns = malloc((size_t)count * sizeof(int));
+    if (*columns == NULL) {
+        rc = -1;
+        goto done;
+    }
+    for (int c = 0; c < count; c++) {
+        int f = field_lookup(values[c]);
+        if (f >= 0 && (seen & (1u << f)) != 0) {
+            add_error(result, header->line, "header: duplicate column %s", values[c]);
+            rc = -2;
+            goto done;
+        }
+        if (f >= 0) {
+            seen |= 1u << f;
+        }
+        (*columns)[c] = f;
+    }
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (fields[f].required && (seen & (1u << f)) == 0) {
+            add_error(result, header->line, "header: missing column %s", fields[f].name);
+            rc = -2;
+            goto done;
+        }
+    }
+    *column_count = count;
+
+done:
+    if (rc != 0) {
+        free(*columns);
+        *columns = NULL;
+    }
+    free(buf);
+    free(values);
+    return rc;
+}
+
+/**
+ * @brief Loads the ids of all food categories, sorted.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int load_categories(MYSQL *conn, int **ids, size_t *count) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    size_t n = 0;
+
+    if (mysql_query(conn, "SELECT id FROM food_categories ORDER BY id") != 0 ||
+        (result = mysql_store_result(conn)) == NULL) {
+        fprintf(stderr, "Import: failed to load categories: %s\n", mysql_error(conn));
+        return -1;
+    }
+
+    *ids = malloc(((size_t)mysql_num_rows(result) + 1) * sizeof(int));
+    if (*ids == NULL) {
+        mysql_free_result(result);
+        return -1;
+    }
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        (*ids)[n++] = atoi(row[0]);
+    }
+    mysql_free_result(result);
+
+    *count = n;
+    return 0;
+}
+
+/**
+ * @brief Makes room for extra bytes in a SQL buffer.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int sql_reserve(struct sql_buffer *b, size_t extra) {
+    if (b->len + extra + 1 <= b->cap) {
+        return 0;
+    }
+    size_t cap = b->cap > 0 ? b->cap * 2 : 64 * 1024;
+    while (cap < b->len + extra + 1) {
+        cap *= 2;
+    }
+    char *grown = realloc(b->data, cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    b->data = grown;
+    b->cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Appends formatted text to a SQL buffer.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int sql_appendf(struct sql_buffer *b, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || sql_reserve(b, (size_t)n) != 0) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    b->len += (size_t)n;
+    return 0;
+}
+
+/**
+ * @brief Appends a quoted, escaped string (or NULL) to a SQL buffer.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int sql_append_string(MYSQL *conn, struct sql_buffer *b, const char *s) {
+    if (s == NULL) {
+        return sql_appendf(b, "NULL");
+    }
+    size_t len = strlen(s);
+    if (sql_reserve(b, 2 * len + 2) != 0) {
+        return -1;
+    }
+    b->data[b->len++] = '\'';
+    b->len += mysql_real_escape_string(conn, b->data + b->len, s, (unsigned long)len);
+    b->data[b->len++] = '\'';
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Builds and runs one INSERT statement for the given rows.
+ *
+ * Rows with ids are upserted; rows without are inserted and given the
+ * consecutive ids MySQL assigns to a multi-row insert.
+ *
+ * @return 0 on success, -1 if out of memory or documents could not be
+ *         invalidated, or the MySQL error code
+ */
+static int write_statement(struct writer *w, struct import_row **rows, size_t count, int with_id) {
+    struct sql_buffer *b = &w->sql;
+
+    b->len = 0;
+    if (sql_appendf(b, "INSERT INTO food_items (%scategory_id, name, description, "
+                       "default_portion_grams, calories_per_100g, protein_per_100g, "
+                       "carbs_per_100g, fat_per_100g, fiber_per_100g, is_snack_suitable, "
+                       "status) VALUES ", with_id ? "id, " : "") != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct import_row *r = rows[i];
+
+        if ((with_id && sql_appendf(b, "%s(%d, ", i > 0 ? "," : "", r->id) != 0) ||
+            (!with_id && sql_appendf(b, "%s(", i > 0 ? "," : "") != 0) ||
+            sql_appendf(b, "%d, ", r->category_id) != 0 ||
+            sql_append_string(w->conn, b, r->name) != 0 ||
+            sql_appendf(b, ", ") != 0 ||
+            sql_append_string(w->conn, b, r->description) != 0 ||
+            sql_appendf(b, ", %d, %.2f, %.2f, %.2f, %.2f, ", r->portion,
+                        r->calories, r->protein, r->carbs, r->fat) != 0 ||
+            (r->has_fiber ? sql_appendf(b, "%.2f", r->fiber) : sql_appendf(b, "NULL")) != 0 ||
+            sql_appendf(b, ", %d, %d)", r->snack, r->status) != 0) {
+            return -1;
+        }
+    }
+
+    if (with_id &&
+        sql_appendf(b, " ON DUPLICATE KEY UPDATE category_id = VALUES(category_id), "
+                       "name = VALUES(name), description = VALUES(description), "
+                       "default_portion_grams = VALUES(default_portion_grams), "
+                       "calories_per_100g = VALUES(calories_per_100g), "
+                       "protein_per_100g = VALUES(protein_per_100g), "
+                       "carbs_per_100g = VALUES(carbs_per_100g), "
+                       "fat_per_100g = VALUES(fat_per_100g), "
+                       "fiber_per_100g = VALUES(fiber_per_100g), "
+                       "is_snack_suitable = VALUES(is_snack_suitable), "
+                       "status = VALUES(status)") != 0) {
+        return -1;
+    }
+
+    if (mysql_real_query(w->conn, b->data, (unsigned long)b->len) != 0) {
+        return (int)mysql_errno(w->conn);
+    }
+
+    /* Stored template documents show food names */
+    if (with_id && template_document_enabled()) {
+        int ids[IMPORT_BATCH_ROWS];
+
+        for (size_t i = 0; i < count; i++) {
+            ids[i] = rows[i]->id;
+        }
+        if (template_document_invalidate_foods(w->conn, ids, count) != 0) {
+            return -1;
+        }
+    }
+
+    my_ulonglong first = mysql_insert_id(w->conn);
+    for (size_t i = 0; i < count; i++) {
+        if (!with_id) {
+            rows[i]->id = (int)(first + i * w->id_step);
+        }
+        rows[i]->state = ROW_WRITTEN;
+        w->pending[w->pending_count++] = rows[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether a MySQL error ends the transaction (not just the statement).
+ *
+ * A deadlock rolls the whole transaction back; client errors (from
+ * CR_MIN_ERROR on) mean the connection itself failed.
+ */
+static int is_fatal(int error) {
+    return error < 0 || error == ER_LOCK_DEADLOCK || error >= CR_MIN_ERROR;
+}
+
+/**
+ * @brief Writes a batch, falling back to one row per statement on error.
+ *
+ * InnoDB rolls back only the failing statement, so rows written earlier
+ * in the transaction are unaffected by a rejected row.
+ *
+ * @return 0 on success, -1 if the transaction can not continue
+ */
+static int write_batch(struct writer *w, struct import_row **rows, size_t count, int with_id) {
+    int error = write_statement(w, rows, count, with_id);
+
+    if (error == 0) {
+        return 0;
+    }
+    if (is_fatal(error)) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        error = write_statement(w, &rows[i], 1, with_id);
+        if (is_fatal(error)) {
+            return -1;
+        }
+        if (error != 0) {
+            rows[i]->state = ROW_FAILED;
+            w->result->failed++;
+            add_error(w->result, rows[i]->line, "database: %s", mysql_error(w->conn));
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Commits the open transaction.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int commit_pending(struct writer *w) {
+    if (mysql_commit(w->conn) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < w->pending_count; i++) {
+        w->pending[i]->state = ROW_COMMITTED;
+    }
+    w->result->imported += (long)w->pending_count;
+    w->pending_count = 0;
+    return 0;
+}
+
+/**
+ * @brief Writes all valid rows: upserts first, then inserts.
+ *
+ * @return 0 on success, IMPORT_ERROR_DB or IMPORT_ERROR_INTERNAL
+ */
+static int write_rows(MYSQL *conn, struct import_row *rows, size_t count, ImportResult *result) {
+    struct writer w = {conn, {NULL, 0, 0}, NULL, 0, 1, result};
+    struct import_row *batch[IMPORT_BATCH_ROWS];
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    int rc = 0;
+
+    if (mysql_autocommit(conn, 0) != 0) {
+        return IMPORT_ERROR_DB;
+    }
+    if (mysql_query(conn, "SELECT @@auto_increment_increment") == 0 &&
+        (res = mysql_store_result(conn)) != NULL) {
+        if ((row = mysql_fetch_row(res)) != NULL && row[0] != NULL && atol(row[0]) > 0) {
+            w.id_step = (unsigned long)atol(row[0]);
+        }
+        mysql_free_result(res);
+    }
+
+    w.pending = malloc((IMPORT_COMMIT_ROWS + IMPORT_BATCH_ROWS) * sizeof(struct import_row *));
+    if (w.pending == NULL) {
+        return IMPORT_ERROR_INTERNAL;
+    }
+
+    for (int with_id = 1; with_id >= 0 && rc == 0; with_id--) {
+        size_t n = 0;
+
+        for (size_t i = 0; i <= count && rc == 0; i++) {
+            if (i < count && rows[i].state == ROW_VALID && (rows[i].id != 0) == with_id) {
+                batch[n++] = &rows[i];
+            }
+            if (n == 0 || (n < IMPORT_BATCH_ROWS && i < count)) {
+                continue;
+            }
+            if (write_batch(&w, batch, n, with_id) != 0) {
+                rc = IMPORT_ERROR_DB;
+            } else if (w.pending_count >= IMPORT_COMMIT_ROWS && commit_pending(&w) != 0) {
+                rc = IMPORT_ERROR_DB;
+            }
+            n = 0;
+        }
+    }
+    if (rc == 0 && commit_pending(&w) != 0) {
+        rc = IMPORT_ERROR_DB;
+    }
+
+    if (rc != 0) {
+        fprintf(stderr, "Import: transaction failed: %s\n", mysql_error(conn));
+        add_error(result, 0, "database: %s", mysql_error(conn));
+        mysql_rollback(conn);
+        for (size_t i = 0; i < count; i++) {
+            if (rows[i].state == ROW_VALID || rows[i].state == ROW_WRITTEN) {
+                rows[i].state = ROW_FAILED;
+                result->failed++;
+            }
+        }
+    }
+
+    free(w.pending);
+    free(w.sql.data);
+    return rc;
+}
+
+/**
+ * @brief Orders rows by id, then by position in the input.
+ */
+static int compare_row_ids(const void *a, const void *b) {
+    const struct import_row *ra = *(const struct import_row *const *)a;
+    const struct import_row *rb = *(const struct import_row *const *)b;
+    if (ra->id != rb->id) {
+        return (ra->id > rb->id) - (ra->id < rb->id);
+    }
+    return (ra->line > rb->line) - (ra->line < rb->line);
+}
+
+/**
+ * @brief Merges committed rows into the catalog and rebuilds its indexes.
+ *
+ * The new catalog and indexes are built while requests keep reading
+ * the current ones; only the final swap takes the write lock.
+ *
+ * @return 1 if the catalog was updated, 0 if there is no catalog, -1 on failure
+ */
+static int update_catalog(struct import_row *rows, size_t count) {
+    struct import_row **committed;
+    CatalogFood *foods;
+    size_t n = 0, unique = 0;
+    Catalog *cat = NULL;
+    SuggestIndex *suggest = NULL;
+    FuzzyIndex *fuzzy = NULL;
+
+    if (catalog_get() == NULL) {
+        return 0;
+    }
+
+    committed = malloc((count > 0 ? count : 1) * sizeof(struct import_row *));
+    foods = malloc((count > 0 ? count : 1) * sizeof(CatalogFood));
+    if (committed == NULL || foods == NULL) {
+        free(committed);
+        free(foods);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (rows[i].state == ROW_COMMITTED) {
+            committed[n++] = &rows[i];
+        }
+    }
+
+    /* The last record for an id is the one in the database */
+    qsort(committed, n, sizeof(struct import_row *), compare_row_ids);
+    for (size_t i = 0; i < n; i++) {
+        const struct import_row *r = committed[i];
+        if (i + 1 < n && committed[i + 1]->id == r->id) {
+            continue;
+        }
+        foods[unique].id = r->id;
+        foods[unique].category_id = r->category_id;
+        foods[unique].name = r->name;
+        foods[unique].calories = (float)r->calories;
+        foods[unique].protein = (float)r->protein;
+        foods[unique].carbs = (float)r->carbs;
+        foods[unique].fat = (float)r->fat;
+        foods[unique].snack_suitable = (unsigned char)r->snack;
+        foods[unique].default_portion = (unsigned short)r->portion;
+        unique++;
+    }
+
+    cat = catalog_merge(foods, (int)unique);
+    if (cat != NULL) {
+        suggest = suggest_prepare(cat);
+        fuzzy = fuzzy_prepare(cat);
+    }
+    free(foods);
+    free(committed);
+
+    if (cat == NULL || suggest == NULL || fuzzy == NULL) {
+        fuzzy_discard(fuzzy);
+        suggest_discard(suggest);
+        catalog_destroy(cat);
+        return -1;
+    }
+
+    catalog_write_lock();
+    catalog_install(cat);
+    suggest_install(suggest);
+    fuzzy_install(fuzzy);
+    catalog_write_unlock();
+    return 1;
+}
+
+/**
+ * @brief Validates records [0, count) with a few worker threads.
+ *
+ * @return 0 on success, -1 on allocation or thread failure
+ */
+static int validate_records(const struct import_job *job, size_t count, int *threads) {
+    struct worker *workers;
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int started, rc = 0;
+
+    if (thread_count > IMPORT_MAX_THREADS) {
+        thread_count = IMPORT_MAX_THREADS;
+    }
+    if ((size_t)thread_count > count / IMPORT_RECORDS_PER_THREAD) {
+        thread_count = (int)(count / IMPORT_RECORDS_PER_THREAD);
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+
+    workers = calloc((size_t)thread_count, sizeof(struct worker));
+    if (workers == NULL) {
+        return -1;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        workers[t].job = job;
+        workers[t].first = count * (size_t)t / (size_t)thread_count;
+        workers[t].last = count * (size_t)(t + 1) / (size_t)thread_count;
+    }
+
+    /* The calling thread is worker 0, and also takes slices whose thread failed to start */
+    for (started = 1; started < thread_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]) != 0) {
+            break;
+        }
+    }
+    worker_run(&workers[0]);
+    for (int t = started; t < thread_count; t++) {
+        worker_run(&workers[t]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        if (workers[t].failed) {
+            rc = -1;
+        }
+    }
+    *threads = started;
+    free(workers);
+    return rc;
+}
+
+/**
+ * @brief Runs an import with import_mutex held.
+ */
+static int import_locked(const char *data, size_t size, ImportFormat format, int dry_run,
+                         ImportResult *result) {
+    struct import_job job = {format, NULL, NULL, NULL, 0, NULL, 0};
+    struct record *records = NULL;
+    struct import_row *rows = NULL;
+    int *categories = NULL, *columns = NULL;
+    size_t record_count, first = 0, count = 0;
+    MYSQL *conn = NULL;
+    int rc = 0;
+
+    if (split_records(data, size, format, &records, &record_count) != 0) {
+        return IMPORT_ERROR_INTERNAL;
+    }
+    if (record_count > IMPORT_MAX_RECORDS) {
+        add_error(result, 0, "more than %d records", IMPORT_MAX_RECORDS);
+        rc = IMPORT_ERROR_FORMAT;
+        goto done;
+    }
+    if (format == IMPORT_CSV && record_count > 0) {
+        int header = parse_header(&records[0], &columns, &job.column_count, result);
+        if (header != 0) {
+            rc = header == -2 ? IMPORT_ERROR_FORMAT : IMPORT_ERROR_INTERNAL;
+            goto done;
+        }
+        job.columns = columns;
+        first = 1;
+    }
+    count = record_count - first;
+    result->received = (long)count;
+
+    conn = db_connect();
+    if (conn == NULL || load_categories(conn, &categories, &job.category_count) != 0) {
+        rc = IMPORT_ERROR_DB;
+        goto done;
+    }
+    job.categories = categories;
+
+    rows = calloc(count > 0 ? count : 1, sizeof(struct import_row));
+    if (rows == NULL) {
+        rc = IMPORT_ERROR_INTERNAL;
+        goto done;
+    }
+    job.records = records + first;
+    job.rows = rows;
+    if (validate_records(&job, count, &result->threads) != 0) {
+        rc = IMPORT_ERROR_INTERNAL;
+        goto done;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (rows[i].state == ROW_INVALID) {
+            result->failed++;
+            if (rows[i].error_field >= 0) {
+                add_error(result, rows[i].line, "%s %s",
+                          fields[rows[i].error_field].name, rows[i].error);
+            } else {
+                add_error(result, rows[i].line, "record %s", rows[i].error);
+            }
+        }
+    }
+
+    if (dry_run) {
+        result->imported = (long)count - result->failed;
+        goto done;
+    }
+
+    rc = write_rows(conn, rows, count, result);
+    if (result->imported > 0) {
+        int updated = update_catalog(rows, count);
+        if (updated < 0) {
+            fprintf(stderr, "Import: failed to refresh the in-memory catalog\n");
+        }
+        result->catalog_updated = updated > 0;
+        /* Snapshots show food names; reloaded on their next read */
+        template_cache_invalidate();
+        /* Any template may use the foods: recompute every profile */
+        if (template_index_load() != 0) {
+            fprintf(stderr, "Import: failed to refresh template profiles\n");
+        }
+    }
+
+done:
+    if (conn != NULL) {
+        mysql_close(conn);
+    }
+    if (rows != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            free(rows[i].name);
+            free(rows[i].description);
+        }
+    }
+    free(rows);
+    free(categories);
+    free(columns);
+    free(records);
+    return rc;
+}
+
+int food_import_run(const char *data, size_t size, ImportFormat format, int dry_run,
+                    ImportResult *result) {
+    int rc;
+
+    memset(result, 0, sizeof(*result));
+    if (pthread_mutex_trylock(&import_mutex) != 0) {
+        return IMPORT_ERROR_BUSY;
+    }
+    rc = import_locked(data, size, format, dry_run, result);
+    pthread_mutex_unlock(&import_mutex);
+
+    if (rc == 0) {
+        printf("Imported foods: %ld of %ld records (%ld failed)%s\n",
+               result->imported, result->received, result->failed, dry_run ? ", dry run" : "");
+    }
+    return rc;
+}
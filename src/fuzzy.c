@@ -0,0 +1,917 @@
+/**
+ * @file fuzzy.c
+ * @brief Vocabulary trigram filter plus Myers bit-parallel verification.
+ *
+ * Food names share a small vocabulary, so typo tolerance is resolved
+ * against distinct words rather than against every food:
+ *
+ *   - Vocabulary: every distinct word of every normalized name. Each word
+ *     has a posting list of the foods containing it, pre-sorted in result
+ *     order (popularity descending, then name).
+ *   - Trigram index: every distinct trigram of a word is hashed into a
+ *     bucket listing the words that contain it (CSR layout).
+ *
+ * A query word matches a vocabulary word when it is within k edits of a
+ * substring of it. Candidates must share at least T - 3k of the query's
+ * T distinct trigrams (one edit touches at most three trigram positions)
+ * and are verified with Myers' algorithm, which handles patterns of up
+ * to 64 bytes in one machine word per text byte.
+ *
+ * Foods are then produced by merging the posting lists of the most
+ * selective query word's matches in result order; any other query words
+ * are verified against each food name. Because the merge yields foods
+ * best-first, the walk stops as soon as no remaining food can enter the
+ * requested top results.
+ *
+ * Per-query buffers live in thread-local scratch space so concurrent
+ * requests never allocate or clear catalog-sized arrays.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fuzzy.h"
+#include "text_fold.h"
+
+/** @brief log2 of the number of trigram hash buckets */
+#define TRIGRAM_BITS 18
+#define TRIGRAM_BUCKETS (1u << TRIGRAM_BITS)
+
+/** @brief Longest pattern verified in one 64-bit word */
+#define MAX_PATTERN 64
+
+/** @brief Maximum number of words considered in a query */
+#define MAX_QUERY_WORDS 8
+
+/** @brief Word-level inverted index */
+struct fuzzy_index {
+    const Catalog *cat;     /**< Catalog the index was built from */
+    int food_count;
+    uint32_t word_count;
+    char *word_pool;        /**< NUL-terminated words, back to back */
+    uint32_t *word_off;     /**< Offset of each word in word_pool */
+    uint32_t *post_off;     /**< word_count + 1 offsets into postings */
+    uint32_t *postings;     /**< Food indices, best-ranked first per word */
+    uint32_t *tri_off;      /**< TRIGRAM_BUCKETS + 1 offsets into tri_words */
+    uint32_t *tri_words;    /**< Word ids grouped by trigram bucket */
+    uint32_t *short_words;  /**< Words shorter than three bytes */
+    uint32_t short_count;
+};
+
+/** @brief A vocabulary word matching a query word */
+struct word_hit {
+    uint32_t word;
+    int distance;
+};
+
+/** @brief Per-thread buffers reused across queries */
+struct fuzzy_scratch {
+    uint32_t word_capacity;
+    uint8_t *word_counts;   /**< Shared-trigram count per word (kept zeroed) */
+    uint32_t *word_touched;
+    int food_capacity;
+    uint8_t *seen;          /**< Food bitmap for de-duplication (kept zeroed) */
+    uint32_t *seen_list;
+    size_t seen_cap;
+    struct word_hit *hits;
+    size_t hits_cap;
+    uint64_t *keys;
+    size_t keys_cap;
+};
+
+/** @brief Currently built index (NULL until fuzzy_build succeeds) */
+static struct fuzzy_index *index_root = NULL;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Hashes three bytes into a bucket number.
+ */
+static inline uint32_t trigram_bucket(const unsigned char *p) {
+    uint32_t key = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (key * 2654435761u) >> (32 - TRIGRAM_BITS);
+}
+
+/**
+ * @brief FNV-1a hash of a word.
+ */
+static uint32_t word_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Packs a food into a key that sorts best-first.
+ *
+ * Layout: distance (8 bits) | inverted popularity (24 bits) | index (32 bits).
+ */
+static uint64_t rank_key(const Catalog *cat, uint32_t index, int distance) {
+    uint32_t pop = cat->popularity[index];
+    if (pop > 0xFFFFFF) {
+        pop = 0xFFFFFF;
+    }
+    return ((uint64_t)distance << 56) | ((uint64_t)(0xFFFFFF - pop) << 32) | index;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t ka = *(const uint64_t *)a;
+    uint64_t kb = *(const uint64_t *)b;
+    return (ka > kb) - (ka < kb);
+}
+
+/**
+ * @brief Ensures a growable buffer can hold at least needed elements.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reserve(void **arr, size_t *cap, size_t needed, size_t elem_size) {
+    if (needed <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 256;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *tmp = realloc(*arr, new_cap * elem_size);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *arr = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+static void scratch_free(void *ptr) {
+    struct fuzzy_scratch *s = ptr;
+    if (s == NULL) {
+        return;
+    }
+    free(s->word_counts);
+    free(s->word_touched);
+    free(s->seen);
+    free(s->seen_list);
+    free(s->hits);
+    free(s->keys);
+    free(s);
+}
+
+static void scratch_key_create(void) {
+    pthread_key_create(&scratch_key, scratch_free);
+}
+
+/**
+ * @brief Returns this thread's scratch buffers sized for an index.
+ *
+ * @return Scratch pointer, or NULL on allocation failure
+ */
+static struct fuzzy_scratch *scratch_get(const struct fuzzy_index *idx) {
+    struct fuzzy_scratch *s;
+
+    pthread_once(&scratch_once, scratch_key_create);
+    s = pthread_getspecific(scratch_key);
+    if (s == NULL) {
+        s = calloc(1, sizeof(struct fuzzy_scratch));
+        if (s == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(scratch_key, s);
+    }
+
+    if (s->word_capacity < idx->word_count) {
+        free(s->word_counts);
+        free(s->word_touched);
+        s->word_counts = calloc(idx->word_count, sizeof(uint8_t));
+        s->word_touched = malloc(idx->word_count * sizeof(uint32_t));
+        s->word_capacity = idx->word_count;
+        if (s->word_counts == NULL || s->word_touched == NULL) {
+            s->word_capacity = 0;
+            return NULL;
+        }
+    }
+
+    if (s->food_capacity < idx->food_count) {
+        free(s->seen);
+        s->seen = calloc((size_t)idx->food_count / 8 + 1, 1);
+        s->food_capacity = idx->food_count;
+        if (s->seen == NULL) {
+            s->food_capacity = 0;
+            return NULL;
+        }
+    }
+    return s;
+}
+
+/**
+ * @brief Marks a food as seen.
+ *
+ * @return 1 if the food was already seen, 0 if newly marked, -1 on failure
+ */
+static int scratch_mark_seen(struct fuzzy_scratch *s, size_t *seen_count, uint32_t food) {
+    uint8_t bit = (uint8_t)(1u << (food & 7));
+    if (s->seen[food >> 3] & bit) {
+        return 1;
+    }
+    if (reserve((void **)&s->seen_list, &s->seen_cap, *seen_count + 1, sizeof(uint32_t)) != 0) {
+        return -1;
+    }
+    s->seen[food >> 3] |= bit;
+    s->seen_list[(*seen_count)++] = food;
+    return 0;
+}
+
+static void scratch_clear_seen(struct fuzzy_scratch *s, size_t seen_count) {
+    for (size_t i = 0; i < seen_count; i++) {
+        s->seen[s->seen_list[i] >> 3] = 0;
+    }
+}
+
+static void index_free(struct fuzzy_index *idx) {
+    if (idx == NULL) {
+        return;
+    }
+    free(idx->word_pool);
+    free(idx->word_off);
+    free(idx->post_off);
+    free(idx->postings);
+    free(idx->tri_off);
+    free(idx->tri_words);
+    free(idx->short_words);
+    free(idx);
+}
+
+/**
+ * @brief Builds vocabulary and word posting lists.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int build_vocabulary(struct fuzzy_index *idx, const Catalog *cat) {
+    uint32_t *table = NULL, *pair_word = NULL, *pair_food = NULL;
+    uint64_t *sort_keys = NULL;
+    size_t table_cap = 1024, pool_cap = 0, pool_used = 0, off_cap = 0;
+    size_t pair_cap = 0, pair_count = 0;
+    int rc = -1;
+
+    table = malloc(table_cap * sizeof(uint32_t));
+    if (table == NULL) {
+        return -1;
+    }
+    memset(table, 0xff, table_cap * sizeof(uint32_t));
+
+    for (int i = 0; i < cat->count; i++) {
+        const char *s = cat->norm_names[i];
+        size_t pair_start = pair_count;
+
+        while (*s != '\0') {
+            size_t len = strcspn(s, " ");
+            uint32_t h = word_hash(s, len);
+            size_t slot = h & (table_cap - 1);
+            uint32_t w;
+
+            /* Open-addressing lookup */
+            while ((w = table[slot]) != UINT32_MAX) {
+                const char *word = idx->word_pool + idx->word_off[w];
+                if (strncmp(word, s, len) == 0 && word[len] == '\0') {
+                    break;
+                }
+                slot = (slot + 1) & (table_cap - 1);
+            }
+
+            if (w == UINT32_MAX) {
+                w = idx->word_count;
+                if (reserve((void **)&idx->word_pool, &pool_cap, pool_used + len + 1, 1) != 0 ||
+                    reserve((void **)&idx->word_off, &off_cap, (size_t)w + 1, sizeof(uint32_t)) != 0) {
+                    goto done;
+                }
+                memcpy(idx->word_pool + pool_used, s, len);
+                idx->word_pool[pool_used + len] = '\0';
+                idx->word_off[w] = (uint32_t)pool_used;
+                pool_used += len + 1;
+                table[slot] = w;
+                idx->word_count++;
+
+                /* Keep the table at most half full */
+                if ((size_t)idx->word_count * 2 > table_cap) {
+                    size_t new_cap = table_cap * 2;
+                    uint32_t *grown = malloc(new_cap * sizeof(uint32_t));
+                    if (grown == NULL) {
+                        goto done;
+                    }
+                    memset(grown, 0xff, new_cap * sizeof(uint32_t));
+                    for (uint32_t v = 0; v < idx->word_count; v++) {
+                        const char *word = idx->word_pool + idx->word_off[v];
+                        size_t pos = word_hash(word, strlen(word)) & (new_cap - 1);
+                        while (grown[pos] != UINT32_MAX) {
+                            pos = (pos + 1) & (new_cap - 1);
+                        }
+                        grown[pos] = v;
+                    }
+                    free(table);
+                    table = grown;
+                    table_cap = new_cap;
+                }
+            }
+
+            /* Record (word, food) once per food */
+            int dup = 0;
+            for (size_t p = pair_start; p < pair_count; p++) {
+                if (pair_word[p] == w) {
+                    dup = 1;
+                    break;
+                }
+            }
+            if (!dup) {
+                size_t cap_before = pair_cap;
+                if (reserve((void **)&pair_word, &pair_cap, pair_count + 1, sizeof(uint32_t)) != 0) {
+                    goto done;
+                }
+                if (pair_cap != cap_before) {
+                    uint32_t *tmp = realloc(pair_food, pair_cap * sizeof(uint32_t));
+                    if (tmp == NULL) {
+                        goto done;
+                    }
+                    pair_food = tmp;
+                }
+                pair_word[pair_count] = w;
+                pair_food[pair_count] = (uint32_t)i;
+                pair_count++;
+            }
+
+            s += len;
+            while (*s == ' ') {
+                s++;
+            }
+        }
+    }
+
+    /* Posting lists: counting sort by word, then rank order within each */
+    idx->post_off = calloc((size_t)idx->word_count + 1, sizeof(uint32_t));
+    idx->postings = malloc((pair_count > 0 ? pair_count : 1) * sizeof(uint32_t));
+    sort_keys = malloc((pair_count > 0 ? pair_count : 1) * sizeof(uint64_t));
+    if (idx->post_off == NULL || idx->postings == NULL || sort_keys == NULL) {
+        goto done;
+    }
+
+    for (size_t p = 0; p < pair_count; p++) {
+        idx->post_off[pair_word[p] + 1]++;
+    }
+    for (uint32_t w = 0; w < idx->word_count; w++) {
+        idx->post_off[w + 1] += idx->post_off[w];
+    }
+    for (size_t p = 0; p < pair_count; p++) {
+        /* Reuse post_off as a fill cursor; restored below */
+        sort_keys[idx->post_off[pair_word[p]]++] = rank_key(cat, pair_food[p], 0);
+    }
+    for (uint32_t w = idx->word_count; w > 0; w--) {
+        idx->post_off[w] = idx->post_off[w - 1];
+    }
+    idx->post_off[0] = 0;
+
+    for (uint32_t w = 0; w < idx->word_count; w++) {
+        uint32_t start = idx->post_off[w];
+        uint32_t end = idx->post_off[w + 1];
+        qsort(sort_keys + start, end - start, sizeof(uint64_t), compare_keys);
+        for (uint32_t p = start; p < end; p++) {
+            idx->postings[p] = (uint32_t)(sort_keys[p] & 0xFFFFFFFFu);
+        }
+    }
+
+    rc = 0;
+
+done:
+    free(sort_keys);
+    free(pair_word);
+    free(pair_food);
+    free(table);
+    return rc;
+}
+
+/**
+ * @brief Builds the trigram -> word index over the vocabulary.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int build_trigrams(struct fuzzy_index *idx) {
+    uint32_t *last_word, *cursor;
+    size_t total = 0, short_cap = 0;
+
+    idx->tri_off = calloc(TRIGRAM_BUCKETS + 1, sizeof(uint32_t));
+    last_word = malloc(TRIGRAM_BUCKETS * sizeof(uint32_t));
+    cursor = malloc(TRIGRAM_BUCKETS * sizeof(uint32_t));
+    if (idx->tri_off == NULL || last_word == NULL || cursor == NULL) {
+        free(last_word);
+        free(cursor);
+        return -1;
+    }
+
+    /* Pass 1: count distinct (bucket, word) pairs */
+    memset(last_word, 0xff, TRIGRAM_BUCKETS * sizeof(uint32_t));
+    for (uint32_t w = 0; w < idx->word_count; w++) {
+        const unsigned char *s = (const unsigned char *)idx->word_pool + idx->word_off[w];
+        size_t len = strlen((const char *)s);
+
+        if (len < 3) {
+            if (reserve((void **)&idx->short_words, &short_cap, idx->short_count + 1,
+                        sizeof(uint32_t)) != 0) {
+                free(last_word);
+                free(cursor);
+                return -1;
+            }
+            idx->short_words[idx->short_count++] = w;
+            continue;
+        }
+        for (size_t p = 0; p + 3 <= len; p++) {
+            uint32_t b = trigram_bucket(s + p);
+            if (last_word[b] != w) {
+                last_word[b] = w;
+                idx->tri_off[b + 1]++;
+                total++;
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < TRIGRAM_BUCKETS; b++) {
+        idx->tri_off[b + 1] += idx->tri_off[b];
+    }
+
+    idx->tri_words = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+    if (idx->tri_words == NULL) {
+        free(last_word);
+        free(cursor);
+        return -1;
+    }
+
+    /* Pass 2: fill */
+    memset(last_word, 0xff, TRIGRAM_BUCKETS * sizeof(uint32_t));
+    memcpy(cursor, idx->tri_off, TRIGRAM_BUCKETS * sizeof(uint32_t));
+    for (uint32_t w = 0; w < idx->word_count; w++) {
+        const unsigned char *s = (const unsigned char *)idx->word_pool + idx->word_off[w];
+        size_t len = strlen((const char *)s);
+        for (size_t p = 0; p + 3 <= len; p++) {
+            uint32_t b = trigram_bucket(s + p);
+            if (last_word[b] != w) {
+                last_word[b] = w;
+                idx->tri_words[cursor[b]++] = w;
+            }
+        }
+    }
+
+    free(last_word);
+    free(cursor);
+    return 0;
+}
+
+FuzzyIndex *fuzzy_prepare(const Catalog *cat) {
+    struct fuzzy_index *idx;
+
+    if (cat == NULL) {
+        return NULL;
+    }
+
+    idx = calloc(1, sizeof(struct fuzzy_index));
+    if (idx == NULL) {
+        return NULL;
+    }
+    idx->cat = cat;
+    idx->food_count = cat->count;
+
+    if (build_vocabulary(idx, cat) != 0 || build_trigrams(idx) != 0) {
+        index_free(idx);
+        return NULL;
+    }
+
+    printf("Built fuzzy index: %u words, %u postings\n",
+           idx->word_count, idx->post_off[idx->word_count]);
+    return idx;
+}
+
+void fuzzy_install(FuzzyIndex *idx) {
+    index_free(index_root);
+    index_root = idx;
+}
+
+void fuzzy_discard(FuzzyIndex *idx) {
+    index_free(idx);
+}
+
+int fuzzy_build(const Catalog *cat) {
+    FuzzyIndex *idx = fuzzy_prepare(cat);
+    if (idx == NULL) {
+        return -1;
+    }
+    fuzzy_install(idx);
+    return 0;
+}
+
+/**
+ * @brief Best edit distance between the pattern and any substring of text.
+ *
+ * Myers (1999) bit-vector algorithm, search variant (free start and end
+ * in the text). Stops early on an exact hit.
+ *
+ * @param peq Per-byte match masks of the pattern
+ * @param m Pattern length (1..64)
+ * @param text Text to search
+ * @return Minimal edit distance
+ */
+static int myers_distance(const uint64_t *peq, int m, const unsigned char *text) {
+    uint64_t pv = ~0ULL;
+    uint64_t mv = 0;
+    uint64_t high = 1ULL << (m - 1);
+    int score = m;
+    int best = m;
+
+    for (; *text != '\0'; text++) {
+        uint64_t eq = peq[*text];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & high) {
+            score++;
+        } else if (mh & high) {
+            score--;
+        }
+
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        if (score < best) {
+            best = score;
+            if (best == 0) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/** @brief One normalized query word with its precomputed masks */
+struct query_word {
+    const char *text;
+    int len;
+    int max_edits;
+    uint64_t peq[256];
+    size_t hits_start;      /**< Range of this word's hits in scratch->hits */
+    size_t hits_end;
+    size_t postings;        /**< Total postings over all hits */
+};
+
+/**
+ * @brief Finds vocabulary words matching one query word.
+ *
+ * Appends (word, distance) hits to scratch->hits.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int match_vocabulary(const struct fuzzy_index *idx, struct fuzzy_scratch *s,
+                            struct query_word *qw, size_t *hit_count) {
+    uint32_t buckets[MAX_PATTERN];
+    int bucket_count = 0, threshold;
+    size_t touched = 0;
+
+    qw->hits_start = *hit_count;
+    qw->postings = 0;
+
+    /* Short words never have trigrams; always verify them directly */
+    for (uint32_t i = 0; i < idx->short_count; i++) {
+        s->word_touched[touched++] = idx->short_words[i];
+    }
+
+    if (qw->len < 3) {
+        /* Too short for trigrams: scan the whole vocabulary */
+        touched = 0;
+        for (uint32_t w = 0; w < idx->word_count; w++) {
+            s->word_touched[touched++] = w;
+        }
+        threshold = 0;
+    } else {
+        for (int p = 0; p + 3 <= qw->len; p++) {
+            uint32_t b = trigram_bucket((const unsigned char *)qw->text + p);
+            int seen = 0;
+            for (int j = 0; j < bucket_count; j++) {
+                if (buckets[j] == b) {
+                    seen = 1;
+                    break;
+                }
+            }
+            if (!seen) {
+                buckets[bucket_count++] = b;
+            }
+        }
+
+        threshold = bucket_count - 3 * qw->max_edits;
+        if (threshold < 1) {
+            threshold = 1;
+        }
+
+        for (int j = 0; j < bucket_count; j++) {
+            for (uint32_t p = idx->tri_off[buckets[j]]; p < idx->tri_off[buckets[j] + 1]; p++) {
+                uint32_t w = idx->tri_words[p];
+                if (s->word_counts[w]++ == 0) {
+                    s->word_touched[touched++] = w;
+                }
+            }
+        }
+    }
+
+    for (size_t t = 0; t < touched; t++) {
+        uint32_t w = s->word_touched[t];
+        int shared = s->word_counts[w];
+        s->word_counts[w] = 0;
+
+        /* Short vocabulary words are exempt from the trigram threshold */
+        if (shared < threshold && strlen(idx->word_pool + idx->word_off[w]) >= 3) {
+            continue;
+        }
+
+        int distance = myers_distance(qw->peq, qw->len,
+                                      (const unsigned char *)idx->word_pool + idx->word_off[w]);
+        if (distance > qw->max_edits) {
+            continue;
+        }
+        if (reserve((void **)&s->hits, &s->hits_cap, *hit_count + 1, sizeof(struct word_hit)) != 0) {
+            for (size_t r = t + 1; r < touched; r++) {
+                s->word_counts[s->word_touched[r]] = 0;
+            }
+            return -1;
+        }
+        s->hits[*hit_count].word = w;
+        s->hits[*hit_count].distance = distance;
+        (*hit_count)++;
+        qw->postings += idx->post_off[w + 1] - idx->post_off[w];
+    }
+
+    qw->hits_end = *hit_count;
+    return 0;
+}
+
+/** @brief Position in one vocabulary word's posting list */
+struct merge_cursor {
+    uint64_t key;
+    uint32_t pos;
+    uint32_t end;
+};
+
+/**
+ * @brief Iterates the foods of a query word's hits in result order.
+ *
+ * Hits are consumed one distance at a time; within a distance, posting
+ * lists (already in popularity order) are merged with a binary min-heap
+ * keyed by rank_key(), so callers can stop after the first few foods.
+ */
+struct posting_merge {
+    const struct fuzzy_index *idx;
+    const Catalog *cat;
+    const struct fuzzy_scratch *s;
+    const struct query_word *qw;
+    struct merge_cursor *heap;
+    size_t heap_size;
+    int distance;           /**< Distance group currently being merged */
+};
+
+static void merge_sift_down(struct merge_cursor *heap, size_t heap_size, struct merge_cursor c) {
+    size_t i = 0;
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        uint64_t mk = c.key;
+        if (l < heap_size && heap[l].key < mk) {
+            m = l;
+            mk = heap[l].key;
+        }
+        if (r < heap_size && heap[r].key < mk) {
+            m = r;
+        }
+        if (m == i) {
+            break;
+        }
+        heap[i] = heap[m];
+        i = m;
+    }
+    heap[i] = c;
+}
+
+/**
+ * @brief Loads the cursors of the next non-empty distance group.
+ *
+ * @return 1 if a group was loaded, 0 when all groups are exhausted
+ */
+static int merge_refill(struct posting_merge *m) {
+    const struct fuzzy_index *idx = m->idx;
+
+    while (m->heap_size == 0 && ++m->distance <= m->qw->max_edits) {
+        for (size_t h = m->qw->hits_start; h < m->qw->hits_end; h++) {
+            uint32_t w = m->s->hits[h].word;
+            if (m->s->hits[h].distance != m->distance || idx->post_off[w] == idx->post_off[w + 1]) {
+                continue;
+            }
+            struct merge_cursor c = {
+                rank_key(m->cat, idx->postings[idx->post_off[w]], m->distance),
+                idx->post_off[w], idx->post_off[w + 1]
+            };
+            /* Sift up */
+            size_t i = m->heap_size++;
+            while (i > 0 && m->heap[(i - 1) / 2].key > c.key) {
+                m->heap[i] = m->heap[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+            m->heap[i] = c;
+        }
+    }
+    return m->heap_size > 0;
+}
+
+/**
+ * @brief Yields the next food in result order.
+ *
+ * @return 1 if a food was produced, 0 when exhausted
+ */
+static int merge_next(struct posting_merge *m, uint32_t *food, int *distance) {
+    if (m->heap_size == 0 && !merge_refill(m)) {
+        return 0;
+    }
+
+    *food = m->idx->postings[m->heap[0].pos];
+    *distance = m->distance;
+
+    if (++m->heap[0].pos < m->heap[0].end) {
+        struct merge_cursor c = m->heap[0];
+        c.key = rank_key(m->cat, m->idx->postings[c.pos], m->distance);
+        merge_sift_down(m->heap, m->heap_size, c);
+    } else if (--m->heap_size > 0) {
+        merge_sift_down(m->heap, m->heap_size, m->heap[m->heap_size]);
+    }
+    return 1;
+}
+
+/**
+ * @brief Ranks foods for a query.
+ *
+ * Walks the foods of the most selective query word in result order and
+ * scores the other words against each food name. The walk stops once
+ * max_results foods are held and none of the remaining ones can rank
+ * better (their total distance is at least the driver's distance).
+ */
+static int collect_matches(const struct fuzzy_index *idx, const Catalog *cat,
+                           struct fuzzy_scratch *s, const struct query_word *words,
+                           int word_count, int driver, int category_id,
+                           FuzzyMatch *out, int max_results) {
+    struct posting_merge merge;
+    size_t hit_total = words[driver].hits_end - words[driver].hits_start;
+    size_t seen_count = 0, held = 0;
+    uint32_t food;
+    int distance, rc = 0;
+
+    memset(&merge, 0, sizeof(merge));
+    merge.idx = idx;
+    merge.cat = cat;
+    merge.s = s;
+    merge.qw = &words[driver];
+    merge.distance = -1;
+    merge.heap = malloc((hit_total > 0 ? hit_total : 1) * sizeof(struct merge_cursor));
+    if (merge.heap == NULL ||
+        reserve((void **)&s->keys, &s->keys_cap, (size_t)max_results, sizeof(uint64_t)) != 0) {
+        free(merge.heap);
+        return -1;
+    }
+
+    while (merge_next(&merge, &food, &distance)) {
+        /* s->keys[0..held) is a max-heap of the best keys so far */
+        if (held == (size_t)max_results && s->keys[0] <= rank_key(cat, food, distance)) {
+            break;
+        }
+
+        int already = scratch_mark_seen(s, &seen_count, food);
+        if (already < 0) {
+            rc = -1;
+            break;
+        }
+        if (already > 0 || (category_id > 0 && cat->category_ids[food] != category_id)) {
+            continue;
+        }
+
+        int total = distance;
+        for (int q = 0; q < word_count && total >= 0; q++) {
+            if (q == driver) {
+                continue;
+            }
+            int d = myers_distance(words[q].peq, words[q].len,
+                                   (const unsigned char *)cat->norm_names[food]);
+            total = (d > words[q].max_edits) ? -1 : total + d;
+        }
+        if (total < 0) {
+            continue;
+        }
+
+        uint64_t key = rank_key(cat, food, total);
+        size_t i;
+        if (held < (size_t)max_results) {
+            /* Sift up */
+            i = held++;
+            while (i > 0 && s->keys[(i - 1) / 2] < key) {
+                s->keys[i] = s->keys[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+            s->keys[i] = key;
+        } else if (key < s->keys[0]) {
+            /* Replace the worst and sift down */
+            i = 0;
+            for (;;) {
+                size_t l = 2 * i + 1, r = l + 1, m = i;
+                uint64_t mk = key;
+                if (l < held && s->keys[l] > mk) {
+                    m = l;
+                    mk = s->keys[l];
+                }
+                if (r < held && s->keys[r] > mk) {
+                    m = r;
+                }
+                if (m == i) {
+                    break;
+                }
+                s->keys[i] = s->keys[m];
+                i = m;
+            }
+            s->keys[i] = key;
+        }
+    }
+
+    scratch_clear_seen(s, seen_count);
+    free(merge.heap);
+
+    qsort(s->keys, held, sizeof(uint64_t), compare_keys);
+    for (size_t i = 0; i < held; i++) {
+        out[i].index = (int)(s->keys[i] & 0xFFFFFFFFu);
+        out[i].distance = (int)(s->keys[i] >> 56);
+    }
+    return (rc < 0 && held == 0) ? -1 : (int)held;
+}
+
+int fuzzy_search(const char *query, int category_id, FuzzyMatch *out, int max_results) {
+    const struct fuzzy_index *idx = index_root;
+    const Catalog *cat;
+    struct fuzzy_scratch *scratch;
+    struct query_word words[MAX_QUERY_WORDS];
+    char q[256];
+    size_t hit_count = 0;
+    int word_count = 0, driver = 0;
+
+    if (idx == NULL) {
+        return -1;
+    }
+    cat = idx->cat;
+    if (text_fold(query, q, sizeof(q)) == 0 || max_results <= 0) {
+        return 0;
+    }
+
+    scratch = scratch_get(idx);
+    if (scratch == NULL) {
+        return -1;
+    }
+
+    /* Split into words; allowed typos grow with word length */
+    for (char *p = q; *p != '\0' && word_count < MAX_QUERY_WORDS;) {
+        struct query_word *qw = &words[word_count];
+        size_t len = strcspn(p, " ");
+
+        qw->text = p;
+        qw->len = (int)(len > MAX_PATTERN ? MAX_PATTERN : len);
+        qw->max_edits = (qw->len <= 3) ? 0 : (qw->len <= 5) ? 1 : (qw->len <= 9) ? 2 : 3;
+        memset(qw->peq, 0, sizeof(qw->peq));
+        for (int i = 0; i < qw->len; i++) {
+            qw->peq[(unsigned char)p[i]] |= 1ULL << i;
+        }
+
+        p += len;
+        if (*p == ' ') {
+            *p++ = '\0';
+        }
+
+        if (match_vocabulary(idx, scratch, qw, &hit_count) != 0) {
+            return -1;
+        }
+        if (qw->hits_start == qw->hits_end) {
+            return 0;
+        }
+        if (qw->postings < words[driver].postings) {
+            driver = word_count;
+        }
+        word_count++;
+    }
+
+    return collect_matches(idx, cat, scratch, words, word_count, driver,
+                           category_id, out, max_results);
+}
+
+void fuzzy_cleanup(void) {
+    index_free(index_root);
+    index_root = NULL;
+}
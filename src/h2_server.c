@@ -0,0 +1,1728 @@
+/**
+ * @file h2_server.c
+ * @brief HTTP/2 listener built on nghttp2.
+ *
+ * Threads and ownership:
+ * - the connection thread owns the socket, the TLS state and the nghttp2
+ *   session, and is the only thread that frees streams;
+ * - handler threads run routes_dispatch() for complete requests and hand
+ *   the stream back through the connection's done list and eventfd;
+ * - a producer thread per streamed response fills the stream's chunk
+ *   queue, blocking while H2_STREAM_QUEUE_CHUNKS are waiting.
+ * Everything shared between them is guarded by the connection's lock.
+ * HPACK and flow control are nghttp2's: the session only asks for body
+ * data while the peer's window is open.
+ *
+ * File-backed bodies skip user space where the socket allows it (h2c,
+ * or TLS with kTLS): DATA frames are queued as a header in the output
+ * buffer plus a file segment that is written with sendfile.
+ */
+
+#define _GNU_SOURCE
+
+#include "h2_server.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <nghttp2/nghttp2.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "http_helpers.h"
+#include "placement.h"
+#include "routes.h"
+#include "tls.h"
+
+/** @brief Maximum request headers kept per stream (extra ones are ignored) */
+#define H2_MAX_HEADERS 64
+
+/** @brief Maximum query arguments kept per stream */
+#define H2_MAX_ARGS 32
+
+/** @brief Maximum response headers per stream */
+#define H2_MAX_RESPONSE_HEADERS 16
+
+/** @brief SETTINGS_MAX_HEADER_LIST_SIZE advertised to clients */
+#define H2_MAX_HEADER_LIST_SIZE (16 * 1024)
+
+/** @brief Encoded frames buffered before writing to the socket */
+#define H2_OUTPUT_BUFFER (64 * 1024)
+
+/** @brief Bytes read from the socket at a time */
+#define H2_READ_BUFFER (16 * 1024)
+
+/** @brief Seconds allowed for the TLS handshake */
+#define H2_HANDSHAKE_TIMEOUT 10
+
+/** @brief Milliseconds open streams get to finish after shutdown starts */
+#define H2_SHUTDOWN_GRACE_MS 5000
+
+struct h2_conn;
+
+/**
+ * @brief A file-backed response body, shared with queued segments.
+ *
+ * Only the connection thread touches refs once the stream is handed back.
+ */
+struct h2_file {
+    int fd;     /**< Open file */
+    int refs;   /**< Stream plus queued segments */
+};
+
+/**
+ * @brief File bytes to write after the output buffer reaches a position.
+ */
+struct h2_segment {
+    size_t at;              /**< Offset in the output buffer it follows */
+    struct h2_file *file;   /**< File (holds a reference) */
+    off_t offset;           /**< Next byte to send */
+    size_t len;             /**< Bytes left */
+};
+
+/**
+ * @brief A piece of a streamed response body.
+ */
+struct h2_chunk {
+    struct h2_chunk *next;  /**< Next chunk in the queue */
+    size_t len;             /**< Bytes in data */
+    size_t pos;             /**< Bytes already handed to the session */
+    char data[];            /**< Body bytes */
+};
+
+/**
+ * @brief A request/response exchange.
+ *
+ * Request fields are written by the connection thread before dispatch;
+ * response fields by the handler thread before the stream is handed back.
+ */
+struct h2_stream {
+    struct h2_conn *conn;           /**< Owning connection */
+    int32_t id;                     /**< Stream id */
+    struct h2_stream *prev;         /**< Previous stream of the connection */
+    struct h2_stream *next;         /**< Next stream of the connection */
+    struct h2_stream *job_next;     /**< Next in the handler queue or done list */
+
+    int closed;                     /**< Closed by the session (lock) */
+    int in_pool;                    /**< Queued, being handled or on the done list */
+    int rejected;                   /**< Answered before the request was complete */
+
+    char method[16];                /**< :method */
+    char *path;                     /**< Decoded :path, query stripped (args point into it) */
+    int header_count;               /**< Entries in headers */
+    const char *headers[H2_MAX_HEADERS][2]; /**< Request headers (one allocation each) */
+    int arg_count;                  /**< Entries in args */
+    const char *args[H2_MAX_ARGS][2];       /**< Decoded query arguments */
+    char *body;                     /**< Request body, NUL-terminated */
+    size_t body_len;                /**< Bytes in body */
+    size_t body_cap;                /**< Allocated size of body */
+
+    int responded;                  /**< A response was prepared */
+    int status;                     /**< Response status code */
+    char status_str[4];             /**< status as text */
+    char length_str[24];            /**< Content-Length as text */
+    int response_header_count;      /**< Entries in response_headers */
+    char *response_headers[H2_MAX_RESPONSE_HEADERS][2]; /**< Lower-cased copies */
+    char *response_body;            /**< Buffered response body */
+    size_t response_len;            /**< Bytes in response_body */
+    size_t response_pos;            /**< Bytes handed to the session */
+    struct h2_file *file;           /**< File-backed body, or NULL */
+    uint64_t file_size;             /**< Body length */
+    uint64_t file_offset;           /**< Next body byte in the file */
+    uint64_t file_left;             /**< Body bytes not yet handed to the session */
+
+    int streaming;                  /**< Body comes from a producer thread */
+    MHD_ContentReaderCallback reader;       /**< Produces the streamed body */
+    void *reader_cls;               /**< Reader state */
+    MHD_ContentReaderFreeCallback reader_free; /**< Releases reader_cls */
+    int producer_running;           /**< Producer thread alive (lock) */
+    struct h2_chunk *chunks;        /**< Produced, unsent chunks (lock) */
+    struct h2_chunk *chunks_tail;   /**< Last chunk (lock) */
+    int chunk_count;                /**< Entries in chunks (lock) */
+    int body_eof;                   /**< Producer reached the end (lock) */
+    int body_error;                 /**< Producer failed (lock) */
+    int deferred;                   /**< Session is waiting for chunks (connection thread) */
+    pthread_cond_t space;           /**< Signalled when a chunk is consumed */
+};
+
+/**
+ * @brief A client connection.
+ */
+struct h2_conn {
+    int fd;                         /**< Client socket */
+    SSL *ssl;                       /**< TLS state, or NULL for h2c */
+    nghttp2_session *session;       /**< HTTP/2 session */
+    int event_fd;                   /**< Signalled by handler and producer threads */
+    pthread_mutex_t lock;           /**< Guards fields shared with other threads */
+    pthread_cond_t idle;            /**< Signalled when busy drops to 0 */
+    int busy;                       /**< Streams in the pool plus running producers (lock) */
+    int closing;                    /**< Connection is being torn down (lock) */
+    int goaway_sent;                /**< Server shutdown already announced */
+    long long deadline_ms;          /**< Monotonic time the shutdown grace ends */
+    struct h2_stream *done;         /**< Handled streams awaiting submission (lock) */
+    struct h2_stream *streams;      /**< All live streams */
+    char *out;                      /**< Encoded frames not yet written */
+    size_t out_len;                 /**< Bytes in out */
+    size_t out_pos;                 /**< Bytes of out already written */
+    size_t out_cap;                 /**< Allocated size of out */
+    struct h2_segment *segments;    /**< File segments interleaved with out */
+    size_t segment_head;            /**< First unwritten segment */
+    size_t segment_count;           /**< Entries in segments */
+    size_t segment_cap;             /**< Allocated entries */
+    size_t segment_bytes;           /**< Bytes queued in segments */
+    int zero_copy;                  /**< File bodies can be sent with sendfile */
+};
+
+/** @brief Listening socket */
+static int listen_fd = -1;
+
+/** @brief Made readable to stop the listener and connections */
+static int stop_fd = -1;
+
+/** @brief TLS context, or NULL for h2c */
+static SSL_CTX *ssl_ctx;
+
+/** @brief Accepts connections */
+static pthread_t accept_thread;
+
+/** @brief accept_thread was started */
+static int accept_started;
+
+/** @brief Handler threads */
+static pthread_t *pool_threads;
+
+/** @brief Entries in pool_threads */
+static int pool_size;
+
+/** @brief Handler threads wanted; those numbered above it exit (pool_mutex) */
+static int pool_target;
+
+/** @brief Serializes start, stop and h2_server_resize() */
+static pthread_mutex_t resize_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Guards the handler queue and the connection count */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Signalled when a stream is queued or the pool stops */
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Signalled when a connection thread exits */
+static pthread_cond_t conn_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Queued streams */
+static struct h2_stream *job_head, *job_tail;
+
+/** @brief Handler threads should exit */
+static int pool_stop;
+
+/** @brief Running connection threads */
+static int conn_count;
+
+/** @brief Most connection threads; further connections are closed at once */
+static int conn_limit;
+
+/**
+ * @brief Wakes the connection thread. Called with the connection lock held.
+ */
+static void conn_notify(struct h2_conn *c) {
+    uint64_t one = 1;
+
+    if (write(c->event_fd, &one, sizeof(one)) < 0) {
+        /* The counter only saturates if the thread stopped reading */
+    }
+}
+
+static nghttp2_nv make_nv(const char *name, const char *value) {
+    nghttp2_nv nv = {
+        (uint8_t *)name, (uint8_t *)value, strlen(name), strlen(value), NGHTTP2_NV_FLAG_NONE
+    };
+    return nv;
+}
+
+static void file_unref(struct h2_file *file) {
+    if (--file->refs == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+static void stream_free(struct h2_stream *st) {
+    struct h2_chunk *chunk;
+
+    for (int i = 0; i < st->header_count; i++) {
+        free((char *)st->headers[i][0]);
+    }
+    for (int i = 0; i < st->response_header_count; i++) {
+        free(st->response_headers[i][0]);
+    }
+    while ((chunk = st->chunks) != NULL) {
+        st->chunks = chunk->next;
+        free(chunk);
+    }
+    if (st->file != NULL) {
+        file_unref(st->file);
+    }
+    pthread_cond_destroy(&st->space);
+    free(st->path);
+    free(st->body);
+    free(st->response_body);
+    free(st);
+}
+
+/**
+ * @brief Frees a stream once the session, the pool and its producer are done with it.
+ */
+static void stream_release(struct h2_conn *c, struct h2_stream *st) {
+    int running;
+
+    pthread_mutex_lock(&c->lock);
+    running = st->producer_running;
+    pthread_mutex_unlock(&c->lock);
+    if (!st->closed || st->in_pool || running) {
+        return;
+    }
+    if (st->prev != NULL) {
+        st->prev->next = st->next;
+    } else {
+        c->streams = st->next;
+    }
+    if (st->next != NULL) {
+        st->next->prev = st->prev;
+    }
+    stream_free(st);
+}
+
+/**
+ * @brief Adds a response header, lower-cased as HTTP/2 requires.
+ *
+ * Connection-specific headers are not allowed in HTTP/2 and are dropped.
+ */
+static int add_response_header(struct h2_stream *st, const char *name, const char *value) {
+    static const char *const hop_by_hop[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"
+    };
+    size_t name_len = strlen(name), value_len = strlen(value);
+    char *copy;
+
+    for (size_t i = 0; i < sizeof(hop_by_hop) / sizeof(hop_by_hop[0]); i++) {
+        if (strcasecmp(name, hop_by_hop[i]) == 0) {
+            return 0;
+        }
+    }
+    if (st->response_header_count == H2_MAX_RESPONSE_HEADERS) {
+        return -1;
+    }
+    copy = malloc(name_len + value_len + 2);
+    if (copy == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        copy[i] = (char)tolower((unsigned char)name[i]);
+    }
+    copy[name_len] = '\0';
+    memcpy(copy + name_len + 1, value, value_len + 1);
+    st->response_headers[st->response_header_count][0] = copy;
+    st->response_headers[st->response_header_count][1] = copy + name_len + 1;
+    st->response_header_count++;
+    return 0;
+}
+
+static int add_cors_headers(struct h2_stream *st) {
+    for (int i = 0; i < HTTP_CORS_HEADER_COUNT; i++) {
+        if (add_response_header(st, http_cors_headers[i].name, http_cors_headers[i].value) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const char *h2_query_arg(void *conn, const char *key) {
+    struct h2_stream *st = conn;
+
+    for (int i = 0; i < st->arg_count; i++) {
+        if (strcmp(st->args[i][0], key) == 0) {
+            return st->args[i][1];
+        }
+    }
+    return NULL;
+}
+
+static const char *h2_header(void *conn, const char *name) {
+    struct h2_stream *st = conn;
+
+    for (int i = 0; i < st->header_count; i++) {
+        if (strcasecmp(st->headers[i][0], name) == 0) {
+            return st->headers[i][1];
+        }
+    }
+    return NULL;
+}
+
+static enum MHD_Result h2_respond(void *conn, int status_code, const char *content_type,
+                                  const HttpHeader *headers, int header_count,
+                                  const char *body, size_t body_len) {
+    struct h2_stream *st = conn;
+
+    if (st->responded) {
+        return MHD_NO;
+    }
+    st->response_body = malloc(body_len > 0 ? body_len : 1);
+    if (st->response_body == NULL ||
+        add_response_header(st, "Content-Type", content_type) != 0 ||
+        add_cors_headers(st) != 0) {
+        return MHD_NO;
+    }
+    for (int i = 0; i < header_count; i++) {
+        if (add_response_header(st, headers[i].name, headers[i].value) != 0) {
+            return MHD_NO;
+        }
+    }
+    memcpy(st->response_body, body, body_len);
+    st->response_len = body_len;
+    st->status = status_code;
+    st->responded = 1;
+    return MHD_YES;
+}
+
+/**
+ * @brief Producer thread: runs the content reader of a streamed response.
+ */
+static void *producer_main(void *arg) {
+    struct h2_stream *st = arg;
+    struct h2_conn *c = st->conn;
+    uint64_t pos = 0;
+
+    for (;;) {
+        struct h2_chunk *chunk;
+        ssize_t n;
+        int stop;
+
+        pthread_mutex_lock(&c->lock);
+        while (st->chunk_count >= H2_STREAM_QUEUE_CHUNKS && !st->closed && !c->closing) {
+            pthread_cond_wait(&st->space, &c->lock);
+        }
+        stop = st->closed || c->closing;
+        pthread_mutex_unlock(&c->lock);
+        if (stop) {
+            break;
+        }
+
+        chunk = malloc(sizeof(*chunk) + HTTP_STREAM_BLOCK_SIZE);
+        n = chunk != NULL ? st->reader(st->reader_cls, pos, chunk->data, HTTP_STREAM_BLOCK_SIZE)
+                          : MHD_CONTENT_READER_END_WITH_ERROR;
+
+        pthread_mutex_lock(&c->lock);
+        if (n <= 0) {
+            free(chunk);
+            if (n == MHD_CONTENT_READER_END_OF_STREAM) {
+                st->body_eof = 1;
+            } else if (n < 0) {
+                st->body_error = 1;
+            }
+        } else {
+            chunk->next = NULL;
+            chunk->len = (size_t)n;
+            chunk->pos = 0;
+            if (st->chunks_tail != NULL) {
+                st->chunks_tail->next = chunk;
+            } else {
+                st->chunks = chunk;
+            }
+            st->chunks_tail = chunk;
+            st->chunk_count++;
+            pos += (uint64_t)n;
+        }
+        stop = st->body_eof || st->body_error;
+        if (!c->closing) {
+            conn_notify(c);
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (stop) {
+            break;
+        }
+    }
+
+    st->reader_free(st->reader_cls);
+
+    pthread_mutex_lock(&c->lock);
+    st->producer_running = 0;
+    if (--c->busy == 0) {
+        pthread_cond_signal(&c->idle);
+    }
+    if (!c->closing) {
+        conn_notify(c);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static enum MHD_Result h2_respond_stream(void *conn, int status_code,
+                                         const HttpHeader *headers, int header_count,
+                                         MHD_ContentReaderCallback reader, void *reader_cls,
+                                         MHD_ContentReaderFreeCallback free_cb) {
+    struct h2_stream *st = conn;
+    struct h2_conn *c = st->conn;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    if (st->responded) {
+        free_cb(reader_cls);
+        return MHD_NO;
+    }
+    for (int i = 0; i < header_count; i++) {
+        if (add_response_header(st, headers[i].name, headers[i].value) != 0) {
+            free_cb(reader_cls);
+            return MHD_NO;
+        }
+    }
+    if (add_cors_headers(st) != 0) {
+        free_cb(reader_cls);
+        return MHD_NO;
+    }
+    st->status = status_code;
+    st->streaming = 1;
+    st->reader = reader;
+    st->reader_cls = reader_cls;
+    st->reader_free = free_cb;
+    st->responded = 1;
+
+    pthread_mutex_lock(&c->lock);
+    st->producer_running = 1;
+    c->busy++;
+    pthread_mutex_unlock(&c->lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, producer_main, st);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        free_cb(reader_cls);
+        pthread_mutex_lock(&c->lock);
+        st->producer_running = 0;
+        st->body_error = 1;
+        c->busy--;
+        pthread_mutex_unlock(&c->lock);
+    }
+    return MHD_YES;
+}
+
+static enum MHD_Result h2_respond_fd(void *conn, int status_code,
+                                     const HttpHeader *headers, int header_count,
+                                     int fd, uint64_t offset, uint64_t size) {
+    struct h2_stream *st = conn;
+
+    if (st->responded) {
+        close(fd);
+        return MHD_NO;
+    }
+    st->file = malloc(sizeof(*st->file));
+    if (st->file == NULL) {
+        close(fd);
+        return MHD_NO;
+    }
+    st->file->fd = fd;
+    st->file->refs = 1;
+    for (int i = 0; i < header_count; i++) {
+        if (add_response_header(st, headers[i].name, headers[i].value) != 0) {
+            return MHD_NO;
+        }
+    }
+    if (add_cors_headers(st) != 0) {
+        return MHD_NO;
+    }
+    st->status = status_code;
+    st->file_size = size;
+    st->file_offset = offset;
+    st->file_left = size;
+    st->responded = 1;
+    return MHD_YES;
+}
+
+static int h2_peer_address(void *conn, struct sockaddr_storage *addr) {
+    struct h2_stream *st = conn;
+    socklen_t len = sizeof(*addr);
+
+    return getpeername(st->conn->fd, (struct sockaddr *)addr, &len) == 0 ? 0 : -1;
+}
+
+/** @brief HTTP/2 front end */
+static const HttpFrontend h2_frontend = {
+    h2_query_arg,
+    h2_header,
+    h2_respond,
+    h2_respond_stream,
+    h2_respond_fd,
+    h2_peer_address,
+};
+
+/**
+ * @brief Handler thread: routes queued streams.
+ *
+ * @param arg Index of the thread in pool_threads
+ */
+static void *pool_main(void *arg) {
+    int index = (int)(intptr_t)arg;
+
+    placement_pin_thread(PLACEMENT_ROLE_H2);
+
+    for (;;) {
+        struct h2_stream *st;
+        struct h2_conn *c;
+        int skip;
+
+        pthread_mutex_lock(&pool_mutex);
+        while (job_head == NULL && !pool_stop && index < pool_target) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+        st = index < pool_target ? job_head : NULL;
+        if (st == NULL) {
+            pthread_mutex_unlock(&pool_mutex);
+            break;
+        }
+        job_head = st->job_next;
+        if (job_head == NULL) {
+            job_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        c = st->conn;
+        pthread_mutex_lock(&c->lock);
+        skip = st->closed || c->closing;
+        pthread_mutex_unlock(&c->lock);
+
+        if (!skip) {
+            HttpRequest request = { &h2_frontend, st, NULL, st->method, st->path,
+                                    st->body != NULL ? st->body : "", st->body_len };
+
+            routes_dispatch(&request);
+            if (!st->responded) {
+                send_error_response(&request, 500, "Internal server error");
+            }
+        }
+
+        pthread_mutex_lock(&c->lock);
+        if (!c->closing) {
+            st->job_next = c->done;
+            c->done = st;
+            conn_notify(c);
+        }
+        if (--c->busy == 0) {
+            pthread_cond_signal(&c->idle);
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+    return NULL;
+}
+
+static void dispatch(struct h2_conn *c, struct h2_stream *st) {
+    st->in_pool = 1;
+    pthread_mutex_lock(&c->lock);
+    c->busy++;
+    pthread_mutex_unlock(&c->lock);
+
+    pthread_mutex_lock(&pool_mutex);
+    st->job_next = NULL;
+    if (job_tail != NULL) {
+        job_tail->job_next = st;
+    } else {
+        job_head = st;
+    }
+    job_tail = st;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * @brief Data source callback: copies the next piece of a response body.
+ */
+static ssize_t read_body(nghttp2_session *session, int32_t stream_id, uint8_t *buf,
+                         size_t length, uint32_t *data_flags, nghttp2_data_source *source,
+                         void *user_data) {
+    struct h2_stream *st = source->ptr;
+    struct h2_conn *c = user_data;
+    struct h2_chunk *chunk;
+    size_t n;
+    (void)session;
+    (void)stream_id;
+
+    if (st->file != NULL) {
+        n = st->file_left < length ? (size_t)st->file_left : length;
+        if (c->zero_copy) {
+            /* send_data() queues the bytes as a file segment and advances the offset */
+            *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+        } else if (n > 0) {
+            ssize_t got = pread(st->file->fd, buf, n, (off_t)st->file_offset);
+
+            if (got <= 0) {
+                return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+            }
+            n = (size_t)got;
+            st->file_offset += n;
+            st->file_left -= n;
+        }
+        if (st->file_left == (c->zero_copy ? n : 0)) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+        return (ssize_t)n;
+    }
+
+    if (!st->streaming) {
+        n = st->response_len - st->response_pos;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(buf, st->response_body + st->response_pos, n);
+        st->response_pos += n;
+        if (st->response_pos == st->response_len) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+        return (ssize_t)n;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    chunk = st->chunks;
+    if (chunk == NULL) {
+        int error = st->body_error, eof = st->body_eof;
+
+        pthread_mutex_unlock(&c->lock);
+        if (error) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        if (eof) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+            return 0;
+        }
+        st->deferred = 1;
+        return NGHTTP2_ERR_DEFERRED;
+    }
+
+    n = chunk->len - chunk->pos;
+    if (n > length) {
+        n = length;
+    }
+    memcpy(buf, chunk->data + chunk->pos, n);
+    chunk->pos += n;
+    if (chunk->pos == chunk->len) {
+        st->chunks = chunk->next;
+        if (st->chunks == NULL) {
+            st->chunks_tail = NULL;
+        }
+        st->chunk_count--;
+        free(chunk);
+        pthread_cond_signal(&st->space);
+    }
+    if (st->chunks == NULL && st->body_eof) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return (ssize_t)n;
+}
+
+static void submit_stream_response(struct h2_conn *c, struct h2_stream *st) {
+    nghttp2_nv nva[H2_MAX_RESPONSE_HEADERS + 2];
+    nghttp2_data_provider provider;
+    size_t count = 0;
+    int empty;
+
+    snprintf(st->status_str, sizeof(st->status_str), "%d", st->status);
+    nva[count++] = make_nv(":status", st->status_str);
+    for (int i = 0; i < st->response_header_count; i++) {
+        nva[count++] = make_nv(st->response_headers[i][0], st->response_headers[i][1]);
+    }
+    if (!st->streaming && st->status != 304) {
+        snprintf(st->length_str, sizeof(st->length_str), "%llu", (unsigned long long)
+                 (st->file != NULL ? st->file_size : st->response_len));
+        nva[count++] = make_nv("content-length", st->length_str);
+    }
+
+    provider.source.ptr = st;
+    provider.read_callback = read_body;
+    empty = !st->streaming && (st->file != NULL ? st->file_size : st->response_len) == 0;
+    if (nghttp2_submit_response(c->session, st->id, nva, count,
+                                empty ? NULL : &provider) != 0) {
+        nghttp2_submit_rst_stream(c->session, NGHTTP2_FLAG_NONE, st->id, NGHTTP2_INTERNAL_ERROR);
+    }
+}
+
+/**
+ * @brief Submits handled streams and resumes streamed bodies with new data.
+ */
+static void conn_handle_events(struct h2_conn *c) {
+    struct h2_stream *done, *st, *next, *reversed = NULL;
+    uint64_t count;
+
+    if (read(c->event_fd, &count, sizeof(count)) < 0) {
+        /* Nothing pending */
+    }
+
+    pthread_mutex_lock(&c->lock);
+    done = c->done;
+    c->done = NULL;
+    pthread_mutex_unlock(&c->lock);
+
+    /* The list is newest first; answer in completion order */
+    while (done != NULL) {
+        next = done->job_next;
+        done->job_next = reversed;
+        reversed = done;
+        done = next;
+    }
+    for (st = reversed; st != NULL; st = next) {
+        next = st->job_next;
+        st->in_pool = 0;
+        if (st->closed) {
+            stream_release(c, st);
+        } else if (!st->rejected) {
+            submit_stream_response(c, st);
+        }
+    }
+
+    for (st = c->streams; st != NULL; st = next) {
+        next = st->next;
+        if (st->closed) {
+            stream_release(c, st);
+        } else if (st->deferred) {
+            int ready;
+
+            pthread_mutex_lock(&c->lock);
+            ready = st->chunks != NULL || st->body_eof || st->body_error;
+            pthread_mutex_unlock(&c->lock);
+            if (ready) {
+                st->deferred = 0;
+                nghttp2_session_resume_data(c->session, st->id);
+            }
+        }
+    }
+}
+
+static int on_begin_headers(nghttp2_session *session, const nghttp2_frame *frame,
+                            void *user_data) {
+    struct h2_conn *c = user_data;
+    struct h2_stream *st;
+
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+        return 0;
+    }
+    st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    st->conn = c;
+    st->id = frame->hd.stream_id;
+    pthread_cond_init(&st->space, NULL);
+    st->next = c->streams;
+    if (c->streams != NULL) {
+        c->streams->prev = st;
+    }
+    c->streams = st;
+    nghttp2_session_set_stream_user_data(session, st->id, st);
+    return 0;
+}
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                     const uint8_t *name, size_t namelen, const uint8_t *value,
+                     size_t valuelen, uint8_t flags, void *user_data) {
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    char *copy;
+    (void)flags;
+    (void)user_data;
+
+    if (st == NULL || frame->hd.type != NGHTTP2_HEADERS) {
+        return 0;
+    }
+
+    if (namelen == 7 && memcmp(name, ":method", 7) == 0) {
+        size_t n = valuelen < sizeof(st->method) - 1 ? valuelen : sizeof(st->method) - 1;
+
+        memcpy(st->method, value, n);
+        st->method[n] = '\0';
+        return 0;
+    }
+    if (namelen == 5 && memcmp(name, ":path", 5) == 0) {
+        char *query;
+
+        free(st->path);
+        st->path = strndup((const char *)value, valuelen);
+        if (st->path == NULL) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        query = strchr(st->path, '?');
+        if (query != NULL) {
+            *query = '\0';
+            st->arg_count = http_parse_query(query + 1, st->args, H2_MAX_ARGS);
+        }
+        http_url_decode(st->path, 0);
+        return 0;
+    }
+    if (namelen > 0 && name[0] == ':') {
+        return 0;
+    }
+
+    if (st->header_count < H2_MAX_HEADERS) {
+        copy = malloc(namelen + valuelen + 2);
+        if (copy == NULL) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        memcpy(copy, name, namelen);
+        copy[namelen] = '\0';
+        memcpy(copy + namelen + 1, value, valuelen);
+        copy[namelen + 1 + valuelen] = '\0';
+        st->headers[st->header_count][0] = copy;
+        st->headers[st->header_count][1] = copy + namelen + 1;
+        st->header_count++;
+    }
+    return 0;
+}
+
+static int on_data_chunk(nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                         const uint8_t *data, size_t len, void *user_data) {
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    struct h2_conn *c = user_data;
+    (void)flags;
+
+    if (st == NULL || st->rejected) {
+        return 0;
+    }
+
+    if (st->body_len + len > routes_max_body_size(st->path != NULL ? st->path : "")) {
+        HttpRequest request = { &h2_frontend, st, NULL, st->method, "", "", 0 };
+
+        /* Answer now; the rest of the body is read and dropped */
+        st->rejected = 1;
+        free(st->body);
+        st->body = NULL;
+        st->body_len = 0;
+        send_error_response(&request, 413, "Request body too large");
+        submit_stream_response(c, st);
+        return 0;
+    }
+
+    if (st->body_len + len + 1 > st->body_cap) {
+        size_t cap = st->body_cap > 0 ? st->body_cap * 2 : 4096;
+        char *grown;
+
+        while (cap < st->body_len + len + 1) {
+            cap *= 2;
+        }
+        grown = realloc(st->body, cap);
+        if (grown == NULL) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        st->body = grown;
+        st->body_cap = cap;
+    }
+    memcpy(st->body + st->body_len, data, len);
+    st->body_len += len;
+    st->body[st->body_len] = '\0';
+    return 0;
+}
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame,
+                         void *user_data) {
+    struct h2_conn *c = user_data;
+    struct h2_stream *st;
+
+    /* Refuse over-limit clients and declared oversized bodies before the body arrives */
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+        st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+        if (st != NULL && st->path != NULL && st->method[0] != '\0') {
+            HttpRequest request = { &h2_frontend, st, NULL, st->method, st->path, "", 0 };
+            const char *length = h2_header(st, "content-length");
+            int retry_after = routes_rate_limit(&request);
+
+            if (retry_after > 0) {
+                st->rejected = 1;
+                send_rate_limited(&request, retry_after);
+                submit_stream_response(c, st);
+                return 0;
+            }
+            if (length != NULL && strtoull(length, NULL, 10) > routes_max_body_size(st->path)) {
+                st->rejected = 1;
+                send_error_response(&request, 413, "Request body too large");
+                submit_stream_response(c, st);
+                return 0;
+            }
+        }
+    }
+
+    if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) ||
+        !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+        return 0;
+    }
+    st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (st == NULL || st->rejected || st->in_pool) {
+        return 0;
+    }
+    if (st->path == NULL || st->method[0] == '\0') {
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, st->id, NGHTTP2_PROTOCOL_ERROR);
+        return 0;
+    }
+    dispatch(c, st);
+    return 0;
+}
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code,
+                           void *user_data) {
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    struct h2_conn *c = user_data;
+    (void)error_code;
+
+    if (st == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&c->lock);
+    st->closed = 1;
+    pthread_cond_signal(&st->space);
+    pthread_mutex_unlock(&c->lock);
+    stream_release(c, st);
+    return 0;
+}
+
+/**
+ * @brief Reads from the socket.
+ *
+ * @return Bytes read, 0 if it would block, or -1 on EOF or error
+ */
+static ssize_t conn_read(struct h2_conn *c, char *buf, size_t len) {
+    if (c->ssl != NULL) {
+        int n = SSL_read(c->ssl, buf, (int)len);
+
+        if (n > 0) {
+            return n;
+        }
+        switch (SSL_get_error(c->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return 0;
+        default:
+            return -1;
+        }
+    } else {
+        ssize_t n = recv(c->fd, buf, len, 0);
+
+        if (n > 0) {
+            return n;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Writes to the socket.
+ *
+ * @return Bytes written, 0 if it would block, or -1 on error
+ */
+static ssize_t conn_write(struct h2_conn *c, const char *buf, size_t len) {
+    if (c->ssl != NULL) {
+        int n = SSL_write(c->ssl, buf, (int)len);
+
+        if (n > 0) {
+            return n;
+        }
+        switch (SSL_get_error(c->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return 0;
+        default:
+            return -1;
+        }
+    } else {
+        ssize_t n = send(c->fd, buf, len, MSG_NOSIGNAL);
+
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Appends encoded bytes to the output buffer.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int out_append(struct h2_conn *c, const void *data, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_len + len > H2_OUTPUT_BUFFER * 2 ? c->out_len + len
+                                                              : H2_OUTPUT_BUFFER * 2;
+        char *grown = realloc(c->out, cap);
+
+        if (grown == NULL) {
+            return -1;
+        }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+/**
+ * @brief Queues a DATA frame of a file-backed body: header now, payload by sendfile.
+ */
+static int send_data(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd,
+                     size_t length, nghttp2_data_source *source, void *user_data) {
+    static const uint8_t zeros[256];
+    struct h2_stream *st = source->ptr;
+    struct h2_conn *c = user_data;
+    struct h2_segment *segment;
+    size_t padlen = frame->data.padlen;
+    (void)session;
+
+    if (out_append(c, framehd, 9) != 0) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    if (padlen > 0) {
+        uint8_t pad = (uint8_t)(padlen - 1);
+
+        if (out_append(c, &pad, 1) != 0) {
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+    }
+
+    if (length > 0) {
+        if (c->segment_count == c->segment_cap) {
+            size_t cap = c->segment_cap > 0 ? c->segment_cap * 2 : 16;
+            struct h2_segment *grown = realloc(c->segments, cap * sizeof(*grown));
+
+            if (grown == NULL) {
+                return NGHTTP2_ERR_CALLBACK_FAILURE;
+            }
+            c->segments = grown;
+            c->segment_cap = cap;
+        }
+        segment = &c->segments[c->segment_count++];
+        segment->at = c->out_len;
+        segment->file = st->file;
+        segment->offset = (off_t)st->file_offset;
+        segment->len = length;
+        st->file->refs++;
+        st->file_offset += length;
+        st->file_left -= length;
+        c->segment_bytes += length;
+    }
+
+    if (padlen > 1 && out_append(c, zeros, padlen - 1) != 0) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes file bytes straight from the page cache.
+ *
+ * @return Bytes written, 0 if it would block, or -1 on error
+ */
+static ssize_t conn_sendfile(struct h2_conn *c, int fd, off_t offset, size_t len) {
+    ssize_t n;
+
+    if (c->ssl != NULL) {
+        n = SSL_sendfile(c->ssl, fd, offset, len, 0);
+        if (n > 0) {
+            return n;
+        }
+        switch (SSL_get_error(c->ssl, (int)n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return 0;
+        default:
+            return -1;
+        }
+    }
+
+    n = sendfile(c->fd, fd, &offset, len);
+    if (n > 0) {
+        return n;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    return -1;
+}
+
+static void segments_release(struct h2_conn *c) {
+    for (size_t i = c->segment_head; i < c->segment_count; i++) {
+        file_unref(c->segments[i].file);
+    }
+    c->segment_head = 0;
+    c->segment_count = 0;
+    c->segment_bytes = 0;
+}
+
+/**
+ * @brief Returns whether encoded output is waiting for the socket.
+ */
+static int conn_pending(const struct h2_conn *c) {
+    return c->out_pos < c->out_len || c->segment_head < c->segment_count;
+}
+
+/**
+ * @brief Encodes pending frames and writes them until the socket would block.
+ *
+ * @return 0 on success, -1 if the connection failed
+ */
+static int conn_flush(struct h2_conn *c) {
+    for (;;) {
+        /* Frames are only encoded while there is room, which paces the producers */
+        while (c->out_len + c->segment_bytes < H2_OUTPUT_BUFFER) {
+            const uint8_t *data;
+            ssize_t n = nghttp2_session_mem_send(c->session, &data);
+
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            if (out_append(c, data, (size_t)n) != 0) {
+                return -1;
+            }
+        }
+
+        while (conn_pending(c)) {
+            struct h2_segment *segment = c->segment_head < c->segment_count
+                                             ? &c->segments[c->segment_head] : NULL;
+            size_t limit = segment != NULL ? segment->at : c->out_len;
+            ssize_t n;
+
+            if (c->out_pos < limit) {
+                n = conn_write(c, c->out + c->out_pos, limit - c->out_pos);
+                if (n > 0) {
+                    c->out_pos += (size_t)n;
+                }
+            } else {
+                n = conn_sendfile(c, segment->file->fd, segment->offset, segment->len);
+                if (n > 0) {
+                    segment->offset += n;
+                    segment->len -= (size_t)n;
+                    c->segment_bytes -= (size_t)n;
+                    if (segment->len == 0) {
+                        file_unref(segment->file);
+                        c->segment_head++;
+                    }
+                }
+            }
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                return 0;
+            }
+        }
+        c->out_len = 0;
+        c->out_pos = 0;
+        c->segment_head = 0;
+        c->segment_count = 0;
+        if (!nghttp2_session_want_write(c->session)) {
+            return 0;
+        }
+    }
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int conn_busy(struct h2_conn *c) {
+    int busy;
+
+    pthread_mutex_lock(&c->lock);
+    busy = c->busy > 0 || c->done != NULL;
+    pthread_mutex_unlock(&c->lock);
+    return busy;
+}
+
+/**
+ * @brief Runs the TLS handshake on the still-blocking socket.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int conn_handshake(struct h2_conn *c) {
+    struct timeval timeout = { H2_HANDSHAKE_TIMEOUT, 0 }, none = { 0, 0 };
+    const unsigned char *alpn;
+    unsigned int alpn_len;
+    int rc;
+
+    c->ssl = SSL_new(ssl_ctx);
+    if (c->ssl == NULL || SSL_set_fd(c->ssl, c->fd) != 1) {
+        return -1;
+    }
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    rc = SSL_accept(c->ssl);
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+    if (rc != 1) {
+        ERR_clear_error();
+        return -1;
+    }
+
+    SSL_get0_alpn_selected(c->ssl, &alpn, &alpn_len);
+    if (alpn_len != 2 || memcmp(alpn, "h2", 2) != 0) {
+        return -1;
+    }
+    c->zero_copy = tls_ktls_send(c->ssl);
+    return 0;
+}
+
+static int conn_setup_session(struct h2_conn *c) {
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_CONCURRENT_STREAMS },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, H2_STREAM_WINDOW },
+        { NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, H2_MAX_HEADER_LIST_SIZE },
+    };
+    int rc;
+
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+        return -1;
+    }
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, on_begin_headers);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+    nghttp2_session_callbacks_set_send_data_callback(callbacks, send_data);
+    rc = nghttp2_session_server_new(&c->session, callbacks, c);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rc != 0) {
+        return -1;
+    }
+
+    if (nghttp2_submit_settings(c->session, NGHTTP2_FLAG_NONE, settings,
+                                sizeof(settings) / sizeof(settings[0])) != 0 ||
+        nghttp2_session_set_local_window_size(c->session, NGHTTP2_FLAG_NONE, 0,
+                                              H2_CONNECTION_WINDOW) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for handler and producer threads, then frees the connection.
+ */
+static void conn_teardown(struct h2_conn *c) {
+    struct h2_stream *st;
+
+    pthread_mutex_lock(&c->lock);
+    c->closing = 1;
+    for (st = c->streams; st != NULL; st = st->next) {
+        pthread_cond_signal(&st->space);
+    }
+    while (c->busy > 0) {
+        pthread_cond_wait(&c->idle, &c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if (c->session != NULL) {
+        nghttp2_session_del(c->session);
+    }
+    while ((st = c->streams) != NULL) {
+        c->streams = st->next;
+        stream_free(st);
+    }
+    segments_release(c);
+    free(c->segments);
+    if (c->ssl != NULL) {
+        SSL_free(c->ssl);
+    }
+    close(c->fd);
+    if (c->event_fd >= 0) {
+        close(c->event_fd);
+    }
+    pthread_cond_destroy(&c->idle);
+    pthread_mutex_destroy(&c->lock);
+    free(c->out);
+    free(c);
+}
+
+/**
+ * @brief Connection thread.
+ */
+static void *conn_main(void *arg) {
+    struct h2_conn *c = arg;
+    char buf[H2_READ_BUFFER];
+
+    placement_pin_thread(PLACEMENT_ROLE_H2);
+
+    /* Without TLS, file bodies always go out with sendfile */
+    c->zero_copy = ssl_ctx == NULL;
+    if ((ssl_ctx == NULL || conn_handshake(c) == 0) && conn_setup_session(c) == 0) {
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+        for (;;) {
+            struct pollfd fds[3];
+            int timeout;
+
+            if (conn_flush(c) != 0) {
+                break;
+            }
+            if (!nghttp2_session_want_read(c->session) &&
+                !nghttp2_session_want_write(c->session) &&
+                !conn_pending(c) && !conn_busy(c)) {
+                break;
+            }
+
+            fds[0].fd = c->fd;
+            fds[0].events = POLLIN | (conn_pending(c) ? POLLOUT : 0);
+            fds[1].fd = c->event_fd;
+            fds[1].events = POLLIN;
+            fds[2].fd = stop_fd;
+            fds[2].events = c->goaway_sent ? 0 : POLLIN;
+            timeout = -1;
+            if (c->goaway_sent) {
+                long long left = c->deadline_ms - monotonic_ms();
+
+                if (left <= 0) {
+                    /* Streams still open after the grace period are cut off */
+                    break;
+                }
+                timeout = (int)left;
+            }
+            if (poll(fds, 3, timeout) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            if (fds[2].revents & POLLIN) {
+                /* Server shutdown: finish open streams, accept no new ones */
+                nghttp2_submit_goaway(c->session, NGHTTP2_FLAG_NONE,
+                                      nghttp2_session_get_last_proc_stream_id(c->session),
+                                      NGHTTP2_NO_ERROR, NULL, 0);
+                c->goaway_sent = 1;
+                c->deadline_ms = monotonic_ms() + H2_SHUTDOWN_GRACE_MS;
+            }
+            if (fds[1].revents & POLLIN) {
+                conn_handle_events(c);
+            }
+            if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n;
+
+                while ((n = conn_read(c, buf, sizeof(buf))) > 0) {
+                    if (nghttp2_session_mem_recv(c->session, (const uint8_t *)buf, (size_t)n) < 0) {
+                        n = -1;
+                        break;
+                    }
+                }
+                if (n < 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    conn_teardown(c);
+    /* Free OpenSSL's per-thread state before h2_server_stop() can return */
+    OPENSSL_thread_stop();
+
+    pthread_mutex_lock(&pool_mutex);
+    conn_count--;
+    pthread_cond_signal(&conn_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Accept thread.
+ */
+static void *accept_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        struct pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+        struct h2_conn *c;
+        pthread_attr_t attr;
+        pthread_t thread;
+        int fd, one = 1;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        pthread_mutex_lock(&pool_mutex);
+        if (conn_limit > 0 && conn_count >= conn_limit) {
+            pthread_mutex_unlock(&pool_mutex);
+            close(fd);
+            continue;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->idle, NULL);
+        if (c->event_fd < 0) {
+            conn_teardown(c);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_mutex);
+        conn_count++;
+        pthread_mutex_unlock(&pool_mutex);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, conn_main, c) != 0) {
+            conn_teardown(c);
+            pthread_mutex_lock(&pool_mutex);
+            conn_count--;
+            pthread_mutex_unlock(&pool_mutex);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return NULL;
+}
+
+/**
+ * @brief ALPN callback: the listener only speaks h2.
+ */
+static int alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *arg) {
+    (void)ssl;
+    (void)arg;
+
+    if (nghttp2_select_next_protocol((unsigned char **)out, outlen, in, inlen) != 1) {
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int open_listener(int port) {
+    struct sockaddr_in addr;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Returns the handler thread count for a setting (0 = two per CPU).
+ */
+static int pool_threads_for(int threads) {
+    if (threads <= 0) {
+        threads = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 2) {
+            threads = 2;
+        }
+    }
+    return threads;
+}
+
+/**
+ * @brief Starts or retires handler threads until there are threads of them.
+ *
+ * Retired threads finish the stream they are handling first.
+ *
+ * @note Caller must hold resize_mutex
+ * @return 0 on success, -1 if a thread could not be started
+ */
+static int pool_resize(int threads) {
+    if (threads > pool_size) {
+        pthread_t *grown = realloc(pool_threads, (size_t)threads * sizeof(*pool_threads));
+
+        if (grown == NULL) {
+            return -1;
+        }
+        pool_threads = grown;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    pool_target = threads;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (; pool_size > threads; pool_size--) {
+        /* A handler may be the one shrinking the pool (POST /admin/config) */
+        if (pthread_equal(pool_threads[pool_size - 1], pthread_self())) {
+            pthread_detach(pool_threads[pool_size - 1]);
+        } else {
+            pthread_join(pool_threads[pool_size - 1], NULL);
+        }
+    }
+    for (; pool_size < threads; pool_size++) {
+        if (pthread_create(&pool_threads[pool_size], NULL, pool_main,
+                           (void *)(intptr_t)pool_size) != 0) {
+            pthread_mutex_lock(&pool_mutex);
+            pool_target = pool_size;
+            pthread_mutex_unlock(&pool_mutex);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int h2_server_start(int port, int threads, const char *cert_file, const char *key_file,
+                    int ktls, int max_connections) {
+    int rc;
+
+    threads = pool_threads_for(threads);
+    conn_limit = max_connections;
+
+    if (cert_file != NULL && cert_file[0] != '\0') {
+        ssl_ctx = tls_context_new(cert_file, key_file, ktls);
+        if (ssl_ctx == NULL) {
+            fprintf(stderr, "HTTP/2: cannot load TLS certificate or key\n");
+            return H2_ERROR_SETUP;
+        }
+        SSL_CTX_set_alpn_select_cb(ssl_ctx, alpn_select, NULL);
+    }
+
+    listen_fd = open_listener(port);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (listen_fd < 0 || stop_fd < 0) {
+        perror("HTTP/2: listen");
+        h2_server_stop();
+        return H2_ERROR_SETUP;
+    }
+
+    pool_stop = 0;
+    pthread_mutex_lock(&resize_mutex);
+    rc = pool_resize(threads);
+    pthread_mutex_unlock(&resize_mutex);
+    if (rc != 0 || pthread_create(&accept_thread, NULL, accept_main, NULL) != 0) {
+        h2_server_stop();
+        return H2_ERROR_SETUP;
+    }
+    accept_started = 1;
+
+    printf("HTTP/2 (%s) listening on port %d, %d handler threads\n",
+           ssl_ctx != NULL ? "TLS" : "h2c", port, threads);
+    return 0;
+}
+
+int h2_server_resize(int threads) {
+    int rc = 0;
+
+    pthread_mutex_lock(&resize_mutex);
+    if (pool_size > 0 && pool_resize(pool_threads_for(threads)) != 0) {
+        rc = H2_ERROR_SETUP;
+    }
+    pthread_mutex_unlock(&resize_mutex);
+    return rc;
+}
+
+void h2_server_stop(void) {
+    uint64_t one = 1;
+
+    if (stop_fd >= 0) {
+        if (write(stop_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+            perror("HTTP/2: stop");
+        }
+        if (accept_started) {
+            pthread_join(accept_thread, NULL);
+            accept_started = 0;
+        }
+    }
+
+    /* Connections finish their open streams, which needs the pool */
+    pthread_mutex_lock(&pool_mutex);
+    while (conn_count > 0) {
+        pthread_cond_wait(&conn_cond, &pool_mutex);
+    }
+    pool_stop = 1;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_mutex_lock(&resize_mutex);
+    for (int i = 0; i < pool_size; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+    free(pool_threads);
+    pool_threads = NULL;
+    pool_size = 0;
+    pool_target = 0;
+    pthread_mutex_unlock(&resize_mutex);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    if (ssl_ctx != NULL) {
+        tls_context_free(ssl_ctx);
+        ssl_ctx = NULL;
+    }
+}
+
+#else
+
+int h2_server_start(int port, int threads, const char *cert_file, const char *key_file,
+                    int ktls, int max_connections) {
+    (void)port;
+    (void)max_connections;
+    (void)threads;
+    (void)cert_file;
+    (void)key_file;
+    (void)ktls;
+    return H2_ERROR_UNAVAILABLE;
+}
+
+int h2_server_resize(int threads) {
+    (void)threads;
+    return H2_ERROR_UNAVAILABLE;
+}
+
+void h2_server_stop(void) {
+}
+
+#endif
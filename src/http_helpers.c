@@ -1,24 +1,53 @@
 /**
  * @file http_helpers.c
- * @brief HTTP response helper implementations.
+ * @brief HTTP request and response helper implementations.
  */
 
 #include <microhttpd.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <netinet/in.h>
 #include "http_helpers.h"
 
-enum MHD_Result send_json_response(
-    struct MHD_Connection *connection,
-    int status_code,
-    const char *json_body)
-{
+const HttpHeader http_cors_headers[HTTP_CORS_HEADER_COUNT] = {
+    { "Access-Control-Allow-Origin", "*" },
+    { "Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS" },
+    { "Access-Control-Allow-Headers", "Content-Type" },
+};
+
+static const char *mhd_query_arg(void *conn, const char *key) {
+    return MHD_lookup_connection_value(conn, MHD_GET_ARGUMENT_KIND, key);
+}
+
+static const char *mhd_header(void *conn, const char *name) {
+    return MHD_lookup_connection_value(conn, MHD_HEADER_KIND, name);
+}
+
+static int mhd_peer_address(void *conn, struct sockaddr_storage *addr) {
+    const union MHD_ConnectionInfo *info =
+        MHD_get_connection_info(conn, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+
+    if (info == NULL || info->client_addr == NULL) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    memcpy(addr, info->client_addr, info->client_addr->sa_family == AF_INET6
+                                        ? sizeof(struct sockaddr_in6)
+                                        : sizeof(struct sockaddr_in));
+    return 0;
+}
+
+static enum MHD_Result mhd_respond(void *conn, int status_code, const char *content_type,
+                                   const HttpHeader *headers, int header_count,
+                                   const char *body, size_t body_len) {
     struct MHD_Response *response;
     enum MHD_Result ret;
 
     response = MHD_create_response_from_buffer(
-        strlen(json_body),
-        (void *)json_body,
+        body_len,
+        (void *)body,
         MHD_RESPMEM_MUST_COPY
     );
 
@@ -26,26 +55,255 @@ enum MHD_Result send_json_response(
         return MHD_NO;
     }
 
-    MHD_add_response_header(response, "Content-Type", "application/json");
-    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-    MHD_add_response_header(response, "Access-Control-Allow-Methods",
-                            "GET, POST, PUT, DELETE, OPTIONS");
-    MHD_add_response_header(response, "Access-Control-Allow-Headers",
-                            "Content-Type");
+    MHD_add_response_header(response, "Content-Type", content_type);
+    for (int i = 0; i < HTTP_CORS_HEADER_COUNT; i++) {
+        MHD_add_response_header(response, http_cors_headers[i].name, http_cors_headers[i].value);
+    }
+    for (int i = 0; i < header_count; i++) {
+        MHD_add_response_header(response, headers[i].name, headers[i].value);
+    }
+
+    ret = MHD_queue_response(conn, status_code, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+static enum MHD_Result mhd_respond_stream(void *conn, int status_code,
+                                          const HttpHeader *headers, int header_count,
+                                          MHD_ContentReaderCallback reader, void *reader_cls,
+                                          MHD_ContentReaderFreeCallback free_cb) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, HTTP_STREAM_BLOCK_SIZE,
+                                                 reader, reader_cls, free_cb);
+    if (response == NULL) {
+        free_cb(reader_cls);
+        return MHD_NO;
+    }
+
+    for (int i = 0; i < header_count; i++) {
+        MHD_add_response_header(response, headers[i].name, headers[i].value);
+    }
+    for (int i = 0; i < HTTP_CORS_HEADER_COUNT; i++) {
+        MHD_add_response_header(response, http_cors_headers[i].name, http_cors_headers[i].value);
+    }
 
-    ret = MHD_queue_response(connection, status_code, response);
+    ret = MHD_queue_response(conn, status_code, response);
     MHD_destroy_response(response);
 
     return ret;
 }
 
+static enum MHD_Result mhd_respond_fd(void *conn, int status_code,
+                                      const HttpHeader *headers, int header_count,
+                                      int fd, uint64_t offset, uint64_t size) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    /* MHD closes fd with the response and uses sendfile when it can */
+    response = MHD_create_response_from_fd_at_offset64(size, fd, offset);
+    if (response == NULL) {
+        close(fd);
+        return MHD_NO;
+    }
+
+    for (int i = 0; i < header_count; i++) {
+        MHD_add_response_header(response, headers[i].name, headers[i].value);
+    }
+    for (int i = 0; i < HTTP_CORS_HEADER_COUNT; i++) {
+        MHD_add_response_header(response, http_cors_headers[i].name, http_cors_headers[i].value);
+    }
+
+    ret = MHD_queue_response(conn, status_code, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+/** @brief libmicrohttpd front end */
+static const HttpFrontend mhd_frontend = {
+    mhd_query_arg,
+    mhd_header,
+    mhd_respond,
+    mhd_respond_stream,
+    mhd_respond_fd,
+    mhd_peer_address,
+};
+
+void http_request_init_mhd(HttpRequest *request, struct MHD_Connection *connection,
+                           const char *method, const char *url,
+                           const char *body, size_t body_len) {
+    request->frontend = &mhd_frontend;
+    request->conn = connection;
+    request->mhd = connection;
+    request->method = method;
+    request->url = url;
+    request->body = body != NULL ? body : "";
+    request->body_len = body != NULL ? body_len : 0;
+}
+
+const char *http_query_arg(HttpRequest *request, const char *key) {
+    return request->frontend->query_arg(request->conn, key);
+}
+
+const char *http_header(HttpRequest *request, const char *name) {
+    return request->frontend->header(request->conn, name);
+}
+
+int http_peer_is_local(HttpRequest *request) {
+    struct sockaddr_storage addr;
+
+    if (request->frontend->peer_address(request->conn, &addr) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)&addr;
+        return (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (addr.ss_family == AF_INET6) {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *)&addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(in6) ||
+               (IN6_IS_ADDR_V4MAPPED(in6) && in6->s6_addr[12] == 127);
+    }
+    return 0;
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    return (tolower((unsigned char)ch) - 'a') + 10;
+}
+
+void http_url_decode(char *s, int plus_is_space) {
+    char *out = s;
+
+    while (*s != '\0') {
+        if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+            *out++ = (char)(hex_value(s[1]) * 16 + hex_value(s[2]));
+            s += 3;
+        } else if (*s == '+' && plus_is_space) {
+            *out++ = ' ';
+            s++;
+        } else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+}
+
+int http_parse_query(char *query, const char *args[][2], int max_args) {
+    int count = 0;
+
+    while (query != NULL && count < max_args) {
+        char *next = strchr(query, '&');
+        char *eq;
+
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        if (*query != '\0') {
+            eq = strchr(query, '=');
+            if (eq != NULL) {
+                *eq = '\0';
+                http_url_decode(eq + 1, 1);
+            }
+            http_url_decode(query, 1);
+            args[count][0] = query;
+            args[count][1] = eq != NULL ? eq + 1 : NULL;
+            count++;
+        }
+        query = next;
+    }
+    return count;
+}
+
+enum MHD_Result send_json_response(
+    HttpRequest *request,
+    int status_code,
+    const char *json_body)
+{
+    return send_json_response_with_headers(request, status_code, json_body, NULL, 0);
+}
+
+enum MHD_Result send_json_response_with_headers(
+    HttpRequest *request,
+    int status_code,
+    const char *json_body,
+    const HttpHeader *headers,
+    int header_count)
+{
+    return request->frontend->respond(request->conn, status_code, "application/json",
+                                      headers, header_count, json_body, strlen(json_body));
+}
+
 enum MHD_Result send_error_response(
-    struct MHD_Connection *connection,
+    HttpRequest *request,
     int status_code,
     const char *error_message)
 {
+    static const char prefix[] = "{\"success\": false, \"error\": \"";
     char buffer[512];
-    snprintf(buffer, sizeof(buffer),
-        "{\"success\": false, \"error\": \"%s\"}", error_message);
-    return send_json_response(connection, status_code, buffer);
+    size_t len = sizeof(prefix) - 1;
+
+    /* Messages may quote the request: escape them as a JSON string */
+    memcpy(buffer, prefix, len);
+    for (const unsigned char *c = (const unsigned char *)error_message; *c != '\0'; c++) {
+        /* Room for the longest escape and the closing "}; cut whole characters */
+        if (len + 6 + 3 > sizeof(buffer)) {
+            while ((unsigned char)buffer[len - 1] >= 0x80 && (unsigned char)buffer[len - 1] < 0xC0) {
+                len--;
+            }
+            if ((unsigned char)buffer[len - 1] >= 0xC0) {
+                len--;
+            }
+            break;
+        }
+        if (*c == '"' || *c == '\\') {
+            buffer[len++] = '\\';
+            buffer[len++] = (char)*c;
+        } else if (*c < 0x20) {
+            len += (size_t)snprintf(buffer + len, 7, "\\u%04x", *c);
+        } else {
+            buffer[len++] = (char)*c;
+        }
+    }
+    memcpy(buffer + len, "\"}", 3);
+    return send_json_response(request, status_code, buffer);
+}
+
+enum MHD_Result send_stream_response(
+    HttpRequest *request,
+    int status_code,
+    const HttpHeader *headers,
+    int header_count,
+    MHD_ContentReaderCallback reader,
+    void *reader_cls,
+    MHD_ContentReaderFreeCallback free_cb)
+{
+    if (request->frontend->respond_stream == NULL) {
+        free_cb(reader_cls);
+        return send_error_response(request, 501, "Not supported by this HTTP front end");
+    }
+    return request->frontend->respond_stream(request->conn, status_code, headers, header_count,
+                                             reader, reader_cls, free_cb);
+}
+
+enum MHD_Result send_fd_response(
+    HttpRequest *request,
+    int status_code,
+    const HttpHeader *headers,
+    int header_count,
+    int fd,
+    uint64_t offset,
+    uint64_t size)
+{
+    if (request->frontend->respond_fd == NULL) {
+        close(fd);
+        return send_error_response(request, 501, "Not supported by this HTTP front end");
+    }
+    return request->frontend->respond_fd(request->conn, status_code, headers, header_count,
+                                         fd, offset, size);
 }
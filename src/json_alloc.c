@@ -0,0 +1,385 @@
+/**
+ * @file json_alloc.c
+ * @brief Slab allocator for cJSON with per-thread caches.
+ */
+
+#include <cjson/cJSON.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "json_alloc.h"
+
+/** @brief Bytes in front of each block; keeps payloads 16-byte aligned */
+#define HEADER_SIZE 16
+
+/** @brief Header value of blocks allocated with malloc() */
+#define LARGE_CLASS UINT32_MAX
+
+/** @brief Bytes carved into blocks at a time */
+#define SLAB_SIZE (64 * 1024)
+
+/** @brief Blocks moved between a thread and the depot at a time */
+#define BATCH_SIZE 128
+
+_Static_assert(JSON_ALLOC_MIN_CACHE >= 2 * BATCH_SIZE,
+               "a flush must leave a batch in the cache");
+
+/** @brief Most size classes: the string classes plus one for cJSON items */
+#define CLASS_COUNT 6
+
+/**
+ * @brief A free block, laid over its header and payload.
+ */
+struct free_block {
+    struct free_block *next;        /**< Next block of the list or batch */
+    struct free_block *next_batch;  /**< Next batch in the depot (first block only) */
+    uint32_t count;                 /**< Blocks in the batch (first block only) */
+};
+
+_Static_assert(sizeof(struct free_block) <= HEADER_SIZE + 16,
+               "free block must fit the smallest block");
+
+/**
+ * @brief Free lists and counters of one thread.
+ */
+struct slab_cache {
+    struct free_block *free[CLASS_COUNT];
+    uint32_t count[CLASS_COUNT];
+    JsonAllocStats stats;           /**< Written by the owner only */
+    struct slab_cache *prev, *next; /**< Registry of live caches */
+};
+
+/** @brief Payload size of each class, ascending */
+static size_t class_size[CLASS_COUNT];
+static int class_count = 0;
+
+/** @brief Class of each payload size rounded up to 16 bytes */
+static uint8_t class_of[JSON_ALLOC_MAX_SMALL / 16 + 1];
+
+/** @brief Batches of free blocks shared by all threads */
+static struct free_block *depot[CLASS_COUNT];
+
+/** @brief Slabs, chained through their first bytes */
+static void *slabs = NULL;
+
+/** @brief Caches of running threads */
+static struct slab_cache *caches = NULL;
+
+/** @brief Counters of threads that have exited */
+static JsonAllocStats retired;
+
+/** @brief Free blocks a thread keeps per class before giving a batch back */
+static int cache_limit = 4 * BATCH_SIZE;
+
+static size_t slab_bytes = 0;
+static int enabled = 0;
+
+/** @brief Guards the depot, the slab list, the registry and retired */
+static pthread_mutex_t depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t cache_key;
+
+/**
+ * @brief Adds to a counter that only the owning thread writes.
+ *
+ * A relaxed store lets json_alloc_stats() read it from another thread
+ * without a locked instruction on the owner's side.
+ */
+static inline void stat_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gives a list of count free blocks to the depot as one batch.
+ *
+ * @note Caller must hold depot_mutex
+ */
+static void depot_push(int cls, struct free_block *list, uint32_t count) {
+    list->count = count;
+    list->next_batch = depot[cls];
+    depot[cls] = list;
+}
+
+static void stats_fold(JsonAllocStats *into, const JsonAllocStats *from) {
+    into->allocs += __atomic_load_n(&from->allocs, __ATOMIC_RELAXED);
+    into->frees += __atomic_load_n(&from->frees, __ATOMIC_RELAXED);
+    into->large_allocs += __atomic_load_n(&from->large_allocs, __ATOMIC_RELAXED);
+    into->refills += __atomic_load_n(&from->refills, __ATOMIC_RELAXED);
+    into->flushes += __atomic_load_n(&from->flushes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Thread exit: hands the free lists to the depot.
+ */
+static void cache_release(void *ptr) {
+    struct slab_cache *cache = ptr;
+
+    pthread_mutex_lock(&depot_mutex);
+    for (int cls = 0; cls < class_count; cls++) {
+        if (cache->free[cls] != NULL) {
+            depot_push(cls, cache->free[cls], cache->count[cls]);
+        }
+    }
+    stats_fold(&retired, &cache->stats);
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    } else {
+        caches = cache->next;
+    }
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&depot_mutex);
+    free(cache);
+}
+
+/**
+ * @brief Returns this thread's cache, creating it on first use.
+ *
+ * @return Cache, or NULL on allocation failure
+ */
+static struct slab_cache *cache_get(void) {
+    struct slab_cache *cache = pthread_getspecific(cache_key);
+
+    if (cache != NULL) {
+        return cache;
+    }
+    cache = calloc(1, sizeof(struct slab_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (pthread_setspecific(cache_key, cache) != 0) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_lock(&depot_mutex);
+    cache->next = caches;
+    if (caches != NULL) {
+        caches->prev = cache;
+    }
+    caches = cache;
+    pthread_mutex_unlock(&depot_mutex);
+    return cache;
+}
+
+/**
+ * @brief Refills an empty free list from the depot, or from a new slab.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int cache_refill(struct slab_cache *cache, int cls) {
+    size_t block = HEADER_SIZE + class_size[cls];
+    struct free_block *list = NULL;
+    uint32_t count = 0;
+    char *slab;
+
+    pthread_mutex_lock(&depot_mutex);
+    if (depot[cls] != NULL) {
+        list = depot[cls];
+        depot[cls] = list->next_batch;
+        pthread_mutex_unlock(&depot_mutex);
+        cache->free[cls] = list;
+        cache->count[cls] = list->count;
+        stat_add(&cache->stats.refills, 1);
+        return 0;
+    }
+    pthread_mutex_unlock(&depot_mutex);
+
+    slab = malloc(SLAB_SIZE);
+    if (slab == NULL) {
+        return -1;
+    }
+    for (size_t i = (SLAB_SIZE - HEADER_SIZE) / block; i > 0; i--) {
+        struct free_block *b = (struct free_block *)(slab + HEADER_SIZE + (i - 1) * block);
+        b->next = list;
+        list = b;
+        count++;
+    }
+
+    pthread_mutex_lock(&depot_mutex);
+    *(void **)slab = slabs;
+    slabs = slab;
+    slab_bytes += SLAB_SIZE;
+    pthread_mutex_unlock(&depot_mutex);
+
+    cache->free[cls] = list;
+    cache->count[cls] = count;
+    return 0;
+}
+
+/**
+ * @brief Gives BATCH_SIZE blocks of an overfull free list to the depot.
+ */
+static void cache_flush(struct slab_cache *cache, int cls) {
+    struct free_block *batch = cache->free[cls];
+    struct free_block *last = batch;
+
+    for (int i = 1; i < BATCH_SIZE; i++) {
+        last = last->next;
+    }
+    cache->free[cls] = last->next;
+    cache->count[cls] -= BATCH_SIZE;
+    last->next = NULL;
+
+    pthread_mutex_lock(&depot_mutex);
+    depot_push(cls, batch, BATCH_SIZE);
+    pthread_mutex_unlock(&depot_mutex);
+    stat_add(&cache->stats.flushes, 1);
+}
+
+static void *large_alloc(struct slab_cache *cache, size_t size) {
+    char *block;
+
+    if (size > SIZE_MAX - HEADER_SIZE || (block = malloc(HEADER_SIZE + size)) == NULL) {
+        return NULL;
+    }
+    *(uint32_t *)block = LARGE_CLASS;
+    if (cache != NULL) {
+        stat_add(&cache->stats.large_allocs, 1);
+    }
+    return block + HEADER_SIZE;
+}
+
+static void *slab_malloc(size_t size) {
+    struct slab_cache *cache = cache_get();
+    struct free_block *b;
+    int cls;
+
+    if (size > JSON_ALLOC_MAX_SMALL || cache == NULL) {
+        return large_alloc(cache, size);
+    }
+    cls = class_of[(size + 15) / 16];
+    if (cache->free[cls] == NULL && cache_refill(cache, cls) != 0) {
+        return NULL;
+    }
+    b = cache->free[cls];
+    cache->free[cls] = b->next;
+    cache->count[cls]--;
+    stat_add(&cache->stats.allocs, 1);
+
+    *(uint32_t *)b = (uint32_t)cls;
+    return (char *)b + HEADER_SIZE;
+}
+
+static void slab_free(void *ptr) {
+    struct slab_cache *cache;
+    struct free_block *b;
+    uint32_t cls;
+
+    if (ptr == NULL) {
+        return;
+    }
+    b = (struct free_block *)((char *)ptr - HEADER_SIZE);
+    cls = *(uint32_t *)b;
+    if (cls == LARGE_CLASS) {
+        free(b);
+        return;
+    }
+
+    cache = cache_get();
+    if (cache == NULL) {
+        b->next = NULL;
+        pthread_mutex_lock(&depot_mutex);
+        depot_push((int)cls, b, 1);
+        pthread_mutex_unlock(&depot_mutex);
+        return;
+    }
+    b->next = cache->free[cls];
+    cache->free[cls] = b;
+    stat_add(&cache->stats.frees, 1);
+    if (++cache->count[cls] >= (uint32_t)__atomic_load_n(&cache_limit, __ATOMIC_RELAXED)) {
+        cache_flush(cache, (int)cls);
+    }
+}
+
+int json_alloc_init(int use_slabs) {
+    static const size_t strings[] = { 16, 32, 64, 128, 256 };
+    static int key_created = 0;
+    cJSON_Hooks hooks = { slab_malloc, slab_free };
+    size_t item = (sizeof(cJSON) + 15) & ~(size_t)15;
+    int n = 0;
+
+    if (!use_slabs) {
+        enabled = 0;
+        cJSON_InitHooks(NULL);
+        return 0;
+    }
+
+    /* String classes with the item class merged in, ascending */
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        if (item != 0 && item <= strings[i]) {
+            if (item < strings[i]) {
+                class_size[n++] = item;
+            }
+            item = 0;
+        }
+        class_size[n++] = strings[i];
+    }
+    if (item != 0 && item <= JSON_ALLOC_MAX_SMALL) {
+        class_size[n++] = item;
+    }
+    class_count = n;
+    for (int units = 0, cls = 0; units <= JSON_ALLOC_MAX_SMALL / 16; units++) {
+        while (class_size[cls] < (size_t)units * 16) {
+            cls++;
+        }
+        class_of[units] = (uint8_t)cls;
+    }
+
+    if (!key_created) {
+        if (pthread_key_create(&cache_key, cache_release) != 0) {
+            return -1;
+        }
+        key_created = 1;
+    }
+    cJSON_InitHooks(&hooks);
+    enabled = 1;
+    return 0;
+}
+
+void json_alloc_set_cache_limit(int blocks) {
+    if (blocks < JSON_ALLOC_MIN_CACHE) {
+        blocks = JSON_ALLOC_MIN_CACHE;
+    }
+    __atomic_store_n(&cache_limit, blocks, __ATOMIC_RELAXED);
+}
+
+void json_alloc_stats(JsonAllocStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->enabled = enabled;
+    if (!enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&depot_mutex);
+    stats_fold(stats, &retired);
+    for (struct slab_cache *cache = caches; cache != NULL; cache = cache->next) {
+        stats_fold(stats, &cache->stats);
+        stats->threads++;
+    }
+    stats->slab_bytes = slab_bytes;
+    pthread_mutex_unlock(&depot_mutex);
+}
+
+void json_alloc_cleanup(void) {
+    if (!enabled) {
+        return;
+    }
+    cJSON_InitHooks(NULL);
+    enabled = 0;
+
+    pthread_mutex_lock(&depot_mutex);
+    for (struct slab_cache *cache = caches; cache != NULL; cache = cache->next) {
+        memset(cache->free, 0, sizeof(cache->free));
+        memset(cache->count, 0, sizeof(cache->count));
+    }
+    memset(depot, 0, sizeof(depot));
+    while (slabs != NULL) {
+        void *next = *(void **)slabs;
+        free(slabs);
+        slabs = next;
+    }
+    slab_bytes = 0;
+    pthread_mutex_unlock(&depot_mutex);
+}
@@ -3,7 +3,8 @@
  * @brief Diet API server entry point.
  *
  * Initializes configuration, database, and HTTP server.
- * Handles graceful shutdown on SIGINT/SIGTERM.
+ * Handles graceful shutdown on SIGINT/SIGTERM and reloads the
+ * configuration on SIGHUP.
  */
 
 #include <microhttpd.h>
@@ -11,15 +12,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include "config.h"
 #include "db.h"
+#include "db_replica.h"
+#include "catalog.h"
+#include "suggest.h"
+#include "fuzzy.h"
+#include "template_index.h"
+#include "template_cache.h"
+#include "template_document.h"
+#include "catalog_bundle.h"
 #include "routes.h"
+#include "uring_server.h"
+#include "h2_server.h"
 #include "http_helpers.h"
+#include "json_alloc.h"
+#include "placement.h"
 
 /** @brief Flag for graceful shutdown */
 static volatile int running = 1;
 
+/** @brief Set by SIGHUP; the main loop reloads the configuration */
+static volatile sig_atomic_t reload_requested = 0;
+
+/** @brief HTTP/2 listener is running */
+static int h2_running = 0;
+
 /**
  * @brief Signal handler for graceful shutdown.
  *
@@ -34,28 +54,61 @@ static void handle_signal(int sig) {
 }
 
 /**
- * @brief Extracts numeric ID from URL path.
- *
- * Example: "/api/foods/123" with prefix "/api/foods/" returns 123
+ * @brief SIGHUP handler: asks the main loop for a configuration reload.
  *
- * @param url Full request URL
- * @param prefix URL prefix to strip (e.g., "/api/foods/")
- * @return Extracted ID, or -1 if URL doesn't match prefix
+ * @param sig Signal number (unused)
+ */
+static void handle_reload_signal(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
+/**
+ * @brief Applies reloadable settings that are not read on each use.
+ */
+static void apply_config(void) {
+    json_alloc_set_cache_limit(CONFIG_LIVE(json_slab_cache));
+    if (h2_running && h2_server_resize(CONFIG_LIVE(h2_threads)) != 0) {
+        fprintf(stderr, "Failed to resize the HTTP/2 handler pool\n");
+    }
+}
+
+/**
+ * @brief Reloads the configuration and prints what changed.
  */
-static int extract_id_from_path(const char *url, const char *prefix) {
-    size_t prefix_len = strlen(prefix);
-    if (strncmp(url, prefix, prefix_len) != 0) {
-        return -1;
+static void reload_config(void) {
+    ConfigUpdate update;
+
+    if (config_reload(&update) != 0) {
+        for (int i = 0; i < update.error_count && i < CONFIG_MAX_MESSAGES; i++) {
+            fprintf(stderr, "Config: %s\n", update.errors[i]);
+        }
+        fprintf(stderr, "Configuration not reloaded\n");
+        return;
     }
-    const char *id_str = url + prefix_len;
-    if (*id_str == '\0') {
-        return -1;
+    printf("Configuration reloaded: %d setting(s) applied\n", update.applied_count);
+    for (int i = 0; i < update.restart_count; i++) {
+        printf("  %s changed, takes effect after a restart\n", update.restart[i]);
     }
-    return atoi(id_str);
 }
 
-/** @brief Maximum POST body size (1MB) */
-#define MAX_POST_SIZE (1024 * 1024)
+/**
+ * @brief MHD connection callback: applies the idle timeout to new connections.
+ *
+ * The timeout also bounds the silence between header bytes, which MHD
+ * reads before calling request_handler.
+ */
+static void notify_connection(void *cls, struct MHD_Connection *connection,
+                              void **socket_context, enum MHD_ConnectionNotificationCode toe) {
+    int timeout = CONFIG_LIVE(http_idle_timeout);
+
+    (void)cls;
+    (void)socket_context;
+    if (toe == MHD_CONNECTION_NOTIFY_STARTED && timeout > 0) {
+        MHD_set_connection_option(connection, MHD_CONNECTION_OPTION_TIMEOUT,
+                                  (unsigned int)timeout);
+    }
+}
 
 /**
  * @brief Connection context for accumulating POST data.
@@ -63,39 +116,25 @@ static int extract_id_from_path(const char *url, const char *prefix) {
 struct connection_info {
     char *post_data;      /**< Accumulated POST body */
     size_t post_data_len; /**< Current length of accumulated data */
+    size_t post_data_cap; /**< Allocated size of post_data */
+    time_t started;       /**< When the headers were complete (monotonic seconds) */
 };
 
 /**
- * @brief Extracts template ID from /api/templates/{id}/full path.
- *
- * @param url Full request URL
- * @return Template ID, or -1 if URL doesn't match pattern
+ * @brief Returns monotonic time in seconds.
  */
-static int extract_template_id(const char *url) {
-    const char *prefix = "/api/templates/";
-    size_t prefix_len = strlen(prefix);
-
-    if (strncmp(url, prefix, prefix_len) != 0) {
-        return -1;
-    }
-
-    const char *id_start = url + prefix_len;
-    char *endptr;
-    long id = strtol(id_start, &endptr, 10);
+static time_t monotonic_now(void) {
+    struct timespec ts;
 
-    /* Check that we got a number followed by /full */
-    if (endptr == id_start || strcmp(endptr, "/full") != 0) {
-        return -1;
-    }
-
-    return (int)id;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
 }
 
 /**
  * @brief Main HTTP request handler callback.
  *
- * Routes incoming requests to appropriate handler functions
- * based on URL and HTTP method.
+ * Accumulates POST bodies, then hands each complete request to
+ * routes_dispatch().
  *
  * @param cls Custom user data (unused)
  * @param connection MHD connection handle
@@ -120,9 +159,20 @@ static enum MHD_Result request_handler(
     (void)cls;
     (void)version;
 
-    /* Handle CORS preflight requests */
-    if (strcmp(method, "OPTIONS") == 0) {
-        return send_json_response(connection, 200, "{}");
+    HttpRequest request;
+
+    /* Connection threads are created by MHD; pin them on first use */
+    placement_pin_thread(PLACEMENT_ROLE_HTTP);
+
+    /* First call of a request: refuse over-limit clients before reading the body */
+    if (*con_cls == NULL) {
+        int retry_after;
+
+        http_request_init_mhd(&request, connection, method, url, NULL, 0);
+        retry_after = routes_rate_limit(&request);
+        if (retry_after > 0) {
+            return send_rate_limited(&request, retry_after);
+        }
     }
 
     /* POST request handling - accumulate body data */
@@ -131,10 +181,19 @@ static enum MHD_Result request_handler(
 
         /* First call for this connection - initialize context */
         if (*con_cls == NULL) {
+            const char *length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                             "Content-Length");
+
+            /* Refuse a declared oversized body before reading any of it */
+            if (length != NULL && strtoull(length, NULL, 10) > routes_max_body_size(url)) {
+                return send_error_response(&request, 413, "Request body too large");
+            }
+
             con_info = calloc(1, sizeof(struct connection_info));
             if (con_info == NULL) {
                 return MHD_NO;
             }
+            con_info->started = monotonic_now();
             *con_cls = con_info;
             return MHD_YES;
         }
@@ -143,28 +202,48 @@ static enum MHD_Result request_handler(
 
         /* More data to accumulate */
         if (*upload_data_size > 0) {
-            /* Check size limit */
-            if (con_info->post_data_len + *upload_data_size > MAX_POST_SIZE) {
+            size_t max_size = routes_max_body_size(url);
+            size_t needed = con_info->post_data_len + *upload_data_size + 1;
+            int body_timeout = CONFIG_LIVE(http_body_timeout);
+
+            /* A client trickling its body must not hold the thread for long */
+            if (body_timeout > 0 && monotonic_now() - con_info->started > body_timeout) {
                 free(con_info->post_data);
                 free(con_info);
                 *con_cls = NULL;
-                return send_error_response(connection, 413, "Request body too large");
+                http_request_init_mhd(&request, connection, method, url, NULL, 0);
+                return send_error_response(&request, 408, "Request body timeout");
             }
 
-            /* Reallocate and append data */
-            char *new_data = realloc(con_info->post_data,
-                                     con_info->post_data_len + *upload_data_size + 1);
-            if (new_data == NULL) {
+            /* Check size limit */
+            if (con_info->post_data_len + *upload_data_size > max_size) {
                 free(con_info->post_data);
                 free(con_info);
                 *con_cls = NULL;
-                return MHD_NO;
+                http_request_init_mhd(&request, connection, method, url, NULL, 0);
+                return send_error_response(&request, 413, "Request body too large");
+            }
+
+            /* Grow geometrically so large bodies are not copied once per chunk */
+            if (needed > con_info->post_data_cap) {
+                size_t cap = con_info->post_data_cap > 0 ? con_info->post_data_cap * 2 : 4096;
+                while (cap < needed) {
+                    cap *= 2;
+                }
+                char *new_data = realloc(con_info->post_data, cap);
+                if (new_data == NULL) {
+                    free(con_info->post_data);
+                    free(con_info);
+                    *con_cls = NULL;
+                    return MHD_NO;
+                }
+                con_info->post_data = new_data;
+                con_info->post_data_cap = cap;
             }
 
-            memcpy(new_data + con_info->post_data_len, upload_data, *upload_data_size);
+            memcpy(con_info->post_data + con_info->post_data_len, upload_data, *upload_data_size);
             con_info->post_data_len += *upload_data_size;
-            new_data[con_info->post_data_len] = '\0';
-            con_info->post_data = new_data;
+            con_info->post_data[con_info->post_data_len] = '\0';
 
             *upload_data_size = 0;
             return MHD_YES;
@@ -173,14 +252,9 @@ static enum MHD_Result request_handler(
         /* All data received - route to handler */
         enum MHD_Result result;
 
-        /* Route: POST /api/benchmark/bulk-insert */
-        if (strcmp(url, "/api/benchmark/bulk-insert") == 0) {
-            result = handle_bulk_insert(connection,
-                                       con_info->post_data ? con_info->post_data : "",
-                                       con_info->post_data_len);
-        } else {
-            result = send_error_response(connection, 404, "Not found");
-        }
+        http_request_init_mhd(&request, connection, method, url,
+                              con_info->post_data, con_info->post_data_len);
+        result = routes_dispatch(&request);
 
         /* Cleanup POST data */
         free(con_info->post_data);
@@ -190,54 +264,16 @@ static enum MHD_Result request_handler(
         return result;
     }
 
-    /* Route: GET /health */
-    if (strcmp(url, "/health") == 0 && strcmp(method, "GET") == 0) {
-        return handle_health(connection);
-    }
-
-    /* Route: GET /api/categories */
-    if (strcmp(url, "/api/categories") == 0 && strcmp(method, "GET") == 0) {
-        return handle_list_categories(connection);
-    }
-
-    /* Route: GET /api/categories/{id} */
-    if (strncmp(url, "/api/categories/", 16) == 0 && strcmp(method, "GET") == 0) {
-        int id = extract_id_from_path(url, "/api/categories/");
-        if (id > 0) {
-            return handle_get_category(connection, id);
-        }
-    }
-
-    /* Route: GET /api/foods */
-    if (strcmp(url, "/api/foods") == 0 && strcmp(method, "GET") == 0) {
-        return handle_list_foods(connection);
-    }
-
-    /* Route: GET /api/foods/{id} */
-    if (strncmp(url, "/api/foods/", 11) == 0 && strcmp(method, "GET") == 0) {
-        int id = extract_id_from_path(url, "/api/foods/");
-        if (id > 0) {
-            return handle_get_food(connection, id);
-        }
-    }
-
-    /* Route: GET /api/templates/{id}/full */
-    if (strcmp(method, "GET") == 0) {
-        int template_id = extract_template_id(url);
-        if (template_id > 0) {
-            return handle_get_template_full(connection, template_id);
-        }
-    }
-
-    /* 404 Not Found */
-    return send_error_response(connection, 404, "Not found");
+    http_request_init_mhd(&request, connection, method, url, NULL, 0);
+    return routes_dispatch(&request);
 }
 
 /**
  * @brief Application entry point.
  *
  * Initializes all components and starts the HTTP server.
- * Runs until SIGINT or SIGTERM is received.
+ * Runs until SIGINT or SIGTERM is received; SIGHUP reloads the
+ * configuration.
  *
  * @param argc Argument count (unused)
  * @param argv Argument vector (unused)
@@ -247,15 +283,29 @@ int main(int argc, char *argv[]) {
     (void)argc;
     (void)argv;
 
-    struct MHD_Daemon *daemon;
+    struct MHD_Daemon *daemon = NULL;
+    int uring_running = 0;
 
     /* Setup signal handlers for graceful shutdown */
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
+    signal(SIGHUP, handle_reload_signal);
 
-    /* Load configuration from environment */
+    /* Load configuration from environment and CONFIG_FILE */
     if (load_config() != 0) {
         fprintf(stderr, "Failed to load configuration\n");
+        free_config();
+        return 1;
+    }
+
+    /* Select the cJSON allocator before anything builds a document */
+    json_alloc_init(config.json_slab);
+    json_alloc_set_cache_limit(config.json_slab_cache);
+    config_subscribe(apply_config);
+
+    /* Thread and memory placement, before any cache is loaded */
+    if (placement_init(config.cpu_affinity, config.numa_shards, config.huge_pages) != 0) {
+        free_config();
         return 1;
     }
 
@@ -266,21 +316,73 @@ int main(int argc, char *argv[]) {
     if (db_init() != 0) {
         fprintf(stderr, "Failed to initialize database (continuing without DB)\n");
     }
+    if (db_replica_init() != 0) {
+        fprintf(stderr, "Ignoring DB_REPLICAS, template-full reads stay on the primary\n");
+    }
+    if (template_document_init() != 0) {
+        fprintf(stderr, "Template-full documents disabled\n");
+    }
+    template_cache_init();
+
+    /* Load in-memory catalog and build search indexes */
+    if (catalog_load() != 0 || suggest_build(catalog_get()) != 0 ||
+        fuzzy_build(catalog_get()) != 0) {
+        fprintf(stderr, "Failed to load food catalog (search endpoints disabled)\n");
+    }
+
+    /* Precompute daily nutrition profiles for template search */
+    if (template_index_load() != 0) {
+        fprintf(stderr, "Failed to load template profiles (template search disabled)\n");
+    }
+
+    /* Start the io_uring front end if requested, falling back to MHD */
+    if (strcmp(config.http_frontend, "uring") == 0) {
+        int rc = uring_server_start(config.server_port, config.uring_threads);
+
+        if (rc == 0) {
+            uring_running = 1;
+        } else if (rc == URING_ERROR_UNAVAILABLE) {
+            fprintf(stderr, "io_uring front end not built (make URING=1), using libmicrohttpd\n");
+        } else {
+            fprintf(stderr, "Failed to start io_uring front end, using libmicrohttpd\n");
+        }
+    }
 
     /* Start HTTP server with thread-per-connection model */
-    daemon = MHD_start_daemon(
-        MHD_USE_THREAD_PER_CONNECTION | MHD_USE_INTERNAL_POLLING_THREAD,
-        config.server_port,
-        NULL, NULL,
-        &request_handler, NULL,
-        MHD_OPTION_END
-    );
-
-    if (daemon == NULL) {
-        fprintf(stderr, "Failed to start HTTP server\n");
-        db_cleanup();
-        free_config();
-        return 1;
+    if (!uring_running) {
+        daemon = MHD_start_daemon(
+            MHD_USE_THREAD_PER_CONNECTION | MHD_USE_INTERNAL_POLLING_THREAD,
+            config.server_port,
+            NULL, NULL,
+            &request_handler, NULL,
+            MHD_OPTION_NOTIFY_CONNECTION, &notify_connection, NULL,
+            MHD_OPTION_CONNECTION_LIMIT, (unsigned int)config.http_connection_limit,
+            MHD_OPTION_PER_IP_CONNECTION_LIMIT, (unsigned int)config.http_per_ip_connection_limit,
+            MHD_OPTION_END
+        );
+
+        if (daemon == NULL) {
+            fprintf(stderr, "Failed to start HTTP server\n");
+            db_replica_cleanup();
+            db_cleanup();
+            free_config();
+            return 1;
+        }
+    }
+
+    /* HTTP/2 listener alongside the HTTP/1.1 one */
+    if (config.h2_port > 0) {
+        int rc = h2_server_start(config.h2_port, config.h2_threads,
+                                 config.tls_cert_file, config.tls_key_file, config.tls_ktls,
+                                 config.http_connection_limit);
+
+        if (rc == 0) {
+            h2_running = 1;
+        } else if (rc == H2_ERROR_UNAVAILABLE) {
+            fprintf(stderr, "HTTP/2 support not built (make HTTP2=1), H2_PORT ignored\n");
+        } else {
+            fprintf(stderr, "Failed to start HTTP/2 listener on port %d\n", config.h2_port);
+        }
     }
 
     printf("Server running on http://localhost:%d\n", config.server_port);
@@ -289,11 +391,30 @@ int main(int argc, char *argv[]) {
     /* Main loop - wait for shutdown signal */
     while (running) {
         sleep(1);
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config();
+        }
     }
 
     /* Cleanup resources */
-    MHD_stop_daemon(daemon);
+    if (h2_running) {
+        h2_server_stop();
+    }
+    if (uring_running) {
+        uring_server_stop();
+    } else {
+        MHD_stop_daemon(daemon);
+    }
+    catalog_bundle_cleanup();
+    template_index_cleanup();
+    template_cache_cleanup();
+    fuzzy_cleanup();
+    suggest_cleanup();
+    catalog_cleanup();
+    db_replica_cleanup();
     db_cleanup();
+    json_alloc_cleanup();
     free_config();
 
     printf("Server stopped\n");
@@ -0,0 +1,532 @@
+/**
+ * @file meal_planner.c
+ * @brief Generates a day of meals that hits nutrition targets.
+ *
+ * A plan is a fixed number of slots (foods) per meal, each with a
+ * portion. The score is the weighted squared relative error of the
+ * plan's totals against the targets. Each worker runs simulated
+ * annealing over two moves: nudge one portion, or swap one food for
+ * another candidate of the same meal at roughly the same calories.
+ * Totals are updated incrementally, so a step is a handful of float
+ * operations and a worker evaluates millions of plans per second.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "meal_planner.h"
+#include "catalog.h"
+#include "config.h"
+
+/** @brief Maximum number of slots (foods) in a plan */
+#define PLAN_MAX_SLOTS (PLAN_MAX_MEALS * PLAN_MAX_ITEMS)
+
+/** @brief Upper bound on worker threads per request */
+#define PLAN_MAX_THREADS 16
+
+/** @brief Portion granularity in grams */
+#define PORTION_STEP 5
+
+/** @brief Steps without a new best before a worker restarts */
+#define STALL_LIMIT 20000
+
+/** @brief Score at which every target is met within a fraction of a percent */
+#define SCORE_GOOD_ENOUGH 1e-5
+
+/** @brief Starting annealing temperature, in score units */
+#define START_TEMPERATURE 1e-3
+
+/** @brief Number of optimized nutrients (calories, protein, carbs, fat) */
+#define NUTRIENTS 4
+
+/** @brief Read-only search input shared by all workers */
+struct search_space {
+    const Catalog *cat;
+    int slot_count;
+    int slot_meal[PLAN_MAX_SLOTS];          /**< Meal of each slot */
+    int *candidates[PLAN_MAX_MEALS];        /**< Catalog indices usable per meal */
+    int candidate_count[PLAN_MAX_MEALS];
+    int assignment[PLAN_MAX_SLOTS];         /**< Distinct foods filling every slot */
+    double target[NUTRIENTS];
+    double weight[NUTRIENTS];               /**< Importance / target^2, 0 if unconstrained */
+    double start;                           /**< Monotonic start time (seconds) */
+    double budget;                          /**< Search time (seconds) */
+    int stop;                               /**< Set once any worker is good enough */
+};
+
+/** @brief A candidate plan */
+struct solution {
+    int food[PLAN_MAX_SLOTS];
+    int grams[PLAN_MAX_SLOTS];
+    double total[NUTRIENTS];
+    double score;
+};
+
+/** @brief Per-thread search state */
+struct worker {
+    struct search_space *space;
+    pthread_t thread;
+    uint64_t rng;
+    long iterations;
+    struct solution best;
+};
+
+/**
+ * @brief Returns monotonic time in seconds.
+ */
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief xorshift64* step; the state must be non-zero.
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief Returns a uniform integer in [0, n).
+ */
+static int random_below(uint64_t *state, int n) {
+    return (int)((next_random(state) >> 33) % (uint64_t)n);
+}
+
+/**
+ * @brief Returns a uniform double in [0, 1).
+ */
+static double random_unit(uint64_t *state) {
+    return (double)(next_random(state) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * @brief Writes the per-gram nutrients of a food.
+ */
+static void food_per_gram(const Catalog *cat, int food, double *out) {
+    out[0] = cat->calories[food] / 100.0;
+    out[1] = cat->protein[food] / 100.0;
+    out[2] = cat->carbs[food] / 100.0;
+    out[3] = cat->fat[food] / 100.0;
+}
+
+/**
+ * @brief Gets the allowed portion range of a food (half to twice its default).
+ */
+static void portion_bounds(const Catalog *cat, int food, int *lo, int *hi) {
+    int portion = cat->default_portions[food] > 0 ? cat->default_portions[food] : 100;
+
+    *lo = portion / 2 / PORTION_STEP * PORTION_STEP;
+    if (*lo < PORTION_STEP) {
+        *lo = PORTION_STEP;
+    }
+    *hi = portion * 2 / PORTION_STEP * PORTION_STEP;
+    if (*hi < *lo) {
+        *hi = *lo;
+    }
+}
+
+/**
+ * @brief Clamps grams to a food's portion range, rounded to PORTION_STEP.
+ */
+static int clamp_portion(const Catalog *cat, int food, double grams) {
+    int lo, hi;
+    int g = (int)(grams / PORTION_STEP + 0.5) * PORTION_STEP;
+
+    portion_bounds(cat, food, &lo, &hi);
+    return g < lo ? lo : (g > hi ? hi : g);
+}
+
+/**
+ * @brief Scores plan totals against the targets.
+ */
+static double score_totals(const struct search_space *space, const double *total) {
+    double score = 0;
+    for (int k = 0; k < NUTRIENTS; k++) {
+        double diff = total[k] - space->target[k];
+        score += space->weight[k] * diff * diff;
+    }
+    return score;
+}
+
+/**
+ * @brief Returns non-zero if a food already fills a slot of the plan.
+ */
+static int plan_uses(const struct solution *sol, int slots, int food) {
+    for (int s = 0; s < slots; s++) {
+        if (sol->food[s] == food) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Recomputes a solution's totals and score from scratch.
+ */
+static void solution_evaluate(const struct search_space *space, struct solution *sol) {
+    double per_gram[NUTRIENTS];
+
+    memset(sol->total, 0, sizeof(sol->total));
+    for (int s = 0; s < space->slot_count; s++) {
+        food_per_gram(space->cat, sol->food[s], per_gram);
+        for (int k = 0; k < NUTRIENTS; k++) {
+            sol->total[k] += per_gram[k] * sol->grams[s];
+        }
+    }
+    sol->score = score_totals(space, sol->total);
+}
+
+/**
+ * @brief Fills every slot with a random unused candidate at its default portion.
+ *
+ * Slots sharing a small pool can leave a later slot with every candidate
+ * taken by earlier picks; the plan then starts from space->assignment.
+ */
+static void solution_random(const struct search_space *space, uint64_t *rng, struct solution *sol) {
+    for (int s = 0; s < space->slot_count; s++) {
+        int meal = space->slot_meal[s];
+        const int *pool = space->candidates[meal];
+        int count = space->candidate_count[meal];
+        int start = random_below(rng, count);
+        int tries = 0;
+
+        /* Scan the pool once from a random start */
+        while (tries < count && plan_uses(sol, s, pool[(start + tries) % count])) {
+            tries++;
+        }
+        if (tries == count) {
+            memcpy(sol->food, space->assignment, sizeof(sol->food));
+            for (s = 0; s < space->slot_count; s++) {
+                sol->grams[s] = clamp_portion(space->cat, sol->food[s],
+                                              space->cat->default_portions[sol->food[s]]);
+            }
+            break;
+        }
+
+        sol->food[s] = pool[(start + tries) % count];
+        sol->grams[s] = clamp_portion(space->cat, sol->food[s],
+                                      space->cat->default_portions[sol->food[s]]);
+    }
+    solution_evaluate(space, sol);
+}
+
+/**
+ * @brief Worker thread: anneals from random starts until the budget runs out.
+ */
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    struct search_space *space = w->space;
+    const Catalog *cat = space->cat;
+    struct solution current;
+    double temperature = START_TEMPERATURE;
+    long since_best = 0;
+
+    solution_random(space, &w->rng, &current);
+    w->best = current;
+
+    for (;;) {
+        /* Check the clock and the shared stop flag every 256 steps */
+        if ((w->iterations & 255) == 0) {
+            double elapsed = monotonic_seconds() - space->start;
+            if (elapsed >= space->budget || __atomic_load_n(&space->stop, __ATOMIC_RELAXED)) {
+                break;
+            }
+            double remaining = 1.0 - elapsed / space->budget;
+            temperature = START_TEMPERATURE * remaining * remaining;
+        }
+        w->iterations++;
+
+        int s = random_below(&w->rng, space->slot_count);
+        int food = current.food[s];
+        int grams = current.grams[s];
+        int new_food = food;
+        int new_grams;
+        double old_per_gram[NUTRIENTS], new_per_gram[NUTRIENTS], total[NUTRIENTS];
+
+        food_per_gram(cat, food, old_per_gram);
+
+        if (random_below(&w->rng, 4) != 0) {
+            /* Nudge the portion by 1-4 steps */
+            int delta = (1 + random_below(&w->rng, 4)) * PORTION_STEP;
+            new_grams = clamp_portion(cat, food, grams + (random_below(&w->rng, 2) ? delta : -delta));
+            if (new_grams == grams) {
+                continue;
+            }
+            memcpy(new_per_gram, old_per_gram, sizeof(new_per_gram));
+        } else {
+            /* Swap the food, keeping the slot's calories where possible */
+            int meal = space->slot_meal[s];
+            new_food = space->candidates[meal][random_below(&w->rng, space->candidate_count[meal])];
+            if (plan_uses(&current, space->slot_count, new_food)) {
+                continue;
+            }
+            food_per_gram(cat, new_food, new_per_gram);
+            new_grams = clamp_portion(cat, new_food, new_per_gram[0] > 0
+                                      ? old_per_gram[0] * grams / new_per_gram[0]
+                                      : cat->default_portions[new_food]);
+        }
+
+        for (int k = 0; k < NUTRIENTS; k++) {
+            total[k] = current.total[k] - old_per_gram[k] * grams + new_per_gram[k] * new_grams;
+        }
+        double score = score_totals(space, total);
+
+        if (score > current.score &&
+            (temperature <= 0 || random_unit(&w->rng) >= exp((current.score - score) / temperature))) {
+            continue;
+        }
+
+        current.food[s] = new_food;
+        current.grams[s] = new_grams;
+        memcpy(current.total, total, sizeof(total));
+        current.score = score;
+
+        if (score < w->best.score) {
+            w->best = current;
+            since_best = 0;
+            if (score < SCORE_GOOD_ENOUGH) {
+                __atomic_store_n(&space->stop, 1, __ATOMIC_RELAXED);
+            }
+        } else if (++since_best > STALL_LIMIT) {
+            /* Restart, alternating between the best plan and a fresh one */
+            if (random_below(&w->rng, 2)) {
+                current = w->best;
+            } else {
+                solution_random(space, &w->rng, &current);
+            }
+            solution_evaluate(space, &current);
+            since_best = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns non-zero if a food satisfies a meal's constraints.
+ */
+static int meal_accepts(const Catalog *cat, const PlanMeal *meal, int food) {
+    if (cat->calories[food] <= 0) {
+        return 0;
+    }
+    if (meal->snack_only && !cat->snack_suitable[food]) {
+        return 0;
+    }
+    if (meal->category_count == 0) {
+        return 1;
+    }
+    for (int c = 0; c < meal->category_count; c++) {
+        if (cat->category_ids[food] == meal->category_ids[c]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Gives slot s a food, moving other slots to other foods if needed.
+ *
+ * One step of bipartite matching (augmenting path).
+ *
+ * @param owner Slot holding each catalog food, or -1
+ * @param seen Foods already tried in this step
+ * @return Non-zero if slot s got a food
+ */
+static int assign_slot(struct search_space *space, int s, int *owner, unsigned char *seen) {
+    int meal = space->slot_meal[s];
+
+    for (int i = 0; i < space->candidate_count[meal]; i++) {
+        int food = space->candidates[meal][i];
+
+        if (seen[food]) {
+            continue;
+        }
+        seen[food] = 1;
+        if (owner[food] < 0 || assign_slot(space, owner[food], owner, seen)) {
+            owner[food] = s;
+            space->assignment[s] = food;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds distinct foods for every slot, if there are enough.
+ *
+ * Each meal having item_count candidates is not enough when meals draw
+ * from the same foods; this checks all slots together.
+ *
+ * @return 0 on success, PLAN_ERROR_NO_CANDIDATES, or PLAN_ERROR_INTERNAL
+ */
+static int space_assign(struct search_space *space) {
+    int *owner = malloc((size_t)space->cat->count * sizeof(int));
+    unsigned char *seen = malloc((size_t)space->cat->count);
+    int rc = 0;
+
+    if (owner == NULL || seen == NULL) {
+        free(owner);
+        free(seen);
+        return PLAN_ERROR_INTERNAL;
+    }
+    for (int i = 0; i < space->cat->count; i++) {
+        owner[i] = -1;
+    }
+    for (int s = 0; s < space->slot_count && rc == 0; s++) {
+        memset(seen, 0, (size_t)space->cat->count);
+        if (!assign_slot(space, s, owner, seen)) {
+            rc = PLAN_ERROR_NO_CANDIDATES;
+        }
+    }
+    free(owner);
+    free(seen);
+    return rc;
+}
+
+/**
+ * @brief Frees the candidate lists of a search space.
+ */
+static void space_free(struct search_space *space) {
+    for (int m = 0; m < PLAN_MAX_MEALS; m++) {
+        free(space->candidates[m]);
+    }
+}
+
+int meal_planner_generate(const PlanRequest *request, PlanResult *result) {
+    const Catalog *cat = catalog_get();
+    struct search_space space;
+    struct worker *workers;
+    int thread_count, started, best, rc;
+
+    if (cat == NULL) {
+        return PLAN_ERROR_NO_CATALOG;
+    }
+
+    memset(&space, 0, sizeof(space));
+    space.cat = cat;
+
+    /* Candidate foods per meal */
+    for (int m = 0; m < request->meal_count; m++) {
+        const PlanMeal *meal = &request->meals[m];
+        int count = 0;
+
+        for (int i = 0; i < cat->count; i++) {
+            count += meal_accepts(cat, meal, i);
+        }
+        if (count < meal->item_count) {
+            space_free(&space);
+            return PLAN_ERROR_NO_CANDIDATES;
+        }
+
+        space.candidates[m] = malloc((size_t)count * sizeof(int));
+        if (space.candidates[m] == NULL) {
+            space_free(&space);
+            return PLAN_ERROR_INTERNAL;
+        }
+        for (int i = 0; i < cat->count; i++) {
+            if (meal_accepts(cat, meal, i)) {
+                space.candidates[m][space.candidate_count[m]++] = i;
+            }
+        }
+        for (int j = 0; j < meal->item_count; j++) {
+            space.slot_meal[space.slot_count++] = m;
+        }
+    }
+
+    rc = space_assign(&space);
+    if (rc != 0) {
+        space_free(&space);
+        return rc;
+    }
+
+    /* Calories weigh double; unset macro targets are ignored */
+    space.target[0] = request->calories;
+    space.target[1] = request->protein;
+    space.target[2] = request->carbs;
+    space.target[3] = request->fat;
+    for (int k = 0; k < NUTRIENTS; k++) {
+        if (space.target[k] > 0) {
+            space.weight[k] = (k == 0 ? 2.0 : 1.0) / (space.target[k] * space.target[k]);
+        }
+    }
+
+    thread_count = CONFIG_LIVE(plan_threads);
+    if (thread_count <= 0) {
+        thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (thread_count > PLAN_MAX_THREADS) {
+        thread_count = PLAN_MAX_THREADS;
+    }
+
+    workers = calloc((size_t)thread_count, sizeof(struct worker));
+    if (workers == NULL) {
+        space_free(&space);
+        return PLAN_ERROR_INTERNAL;
+    }
+
+    uint64_t seed = request->seed != 0 ? request->seed
+                                       : (uint64_t)(monotonic_seconds() * 1e9);
+    for (int t = 0; t < thread_count; t++) {
+        workers[t].space = &space;
+        /* splitmix64 of seed + t, so workers start from different plans */
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        workers[t].rng = (z ^ (z >> 31)) | 1;
+    }
+
+    space.start = monotonic_seconds();
+    space.budget = request->time_budget_ms / 1000.0;
+
+    /* The calling thread is worker 0 */
+    for (started = 1; started < thread_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]) != 0) {
+            break;
+        }
+    }
+    worker_run(&workers[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    best = 0;
+    memset(result, 0, sizeof(*result));
+    for (int t = 0; t < started; t++) {
+        result->iterations += workers[t].iterations;
+        if (workers[t].best.score < workers[best].best.score) {
+            best = t;
+        }
+    }
+    result->threads = started;
+
+    const struct solution *sol = &workers[best].best;
+    int s = 0;
+    for (int m = 0; m < request->meal_count; m++) {
+        for (int j = 0; j < request->meals[m].item_count; j++, s++) {
+            result->items[m][j].index = sol->food[s];
+            result->items[m][j].grams = sol->grams[s];
+        }
+    }
+    result->calories = (float)sol->total[0];
+    result->protein = (float)sol->total[1];
+    result->carbs = (float)sol->total[2];
+    result->fat = (float)sol->total[3];
+    result->score = sol->score;
+
+    free(workers);
+    space_free(&space);
+    return 0;
+}
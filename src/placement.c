@@ -0,0 +1,513 @@
+/**
+ * @file placement.c
+ * @brief CPU affinity, NUMA placement and huge pages (Linux).
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+#include "placement.h"
+
+/** @brief Size and alignment of a transparent or explicit huge page */
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+/**
+ * @brief A mapping made by placement_alloc().
+ */
+struct region {
+    PlacementRegion info;
+    void *map;                  /**< Start of the mapping (== info.addr) */
+    size_t map_len;             /**< Bytes mapped */
+    struct region *next;
+};
+
+static int pinning = 0;
+static int numa_shards = 0;
+static PlacementHugePages huge_pages = PLACEMENT_HUGE_OFF;
+
+/** @brief Node of each CPU */
+static unsigned char cpu_node[PLACEMENT_MAX_CPUS];
+
+/** @brief CPUs threads are pinned to, in the order they are handed out */
+static int pin_cpus[PLACEMENT_MAX_CPUS];
+static int pin_cpu_count = 0;
+
+static int node_count = 1;
+
+/** @brief Next entry of pin_cpus to hand out */
+static unsigned int next_pin = 0;
+
+static int pinned[PLACEMENT_ROLE_COUNT];
+static int cpu_threads[PLACEMENT_MAX_CPUS];
+
+static struct region *regions = NULL;
+static pthread_mutex_t region_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t pinned_key;
+
+/**
+ * @brief Parses a CPU list such as "0-3,8,10-11" into a flag array.
+ *
+ * @return 0 on success, -1 if malformed
+ */
+static int parse_cpu_list(const char *list, unsigned char *set) {
+    const char *p = list;
+
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last;
+
+        if (end == p || first < 0 || first >= PLACEMENT_MAX_CPUS) {
+            return -1;
+        }
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= PLACEMENT_MAX_CPUS) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            set[cpu] = 1;
+        }
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads which node each CPU belongs to from sysfs.
+ */
+static void read_topology(void) {
+    unsigned char set[PLACEMENT_MAX_CPUS];
+    char path[64], line[4096];
+
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        FILE *f;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        memset(set, 0, sizeof(set));
+        if (fgets(line, sizeof(line), f) != NULL && parse_cpu_list(line, set) == 0) {
+            for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                if (set[cpu]) {
+                    cpu_node[cpu] = (unsigned char)node;
+                }
+            }
+            node_count = node + 1;
+        }
+        fclose(f);
+    }
+}
+
+/**
+ * @brief Fills set with the CPUs this process may run on.
+ */
+static void allowed_cpus(unsigned char *set) {
+#ifdef __linux__
+    cpu_set_t mask;
+
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            set[cpu] = CPU_ISSET(cpu, &mask) ? 1 : 0;
+        }
+        return;
+    }
+#endif
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < online && cpu < PLACEMENT_MAX_CPUS; cpu++) {
+        set[cpu] = 1;
+    }
+}
+
+/**
+ * @brief Orders the chosen CPUs so that consecutive threads alternate nodes.
+ */
+static void order_pin_cpus(const unsigned char *set) {
+    int taken[PLACEMENT_MAX_NODES] = { 0 };
+    int added;
+
+    pin_cpu_count = 0;
+    do {
+        added = 0;
+        for (int node = 0; node < node_count; node++) {
+            int seen = 0;
+
+            for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                if (!set[cpu] || cpu_node[cpu] != node) {
+                    continue;
+                }
+                if (seen++ == taken[node]) {
+                    pin_cpus[pin_cpu_count++] = cpu;
+                    taken[node]++;
+                    added = 1;
+                    break;
+                }
+            }
+        }
+    } while (added);
+}
+
+int placement_init(const char *cpus, int shards, const char *pages) {
+    unsigned char allowed[PLACEMENT_MAX_CPUS] = { 0 };
+    unsigned char chosen[PLACEMENT_MAX_CPUS] = { 0 };
+
+    if (strcmp(pages, "off") == 0 || pages[0] == '\0') {
+        huge_pages = PLACEMENT_HUGE_OFF;
+    } else if (strcmp(pages, "thp") == 0) {
+        huge_pages = PLACEMENT_HUGE_THP;
+    } else if (strcmp(pages, "explicit") == 0) {
+        huge_pages = PLACEMENT_HUGE_EXPLICIT;
+    } else {
+        fprintf(stderr, "HUGE_PAGES must be off, thp or explicit\n");
+        return -1;
+    }
+
+#ifdef __linux__
+    read_topology();
+    numa_shards = shards && node_count > 1;
+    allowed_cpus(allowed);
+
+    if (cpus[0] != '\0') {
+        if (strcmp(cpus, "all") == 0) {
+            memcpy(chosen, allowed, sizeof(chosen));
+        } else if (parse_cpu_list(cpus, chosen) != 0) {
+            fprintf(stderr, "CPU_AFFINITY must be all or a CPU list such as 0-7,16-23\n");
+            return -1;
+        }
+        for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            chosen[cpu] &= allowed[cpu];
+        }
+        order_pin_cpus(chosen);
+        if (pin_cpu_count == 0) {
+            fprintf(stderr, "CPU_AFFINITY names no usable CPU, threads are not pinned\n");
+        } else if (pthread_key_create(&pinned_key, NULL) == 0) {
+            pinning = 1;
+        }
+    }
+#else
+    (void)shards;
+    (void)allowed;
+    (void)chosen;
+    if (cpus[0] != '\0') {
+        fprintf(stderr, "CPU_AFFINITY is only supported on Linux\n");
+    }
+#endif
+
+    if (pinning || numa_shards || huge_pages != PLACEMENT_HUGE_OFF) {
+        printf("Placement: %d node(s), %s, numa shards %s, huge pages %s\n",
+               node_count, pinning ? "threads pinned" : "threads not pinned",
+               numa_shards ? "on" : "off", placement_huge_pages_name(huge_pages));
+    }
+    return 0;
+}
+
+void placement_pin_thread(PlacementRole role) {
+#ifdef __linux__
+    cpu_set_t mask;
+    int cpu;
+
+    if (!pinning || pthread_getspecific(pinned_key) != NULL) {
+        return;
+    }
+    cpu = pin_cpus[__atomic_fetch_add(&next_pin, 1, __ATOMIC_RELAXED) % (unsigned int)pin_cpu_count];
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) {
+        __atomic_add_fetch(&pinned[role], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&cpu_threads[cpu], 1, __ATOMIC_RELAXED);
+    }
+    /* Mark the thread even if it failed, so it is not retried per request */
+    pthread_setspecific(pinned_key, &pinned[role]);
+#else
+    (void)role;
+#endif
+}
+
+int placement_node_count(void) {
+    return numa_shards ? node_count : 1;
+}
+
+int placement_current_node(void) {
+#ifdef __linux__
+    if (numa_shards) {
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && cpu < PLACEMENT_MAX_CPUS) {
+            return cpu_node[cpu];
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Arguments of a placement_run_on_node() thread.
+ */
+struct node_job {
+    void (*fn)(void *);
+    void *arg;
+};
+
+static void *node_job_main(void *arg) {
+    struct node_job *job = arg;
+    job->fn(job->arg);
+    return NULL;
+}
+
+int placement_run_on_node(int node, void (*fn)(void *), void *arg) {
+#ifdef __linux__
+    unsigned char allowed[PLACEMENT_MAX_CPUS] = { 0 };
+    struct node_job job = { fn, arg };
+    pthread_attr_t attr;
+    pthread_t thread;
+    cpu_set_t mask;
+    int cpus = 0, rc;
+
+    allowed_cpus(allowed);
+    CPU_ZERO(&mask);
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (allowed[cpu] && cpu_node[cpu] == node) {
+            CPU_SET(cpu, &mask);
+            cpus++;
+        }
+    }
+    if (cpus == 0) {
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask);
+    rc = pthread_create(&thread, &attr, node_job_main, &job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    return 0;
+#else
+    (void)node;
+    fn(arg);
+    return 0;
+#endif
+}
+
+/**
+ * @brief Maps len bytes aligned to HUGE_PAGE_SIZE.
+ *
+ * @return Mapping, or MAP_FAILED
+ */
+static void *map_aligned(size_t len) {
+    char *raw = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *aligned;
+
+    if (raw == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, (size_t)(aligned - raw));
+    }
+    if (raw + len + HUGE_PAGE_SIZE > aligned + len) {
+        munmap(aligned + len, (size_t)(raw + len + HUGE_PAGE_SIZE - (aligned + len)));
+    }
+    return aligned;
+}
+
+void *placement_alloc(const char *label, size_t size, int node) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t huge_len = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    struct region *r = calloc(1, sizeof(struct region));
+    void *map = MAP_FAILED;
+
+    if (r == NULL || size == 0) {
+        free(r);
+        return NULL;
+    }
+
+#ifdef MAP_HUGETLB
+    if (huge_pages == PLACEMENT_HUGE_EXPLICIT) {
+        map = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        r->map_len = huge_len;
+        r->info.pages = PLACEMENT_HUGE_EXPLICIT;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (map == MAP_FAILED && huge_pages != PLACEMENT_HUGE_OFF) {
+        map = map_aligned(huge_len);
+        if (map != MAP_FAILED) {
+            madvise(map, huge_len, MADV_HUGEPAGE);
+        }
+        r->map_len = huge_len;
+        r->info.pages = PLACEMENT_HUGE_THP;
+    }
+#endif
+    if (map == MAP_FAILED) {
+        r->map_len = (size + page - 1) & ~(page - 1);
+        r->info.pages = PLACEMENT_HUGE_OFF;
+        map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            free(r);
+            return NULL;
+        }
+    }
+
+#ifdef PR_SET_VMA_ANON_NAME
+    /* Shows up as [anon:<label>] in /proc/<pid>/maps (Linux 5.17+) */
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, (unsigned long)map, r->map_len, (unsigned long)label);
+#endif
+
+    r->map = map;
+    r->info.label = label;
+    r->info.addr = map;
+    r->info.size = size;
+    r->info.wanted_node = node;
+
+    pthread_mutex_lock(&region_mutex);
+    r->next = regions;
+    regions = r;
+    pthread_mutex_unlock(&region_mutex);
+    return map;
+}
+
+void placement_free(void *ptr) {
+    struct region **link, *r = NULL;
+
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&region_mutex);
+    for (link = &regions; *link != NULL; link = &(*link)->next) {
+        if ((*link)->map == ptr) {
+            r = *link;
+            *link = r->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&region_mutex);
+
+    if (r != NULL) {
+        munmap(r->map, r->map_len);
+        free(r);
+    }
+}
+
+void placement_stats(PlacementStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->pinning = pinning;
+    stats->numa_shards = numa_shards;
+    stats->huge_pages = huge_pages;
+    stats->nodes = node_count;
+    stats->cpus = pin_cpu_count;
+    for (int role = 0; role < PLACEMENT_ROLE_COUNT; role++) {
+        stats->pinned[role] = __atomic_load_n(&pinned[role], __ATOMIC_RELAXED);
+    }
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+        int threads = __atomic_load_n(&cpu_threads[cpu], __ATOMIC_RELAXED);
+        stats->cpu_threads[cpu] = threads;
+        stats->node_threads[cpu_node[cpu]] += threads;
+    }
+}
+
+/**
+ * @brief Returns the node holding the page at addr, or -1.
+ */
+static int page_node(const void *addr) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    void *pages[1] = { (void *)addr };
+    int status[1] = { -1 };
+
+    /* With no target nodes, move_pages() only reports where pages are */
+    if (syscall(SYS_move_pages, 0, 1UL, pages, NULL, status, 0) == 0 && status[0] >= 0) {
+        return status[0];
+    }
+#else
+    (void)addr;
+#endif
+    return -1;
+}
+
+/**
+ * @brief Adds the huge page usage of each mapping in smaps to its region.
+ *
+ * @note Caller must hold region_mutex
+ */
+static void read_huge_bytes(void) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    struct region *current = NULL;
+    char line[512];
+
+    if (f == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end, kb;
+
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            current = NULL;
+            for (struct region *r = regions; r != NULL; r = r->next) {
+                uintptr_t map = (uintptr_t)r->map;
+                if (start >= map && end <= map + r->map_len) {
+                    current = r;
+                    break;
+                }
+            }
+        } else if (current != NULL &&
+                   (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+                    sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                    sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1)) {
+            current->info.huge_bytes += (size_t)kb * 1024;
+        }
+    }
+    fclose(f);
+}
+
+int placement_regions(PlacementRegion *out, int max) {
+    int n = 0;
+
+    pthread_mutex_lock(&region_mutex);
+    for (struct region *r = regions; r != NULL; r = r->next) {
+        r->info.huge_bytes = 0;
+    }
+    read_huge_bytes();
+    for (struct region *r = regions; r != NULL && n < max; r = r->next) {
+        out[n] = r->info;
+        out[n].node = page_node(r->map);
+        n++;
+    }
+    pthread_mutex_unlock(&region_mutex);
+    return n;
+}
+
+const char *placement_huge_pages_name(PlacementHugePages pages) {
+    switch (pages) {
+    case PLACEMENT_HUGE_THP:
+        return "thp";
+    case PLACEMENT_HUGE_EXPLICIT:
+        return "explicit";
+    default:
+        return "off";
+    }
+}
@@ -0,0 +1,224 @@
+/**
+ * @file rate_limit.c
+ * @brief Lock-free table of per-client token buckets.
+ */
+
+#define _GNU_SOURCE
+#include <netinet/in.h>
+#include <string.h>
+#include <time.h>
+#include "rate_limit.h"
+
+/** @brief Token fractions per request */
+#define TOKEN_UNIT 1000u
+
+/** @brief Buckets per group (one 64-byte cache line) */
+#define GROUP_SLOTS 4
+
+/**
+ * @brief A bucket.
+ *
+ * state holds the time of the last refill in milliseconds (high 32 bits,
+ * wrapping) and the tokens left in 1/TOKEN_UNIT (low 32 bits), so that
+ * one compare-and-swap updates both.
+ */
+struct bucket {
+    uint64_t key;       /**< Client and class hash, never 0 (0 = free) */
+    uint64_t state;
+};
+
+struct group {
+    struct bucket slot[GROUP_SLOTS];
+} __attribute__((aligned(64)));
+
+static struct group table[RATE_LIMIT_GROUPS];
+
+static uint64_t limited[RATE_CLASS_COUNT];
+static uint64_t evictions;
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Milliseconds on a wrapping 32-bit clock.
+ */
+static uint32_t now_ms(void) {
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+RateClass rate_limit_class(const char *method, const char *path) {
+    if (strcmp(method, "OPTIONS") == 0 || strcmp(path, "/health") == 0 ||
+        strcmp(path, "/metrics") == 0 || strncmp(path, "/admin/", 7) == 0) {
+        return RATE_CLASS_NONE;
+    }
+    if (strcmp(method, "POST") == 0) {
+        if (strcmp(path, "/api/benchmark/bulk-insert") == 0 ||
+            strcmp(path, "/api/foods/import") == 0) {
+            return RATE_CLASS_WRITE;
+        }
+        if (strcmp(path, "/api/plans/generate") == 0) {
+            return RATE_CLASS_HEAVY;
+        }
+        return RATE_CLASS_READ;
+    }
+    if (strncmp(path, "/api/export/", 12) == 0 || strcmp(path, "/api/catalog/bundle") == 0) {
+        return RATE_CLASS_HEAVY;
+    }
+    if (strncmp(path, "/api/templates/", 15) == 0) {
+        size_t len = strlen(path);
+
+        if (len > 5 && strcmp(path + len - 5, "/full") == 0) {
+            return RATE_CLASS_HEAVY;
+        }
+    }
+    return RATE_CLASS_READ;
+}
+
+uint64_t rate_limit_client(const char *key, size_t key_len, const struct sockaddr_storage *addr) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    if (key != NULL) {
+        return fnv1a(key, key_len, fnv1a("k", 1, hash));
+    }
+    if (addr != NULL && addr->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        return fnv1a(&in->sin_addr, sizeof(in->sin_addr), hash);
+    }
+    if (addr != NULL && addr->ss_family == AF_INET6) {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+
+        /* IPv4-mapped addresses count as the IPv4 client */
+        if (IN6_IS_ADDR_V4MAPPED(in6)) {
+            return fnv1a(&in6->s6_addr[12], 4, hash);
+        }
+        return fnv1a(in6, sizeof(*in6), hash);
+    }
+    return hash;
+}
+
+/**
+ * @brief Finds or claims the bucket of a key.
+ */
+static struct bucket *bucket_get(uint64_t key, uint32_t now, uint32_t full) {
+    struct group *g = &table[key >> 50 & (RATE_LIMIT_GROUPS - 1)];
+    struct bucket *oldest = &g->slot[0];
+    uint32_t oldest_age = 0;
+
+    _Static_assert((RATE_LIMIT_GROUPS & (RATE_LIMIT_GROUPS - 1)) == 0,
+                   "RATE_LIMIT_GROUPS must be a power of two");
+
+    for (int i = 0; i < GROUP_SLOTS; i++) {
+        struct bucket *b = &g->slot[i];
+        uint64_t k = __atomic_load_n(&b->key, __ATOMIC_ACQUIRE);
+
+        if (k == key) {
+            return b;
+        }
+        if (k == 0) {
+            uint64_t expected = 0;
+
+            __atomic_store_n(&b->state, (uint64_t)now << 32 | full, __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&b->key, &expected, key, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                return b;
+            }
+            if (expected == key) {
+                return b;
+            }
+            continue;
+        }
+        uint32_t age = now - (uint32_t)(__atomic_load_n(&b->state, __ATOMIC_RELAXED) >> 32);
+        if (age >= oldest_age) {
+            oldest_age = age;
+            oldest = b;
+        }
+    }
+
+    /* Group full: reuse the bucket refilled longest ago */
+    __atomic_store_n(&oldest->key, key, __ATOMIC_RELEASE);
+    __atomic_store_n(&oldest->state, (uint64_t)now << 32 | full, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+    return oldest;
+}
+
+int rate_limit_take(uint64_t client, RateClass cls, int rate, int burst_seconds) {
+    uint64_t key = mix(client + (uint64_t)cls * 0x9e3779b97f4a7c15ULL) | 1;
+    uint64_t capacity = (uint64_t)rate * (uint64_t)burst_seconds;
+    uint32_t now = now_ms(), full;
+    struct bucket *b;
+    uint64_t state;
+
+    if (rate <= 0) {
+        return 0;
+    }
+    capacity = (capacity > 0 ? capacity : 1) * TOKEN_UNIT;
+    full = capacity > UINT32_MAX ? UINT32_MAX : (uint32_t)capacity;
+
+    b = bucket_get(key, now, full);
+    state = __atomic_load_n(&b->state, __ATOMIC_RELAXED);
+    for (;;) {
+        uint32_t last = (uint32_t)(state >> 32);
+        int32_t elapsed = (int32_t)(now - last);
+        uint64_t tokens = state & UINT32_MAX;
+
+        /* Another thread may have stored a later time */
+        if (elapsed > 0) {
+            /* rate requests per second = rate token units per millisecond */
+            tokens += (uint64_t)elapsed * (uint64_t)rate;
+            last = now;
+        }
+
+        if (tokens > full) {
+            tokens = full;
+        }
+        if (tokens < TOKEN_UNIT) {
+            uint64_t wait_ms = (TOKEN_UNIT - tokens + (uint64_t)rate - 1) / (uint64_t)rate;
+
+            __atomic_add_fetch(&limited[cls], 1, __ATOMIC_RELAXED);
+            return (int)((wait_ms + 999) / 1000);
+        }
+        if (__atomic_compare_exchange_n(&b->state, &state,
+                                        (uint64_t)last << 32 | (tokens - TOKEN_UNIT), 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+}
+
+void rate_limit_stats(RateLimitStats *stats) {
+    for (int i = 0; i < RATE_CLASS_COUNT; i++) {
+        stats->limited[i] = __atomic_load_n(&limited[i], __ATOMIC_RELAXED);
+    }
+    stats->evictions = __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+}
+
+const char *rate_limit_class_name(RateClass cls) {
+    switch (cls) {
+    case RATE_CLASS_READ: return "read";
+    case RATE_CLASS_HEAVY: return "heavy";
+    case RATE_CLASS_WRITE: return "write";
+    default: return "none";
+    }
+}
@@ -11,25 +11,340 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <time.h>
 #include "routes.h"
+#include "config.h"
 #include "http_helpers.h"
 #include "db.h"
-
-enum MHD_Result handle_health(struct MHD_Connection *connection) {
+#include "db_replica.h"
+#include "catalog.h"
+#include "suggest.h"
+#include "fuzzy.h"
+#include "food_filter.h"
+#include "template_index.h"
+#include "template_cache.h"
+#include "template_document.h"
+#include "meal_planner.h"
+#include "exporter.h"
+#include "food_import.h"
+#include "catalog_bundle.h"
+#include "json_alloc.h"
+#include "placement.h"
+#include "rate_limit.h"
+
+enum MHD_Result handle_health(HttpRequest *request) {
     cJSON *root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "status", "ok");
     cJSON_AddStringToObject(root, "service", "diet-api-c");
 
     char *json_str = cJSON_PrintUnformatted(root);
-    enum MHD_Result ret = send_json_response(connection, 200, json_str);
+    enum MHD_Result ret = send_json_response(request, 200, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+/** @brief Most placement regions listed by /metrics */
+#define METRICS_MAX_REGIONS 64
+
+static const char *const placement_role_names[PLACEMENT_ROLE_COUNT] = {
+    "http", "uring", "h2"
+};
+
+/**
+ * @brief Adds thread and memory placement to a metrics object.
+ */
+static void add_placement_metrics(cJSON *root) {
+    PlacementStats stats;
+    PlacementRegion regions[METRICS_MAX_REGIONS];
+    cJSON *placement = cJSON_AddObjectToObject(root, "placement");
+    cJSON *threads, *cpus, *nodes, *memory;
+    int count;
+
+    placement_stats(&stats);
+    cJSON_AddBoolToObject(placement, "pinning", stats.pinning);
+    cJSON_AddBoolToObject(placement, "numa_shards", stats.numa_shards);
+    cJSON_AddStringToObject(placement, "huge_pages", placement_huge_pages_name(stats.huge_pages));
+    cJSON_AddNumberToObject(placement, "nodes", stats.nodes);
+    cJSON_AddNumberToObject(placement, "cpus", stats.cpus);
+
+    threads = cJSON_AddObjectToObject(placement, "pinned_threads");
+    for (int role = 0; role < PLACEMENT_ROLE_COUNT; role++) {
+        cJSON_AddNumberToObject(threads, placement_role_names[role], stats.pinned[role]);
+    }
+    cpus = cJSON_AddObjectToObject(placement, "cpu_threads");
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+        if (stats.cpu_threads[cpu] > 0) {
+            char key[16];
+            snprintf(key, sizeof(key), "%d", cpu);
+            cJSON_AddNumberToObject(cpus, key, stats.cpu_threads[cpu]);
+        }
+    }
+    nodes = cJSON_AddArrayToObject(placement, "node_threads");
+    for (int node = 0; node < stats.nodes && node < PLACEMENT_MAX_NODES; node++) {
+        cJSON_AddItemToArray(nodes, cJSON_CreateNumber(stats.node_threads[node]));
+    }
+
+    memory = cJSON_AddArrayToObject(placement, "memory");
+    count = placement_regions(regions, METRICS_MAX_REGIONS);
+    for (int i = 0; i < count; i++) {
+        cJSON *region = cJSON_CreateObject();
+        cJSON_AddStringToObject(region, "name", regions[i].label);
+        cJSON_AddNumberToObject(region, "bytes", (double)regions[i].size);
+        cJSON_AddNumberToObject(region, "wanted_node", regions[i].wanted_node);
+        cJSON_AddNumberToObject(region, "node", regions[i].node);
+        cJSON_AddStringToObject(region, "pages", placement_huge_pages_name(regions[i].pages));
+        cJSON_AddNumberToObject(region, "huge_bytes", (double)regions[i].huge_bytes);
+        cJSON_AddItemToArray(memory, region);
+    }
+}
+
+/**
+ * @brief Adds the "db_pool" section of /metrics.
+ */
+static void add_db_pool_metrics(cJSON *root) {
+    DbPoolStats stats;
+    cJSON *pool = cJSON_AddObjectToObject(root, "db_pool");
+
+    db_pool_stats(&stats);
+    cJSON_AddNumberToObject(pool, "min", stats.min);
+    cJSON_AddNumberToObject(pool, "max", stats.max);
+    cJSON_AddNumberToObject(pool, "target", stats.target);
+    cJSON_AddNumberToObject(pool, "ceiling", stats.ceiling);
+    cJSON_AddNumberToObject(pool, "open", stats.open);
+    cJSON_AddNumberToObject(pool, "idle", stats.idle);
+    cJSON_AddNumberToObject(pool, "waiting", stats.waiting);
+    cJSON_AddNumberToObject(pool, "queries_per_sec", stats.queries_per_sec);
+    cJSON_AddNumberToObject(pool, "mean_wait_us", stats.mean_wait_us);
+    cJSON_AddNumberToObject(pool, "mean_exec_us", stats.mean_exec_us);
+    cJSON_AddNumberToObject(pool, "busy", stats.busy);
+    cJSON_AddNumberToObject(pool, "mysql_threads_running", stats.mysql_threads_running);
+    cJSON_AddNumberToObject(pool, "queries", (double)stats.queries);
+    cJSON_AddNumberToObject(pool, "waits", (double)stats.waits);
+    cJSON_AddNumberToObject(pool, "grows", (double)stats.grows);
+    cJSON_AddNumberToObject(pool, "shrinks", (double)stats.shrinks);
+    cJSON_AddNumberToObject(pool, "saturations", (double)stats.saturations);
+}
+
+/**
+ * @brief Adds the "db_replicas" section of /metrics.
+ */
+static void add_db_replica_metrics(cJSON *root) {
+    DbReplicaStats stats;
+    cJSON *section = cJSON_AddObjectToObject(root, "db_replicas");
+    cJSON *routes;
+
+    db_replica_stats(&stats);
+    cJSON_AddNumberToObject(section, "replicas", stats.replicas);
+    cJSON_AddNumberToObject(section, "hedge_percent", stats.hedge_percent);
+    cJSON_AddNumberToObject(section, "over_budget", (double)stats.over_budget);
+    cJSON_AddNumberToObject(section, "cancelled", (double)stats.cancelled);
+    cJSON_AddNumberToObject(section, "fallbacks", (double)stats.fallbacks);
+    routes = cJSON_AddObjectToObject(section, "routes");
+    for (int i = 0; i < stats.route_count; i++) {
+        cJSON *route = cJSON_AddObjectToObject(routes, stats.routes[i].name);
+
+        cJSON_AddNumberToObject(route, "p95_us", (double)stats.routes[i].p95_us);
+        cJSON_AddNumberToObject(route, "reads", (double)stats.routes[i].reads);
+        cJSON_AddNumberToObject(route, "hedges", (double)stats.routes[i].hedges);
+        cJSON_AddNumberToObject(route, "hedge_wins", (double)stats.routes[i].hedge_wins);
+    }
+}
+
+/**
+ * @brief Adds the "template_cache" section of /metrics.
+ */
+static void add_template_cache_metrics(cJSON *root) {
+    TemplateCacheStats stats;
+    cJSON *section = cJSON_AddObjectToObject(root, "template_cache");
+
+    template_cache_stats(&stats);
+    cJSON_AddBoolToObject(section, "enabled", stats.enabled);
+    cJSON_AddNumberToObject(section, "templates", stats.templates);
+    cJSON_AddNumberToObject(section, "snapshots", (double)stats.snapshots);
+    cJSON_AddNumberToObject(section, "days", (double)stats.days);
+    cJSON_AddNumberToObject(section, "meals", (double)stats.meals);
+    cJSON_AddNumberToObject(section, "loads", (double)stats.loads);
+    cJSON_AddNumberToObject(section, "updates", (double)stats.updates);
+    cJSON_AddNumberToObject(section, "invalidations", (double)stats.invalidations);
+    cJSON_AddNumberToObject(section, "serialized_bytes", (double)stats.serialized_bytes);
+    cJSON_AddNumberToObject(section, "patches", (double)stats.patches);
+    cJSON_AddNumberToObject(section, "full_patches", (double)stats.full_patches);
+}
+
+/**
+ * @brief Adds the "rate_limit" section of /metrics.
+ */
+static void add_rate_limit_metrics(cJSON *root) {
+    RateLimitStats stats;
+    cJSON *limits = cJSON_AddObjectToObject(root, "rate_limit");
+    cJSON *limited = cJSON_AddObjectToObject(limits, "limited");
+
+    rate_limit_stats(&stats);
+    for (int cls = 0; cls < RATE_CLASS_COUNT; cls++) {
+        cJSON_AddNumberToObject(limited, rate_limit_class_name((RateClass)cls),
+                                (double)stats.limited[cls]);
+    }
+    cJSON_AddNumberToObject(limits, "evictions", (double)stats.evictions);
+}
+
+enum MHD_Result handle_metrics(HttpRequest *request) {
+    cJSON *root = cJSON_CreateObject();
+    JsonAllocStats alloc_stats;
+
+    add_placement_metrics(root);
+    add_db_pool_metrics(root);
+    add_db_replica_metrics(root);
+    add_template_cache_metrics(root);
+    add_rate_limit_metrics(root);
+
+    json_alloc_stats(&alloc_stats);
+    cJSON *alloc = cJSON_AddObjectToObject(root, "json_alloc");
+    cJSON_AddBoolToObject(alloc, "slab", alloc_stats.enabled);
+    if (alloc_stats.enabled) {
+        cJSON_AddNumberToObject(alloc, "threads", alloc_stats.threads);
+        cJSON_AddNumberToObject(alloc, "allocs", (double)alloc_stats.allocs);
+        cJSON_AddNumberToObject(alloc, "frees", (double)alloc_stats.frees);
+        cJSON_AddNumberToObject(alloc, "large_allocs", (double)alloc_stats.large_allocs);
+        cJSON_AddNumberToObject(alloc, "refills", (double)alloc_stats.refills);
+        cJSON_AddNumberToObject(alloc, "flushes", (double)alloc_stats.flushes);
+        cJSON_AddNumberToObject(alloc, "slab_bytes", (double)alloc_stats.slab_bytes);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    enum MHD_Result ret = send_json_response(request, 200, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+enum MHD_Result handle_get_config(HttpRequest *request) {
+    if (!http_peer_is_local(request)) {
+        return send_error_response(request, 403, "Forbidden");
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *settings = cJSON_AddArrayToObject(root, "settings");
+    char value[256];
+
+    for (int i = 0; i < config_option_count; i++) {
+        const ConfigOption *option = &config_options[i];
+        const char *source = config_format(option, value, sizeof(value));
+        cJSON *item = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(item, "key", option->key);
+        if (option->type == CONFIG_INT) {
+            cJSON_AddNumberToObject(item, "value", atoi(value));
+        } else {
+            cJSON_AddStringToObject(item, "value", value);
+        }
+        cJSON_AddStringToObject(item, "source", source);
+        cJSON_AddBoolToObject(item, "reloadable", option->reloadable);
+        cJSON_AddItemToArray(settings, item);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    enum MHD_Result ret = send_json_response(request, 200, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+/**
+ * @brief Sends the outcome of a configuration update.
+ *
+ * Response: {"applied": [...], "restart_required": [...], "errors": [...]}
+ * with status 400 if nothing was applied because of errors.
+ */
+static enum MHD_Result send_config_update(HttpRequest *request, const ConfigUpdate *update) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *list;
+
+    list = cJSON_AddArrayToObject(root, "applied");
+    for (int i = 0; i < update->applied_count; i++) {
+        cJSON_AddItemToArray(list, cJSON_CreateString(update->applied[i]));
+    }
+    list = cJSON_AddArrayToObject(root, "restart_required");
+    for (int i = 0; i < update->restart_count; i++) {
+        cJSON_AddItemToArray(list, cJSON_CreateString(update->restart[i]));
+    }
+    list = cJSON_AddArrayToObject(root, "errors");
+    for (int i = 0; i < update->error_count && i < CONFIG_MAX_MESSAGES; i++) {
+        cJSON_AddItemToArray(list, cJSON_CreateString(update->errors[i]));
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    enum MHD_Result ret = send_json_response(request, update->error_count > 0 ? 400 : 200,
+                                             json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_list_categories(struct MHD_Connection *connection) {
+enum MHD_Result handle_set_config(HttpRequest *request,
+                                  const char *post_data, size_t post_data_size) {
+    const char *pairs[CONFIG_MAX_MESSAGES][2];
+    char numbers[CONFIG_MAX_MESSAGES][32];
+    ConfigUpdate update;
+    cJSON *json_input, *item;
+    int count = 0;
+
+    (void)post_data_size;
+
+    if (!http_peer_is_local(request)) {
+        return send_error_response(request, 403, "Forbidden");
+    }
+    json_input = cJSON_Parse(post_data);
+    if (!cJSON_IsObject(json_input)) {
+        cJSON_Delete(json_input);
+        return send_error_response(request, 400, "Expected a JSON object of settings");
+    }
+
+    cJSON_ArrayForEach(item, json_input) {
+        if (count == CONFIG_MAX_MESSAGES) {
+            cJSON_Delete(json_input);
+            return send_error_response(request, 400, "Too many settings");
+        }
+        if (cJSON_IsString(item)) {
+            pairs[count][1] = item->valuestring;
+        } else if (cJSON_IsNumber(item)) {
+            snprintf(numbers[count], sizeof(numbers[count]), "%.0f", item->valuedouble);
+            pairs[count][1] = numbers[count];
+        } else if (cJSON_IsBool(item)) {
+            pairs[count][1] = cJSON_IsTrue(item) ? "1" : "0";
+        } else {
+            cJSON_Delete(json_input);
+            return send_error_response(request, 400, "Setting values must be strings or numbers");
+        }
+        pairs[count][0] = item->string;
+        count++;
+    }
+
+    config_set(pairs, count, &update);
+    cJSON_Delete(json_input);
+    return send_config_update(request, &update);
+}
+
+enum MHD_Result handle_reload_config(HttpRequest *request) {
+    ConfigUpdate update;
+
+    if (!http_peer_is_local(request)) {
+        return send_error_response(request, 403, "Forbidden");
+    }
+    config_reload(&update);
+    return send_config_update(request, &update);
+}
+
+enum MHD_Result handle_list_categories(HttpRequest *request) {
     MYSQL_RES *result;
     MYSQL_ROW row;
     cJSON *root, *categories, *item;
@@ -42,7 +357,7 @@ enum MHD_Result handle_list_categories(struct MHD_Connection *connection) {
     );
 
     if (result == NULL) {
-        return send_error_response(connection, 500, "Database error");
+        return send_error_response(request, 500, "Database error");
     }
 
     root = cJSON_CreateObject();
@@ -64,15 +379,15 @@ enum MHD_Result handle_list_categories(struct MHD_Connection *connection) {
     mysql_free_result(result);
 
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 200, json_str);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_get_category(struct MHD_Connection *connection, int id) {
+enum MHD_Result handle_get_category(HttpRequest *request, int id) {
     MYSQL_RES *result;
     MYSQL_ROW row;
     cJSON *root, *category;
@@ -87,13 +402,13 @@ enum MHD_Result handle_get_category(struct MHD_Connection *connection, int id) {
     result = db_query(query);
 
     if (result == NULL) {
-        return send_error_response(connection, 500, "Database error");
+        return send_error_response(request, 500, "Database error");
     }
 
     row = mysql_fetch_row(result);
     if (row == NULL) {
         mysql_free_result(result);
-        return send_error_response(connection, 404, "Category not found");
+        return send_error_response(request, 404, "Category not found");
     }
 
     root = cJSON_CreateObject();
@@ -109,15 +424,183 @@ enum MHD_Result handle_get_category(struct MHD_Connection *connection, int id) {
     mysql_free_result(result);
 
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 200, json_str);
+    ret = send_json_response(request, 200, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+/**
+ * @brief Adds a catalog food to a JSON object in the /api/foods shape.
+ *
+ * @param item Target JSON object
+ * @param cat Loaded catalog
+ * @param idx Catalog index of the food
+ */
+static void add_catalog_food(cJSON *item, const Catalog *cat, int idx) {
+    cJSON_AddNumberToObject(item, "id", cat->ids[idx]);
+    cJSON_AddStringToObject(item, "name", cat->names[idx]);
+    cJSON_AddNumberToObject(item, "category_id", cat->category_ids[idx]);
+    cJSON_AddNumberToObject(item, "calories", cat->calories[idx]);
+    cJSON_AddNumberToObject(item, "protein", cat->protein[idx]);
+    cJSON_AddNumberToObject(item, "carbs", cat->carbs[idx]);
+    cJSON_AddNumberToObject(item, "fat", cat->fat[idx]);
+}
+
+/**
+ * @brief Sends a /api/foods style list of catalog foods.
+ *
+ * @param request The HTTP request
+ * @param cat Loaded catalog
+ * @param indices Catalog indices to include, in order
+ * @param distances Edit distance per food, or NULL to omit the field
+ * @param count Number of foods
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+static enum MHD_Result send_catalog_foods(HttpRequest *request,
+                                          const Catalog *cat, const int *indices,
+                                          const int *distances, int count) {
+    cJSON *root, *foods, *item;
+    char *json_str;
+    enum MHD_Result ret;
+
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", 1);
+    foods = cJSON_AddArrayToObject(root, "foods");
+
+    for (int i = 0; i < count; i++) {
+        item = cJSON_CreateObject();
+        add_catalog_food(item, cat, indices[i]);
+        if (distances != NULL) {
+            cJSON_AddNumberToObject(item, "distance", distances[i]);
+        }
+        cJSON_AddItemToArray(foods, item);
+    }
+
+    cJSON_AddNumberToObject(root, "count", count);
+
+    json_str = cJSON_PrintUnformatted(root);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_list_foods(struct MHD_Connection *connection) {
+/**
+ * @brief Serves GET /api/foods?search=... from the in-memory catalog.
+ *
+ * Plain search is a folded substring match; fuzzy search goes through
+ * the trigram index and reports each food's edit distance.
+ *
+ * @param request The HTTP request
+ * @param search Raw search string
+ * @param fuzzy Non-zero for typo-tolerant search
+ * @param category_id Category filter (0 for any)
+ * @param limit Maximum number of results
+ * @return MHD_YES on success, MHD_NO on failure
+ */
+static enum MHD_Result list_foods_in_memory(HttpRequest *request,
+                                            const char *search, int fuzzy,
+                                            int category_id, int limit) {
+    const Catalog *cat;
+    int *indices = malloc((size_t)limit * sizeof(int));
+    int *distances = NULL;
+    FuzzyMatch *matches = NULL;
+    int count;
+    enum MHD_Result ret;
+
+    if (indices == NULL) {
+        return send_error_response(request, 500, "Out of memory");
+    }
+    if (fuzzy) {
+        matches = malloc((size_t)limit * sizeof(FuzzyMatch));
+        distances = malloc((size_t)limit * sizeof(int));
+        if (matches == NULL || distances == NULL) {
+            free(matches);
+            free(distances);
+            free(indices);
+            return send_error_response(request, 500, "Out of memory");
+        }
+    }
+
+    /* Indices are only meaningful for the catalog they were found in */
+    catalog_read_lock();
+    cat = catalog_get();
+    if (fuzzy) {
+        count = fuzzy_search(search, category_id, matches, limit);
+        for (int i = 0; i < count; i++) {
+            indices[i] = matches[i].index;
+            distances[i] = matches[i].distance;
+        }
+    } else {
+        count = catalog_search(search, category_id, indices, limit);
+    }
+
+    if (cat == NULL || count < 0) {
+        ret = send_error_response(request, 503, "Catalog not loaded");
+    } else {
+        ret = send_catalog_foods(request, cat, indices, distances, count);
+    }
+    catalog_read_unlock();
+
+    free(matches);
+    free(distances);
+    free(indices);
+    return ret;
+}
+
+/**
+ * @brief Reads min_<nutrient>, max_<nutrient> and sort from the query string.
+ *
+ * @param request The HTTP request
+ * @param filter Filter to fill in (must be initialized)
+ * @param active Set to non-zero if any of the parameters was given
+ * @return 0 on success, -1 if a parameter is malformed
+ */
+static int parse_food_filter(HttpRequest *request, FoodFilter *filter, int *active) {
+    char key[32];
+
+    *active = 0;
+    for (int n = 0; n < NUTRIENT_COUNT; n++) {
+        for (int bound = 0; bound < 2; bound++) {
+            const char *value;
+            char *end;
+
+            snprintf(key, sizeof(key), "%s_%s", bound == 0 ? "min" : "max",
+                     food_filter_nutrient_name((Nutrient)n));
+            value = http_query_arg(request, key);
+            if (value == NULL) {
+                continue;
+            }
+
+            float parsed = strtof(value, &end);
+            if (end == value || *end != '\0' || parsed != parsed) {
+                return -1;
+            }
+            if (bound == 0) {
+                filter->min[n] = parsed;
+            } else {
+                filter->max[n] = parsed;
+            }
+            *active = 1;
+        }
+    }
+
+    const char *sort = http_query_arg(request, "sort");
+    if (sort != NULL) {
+        if (food_filter_parse_sort(sort, filter) != 0) {
+            return -1;
+        }
+        *active = 1;
+    }
+    return 0;
+}
+
+enum MHD_Result handle_list_foods(HttpRequest *request) {
     MYSQL_RES *result;
     MYSQL_ROW row;
     cJSON *root, *foods, *item;
@@ -125,12 +608,60 @@ enum MHD_Result handle_list_foods(struct MHD_Connection *connection) {
     enum MHD_Result ret;
 
     /* Get query parameters */
-    const char *category_id_str = MHD_lookup_connection_value(
-        connection, MHD_GET_ARGUMENT_KIND, "category_id");
-    const char *search = MHD_lookup_connection_value(
-        connection, MHD_GET_ARGUMENT_KIND, "search");
-    const char *limit_str = MHD_lookup_connection_value(
-        connection, MHD_GET_ARGUMENT_KIND, "limit");
+    const char *category_id_str = http_query_arg(request, "category_id");
+    const char *search = http_query_arg(request, "search");
+    const char *limit_str = http_query_arg(request, "limit");
+    const char *fuzzy = http_query_arg(request, "fuzzy");
+
+    /* Parse and validate limit parameter */
+    int limit = 100;
+    if (limit_str != NULL) {
+        limit = atoi(limit_str);
+        if (limit <= 0 || limit > 1000) limit = 100;
+    }
+
+    int use_fuzzy = fuzzy != NULL && (strcmp(fuzzy, "1") == 0 || strcmp(fuzzy, "true") == 0);
+
+    /* Nutrition ranges and sorting are evaluated over the catalog columns */
+    FoodFilter filter;
+    int filter_active;
+    food_filter_init(&filter);
+    if (parse_food_filter(request, &filter, &filter_active) != 0) {
+        return send_error_response(request, 400, "Invalid nutrition filter or sort");
+    }
+    if (filter_active) {
+        if (use_fuzzy) {
+            return send_error_response(request, 400,
+                                       "Fuzzy search cannot be combined with nutrition filters");
+        }
+        filter.category_id = category_id_str ? atoi(category_id_str) : 0;
+        filter.search = search;
+
+        int *indices = malloc((size_t)limit * sizeof(int));
+        if (indices == NULL) {
+            return send_error_response(request, 500, "Out of memory");
+        }
+        catalog_read_lock();
+        if (catalog_get() == NULL) {
+            ret = send_error_response(request, 503, "Catalog not loaded");
+        } else {
+            int count = food_filter_run(&filter, indices, limit);
+            if (count < 0) {
+                ret = send_error_response(request, 500, "Filter failed");
+            } else {
+                ret = send_catalog_foods(request, catalog_get(), indices, NULL, count);
+            }
+        }
+        catalog_read_unlock();
+        free(indices);
+        return ret;
+    }
+
+    /* Name search is answered from the in-memory catalog when loaded */
+    if (search != NULL && search[0] != '\0' && (use_fuzzy || catalog_get() != NULL)) {
+        return list_foods_in_memory(request, search, use_fuzzy,
+                                    category_id_str ? atoi(category_id_str) : 0, limit);
+    }
 
     char query[1024];
     char where_clause[512] = "";
@@ -143,28 +674,23 @@ enum MHD_Result handle_list_foods(struct MHD_Connection *connection) {
         has_where = 1;
     }
 
-    /*
-     * @warning SQL injection vulnerability!
-     * TODO: Use mysql_real_escape_string() for search parameter
-     */
-    if (search != NULL && strlen(search) > 0) {
+    /* Fallback when the catalog is not loaded: escaped LIKE search */
+    if (search != NULL && strlen(search) > 0 && db_get_connection() != NULL) {
+        char escaped[2 * 100 + 1];
+        size_t search_len = strlen(search);
+        if (search_len > 100) search_len = 100;
+        mysql_real_escape_string(db_get_connection(), escaped, search, search_len);
+
         if (has_where) {
             snprintf(where_clause + strlen(where_clause),
                 sizeof(where_clause) - strlen(where_clause),
-                " AND name LIKE '%%%s%%'", search);
+                " AND name LIKE '%%%s%%'", escaped);
         } else {
             snprintf(where_clause, sizeof(where_clause),
-                " WHERE name LIKE '%%%s%%'", search);
+                " WHERE name LIKE '%%%s%%'", escaped);
         }
     }
 
-    /* Parse and validate limit parameter */
-    int limit = 100;
-    if (limit_str != NULL) {
-        limit = atoi(limit_str);
-        if (limit <= 0 || limit > 1000) limit = 100;
-    }
-
     snprintf(query, sizeof(query),
         "SELECT id, name, category_id, calories_per_100g, protein_per_100g, "
         "carbs_per_100g, fat_per_100g FROM food_items%s ORDER BY name LIMIT %d",
@@ -173,7 +699,7 @@ enum MHD_Result handle_list_foods(struct MHD_Connection *connection) {
     result = db_query(query);
 
     if (result == NULL) {
-        return send_error_response(connection, 500, "Database error");
+        return send_error_response(request, 500, "Database error");
     }
 
     root = cJSON_CreateObject();
@@ -197,15 +723,68 @@ enum MHD_Result handle_list_foods(struct MHD_Connection *connection) {
     mysql_free_result(result);
 
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 200, json_str);
+    ret = send_json_response(request, 200, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+enum MHD_Result handle_suggest_foods(HttpRequest *request) {
+    cJSON *root, *suggestions, *item;
+    char *json_str;
+    enum MHD_Result ret;
+    int matches[SUGGEST_TOP_K];
+
+    const char *q = http_query_arg(request, "q");
+    const char *limit_str = http_query_arg(request, "limit");
+
+    if (q == NULL || q[0] == '\0') {
+        return send_error_response(request, 400, "Missing q parameter");
+    }
+
+    /* Parse and validate limit parameter */
+    int limit = SUGGEST_TOP_K;
+    if (limit_str != NULL) {
+        limit = atoi(limit_str);
+        if (limit <= 0 || limit > SUGGEST_TOP_K) limit = SUGGEST_TOP_K;
+    }
+
+    catalog_read_lock();
+    const Catalog *cat = catalog_get();
+    int count = suggest_lookup(q, matches, limit);
+    if (cat == NULL || count < 0) {
+        catalog_read_unlock();
+        return send_error_response(request, 503, "Catalog not loaded");
+    }
+
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", 1);
+    suggestions = cJSON_AddArrayToObject(root, "suggestions");
+
+    for (int i = 0; i < count; i++) {
+        int idx = matches[i];
+        item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", cat->ids[idx]);
+        cJSON_AddStringToObject(item, "name", cat->names[idx]);
+        cJSON_AddNumberToObject(item, "category_id", cat->category_ids[idx]);
+        cJSON_AddItemToArray(suggestions, item);
+    }
+    catalog_read_unlock();
+
+    cJSON_AddNumberToObject(root, "count", count);
+
+    json_str = cJSON_PrintUnformatted(root);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_get_food(struct MHD_Connection *connection, int id) {
+enum MHD_Result handle_get_food(HttpRequest *request, int id) {
     MYSQL_RES *result;
     MYSQL_ROW row;
     cJSON *root, *food;
@@ -220,13 +799,13 @@ enum MHD_Result handle_get_food(struct MHD_Connection *connection, int id) {
     result = db_query(query);
 
     if (result == NULL) {
-        return send_error_response(connection, 500, "Database error");
+        return send_error_response(request, 500, "Database error");
     }
 
     row = mysql_fetch_row(result);
     if (row == NULL) {
         mysql_free_result(result);
-        return send_error_response(connection, 404, "Food not found");
+        return send_error_response(request, 404, "Food not found");
     }
 
     root = cJSON_CreateObject();
@@ -244,146 +823,419 @@ enum MHD_Result handle_get_food(struct MHD_Connection *connection, int id) {
     mysql_free_result(result);
 
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 200, json_str);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_get_template_full(struct MHD_Connection *connection, int id) {
-    MYSQL_RES *result;
-    MYSQL_ROW row;
-    cJSON *root, *template_obj, *days_arr, *day_obj, *meals_arr, *meal_obj, *items_arr, *item_obj;
-    char *json_str;
-    enum MHD_Result ret;
-    char query[512];
+/**
+ * @brief Parses a number that must make up the whole string.
+ *
+ * @return 0 on success, -1 if value is not a number
+ */
+static int parse_bound(const char *value, float *out) {
+    char *end;
+    float parsed = strtof(value, &end);
+    if (end == value || *end != '\0' || parsed != parsed) {
+        return -1;
+    }
+    *out = parsed;
+    return 0;
+}
 
-    /* Get template */
-    snprintf(query, sizeof(query),
-        "SELECT id, code, name, description, segment, type, duration_days, calories_target "
-        "FROM diet_templates WHERE id = %d", id);
+/**
+ * @brief Parses a "min-max" range; either side may be left empty.
+ *
+ * A single number without '-' is taken as both bounds.
+ *
+ * @return 0 on success, -1 if the range is malformed
+ */
+static int parse_range(const char *value, float *min, float *max) {
+    char buf[64];
+    char *dash;
 
-    result = db_query(query);
-    if (result == NULL) {
-        return send_error_response(connection, 500, "Database error");
+    if (strlen(value) >= sizeof(buf)) {
+        return -1;
     }
+    strcpy(buf, value);
 
-    row = mysql_fetch_row(result);
-    if (row == NULL) {
-        mysql_free_result(result);
-        return send_error_response(connection, 404, "Template not found");
+    dash = strchr(buf, '-');
+    if (dash == NULL) {
+        if (parse_bound(buf, min) != 0) {
+            return -1;
+        }
+        *max = *min;
+        return 0;
     }
 
-    root = cJSON_CreateObject();
-    cJSON_AddBoolToObject(root, "success", 1);
-
-    template_obj = cJSON_AddObjectToObject(root, "template");
-    cJSON_AddNumberToObject(template_obj, "id", atoi(row[0]));
-    cJSON_AddStringToObject(template_obj, "code", row[1] ? row[1] : "");
-    cJSON_AddStringToObject(template_obj, "name", row[2] ? row[2] : "");
-    cJSON_AddStringToObject(template_obj, "description", row[3] ? row[3] : "");
-    cJSON_AddStringToObject(template_obj, "segment", row[4] ? row[4] : "");
-    cJSON_AddStringToObject(template_obj, "type", row[5] ? row[5] : "");
-    cJSON_AddNumberToObject(template_obj, "duration_days", row[6] ? atoi(row[6]) : 0);
-    cJSON_AddNumberToObject(template_obj, "calories_target", row[7] ? atoi(row[7]) : 0);
+    *dash = '\0';
+    if (buf[0] != '\0' && parse_bound(buf, min) != 0) {
+        return -1;
+    }
+    if (dash[1] != '\0' && parse_bound(dash + 1, max) != 0) {
+        return -1;
+    }
+    return 0;
+}
 
-    mysql_free_result(result);
+enum MHD_Result handle_search_templates(HttpRequest *request) {
+    TemplateQuery query;
+    const TemplateProfile **matches;
+    cJSON *root, *templates, *item, *daily;
+    char *json_str;
+    enum MHD_Result ret;
+    char key[32];
+    int count;
+
+    template_query_init(&query);
+
+    struct {
+        const char *name;
+        float *min;
+        float *max;
+    } bounds[] = {
+        {"kcal", &query.calories_min, &query.calories_max},
+        {"protein", &query.protein_min, &query.protein_max},
+        {"carbs", &query.carbs_min, &query.carbs_max},
+        {"fat", &query.fat_min, &query.fat_max},
+    };
+
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++) {
+        const char *value;
+
+        value = http_query_arg(request, bounds[i].name);
+        if (value != NULL && parse_range(value, bounds[i].min, bounds[i].max) != 0) {
+            return send_error_response(request, 400, "Invalid nutrition range");
+        }
 
-    /* Get days */
-    days_arr = cJSON_AddArrayToObject(template_obj, "days");
+        snprintf(key, sizeof(key), "%s_min", bounds[i].name);
+        value = http_query_arg(request, key);
+        if (value != NULL && parse_bound(value, bounds[i].min) != 0) {
+            return send_error_response(request, 400, "Invalid nutrition range");
+        }
 
-    snprintf(query, sizeof(query),
-        "SELECT id, day_number, day_name FROM diet_days WHERE template_id = %d ORDER BY day_number", id);
+        snprintf(key, sizeof(key), "%s_max", bounds[i].name);
+        value = http_query_arg(request, key);
+        if (value != NULL && parse_bound(value, bounds[i].max) != 0) {
+            return send_error_response(request, 400, "Invalid nutrition range");
+        }
+    }
 
-    result = db_query(query);
-    if (result == NULL) {
-        cJSON_Delete(root);
-        return send_error_response(connection, 500, "Database error");
+    const char *limit_str = http_query_arg(request, "limit");
+    int limit = 100;
+    if (limit_str != NULL) {
+        limit = atoi(limit_str);
+        if (limit <= 0 || limit > 1000) limit = 100;
     }
 
-    /* Store day IDs for meal queries */
-    int day_ids[100];
-    int day_count = 0;
+    matches = malloc((size_t)limit * sizeof(*matches));
+    if (matches == NULL) {
+        return send_error_response(request, 500, "Out of memory");
+    }
 
-    while ((row = mysql_fetch_row(result)) != NULL && day_count < 100) {
-        day_obj = cJSON_CreateObject();
-        day_ids[day_count] = atoi(row[0]);
-        cJSON_AddNumberToObject(day_obj, "id", day_ids[day_count]);
-        cJSON_AddNumberToObject(day_obj, "day_number", row[1] ? atoi(row[1]) : 0);
-        cJSON_AddStringToObject(day_obj, "day_name", row[2] ? row[2] : "");
-        cJSON_AddArrayToObject(day_obj, "meals");
-        cJSON_AddItemToArray(days_arr, day_obj);
-        day_count++;
+    template_index_read_lock();
+    count = template_index_search(&query, matches, limit);
+    if (count < 0) {
+        template_index_read_unlock();
+        free(matches);
+        return send_error_response(request, 503, "Template index not loaded");
     }
-    mysql_free_result(result);
 
-    /* Get meals for each day */
-    for (int i = 0; i < day_count; i++) {
-        day_obj = cJSON_GetArrayItem(days_arr, i);
-        meals_arr = cJSON_GetObjectItem(day_obj, "meals");
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", 1);
+    templates = cJSON_AddArrayToObject(root, "templates");
 
-        snprintf(query, sizeof(query),
-            "SELECT id, meal_type, meal_order, time_suggestion "
-            "FROM diet_meals WHERE day_id = %d ORDER BY meal_order", day_ids[i]);
-
-        result = db_query(query);
-        if (result == NULL) continue;
-
-        int meal_ids[50];
-        int meal_count = 0;
-
-        while ((row = mysql_fetch_row(result)) != NULL && meal_count < 50) {
-            meal_obj = cJSON_CreateObject();
-            meal_ids[meal_count] = atoi(row[0]);
-            cJSON_AddNumberToObject(meal_obj, "id", meal_ids[meal_count]);
-            cJSON_AddStringToObject(meal_obj, "meal_type", row[1] ? row[1] : "");
-            cJSON_AddNumberToObject(meal_obj, "meal_order", row[2] ? atoi(row[2]) : 0);
-            cJSON_AddStringToObject(meal_obj, "time_suggestion", row[3] ? row[3] : "");
-            cJSON_AddArrayToObject(meal_obj, "items");
-            cJSON_AddItemToArray(meals_arr, meal_obj);
-            meal_count++;
-        }
-        mysql_free_result(result);
+    for (int i = 0; i < count; i++) {
+        const TemplateProfile *p = matches[i];
 
-        /* Get items for each meal */
-        for (int j = 0; j < meal_count; j++) {
-            meal_obj = cJSON_GetArrayItem(meals_arr, j);
-            items_arr = cJSON_GetObjectItem(meal_obj, "items");
-
-            snprintf(query, sizeof(query),
-                "SELECT mi.id, mi.food_item_id, f.name, mi.portion_grams_min, mi.portion_grams_max "
-                "FROM diet_meal_items mi "
-                "JOIN food_items f ON mi.food_item_id = f.id "
-                "WHERE mi.meal_id = %d ORDER BY mi.sort_order", meal_ids[j]);
-
-            result = db_query(query);
-            if (result == NULL) continue;
-
-            while ((row = mysql_fetch_row(result)) != NULL) {
-                item_obj = cJSON_CreateObject();
-                cJSON_AddNumberToObject(item_obj, "id", atoi(row[0]));
-                cJSON_AddNumberToObject(item_obj, "food_item_id", row[1] ? atoi(row[1]) : 0);
-                cJSON_AddStringToObject(item_obj, "food_name", row[2] ? row[2] : "");
-                cJSON_AddNumberToObject(item_obj, "portion_grams_min", row[3] ? atoi(row[3]) : 0);
-                cJSON_AddNumberToObject(item_obj, "portion_grams_max", row[4] ? atoi(row[4]) : 0);
-                cJSON_AddItemToArray(items_arr, item_obj);
-            }
-            mysql_free_result(result);
-        }
+        item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", p->id);
+        cJSON_AddStringToObject(item, "code", p->code);
+        cJSON_AddStringToObject(item, "name", p->name);
+        cJSON_AddStringToObject(item, "segment", p->segment);
+        cJSON_AddStringToObject(item, "type", p->type);
+        cJSON_AddNumberToObject(item, "duration_days", p->duration_days);
+        cJSON_AddNumberToObject(item, "calories_target", p->calories_target);
+
+        daily = cJSON_AddObjectToObject(item, "daily");
+        cJSON_AddNumberToObject(daily, "calories", roundf(p->calories));
+        cJSON_AddNumberToObject(daily, "protein", roundf(p->protein * 10.0f) / 10.0f);
+        cJSON_AddNumberToObject(daily, "carbs", roundf(p->carbs * 10.0f) / 10.0f);
+        cJSON_AddNumberToObject(daily, "fat", roundf(p->fat * 10.0f) / 10.0f);
+
+        cJSON_AddItemToArray(templates, item);
     }
 
+    template_index_read_unlock();
+    cJSON_AddNumberToObject(root, "count", count);
+    free(matches);
+
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 200, json_str);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
 
-enum MHD_Result handle_bulk_insert(struct MHD_Connection *connection,
+enum MHD_Result handle_export(HttpRequest *request, ExportTable table) {
+    ExportStream *stream;
+    HttpHeader headers[EXPORT_MAX_HEADERS];
+    ExportFormat format = EXPORT_NDJSON;
+    int header_count;
+
+    const char *format_str = http_query_arg(request, "format");
+    const char *accept_encoding = http_header(request, "Accept-Encoding");
+
+    /* Checked first so an unusable export does not take a database connection */
+    if (request->frontend->respond_stream == NULL) {
+        return send_error_response(request, 501, "Not supported by this HTTP front end");
+    }
+    if (format_str != NULL) {
+        if (strcmp(format_str, "csv") == 0) {
+            format = EXPORT_CSV;
+        } else if (strcmp(format_str, "ndjson") != 0) {
+            return send_error_response(request, 400, "format must be ndjson or csv");
+        }
+    }
+    int gzip = accept_encoding != NULL && strstr(accept_encoding, "gzip") != NULL;
+
+    header_count = export_open(table, format, gzip, &stream, headers);
+    if (header_count == EXPORT_ERROR_BUSY) {
+        return send_error_response(request, 503, "Too many exports running");
+    }
+    if (header_count < 0) {
+        return send_error_response(request, 500, "Database error");
+    }
+
+    return send_stream_response(request, 200, headers, header_count,
+                                export_read, stream, export_close);
+}
+
+enum MHD_Result handle_catalog_bundle(HttpRequest *request) {
+    enum MHD_Result ret;
+
+    const char *accept_encoding = http_header(request, "Accept-Encoding");
+    const char *if_none_match = http_header(request, "If-None-Match");
+
+    int gzip = accept_encoding != NULL && strstr(accept_encoding, "gzip") != NULL;
+
+    switch (catalog_bundle_send(request, gzip, if_none_match, &ret)) {
+    case 0:
+        return ret;
+    case BUNDLE_ERROR_NO_CATALOG:
+        return send_error_response(request, 503, "Catalog not loaded");
+    default:
+        return send_error_response(request, 500, "Failed to build catalog bundle");
+    }
+}
+
+/**
+ * @brief TemplateFetch on the replicas, or the pool without them.
+ */
+static MYSQL_RES *fetch_template_read(void *ctx, const char *query) {
+    (void)ctx;
+    return db_query_read("template-full", query);
+}
+
+/**
+ * @brief A body held in a MySQL result cell.
+ */
+struct cell_stream {
+    MYSQL_RES *result;
+    const char *data;
+    size_t len;
+};
+
+static ssize_t cell_read(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct cell_stream *st = cls;
+    size_t n;
+
+    if (pos >= st->len) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    n = st->len - (size_t)pos < max ? st->len - (size_t)pos : max;
+    memcpy(buf, st->data + pos, n);
+    return (ssize_t)n;
+}
+
+static void cell_free(void *cls) {
+    struct cell_stream *st = cls;
+
+    mysql_free_result(st->result);
+    free(st);
+}
+
+/**
+ * @brief Sends template-full as assembled by MySQL, without parsing it.
+ *
+ * The cell is streamed from the result set rather than copied, on front
+ * ends that can stream.
+ */
+static enum MHD_Result send_template_json(HttpRequest *request, MYSQL_RES *result) {
+    static const HttpHeader headers[] = { { "Content-Type", "application/json" } };
+    MYSQL_ROW row = mysql_fetch_row(result);
+    unsigned long *lengths = mysql_fetch_lengths(result);
+    struct cell_stream *st;
+    enum MHD_Result ret;
+
+    if (row == NULL || row[0] == NULL) {
+        mysql_free_result(result);
+        return send_error_response(request, 500, "Database error");
+    }
+    if (request->frontend->respond_stream == NULL ||
+        (st = malloc(sizeof(*st))) == NULL) {
+        ret = send_json_response(request, 200, row[0]);
+        mysql_free_result(result);
+        return ret;
+    }
+    st->result = result;
+    st->data = row[0];
+    st->len = lengths[0];
+    return send_stream_response(request, 200, headers, 1, cell_read, st, cell_free);
+}
+
+static ssize_t snapshot_read(void *cls, uint64_t pos, char *buf, size_t max) {
+    size_t n = template_cache_read(cls, (size_t)pos, buf, max);
+
+    return n > 0 ? (ssize_t)n : MHD_CONTENT_READER_END_OF_STREAM;
+}
+
+static void snapshot_free(void *cls) {
+    template_cache_release(cls);
+}
+
+/**
+ * @brief Sends a template snapshot, or 304 if the client has its version.
+ *
+ * The body is streamed from the snapshot's segments, which the stream
+ * keeps referenced, on front ends that can stream.
+ */
+static enum MHD_Result send_template_snapshot(HttpRequest *request, TemplateSnapshot *snap) {
+    const char *if_none_match = http_header(request, "If-None-Match");
+    char etag[48];
+    HttpHeader headers[4];
+    enum MHD_Result ret;
+    char *body;
+
+    snprintf(etag, sizeof(etag), "\"t%dv%llu\"", snap->id, (unsigned long long)snap->version);
+    headers[0] = (HttpHeader){ "ETag", etag };
+    headers[1] = (HttpHeader){ "Cache-Control", "no-cache" };
+    headers[2] = (HttpHeader){ "Access-Control-Expose-Headers", "ETag" };
+    headers[3] = (HttpHeader){ "Content-Type", "application/json" };
+
+    if (if_none_match != NULL &&
+        (strcmp(if_none_match, "*") == 0 || strstr(if_none_match, etag) != NULL)) {
+        ret = send_json_response_with_headers(request, 304, "", headers, 3);
+    } else if (request->frontend->respond_stream != NULL) {
+        return send_stream_response(request, 200, headers, 4, snapshot_read, snap, snapshot_free);
+    } else if ((body = template_cache_body(snap)) != NULL) {
+        ret = send_json_response_with_headers(request, 200, body, headers, 3);
+        free(body);
+    } else {
+        ret = send_error_response(request, 500, "Out of memory");
+    }
+    template_cache_release(snap);
+    return ret;
+}
+
+enum MHD_Result handle_get_template_full(HttpRequest *request, int id) {
+    const char *strategy = http_query_arg(request, "strategy");
+    MYSQL_RES *result;
+    cJSON *root;
+    char *json_str;
+    enum MHD_Result ret;
+    int rc;
+
+    if (strategy != NULL && strcmp(strategy, "c") != 0 && strcmp(strategy, "mysql") != 0) {
+        return send_error_response(request, 400, "strategy must be c or mysql");
+    }
+
+    /* Snapshot, then stored document: sent as they are, unless a strategy is asked for */
+    if (strategy == NULL && template_cache_enabled()) {
+        TemplateSnapshot *snap;
+
+        rc = template_cache_get(id, &snap);
+        if (rc == 0) {
+            return send_template_snapshot(request, snap);
+        }
+    } else if (strategy == NULL && template_document_enabled()) {
+        rc = template_document_get(id, &json_str);
+        if (rc == 0) {
+            ret = send_json_response(request, 200, json_str);
+            free(json_str);
+            return ret;
+        }
+    } else if (strcmp(strategy != NULL ? strategy : config.template_full_strategy, "mysql") == 0) {
+        rc = template_document_fetch_json(id, &result);
+        if (rc == 0) {
+            return send_template_json(request, result);
+        }
+    } else {
+        rc = template_document_build(id, 0, fetch_template_read, NULL, &root);
+        if (rc == 0) {
+            json_str = cJSON_PrintUnformatted(root);
+            ret = send_json_response(request, 200, json_str);
+            cJSON_free(json_str);
+            cJSON_Delete(root);
+            return ret;
+        }
+    }
+
+    if (rc == TEMPLATE_DOCUMENT_NOT_FOUND) {
+        return send_error_response(request, 404, "Template not found");
+    }
+    return send_error_response(request, 500, "Database error");
+}
+
+enum MHD_Result handle_get_template_changes(HttpRequest *request, int id) {
+    const char *since_str = http_query_arg(request, "since");
+    TemplateChanges changes;
+    unsigned long long since;
+    enum MHD_Result ret;
+    char *endptr;
+    char *body;
+    int rc;
+
+    if (!template_cache_enabled()) {
+        return send_error_response(request, 503, "Template cache disabled");
+    }
+    if (since_str == NULL || *since_str < '0' || *since_str > '9') {
+        return send_error_response(request, 400, "since must be a version");
+    }
+    since = strtoull(since_str, &endptr, 10);
+    if (*endptr != '\0') {
+        return send_error_response(request, 400, "since must be a version");
+    }
+
+    rc = template_cache_changes(id, since, &changes);
+    if (rc == TEMPLATE_DOCUMENT_NOT_FOUND) {
+        return send_error_response(request, 404, "Template not found");
+    }
+    if (rc != 0) {
+        return send_error_response(request, 500, "Database error");
+    }
+
+    body = malloc(changes.patch_len + 96);
+    if (body == NULL) {
+        free(changes.patch);
+        return send_error_response(request, 500, "Out of memory");
+    }
+    snprintf(body, changes.patch_len + 96,
+             "{\"success\":true,\"since\":%llu,\"version\":%llu,\"full\":%s,\"patch\":%s}",
+             since, (unsigned long long)changes.version, changes.full ? "true" : "false",
+             changes.patch);
+    ret = send_json_response(request, 200, body);
+    free(body);
+    free(changes.patch);
+    return ret;
+}
+
+enum MHD_Result handle_bulk_insert(HttpRequest *request,
                                    const char *post_data, size_t post_data_size) {
     (void)post_data_size;
     cJSON *root, *json_input, *items_arr, *item;
@@ -393,12 +1245,12 @@ enum MHD_Result handle_bulk_insert(struct MHD_Connection *connection,
     int inserted = 0;
 
     if (post_data == NULL) {
-        return send_error_response(connection, 400, "Missing request body");
+        return send_error_response(request, 400, "Missing request body");
     }
 
     json_input = cJSON_Parse(post_data);
     if (json_input == NULL) {
-        return send_error_response(connection, 400, "Invalid JSON");
+        return send_error_response(request, 400, "Invalid JSON");
     }
 
     cJSON *meal_id_json = cJSON_GetObjectItem(json_input, "meal_id");
@@ -406,11 +1258,19 @@ enum MHD_Result handle_bulk_insert(struct MHD_Connection *connection,
 
     if (!cJSON_IsNumber(meal_id_json) || !cJSON_IsArray(items_arr)) {
         cJSON_Delete(json_input);
-        return send_error_response(connection, 400, "Invalid request format");
+        return send_error_response(request, 400, "Invalid request format");
     }
 
     int meal_id = meal_id_json->valueint;
     int items_count = cJSON_GetArraySize(items_arr);
+    DbTransaction txn;
+    int rc = 0;
+
+    /* One transaction, so that the template document changes with its items */
+    if (db_begin(&txn) != 0) {
+        cJSON_Delete(json_input);
+        return send_error_response(request, 500, "Database error");
+    }
 
     /* Insert each item */
     for (int i = 0; i < items_count; i++) {
@@ -434,22 +1294,567 @@ enum MHD_Result handle_bulk_insert(struct MHD_Connection *connection,
             portion_max->valueint,
             cJSON_IsNumber(sort_order) ? sort_order->valueint : i);
 
-        if (db_execute(query) >= 0) {
+        if (mysql_query(txn.conn, query) == 0) {
             inserted++;
+        } else {
+            fprintf(stderr, "Execute failed: %s\n", mysql_error(txn.conn));
         }
     }
 
     cJSON_Delete(json_input);
 
+    int template_id = 0;
+
+    if (inserted > 0) {
+        template_id = template_document_meal_template(txn.conn, meal_id);
+        if (template_document_enabled()) {
+            rc = template_id > 0 ? template_document_rebuild(txn.conn, template_id) : -1;
+        }
+    }
+    if (db_end(&txn, rc == 0) != 0 || rc != 0) {
+        return send_error_response(request, 500, "Database error");
+    }
+    if (template_id > 0) {
+        /* After the commit, so the new version reads the new items */
+        template_cache_meal_changed(template_id, meal_id);
+        if (template_index_refresh(template_id) != 0) {
+            fprintf(stderr, "Failed to refresh the profile of template %d\n", template_id);
+        }
+    }
+
     root = cJSON_CreateObject();
     cJSON_AddBoolToObject(root, "success", 1);
     cJSON_AddNumberToObject(root, "inserted_count", inserted);
 
     json_str = cJSON_PrintUnformatted(root);
-    ret = send_json_response(connection, 201, json_str);
+    ret = send_json_response(request, 201, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+/**
+ * @brief Reads a JSON array of category ids.
+ *
+ * @param array JSON array (NULL leaves the list empty)
+ * @param ids Output ids (PLAN_MAX_CATEGORIES entries)
+ * @param count Output number of ids
+ * @return 0 on success, -1 if the array is malformed or too long
+ */
+static int parse_category_ids(const cJSON *array, int *ids, int *count) {
+    const cJSON *entry;
+
+    *count = 0;
+    if (array == NULL) {
+        return 0;
+    }
+    if (!cJSON_IsArray(array) || cJSON_GetArraySize(array) > PLAN_MAX_CATEGORIES) {
+        return -1;
+    }
+    cJSON_ArrayForEach(entry, array) {
+        if (!cJSON_IsNumber(entry)) {
+            return -1;
+        }
+        ids[(*count)++] = entry->valueint;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fills a plan meal, checking the meal type and item count.
+ *
+ * @return 0 on success, -1 if invalid
+ */
+static int set_plan_meal(PlanMeal *meal, const char *meal_type, int item_count, int snack_only) {
+    if (strcmp(meal_type, "breakfast") != 0 && strcmp(meal_type, "lunch") != 0 &&
+        strcmp(meal_type, "dinner") != 0 && strcmp(meal_type, "snack") != 0) {
+        return -1;
+    }
+    if (item_count < 1 || item_count > PLAN_MAX_ITEMS) {
+        return -1;
+    }
+    snprintf(meal->meal_type, sizeof(meal->meal_type), "%s", meal_type);
+    meal->item_count = item_count;
+    meal->snack_only = snack_only;
+    return 0;
+}
+
+/**
+ * @brief Parses a POST /api/plans/generate body into a plan request.
+ *
+ * @return 0 on success, -1 if the request is invalid
+ */
+static int parse_plan_request(const cJSON *json, PlanRequest *request) {
+    const cJSON *value, *meals, *meal;
+    int default_categories[PLAN_MAX_CATEGORIES];
+    int default_category_count;
+    int budget_max = CONFIG_LIVE(plan_budget_max_ms);
+
+    memset(request, 0, sizeof(*request));
+
+    value = cJSON_GetObjectItem(json, "calories");
+    if (!cJSON_IsNumber(value) || value->valuedouble <= 0) {
+        return -1;
+    }
+    request->calories = (float)value->valuedouble;
+
+    value = cJSON_GetObjectItem(json, "protein");
+    request->protein = cJSON_IsNumber(value) ? (float)value->valuedouble : 0;
+    value = cJSON_GetObjectItem(json, "carbs");
+    request->carbs = cJSON_IsNumber(value) ? (float)value->valuedouble : 0;
+    value = cJSON_GetObjectItem(json, "fat");
+    request->fat = cJSON_IsNumber(value) ? (float)value->valuedouble : 0;
+
+    value = cJSON_GetObjectItem(json, "time_budget_ms");
+    request->time_budget_ms = cJSON_IsNumber(value) ? value->valueint
+                                                    : (budget_max < 100 ? budget_max : 100);
+    if (request->time_budget_ms < 1 || request->time_budget_ms > budget_max) {
+        return -1;
+    }
+
+    value = cJSON_GetObjectItem(json, "seed");
+    request->seed = cJSON_IsNumber(value) ? (unsigned int)value->valuedouble : 0;
+
+    if (parse_category_ids(cJSON_GetObjectItem(json, "category_ids"),
+                           default_categories, &default_category_count) != 0) {
+        return -1;
+    }
+
+    meals = cJSON_GetObjectItem(json, "meals");
+    if (meals == NULL) {
+        set_plan_meal(&request->meals[0], "breakfast", 3, 0);
+        set_plan_meal(&request->meals[1], "lunch", 3, 0);
+        set_plan_meal(&request->meals[2], "dinner", 3, 0);
+        set_plan_meal(&request->meals[3], "snack", 1, 1);
+        request->meal_count = 4;
+    } else {
+        if (!cJSON_IsArray(meals) || cJSON_GetArraySize(meals) < 1 ||
+            cJSON_GetArraySize(meals) > PLAN_MAX_MEALS) {
+            return -1;
+        }
+        cJSON_ArrayForEach(meal, meals) {
+            PlanMeal *m = &request->meals[request->meal_count++];
+            const cJSON *type = cJSON_GetObjectItem(meal, "meal_type");
+            const cJSON *items = cJSON_GetObjectItem(meal, "items");
+            const cJSON *snack_only = cJSON_GetObjectItem(meal, "snack_only");
+
+            if (!cJSON_IsString(type)) {
+                return -1;
+            }
+            int is_snack = strcmp(type->valuestring, "snack") == 0;
+            if (set_plan_meal(m, type->valuestring,
+                              cJSON_IsNumber(items) ? items->valueint : (is_snack ? 1 : 3),
+                              cJSON_IsBool(snack_only) ? cJSON_IsTrue(snack_only) : is_snack) != 0) {
+                return -1;
+            }
+            if (parse_category_ids(cJSON_GetObjectItem(meal, "category_ids"),
+                                   m->category_ids, &m->category_count) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    /* Meals without their own categories use the request-wide list */
+    for (int i = 0; i < request->meal_count; i++) {
+        if (request->meals[i].category_count == 0) {
+            memcpy(request->meals[i].category_ids, default_categories, sizeof(default_categories));
+            request->meals[i].category_count = default_category_count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds calories/protein/carbs/fat rounded to one decimal to a JSON object.
+ */
+static void add_nutrition(cJSON *obj, double calories, double protein, double carbs, double fat) {
+    cJSON_AddNumberToObject(obj, "calories", round(calories * 10.0) / 10.0);
+    cJSON_AddNumberToObject(obj, "protein", round(protein * 10.0) / 10.0);
+    cJSON_AddNumberToObject(obj, "carbs", round(carbs * 10.0) / 10.0);
+    cJSON_AddNumberToObject(obj, "fat", round(fat * 10.0) / 10.0);
+}
+
+enum MHD_Result handle_generate_plan(HttpRequest *request,
+                                     const char *post_data, size_t post_data_size) {
+    (void)post_data_size;
+    PlanRequest plan_request;
+    PlanResult plan;
+    cJSON *json_input, *root, *plan_obj, *meals_arr, *meal_obj, *items_arr, *item_obj, *search;
+    char *json_str;
+    enum MHD_Result ret;
+    const Catalog *cat;
+    struct timespec started, finished;
+    int rc;
+
+    if (post_data == NULL) {
+        return send_error_response(request, 400, "Missing request body");
+    }
+
+    json_input = cJSON_Parse(post_data);
+    if (json_input == NULL) {
+        return send_error_response(request, 400, "Invalid JSON");
+    }
+    rc = parse_plan_request(json_input, &plan_request);
+    cJSON_Delete(json_input);
+    if (rc != 0) {
+        return send_error_response(request, 400, "Invalid request format");
+    }
+
+    /* Held until the plan's catalog indices have been turned into JSON */
+    catalog_read_lock();
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    rc = meal_planner_generate(&plan_request, &plan);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    if (rc != 0) {
+        catalog_read_unlock();
+    }
+
+    if (rc == PLAN_ERROR_NO_CATALOG) {
+        return send_error_response(request, 503, "Catalog not loaded");
+    }
+    if (rc == PLAN_ERROR_NO_CANDIDATES) {
+        return send_error_response(request, 422, "Not enough distinct foods match the meals' constraints");
+    }
+    if (rc != 0) {
+        return send_error_response(request, 500, "Plan generation failed");
+    }
+
+    cat = catalog_get();
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", 1);
+
+    plan_obj = cJSON_AddObjectToObject(root, "plan");
+    meals_arr = cJSON_AddArrayToObject(plan_obj, "meals");
+    for (int m = 0; m < plan_request.meal_count; m++) {
+        meal_obj = cJSON_CreateObject();
+        cJSON_AddStringToObject(meal_obj, "meal_type", plan_request.meals[m].meal_type);
+        items_arr = cJSON_AddArrayToObject(meal_obj, "items");
+
+        for (int j = 0; j < plan_request.meals[m].item_count; j++) {
+            int idx = plan.items[m][j].index;
+            double scale = plan.items[m][j].grams / 100.0;
+
+            item_obj = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item_obj, "food_item_id", cat->ids[idx]);
+            cJSON_AddStringToObject(item_obj, "name", cat->names[idx]);
+            cJSON_AddNumberToObject(item_obj, "grams", plan.items[m][j].grams);
+            add_nutrition(item_obj, cat->calories[idx] * scale, cat->protein[idx] * scale,
+                          cat->carbs[idx] * scale, cat->fat[idx] * scale);
+            cJSON_AddItemToArray(items_arr, item_obj);
+        }
+        cJSON_AddItemToArray(meals_arr, meal_obj);
+    }
+    catalog_read_unlock();
+    add_nutrition(cJSON_AddObjectToObject(plan_obj, "totals"),
+                  plan.calories, plan.protein, plan.carbs, plan.fat);
+
+    search = cJSON_AddObjectToObject(root, "search");
+    cJSON_AddNumberToObject(search, "score", plan.score);
+    cJSON_AddNumberToObject(search, "iterations", (double)plan.iterations);
+    cJSON_AddNumberToObject(search, "threads", plan.threads);
+    cJSON_AddNumberToObject(search, "elapsed_ms",
+        (double)(finished.tv_sec - started.tv_sec) * 1000.0 +
+        (double)(finished.tv_nsec - started.tv_nsec) / 1e6);
+
+    json_str = cJSON_PrintUnformatted(root);
+    ret = send_json_response(request, 200, json_str);
 
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
 
     return ret;
 }
+
+enum MHD_Result handle_import_foods(HttpRequest *request,
+                                    const char *post_data, size_t post_data_size) {
+    ImportResult result;
+    ImportFormat format = IMPORT_NDJSON;
+    cJSON *root, *errors, *item;
+    char *json_str;
+    enum MHD_Result ret;
+    struct timespec started, finished;
+    int rc;
+
+    const char *format_str = http_query_arg(request, "format");
+    const char *dry_run_str = http_query_arg(request, "dry_run");
+    const char *content_type = http_header(request, "Content-Type");
+
+    if (format_str != NULL) {
+        if (strcmp(format_str, "csv") == 0) {
+            format = IMPORT_CSV;
+        } else if (strcmp(format_str, "ndjson") != 0) {
+            return send_error_response(request, 400, "format must be ndjson or csv");
+        }
+    } else if (content_type != NULL && strstr(content_type, "text/csv") != NULL) {
+        format = IMPORT_CSV;
+    }
+    int dry_run = dry_run_str != NULL &&
+                  (strcmp(dry_run_str, "1") == 0 || strcmp(dry_run_str, "true") == 0);
+
+    if (post_data == NULL || post_data_size == 0) {
+        return send_error_response(request, 400, "Missing request body");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    rc = food_import_run(post_data, post_data_size, format, dry_run, &result);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    if (rc == IMPORT_ERROR_BUSY) {
+        return send_error_response(request, 503, "Another import is running");
+    }
+    if (rc == IMPORT_ERROR_FORMAT) {
+        return send_error_response(request, 400, result.errors[0].message);
+    }
+    if (rc == IMPORT_ERROR_INTERNAL || (rc == IMPORT_ERROR_DB && result.received == 0)) {
+        return send_error_response(request, 500,
+                                   rc == IMPORT_ERROR_DB ? "Database error" : "Import failed");
+    }
+
+    /* Counts are reported even when the database failed part-way */
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", rc == 0);
+    if (rc != 0) {
+        cJSON_AddStringToObject(root, "error", "Database error");
+    }
+    cJSON_AddBoolToObject(root, "dry_run", dry_run);
+    cJSON_AddNumberToObject(root, "received", (double)result.received);
+    cJSON_AddNumberToObject(root, "imported", (double)result.imported);
+    cJSON_AddNumberToObject(root, "failed", (double)result.failed);
+    cJSON_AddBoolToObject(root, "catalog_updated", result.catalog_updated);
+
+    errors = cJSON_AddArrayToObject(root, "errors");
+    for (int i = 0; i < result.error_count; i++) {
+        item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "line", (double)result.errors[i].line);
+        cJSON_AddStringToObject(item, "message", result.errors[i].message);
+        cJSON_AddItemToArray(errors, item);
+    }
+
+    cJSON_AddNumberToObject(root, "threads", result.threads);
+    cJSON_AddNumberToObject(root, "elapsed_ms",
+        (double)(finished.tv_sec - started.tv_sec) * 1000.0 +
+        (double)(finished.tv_nsec - started.tv_nsec) / 1e6);
+
+    json_str = cJSON_PrintUnformatted(root);
+    ret = send_json_response(request, rc == 0 ? 200 : 500, json_str);
+
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+/**
+ * @brief Extracts numeric ID from URL path.
+ *
+ * Example: "/api/foods/123" with prefix "/api/foods/" returns 123
+ *
+ * @param url Full request URL
+ * @param prefix URL prefix to strip (e.g., "/api/foods/")
+ * @return Extracted ID, or -1 if URL doesn't match prefix
+ */
+static int extract_id_from_path(const char *url, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    if (strncmp(url, prefix, prefix_len) != 0) {
+        return -1;
+    }
+    const char *id_str = url + prefix_len;
+    if (*id_str == '\0') {
+        return -1;
+    }
+    return atoi(id_str);
+}
+
+/**
+ * @brief Extracts template ID from /api/templates/{id}/<action> path.
+ *
+ * @param url Full request URL
+ * @param action Expected suffix, such as "/full"
+ * @return Template ID, or -1 if URL doesn't match pattern
+ */
+static int extract_template_id(const char *url, const char *action) {
+    const char *prefix = "/api/templates/";
+    size_t prefix_len = strlen(prefix);
+
+    if (strncmp(url, prefix, prefix_len) != 0) {
+        return -1;
+    }
+
+    const char *id_start = url + prefix_len;
+    char *endptr;
+    long id = strtol(id_start, &endptr, 10);
+
+    /* Check that we got a number followed by the action */
+    if (endptr == id_start || strcmp(endptr, action) != 0) {
+        return -1;
+    }
+
+    return (int)id;
+}
+
+size_t routes_max_body_size(const char *url) {
+    return (size_t)(strcmp(url, "/api/foods/import") == 0 ? CONFIG_LIVE(import_max_body_size)
+                                                          : CONFIG_LIVE(max_body_size));
+}
+
+int routes_rate_limit(HttpRequest *request) {
+    RateClass cls = rate_limit_class(request->method, request->url);
+    struct sockaddr_storage addr;
+    const char *key = NULL;
+    int rate;
+
+    switch (cls) {
+    case RATE_CLASS_READ: rate = CONFIG_LIVE(rate_limit_read); break;
+    case RATE_CLASS_HEAVY: rate = CONFIG_LIVE(rate_limit_heavy); break;
+    case RATE_CLASS_WRITE: rate = CONFIG_LIVE(rate_limit_write); break;
+    default: return 0;
+    }
+    if (rate == 0) {
+        return 0;
+    }
+
+    if (config.rate_limit_key_header[0] != '\0') {
+        key = http_header(request, config.rate_limit_key_header);
+    }
+    if (key == NULL && request->frontend->peer_address(request->conn, &addr) != 0) {
+        addr.ss_family = AF_UNSPEC;
+    }
+    return rate_limit_take(rate_limit_client(key, key != NULL ? strlen(key) : 0, &addr), cls,
+                           rate, CONFIG_LIVE(rate_limit_burst));
+}
+
+enum MHD_Result send_rate_limited(HttpRequest *request, int retry_after) {
+    char seconds[16];
+    HttpHeader header = { "Retry-After", seconds };
+
+    snprintf(seconds, sizeof(seconds), "%d", retry_after);
+    return send_json_response_with_headers(request, 429,
+                                           "{\"success\": false, \"error\": \"Too many requests\"}",
+                                           &header, 1);
+}
+
+enum MHD_Result routes_dispatch(HttpRequest *request) {
+    const char *url = request->url;
+    const char *method = request->method;
+
+    /* Handle CORS preflight requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        return send_json_response(request, 200, "{}");
+    }
+
+    if (strcmp(method, "POST") == 0) {
+        /* Route: POST /api/benchmark/bulk-insert */
+        if (strcmp(url, "/api/benchmark/bulk-insert") == 0) {
+            return handle_bulk_insert(request, request->body, request->body_len);
+        }
+
+        /* Route: POST /api/plans/generate */
+        if (strcmp(url, "/api/plans/generate") == 0) {
+            return handle_generate_plan(request, request->body, request->body_len);
+        }
+
+        /* Route: POST /admin/config */
+        if (strcmp(url, "/admin/config") == 0) {
+            return handle_set_config(request, request->body, request->body_len);
+        }
+
+        /* Route: POST /admin/config/reload */
+        if (strcmp(url, "/admin/config/reload") == 0) {
+            return handle_reload_config(request);
+        }
+
+        /* Route: POST /api/foods/import */
+        if (strcmp(url, "/api/foods/import") == 0) {
+            return handle_import_foods(request, request->body, request->body_len);
+        }
+
+        return send_error_response(request, 404, "Not found");
+    }
+
+    /* Route: GET /health */
+    if (strcmp(url, "/health") == 0 && strcmp(method, "GET") == 0) {
+        return handle_health(request);
+    }
+
+    /* Route: GET /metrics */
+    if (strcmp(url, "/metrics") == 0 && strcmp(method, "GET") == 0) {
+        return handle_metrics(request);
+    }
+
+    /* Route: GET /admin/config */
+    if (strcmp(url, "/admin/config") == 0 && strcmp(method, "GET") == 0) {
+        return handle_get_config(request);
+    }
+
+    /* Route: GET /api/categories */
+    if (strcmp(url, "/api/categories") == 0 && strcmp(method, "GET") == 0) {
+        return handle_list_categories(request);
+    }
+
+    /* Route: GET /api/categories/{id} */
+    if (strncmp(url, "/api/categories/", 16) == 0 && strcmp(method, "GET") == 0) {
+        int id = extract_id_from_path(url, "/api/categories/");
+        if (id > 0) {
+            return handle_get_category(request, id);
+        }
+    }
+
+    /* Route: GET /api/catalog/bundle */
+    if (strcmp(url, "/api/catalog/bundle") == 0 && strcmp(method, "GET") == 0) {
+        return handle_catalog_bundle(request);
+    }
+
+    /* Route: GET /api/foods */
+    if (strcmp(url, "/api/foods") == 0 && strcmp(method, "GET") == 0) {
+        return handle_list_foods(request);
+    }
+
+    /* Route: GET /api/foods/suggest */
+    if (strcmp(url, "/api/foods/suggest") == 0 && strcmp(method, "GET") == 0) {
+        return handle_suggest_foods(request);
+    }
+
+    /* Route: GET /api/foods/{id} */
+    if (strncmp(url, "/api/foods/", 11) == 0 && strcmp(method, "GET") == 0) {
+        int id = extract_id_from_path(url, "/api/foods/");
+        if (id > 0) {
+            return handle_get_food(request, id);
+        }
+    }
+
+    /* Route: GET /api/export/foods */
+    if (strcmp(url, "/api/export/foods") == 0 && strcmp(method, "GET") == 0) {
+        return handle_export(request, EXPORT_FOODS);
+    }
+
+    /* Route: GET /api/export/templates */
+    if (strcmp(url, "/api/export/templates") == 0 && strcmp(method, "GET") == 0) {
+        return handle_export(request, EXPORT_TEMPLATES);
+    }
+
+    /* Route: GET /api/templates/search */
+    if (strcmp(url, "/api/templates/search") == 0 && strcmp(method, "GET") == 0) {
+        return handle_search_templates(request);
+    }
+
+    /* Route: GET /api/templates/{id}/full */
+    if (strcmp(method, "GET") == 0) {
+        int template_id = extract_template_id(url, "/full");
+        if (template_id > 0) {
+            return handle_get_template_full(request, template_id);
+        }
+    }
+
+    /* Route: GET /api/templates/{id}/changes?since=<version> */
+    if (strcmp(method, "GET") == 0) {
+        int template_id = extract_template_id(url, "/changes");
+        if (template_id > 0) {
+            return handle_get_template_changes(request, template_id);
+        }
+    }
+
+    /* 404 Not Found */
+    return send_error_response(request, 404, "Not found");
+}
@@ -0,0 +1,389 @@
+/**
+ * @file suggest.c
+ * @brief Compact trie with per-node top-k for prefix autocomplete.
+ *
+ * Build happens in four steps:
+ *   1. Every word start of every normalized name becomes a key.
+ *   2. Keys are inserted in sorted order, so new children are always
+ *      appended after their siblings.
+ *   3. Nodes are visited children-first to compute the top-k foods of
+ *      each subtree. Chain nodes (one child, no terminal) share their
+ *      child's list, so storage grows with branching nodes only.
+ *   4. Nodes are re-laid out breadth-first so the children of a node are
+ *      contiguous and can be binary searched by label.
+ *
+ * The final structure is read-only, so lookups need no locking.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "suggest.h"
+#include "text_fold.h"
+
+/** @brief Final trie node (12 bytes) */
+struct suggest_node {
+    uint32_t child_start;   /**< Index of first child in nodes[] */
+    uint32_t topk_off;      /**< Offset of top-k list in topk[] */
+    uint16_t child_count;   /**< Number of children */
+    uint8_t label;          /**< Byte on the edge leading to this node */
+    uint8_t topk_count;     /**< Entries in the top-k list */
+};
+
+/** @brief Node used while building, linked by first-child/next-sibling */
+struct build_node {
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t next_sibling;
+    int32_t term_head;      /**< First terminal key, -1 if none */
+    uint32_t topk_off;
+    uint8_t topk_count;
+    uint8_t label;
+    uint16_t child_count;
+};
+
+/** @brief Sort key: one word-start suffix of a food name */
+struct suggest_key {
+    const char *text;
+    int food;
+};
+
+/** @brief Read-only index */
+struct suggest_index {
+    struct suggest_node *nodes;
+    uint32_t node_count;
+    uint32_t *topk;
+};
+
+/** @brief Currently built index (NULL until suggest_build succeeds) */
+static struct suggest_index *index_root = NULL;
+
+/** @brief Sentinel for "no node" in build links */
+#define NO_NODE UINT32_MAX
+
+static int compare_keys(const void *a, const void *b) {
+    const struct suggest_key *ka = a;
+    const struct suggest_key *kb = b;
+    return strcmp(ka->text, kb->text);
+}
+
+/**
+ * @brief Returns 1 if food a ranks before food b in suggestions.
+ */
+static int ranks_before(const Catalog *cat, uint32_t a, uint32_t b) {
+    if (cat->popularity[a] != cat->popularity[b]) {
+        return cat->popularity[a] > cat->popularity[b];
+    }
+    return a < b;
+}
+
+/**
+ * @brief Offers a candidate to a bounded, ranked top-k list.
+ *
+ * Duplicates are ignored (the same food can reach a node through
+ * several of its words).
+ */
+static void topk_offer(const Catalog *cat, uint32_t *list, int *count, uint32_t food) {
+    int n = *count;
+    int pos;
+
+    for (int i = 0; i < n; i++) {
+        if (list[i] == food) {
+            return;
+        }
+    }
+
+    if (n == SUGGEST_TOP_K && !ranks_before(cat, food, list[n - 1])) {
+        return;
+    }
+
+    pos = (n < SUGGEST_TOP_K) ? n : n - 1;
+    while (pos > 0 && ranks_before(cat, food, list[pos - 1])) {
+        list[pos] = list[pos - 1];
+        pos--;
+    }
+    list[pos] = food;
+    if (n < SUGGEST_TOP_K) {
+        (*count)++;
+    }
+}
+
+/**
+ * @brief Growable array append helper.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int grow(void **arr, size_t *cap, size_t needed, size_t elem_size) {
+    if (needed <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 1024;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *tmp = realloc(*arr, new_cap * elem_size);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *arr = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+static void index_free(struct suggest_index *idx) {
+    if (idx == NULL) {
+        return;
+    }
+    free(idx->nodes);
+    free(idx->topk);
+    free(idx);
+}
+
+SuggestIndex *suggest_prepare(const Catalog *cat) {
+    struct suggest_key *keys = NULL;
+    int32_t *term_next = NULL;
+    struct build_node *bnodes = NULL;
+    uint32_t *topk = NULL, *queue = NULL;
+    struct suggest_index *idx = NULL;
+    size_t key_count = 0, bnode_cap = 0, bnode_count = 0, topk_cap = 0, topk_used = 0;
+    SuggestIndex *built = NULL;
+
+    if (cat == NULL) {
+        return NULL;
+    }
+
+    /* Step 1: collect word-start keys */
+    for (int i = 0; i < cat->count; i++) {
+        const char *s = cat->norm_names[i];
+        for (const char *p = s; *p != '\0'; p++) {
+            if (p == s || p[-1] == ' ') {
+                key_count++;
+            }
+        }
+    }
+
+    keys = malloc((key_count > 0 ? key_count : 1) * sizeof(struct suggest_key));
+    term_next = malloc((key_count > 0 ? key_count : 1) * sizeof(int32_t));
+    if (keys == NULL || term_next == NULL) {
+        goto done;
+    }
+
+    key_count = 0;
+    for (int i = 0; i < cat->count; i++) {
+        const char *s = cat->norm_names[i];
+        for (const char *p = s; *p != '\0'; p++) {
+            if (p == s || p[-1] == ' ') {
+                keys[key_count].text = p;
+                keys[key_count].food = i;
+                key_count++;
+            }
+        }
+    }
+    qsort(keys, key_count, sizeof(struct suggest_key), compare_keys);
+
+    /* Step 2: insert sorted keys, reusing the path of the previous key */
+    if (grow((void **)&bnodes, &bnode_cap, 1, sizeof(struct build_node)) != 0) {
+        goto done;
+    }
+    memset(&bnodes[0], 0, sizeof(struct build_node));
+    bnodes[0].first_child = bnodes[0].last_child = bnodes[0].next_sibling = NO_NODE;
+    bnodes[0].term_head = -1;
+    bnode_count = 1;
+
+    uint32_t path[256];
+    size_t path_len = 0;
+    const char *prev = "";
+    path[0] = 0;
+
+    for (size_t k = 0; k < key_count; k++) {
+        const char *text = keys[k].text;
+        size_t len = strlen(text);
+        size_t lcp = 0;
+
+        if (len > 255) {
+            len = 255;
+        }
+        while (lcp < len && lcp < path_len && text[lcp] == prev[lcp]) {
+            lcp++;
+        }
+
+        for (size_t d = lcp; d < len; d++) {
+            uint32_t parent = path[d];
+
+            if (grow((void **)&bnodes, &bnode_cap, bnode_count + 1,
+                     sizeof(struct build_node)) != 0) {
+                goto done;
+            }
+
+            uint32_t child = (uint32_t)bnode_count++;
+            memset(&bnodes[child], 0, sizeof(struct build_node));
+            bnodes[child].label = (uint8_t)text[d];
+            bnodes[child].first_child = NO_NODE;
+            bnodes[child].last_child = NO_NODE;
+            bnodes[child].next_sibling = NO_NODE;
+            bnodes[child].term_head = -1;
+
+            /* Keys are sorted, so a new child is always the largest label */
+            if (bnodes[parent].last_child == NO_NODE) {
+                bnodes[parent].first_child = child;
+            } else {
+                bnodes[bnodes[parent].last_child].next_sibling = child;
+            }
+            bnodes[parent].last_child = child;
+            bnodes[parent].child_count++;
+            path[d + 1] = child;
+        }
+
+        term_next[k] = bnodes[path[len]].term_head;
+        bnodes[path[len]].term_head = (int32_t)k;
+        path_len = len;
+        prev = text;
+    }
+
+    /*
+     * Step 3: nodes were created in pre-order, so walking indices
+     * backwards visits every child before its parent.
+     */
+    for (size_t n = bnode_count; n-- > 0;) {
+        struct build_node *node = &bnodes[n];
+        uint32_t list[SUGGEST_TOP_K];
+        int count = 0;
+
+        if (node->term_head < 0 && node->child_count == 1) {
+            node->topk_off = bnodes[node->first_child].topk_off;
+            node->topk_count = bnodes[node->first_child].topk_count;
+            continue;
+        }
+
+        for (int32_t t = node->term_head; t >= 0; t = term_next[t]) {
+            topk_offer(cat, list, &count, (uint32_t)keys[t].food);
+        }
+        for (uint32_t c = node->first_child; c != NO_NODE; c = bnodes[c].next_sibling) {
+            for (int i = 0; i < bnodes[c].topk_count; i++) {
+                topk_offer(cat, list, &count, topk[bnodes[c].topk_off + i]);
+            }
+        }
+
+        if (grow((void **)&topk, &topk_cap, topk_used + (size_t)count,
+                 sizeof(uint32_t)) != 0) {
+            goto done;
+        }
+        memcpy(topk + topk_used, list, (size_t)count * sizeof(uint32_t));
+        node->topk_off = (uint32_t)topk_used;
+        node->topk_count = (uint8_t)count;
+        topk_used += (size_t)count;
+    }
+
+    /* Step 4: breadth-first relayout so siblings are contiguous */
+    idx = calloc(1, sizeof(struct suggest_index));
+    queue = malloc(bnode_count * sizeof(uint32_t));
+    if (idx == NULL || queue == NULL) {
+        goto done;
+    }
+    idx->nodes = malloc(bnode_count * sizeof(struct suggest_node));
+    if (idx->nodes == NULL) {
+        goto done;
+    }
+
+    size_t head = 0, tail = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        uint32_t b = queue[head];
+        struct suggest_node *out = &idx->nodes[head];
+
+        out->label = bnodes[b].label;
+        out->topk_off = bnodes[b].topk_off;
+        out->topk_count = bnodes[b].topk_count;
+        out->child_count = bnodes[b].child_count;
+        out->child_start = (uint32_t)tail;
+        for (uint32_t c = bnodes[b].first_child; c != NO_NODE; c = bnodes[c].next_sibling) {
+            queue[tail++] = c;
+        }
+        head++;
+    }
+
+    idx->node_count = (uint32_t)bnode_count;
+    idx->topk = topk;
+    topk = NULL;
+
+    built = idx;
+    idx = NULL;
+
+    printf("Built suggest index: %zu keys, %zu nodes, %zu top-k entries\n",
+           key_count, bnode_count, topk_used);
+
+done:
+    index_free(idx);
+    free(queue);
+    free(topk);
+    free(bnodes);
+    free(term_next);
+    free(keys);
+    return built;
+}
+
+void suggest_install(SuggestIndex *idx) {
+    index_free(index_root);
+    index_root = idx;
+}
+
+void suggest_discard(SuggestIndex *idx) {
+    index_free(idx);
+}
+
+int suggest_build(const Catalog *cat) {
+    SuggestIndex *idx = suggest_prepare(cat);
+    if (idx == NULL) {
+        return -1;
+    }
+    suggest_install(idx);
+    return 0;
+}
+
+int suggest_lookup(const char *prefix, int *out, int max_results) {
+    const struct suggest_index *idx = index_root;
+    char norm[256];
+    uint32_t node = 0;
+
+    if (idx == NULL) {
+        return -1;
+    }
+
+    size_t len = text_fold(prefix, norm, sizeof(norm));
+
+    for (size_t i = 0; i < len; i++) {
+        const struct suggest_node *parent = &idx->nodes[node];
+        uint8_t c = (uint8_t)norm[i];
+        uint32_t lo = parent->child_start;
+        uint32_t hi = lo + parent->child_count;
+
+        /* Binary search among contiguous, label-sorted children */
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (idx->nodes[mid].label < c) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == parent->child_start + parent->child_count || idx->nodes[lo].label != c) {
+            return 0;
+        }
+        node = lo;
+    }
+
+    int n = idx->nodes[node].topk_count;
+    if (n > max_results) {
+        n = max_results;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = (int)idx->topk[idx->nodes[node].topk_off + (uint32_t)i];
+    }
+    return n;
+}
+
+void suggest_cleanup(void) {
+    index_free(index_root);
+    index_root = NULL;
+}
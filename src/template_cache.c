@@ -0,0 +1,1119 @@
+/**
+ * @file template_cache.c
+ * @brief Versioned template snapshots with structural sharing.
+ *
+ * Each slot publishes one snapshot pointer. A reader announces itself
+ * in one of two counters, chosen by the slot's phase, checks that the
+ * phase has not moved on meanwhile (else it counted where no writer will
+ * look, and tries again), loads the pointer and takes a reference. A
+ * writer exchanges the pointer, flips the phase, and waits for the
+ * counter of the old phase to drain before dropping the published
+ * reference: any reader that could have loaded the old pointer has by
+ * then taken its own. Readers never block, and new readers count in the
+ * other phase, so writers are not starved.
+ */
+
+#define _GNU_SOURCE
+#include <cjson/cJSON.h>
+#include <mysql/mysql.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "db.h"
+#include "template_cache.h"
+#include "template_document.h"
+
+/**
+ * @brief One entry of a template's change log: a meal replaced.
+ */
+struct change {
+    uint64_t version;               /**< Version the change produced */
+    int day_index;
+    int meal_index;
+    TemplateMeal *meal;             /**< New meal (referenced) */
+};
+
+struct slot {
+    int id;                         /**< Template ID, 0 = free; set once */
+    TemplateSnapshot *current;      /**< Published snapshot, or NULL */
+    int phase;                      /**< Counter new readers use */
+    int readers[2];                 /**< Readers between announcing and referencing */
+    uint64_t version;               /**< Last version published (guarded by mutex) */
+    pthread_mutex_t mutex;          /**< Serializes writers and loads of this template */
+    struct change *log;             /**< Ring of TEMPLATE_CHANGE_LOG changes, or NULL */
+    int log_start;                  /**< Oldest entry */
+    int log_count;
+    uint64_t log_base;              /**< Oldest version the log leads on from */
+};
+
+static struct slot slots[TEMPLATE_CACHE_SLOTS];
+
+/** @brief Guards claiming slots */
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int enabled = 0;
+
+/** @brief First version of every template */
+static uint64_t version_base = 1;
+
+static long snapshots_alive = 0;
+static long days_alive = 0;
+static long meals_alive = 0;
+static uint64_t loads = 0;
+static uint64_t updates = 0;
+static uint64_t invalidations = 0;
+static uint64_t serialized_bytes = 0;
+static uint64_t patches = 0;
+static uint64_t full_patches = 0;
+
+/** @brief Bumped by writes and template_cache_invalidate(), so loads racing them are not published */
+static uint64_t generation = 0;
+
+void template_cache_init(void) {
+    struct timespec ts;
+
+    if (!config.template_cache) {
+        return;
+    }
+    for (int i = 0; i < TEMPLATE_CACHE_SLOTS; i++) {
+        pthread_mutex_init(&slots[i].mutex, NULL);
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    version_base = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    enabled = 1;
+    printf("Template snapshots cached in memory\n");
+}
+
+int template_cache_enabled(void) {
+    return enabled;
+}
+
+/**
+ * @brief Finds the slot of a template.
+ *
+ * @param claim Claim a free slot if the template has none
+ * @return Slot, or NULL if absent (or the table is full)
+ */
+static struct slot *slot_find(int id, int claim) {
+    unsigned int start = (unsigned int)id * 2654435761u % TEMPLATE_CACHE_SLOTS;
+    struct slot *found = NULL;
+
+    for (int pass = 0; pass < 2 && found == NULL; pass++) {
+        if (pass == 1) {
+            if (!claim) {
+                break;
+            }
+            pthread_mutex_lock(&table_mutex);
+        }
+        for (unsigned int n = 0; n < TEMPLATE_CACHE_SLOTS; n++) {
+            struct slot *s = &slots[(start + n) % TEMPLATE_CACHE_SLOTS];
+            /* Sequentially consistent against generation: see template_cache_get() */
+            int slot_id = __atomic_load_n(&s->id, __ATOMIC_SEQ_CST);
+
+            if (slot_id == id) {
+                found = s;
+                break;
+            }
+            if (slot_id == 0) {
+                if (pass == 1) {
+                    __atomic_store_n(&s->id, id, __ATOMIC_SEQ_CST);
+                    found = s;
+                }
+                break;
+            }
+        }
+        if (pass == 1) {
+            pthread_mutex_unlock(&table_mutex);
+        }
+    }
+    return found;
+}
+
+static void meal_release(TemplateMeal *meal) {
+    if (__atomic_sub_fetch(&meal->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (int i = 0; i < meal->item_count; i++) {
+        free(meal->items[i].food_name);
+    }
+    free(meal->items);
+    free(meal->json);
+    free(meal->meal_type);
+    free(meal->time_suggestion);
+    free(meal);
+    __atomic_sub_fetch(&meals_alive, 1, __ATOMIC_RELAXED);
+}
+
+static void day_release(TemplateDay *day) {
+    if (__atomic_sub_fetch(&day->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (int i = 0; i < day->meal_count; i++) {
+        meal_release(day->meals[i]);
+    }
+    free(day->meals);
+    free(day->json);
+    free(day->day_name);
+    free(day);
+    __atomic_sub_fetch(&days_alive, 1, __ATOMIC_RELAXED);
+}
+
+void template_cache_release(TemplateSnapshot *snap) {
+    if (__atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (int i = 0; i < snap->day_count; i++) {
+        if (snap->days[i] != NULL) {
+            day_release(snap->days[i]);
+        }
+    }
+    free(snap->days);
+    free(snap->code);
+    free(snap->name);
+    free(snap->description);
+    free(snap->segment);
+    free(snap->type);
+    free(snap->head);
+    free(snap->offsets);
+    free(snap);
+    __atomic_sub_fetch(&snapshots_alive, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Takes a reference to the published snapshot, without locking.
+ */
+static TemplateSnapshot *slot_acquire(struct slot *s) {
+    TemplateSnapshot *snap;
+    int phase;
+
+    for (;;) {
+        phase = __atomic_load_n(&s->phase, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&s->readers[phase], 1, __ATOMIC_SEQ_CST);
+        /* A writer that flipped the phase in between is not waiting for this counter */
+        if (__atomic_load_n(&s->phase, __ATOMIC_SEQ_CST) == phase) {
+            break;
+        }
+        __atomic_sub_fetch(&s->readers[phase], 1, __ATOMIC_RELEASE);
+    }
+    snap = __atomic_load_n(&s->current, __ATOMIC_SEQ_CST);
+    if (snap != NULL) {
+        __atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&s->readers[phase], 1, __ATOMIC_RELEASE);
+    return snap;
+}
+
+/**
+ * @brief Replaces the published snapshot (NULL to drop it).
+ *
+ * @note Caller must hold s->mutex
+ */
+static void slot_publish(struct slot *s, TemplateSnapshot *snap) {
+    TemplateSnapshot *old = __atomic_exchange_n(&s->current, snap, __ATOMIC_SEQ_CST);
+    int phase = __atomic_load_n(&s->phase, __ATOMIC_SEQ_CST);
+
+    if (snap != NULL) {
+        s->version = snap->version;
+    }
+    __atomic_store_n(&s->phase, !phase, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&s->readers[phase], __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    if (old != NULL) {
+        template_cache_release(old);
+    }
+}
+
+/**
+ * @brief Empties a template's change log; it now leads on from version.
+ *
+ * @note Caller must hold s->mutex
+ */
+static void log_reset(struct slot *s, uint64_t version) {
+    for (int i = 0; i < s->log_count; i++) {
+        meal_release(s->log[(s->log_start + i) % config.template_change_log].meal);
+    }
+    s->log_start = 0;
+    s->log_count = 0;
+    s->log_base = version;
+}
+
+/**
+ * @brief Records that a version replaced one meal, dropping the oldest entry if full.
+ *
+ * @note Caller must hold s->mutex
+ */
+static void log_append(struct slot *s, uint64_t version, int day_index, int meal_index,
+                       TemplateMeal *meal) {
+    int size = config.template_change_log;
+    struct change *entry;
+
+    if (s->log == NULL && size > 0) {
+        s->log = calloc((size_t)size, sizeof(struct change));
+    }
+    if (s->log == NULL) {
+        /* Nothing to lead on from: older versions get the full template */
+        log_reset(s, version);
+        return;
+    }
+    if (s->log_count == size) {
+        entry = &s->log[s->log_start];
+        s->log_base = entry->version;
+        meal_release(entry->meal);
+        s->log_start = (s->log_start + 1) % size;
+        s->log_count--;
+    }
+    entry = &s->log[(s->log_start + s->log_count) % size];
+    entry->version = version;
+    entry->day_index = day_index;
+    entry->meal_index = meal_index;
+    entry->meal = meal;
+    __atomic_add_fetch(&meal->refs, 1, __ATOMIC_RELAXED);
+    s->log_count++;
+}
+
+static char *dup_string(const char *s) {
+    return strdup(s != NULL ? s : "");
+}
+
+static TemplateSnapshot *snapshot_alloc(void) {
+    TemplateSnapshot *snap = calloc(1, sizeof(*snap));
+
+    if (snap != NULL) {
+        snap->refs = 1;
+        __atomic_add_fetch(&snapshots_alive, 1, __ATOMIC_RELAXED);
+    }
+    return snap;
+}
+
+static TemplateDay *day_alloc(int meal_count) {
+    TemplateDay *day = calloc(1, sizeof(*day));
+
+    if (day == NULL) {
+        return NULL;
+    }
+    day->refs = 1;
+    day->meals = calloc((size_t)meal_count + 1, sizeof(TemplateMeal *));
+    if (day->meals == NULL) {
+        free(day);
+        return NULL;
+    }
+    __atomic_add_fetch(&days_alive, 1, __ATOMIC_RELAXED);
+    return day;
+}
+
+static TemplateMeal *meal_alloc(int item_count) {
+    TemplateMeal *meal = calloc(1, sizeof(*meal));
+
+    if (meal == NULL) {
+        return NULL;
+    }
+    meal->refs = 1;
+    meal->items = calloc((size_t)item_count + 1, sizeof(TemplateItem));
+    if (meal->items == NULL) {
+        free(meal);
+        return NULL;
+    }
+    __atomic_add_fetch(&meals_alive, 1, __ATOMIC_RELAXED);
+    return meal;
+}
+
+static int json_int(const cJSON *obj, const char *key) {
+    const cJSON *item = cJSON_GetObjectItem(obj, key);
+    return cJSON_IsNumber(item) ? item->valueint : 0;
+}
+
+static const char *json_string(const cJSON *obj, const char *key) {
+    const cJSON *item = cJSON_GetObjectItem(obj, key);
+    return cJSON_IsString(item) ? item->valuestring : "";
+}
+
+/**
+ * @brief Prints an object whose last member is an empty array, leaving it open.
+ *
+ * The closing "]" and "}"s are dropped, so that pre-serialized elements
+ * can be appended in their place.
+ *
+ * @param obj Object to print (deleted)
+ * @param closing Closing characters to drop
+ * @param extra Bytes to reserve after the printed part
+ * @param len Set to the length of the printed part
+ * @return malloc()ed buffer, or NULL if out of memory
+ */
+static char *print_open(cJSON *obj, size_t closing, size_t extra, size_t *len) {
+    char *json = cJSON_PrintUnformatted(obj);
+    char *buf = NULL;
+
+    cJSON_Delete(obj);
+    if (json == NULL) {
+        return NULL;
+    }
+    *len = strlen(json) - closing;
+    __atomic_add_fetch(&serialized_bytes, *len, __ATOMIC_RELAXED);
+    /* malloc()ed, as the last reference may be dropped on any thread */
+    buf = malloc(*len + extra + 1);
+    if (buf != NULL) {
+        memcpy(buf, json, *len);
+        buf[*len] = '\0';
+    }
+    cJSON_free(json);
+    return buf;
+}
+
+/**
+ * @brief Serializes a meal.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int meal_render(TemplateMeal *meal) {
+    cJSON *obj = cJSON_CreateObject();
+    cJSON *items, *node;
+
+    cJSON_AddNumberToObject(obj, "id", meal->id);
+    cJSON_AddStringToObject(obj, "meal_type", meal->meal_type);
+    cJSON_AddNumberToObject(obj, "meal_order", meal->meal_order);
+    cJSON_AddStringToObject(obj, "time_suggestion", meal->time_suggestion);
+    items = cJSON_AddArrayToObject(obj, "items");
+    for (int k = 0; k < meal->item_count; k++) {
+        const TemplateItem *it = &meal->items[k];
+
+        node = cJSON_CreateObject();
+        cJSON_AddItemToArray(items, node);
+        cJSON_AddNumberToObject(node, "id", it->id);
+        cJSON_AddNumberToObject(node, "food_item_id", it->food_item_id);
+        cJSON_AddStringToObject(node, "food_name", it->food_name);
+        cJSON_AddNumberToObject(node, "portion_grams_min", it->portion_grams_min);
+        cJSON_AddNumberToObject(node, "portion_grams_max", it->portion_grams_max);
+    }
+
+    meal->json = print_open(obj, 0, 0, &meal->json_len);
+    return meal->json != NULL ? 0 : -1;
+}
+
+/**
+ * @brief Serializes a day around the segments of its meals.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int day_render(TemplateDay *day) {
+    cJSON *obj = cJSON_CreateObject();
+    size_t meals_len = 0;
+
+    cJSON_AddNumberToObject(obj, "id", day->id);
+    cJSON_AddNumberToObject(obj, "day_number", day->day_number);
+    cJSON_AddStringToObject(obj, "day_name", day->day_name);
+    cJSON_AddArrayToObject(obj, "meals");
+    for (int j = 0; j < day->meal_count; j++) {
+        meals_len += day->meals[j]->json_len + 1;
+    }
+
+    /* {...,"meals":[ + meal,meal + ]} */
+    day->json = print_open(obj, 2, meals_len + 2, &day->json_len);
+    if (day->json == NULL) {
+        return -1;
+    }
+    for (int j = 0; j < day->meal_count; j++) {
+        if (j > 0) {
+            day->json[day->json_len++] = ',';
+        }
+        memcpy(day->json + day->json_len, day->meals[j]->json, day->meals[j]->json_len);
+        day->json_len += day->meals[j]->json_len;
+    }
+    memcpy(day->json + day->json_len, "]}", 3);
+    day->json_len += 2;
+    return 0;
+}
+
+/**
+ * @brief Serializes the template fields and indexes the day segments.
+ *
+ * Days are already serialized; this is all a new version re-renders
+ * besides the changed meal and day.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int snapshot_render(TemplateSnapshot *snap) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *obj;
+    size_t pos;
+
+    cJSON_AddBoolToObject(root, "success", 1);
+    obj = cJSON_AddObjectToObject(root, "template");
+    cJSON_AddNumberToObject(obj, "id", snap->id);
+    cJSON_AddNumberToObject(obj, "version", (double)snap->version);
+    cJSON_AddStringToObject(obj, "code", snap->code);
+    cJSON_AddStringToObject(obj, "name", snap->name);
+    cJSON_AddStringToObject(obj, "description", snap->description);
+    cJSON_AddStringToObject(obj, "segment", snap->segment);
+    cJSON_AddStringToObject(obj, "type", snap->type);
+    cJSON_AddNumberToObject(obj, "duration_days", snap->duration_days);
+    cJSON_AddNumberToObject(obj, "calories_target", snap->calories_target);
+    cJSON_AddArrayToObject(obj, "days");
+
+    /* {"success":true,"template":{...,"days":[ */
+    snap->head = print_open(root, 3, 0, &snap->head_len);
+    snap->offsets = malloc(((size_t)snap->day_count + 2) * sizeof(size_t));
+    if (snap->head == NULL || snap->offsets == NULL) {
+        return -1;
+    }
+
+    /* Segment i + 1 is day i; the separating commas fill the gaps */
+    snap->offsets[0] = 0;
+    pos = snap->head_len;
+    for (int i = 0; i < snap->day_count; i++) {
+        pos += i > 0;
+        snap->offsets[i + 1] = pos;
+        pos += snap->days[i]->json_len;
+    }
+    snap->offsets[snap->day_count + 1] = pos;
+    snap->body_len = pos + 3;
+    return 0;
+}
+
+/**
+ * @brief Returns the bytes of a segment of the body.
+ */
+static const char *segment_data(const TemplateSnapshot *snap, int seg, size_t *len) {
+    if (seg == 0) {
+        *len = snap->head_len;
+        return snap->head;
+    }
+    if (seg <= snap->day_count) {
+        *len = snap->days[seg - 1]->json_len;
+        return snap->days[seg - 1]->json;
+    }
+    *len = 3;
+    return "]}}";
+}
+
+size_t template_cache_read(const TemplateSnapshot *snap, size_t pos, char *buf, size_t max) {
+    int lo = 0, hi = snap->day_count + 1;
+    size_t copied = 0;
+
+    if (pos >= snap->body_len) {
+        return 0;
+    }
+    /* Last segment starting at or before pos */
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (snap->offsets[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    for (int seg = lo; seg <= snap->day_count + 1 && copied < max; seg++) {
+        size_t len, skip = pos + copied - snap->offsets[seg], n;
+        const char *data = segment_data(snap, seg, &len);
+
+        if (skip < len) {
+            n = len - skip < max - copied ? len - skip : max - copied;
+            memcpy(buf + copied, data + skip, n);
+            copied += n;
+        }
+        if (seg <= snap->day_count && copied < max &&
+            pos + copied < snap->offsets[seg + 1]) {
+            buf[copied++] = ',';
+        }
+    }
+    return copied;
+}
+
+char *template_cache_body(const TemplateSnapshot *snap) {
+    char *body = malloc(snap->body_len + 1);
+
+    if (body != NULL) {
+        template_cache_read(snap, 0, body, snap->body_len);
+        body[snap->body_len] = '\0';
+    }
+    return body;
+}
+
+/**
+ * @brief Builds a meal from its template-full JSON.
+ */
+static TemplateMeal *meal_from_json(const cJSON *obj) {
+    const cJSON *items = cJSON_GetObjectItem(obj, "items"), *item;
+    TemplateMeal *meal = meal_alloc(cJSON_GetArraySize(items));
+
+    if (meal == NULL) {
+        return NULL;
+    }
+    meal->id = json_int(obj, "id");
+    meal->meal_order = json_int(obj, "meal_order");
+    meal->meal_type = dup_string(json_string(obj, "meal_type"));
+    meal->time_suggestion = dup_string(json_string(obj, "time_suggestion"));
+    cJSON_ArrayForEach(item, items) {
+        TemplateItem *it = &meal->items[meal->item_count++];
+
+        it->id = json_int(item, "id");
+        it->food_item_id = json_int(item, "food_item_id");
+        it->food_name = dup_string(json_string(item, "food_name"));
+        it->portion_grams_min = json_int(item, "portion_grams_min");
+        it->portion_grams_max = json_int(item, "portion_grams_max");
+        if (it->food_name == NULL) {
+            meal_release(meal);
+            return NULL;
+        }
+    }
+    if (meal->meal_type == NULL || meal->time_suggestion == NULL || meal_render(meal) != 0) {
+        meal_release(meal);
+        return NULL;
+    }
+    return meal;
+}
+
+/**
+ * @brief Builds a snapshot from the template-full response.
+ */
+static TemplateSnapshot *snapshot_from_json(const cJSON *root) {
+    const cJSON *obj = cJSON_GetObjectItem(root, "template");
+    const cJSON *days = cJSON_GetObjectItem(obj, "days"), *day_obj, *meal_obj;
+    TemplateSnapshot *snap = snapshot_alloc();
+
+    if (snap == NULL) {
+        return NULL;
+    }
+    snap->id = json_int(obj, "id");
+    snap->code = dup_string(json_string(obj, "code"));
+    snap->name = dup_string(json_string(obj, "name"));
+    snap->description = dup_string(json_string(obj, "description"));
+    snap->segment = dup_string(json_string(obj, "segment"));
+    snap->type = dup_string(json_string(obj, "type"));
+    snap->duration_days = json_int(obj, "duration_days");
+    snap->calories_target = json_int(obj, "calories_target");
+    snap->days = calloc((size_t)cJSON_GetArraySize(days) + 1, sizeof(TemplateDay *));
+    if (snap->code == NULL || snap->name == NULL || snap->description == NULL ||
+        snap->segment == NULL || snap->type == NULL || snap->days == NULL) {
+        template_cache_release(snap);
+        return NULL;
+    }
+
+    cJSON_ArrayForEach(day_obj, days) {
+        const cJSON *meals = cJSON_GetObjectItem(day_obj, "meals");
+        TemplateDay *day = day_alloc(cJSON_GetArraySize(meals));
+
+        if (day == NULL) {
+            template_cache_release(snap);
+            return NULL;
+        }
+        snap->days[snap->day_count++] = day;
+        day->id = json_int(day_obj, "id");
+        day->day_number = json_int(day_obj, "day_number");
+        day->day_name = dup_string(json_string(day_obj, "day_name"));
+        if (day->day_name == NULL) {
+            template_cache_release(snap);
+            return NULL;
+        }
+        cJSON_ArrayForEach(meal_obj, meals) {
+            TemplateMeal *meal = meal_from_json(meal_obj);
+
+            if (meal == NULL) {
+                template_cache_release(snap);
+                return NULL;
+            }
+            day->meals[day->meal_count++] = meal;
+        }
+        if (day_render(day) != 0) {
+            template_cache_release(snap);
+            return NULL;
+        }
+    }
+    return snap;
+}
+
+static MYSQL_RES *fetch_primary(void *ctx, const char *query) {
+    (void)ctx;
+    return db_query(query);
+}
+
+/**
+ * @brief Makes a freshly loaded snapshot the slot's latest version.
+ *
+ * A load that overlapped a write or template_cache_invalidate() may have
+ * read what they replaced, so it is returned to the caller but not
+ * published.
+ *
+ * @param gen Generation read before the load started
+ * @note Caller must hold s->mutex
+ */
+static void slot_adopt(struct slot *s, TemplateSnapshot *snap, uint64_t gen) {
+    s->version = snap->version;
+    log_reset(s, snap->version);
+    if (__atomic_load_n(&generation, __ATOMIC_SEQ_CST) == gen) {
+        snap->refs++;
+        slot_publish(s, snap);
+    }
+}
+
+/**
+ * @brief Loads a template from the primary and, given a slot, adopts it.
+ *
+ * @param s Slot of the template, or NULL for a snapshot that is not kept
+ * @param snapshot Set to a referenced snapshot on success
+ * @note Caller must hold s->mutex
+ */
+static int slot_load(struct slot *s, int id, TemplateSnapshot **snapshot) {
+    uint64_t gen = __atomic_load_n(&generation, __ATOMIC_SEQ_CST);
+    TemplateSnapshot *snap;
+    cJSON *root;
+    int rc;
+
+    rc = template_document_build(id, 0, fetch_primary, NULL, &root);
+    if (rc != 0) {
+        return rc;
+    }
+    snap = snapshot_from_json(root);
+    cJSON_Delete(root);
+    if (snap == NULL) {
+        return -1;
+    }
+    snap->version = s != NULL && s->version > 0 ? s->version + 1 : version_base;
+    if (snapshot_render(snap) != 0) {
+        template_cache_release(snap);
+        return -1;
+    }
+    if (s != NULL) {
+        slot_adopt(s, snap, gen);
+    }
+    __atomic_add_fetch(&loads, 1, __ATOMIC_RELAXED);
+    *snapshot = snap;
+    return 0;
+}
+
+int template_cache_get(int id, TemplateSnapshot **out) {
+    struct slot *s = slot_find(id, 0);
+    TemplateSnapshot *snap = NULL;
+    int rc = 0;
+
+    if (s != NULL && (snap = slot_acquire(s)) != NULL) {
+        *out = snap;
+        return 0;
+    }
+
+    if (s == NULL) {
+        /*
+         * Only templates that exist get a slot, or misses would fill the
+         * table. A write that looks for the slot before it is claimed
+         * bumps the generation first, so this load is then not published.
+         */
+        uint64_t gen = __atomic_load_n(&generation, __ATOMIC_SEQ_CST);
+
+        rc = slot_load(NULL, id, &snap);
+        if (rc != 0 || (s = slot_find(id, 1)) == NULL) {
+            /* Not found, or table full: the snapshot serves this request only */
+            *out = snap;
+            return rc;
+        }
+        pthread_mutex_lock(&s->mutex);
+        if (s->version == 0) {
+            slot_adopt(s, snap, gen);
+            pthread_mutex_unlock(&s->mutex);
+            *out = snap;
+            return 0;
+        }
+        /* Another request claimed the slot first: use its version */
+        template_cache_release(snap);
+    } else {
+        pthread_mutex_lock(&s->mutex);
+    }
+
+    snap = slot_acquire(s);
+    if (snap == NULL) {
+        rc = slot_load(s, id, &snap);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    *out = snap;
+    return rc;
+}
+
+/**
+ * @brief Reads a meal's items from the primary into a copy of the meal.
+ */
+static TemplateMeal *meal_reload(const TemplateMeal *old) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    TemplateMeal *meal;
+    char query[512];
+
+    snprintf(query, sizeof(query),
+        "SELECT mi.id, mi.food_item_id, f.name, mi.portion_grams_min, mi.portion_grams_max "
+        "FROM diet_meal_items mi "
+        "JOIN food_items f ON mi.food_item_id = f.id "
+        "WHERE mi.meal_id = %d ORDER BY mi.sort_order, mi.id", old->id);
+    result = db_query(query);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    meal = meal_alloc((int)mysql_num_rows(result));
+    if (meal == NULL) {
+        mysql_free_result(result);
+        return NULL;
+    }
+    meal->id = old->id;
+    meal->meal_order = old->meal_order;
+    meal->meal_type = dup_string(old->meal_type);
+    meal->time_suggestion = dup_string(old->time_suggestion);
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        TemplateItem *it = &meal->items[meal->item_count++];
+
+        it->id = atoi(row[0]);
+        it->food_item_id = row[1] ? atoi(row[1]) : 0;
+        it->food_name = dup_string(row[2]);
+        it->portion_grams_min = row[3] ? atoi(row[3]) : 0;
+        it->portion_grams_max = row[4] ? atoi(row[4]) : 0;
+        if (it->food_name == NULL) {
+            mysql_free_result(result);
+            meal_release(meal);
+            return NULL;
+        }
+    }
+    mysql_free_result(result);
+
+    if (meal->meal_type == NULL || meal->time_suggestion == NULL || meal_render(meal) != 0) {
+        meal_release(meal);
+        return NULL;
+    }
+    return meal;
+}
+
+/**
+ * @brief Builds the next version of a snapshot with one meal replaced.
+ *
+ * Every other day and meal is shared with the previous version.
+ */
+static TemplateSnapshot *snapshot_replace_meal(const TemplateSnapshot *cur, int day_index,
+                                               int meal_index, TemplateMeal *meal) {
+    const TemplateDay *old_day = cur->days[day_index];
+    TemplateSnapshot *snap = snapshot_alloc();
+    TemplateDay *day;
+
+    if (snap == NULL) {
+        meal_release(meal);
+        return NULL;
+    }
+    snap->id = cur->id;
+    snap->code = dup_string(cur->code);
+    snap->name = dup_string(cur->name);
+    snap->description = dup_string(cur->description);
+    snap->segment = dup_string(cur->segment);
+    snap->type = dup_string(cur->type);
+    snap->duration_days = cur->duration_days;
+    snap->calories_target = cur->calories_target;
+    snap->days = calloc((size_t)cur->day_count + 1, sizeof(TemplateDay *));
+    day = day_alloc(old_day->meal_count);
+    if (snap->code == NULL || snap->name == NULL || snap->description == NULL ||
+        snap->segment == NULL || snap->type == NULL || snap->days == NULL || day == NULL) {
+        if (day != NULL) {
+            day_release(day);
+        }
+        meal_release(meal);
+        template_cache_release(snap);
+        return NULL;
+    }
+
+    day->id = old_day->id;
+    day->day_number = old_day->day_number;
+    day->day_name = dup_string(old_day->day_name);
+    for (int j = 0; j < old_day->meal_count; j++) {
+        if (j == meal_index) {
+            day->meals[j] = meal;
+        } else {
+            day->meals[j] = old_day->meals[j];
+            __atomic_add_fetch(&day->meals[j]->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    day->meal_count = old_day->meal_count;
+
+    for (int i = 0; i < cur->day_count; i++) {
+        if (i == day_index) {
+            snap->days[i] = day;
+        } else {
+            snap->days[i] = cur->days[i];
+            __atomic_add_fetch(&snap->days[i]->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    snap->day_count = cur->day_count;
+
+    if (day->day_name == NULL || day_render(day) != 0) {
+        template_cache_release(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+int template_cache_meal_changed(int template_id, int meal_id) {
+    struct slot *s;
+    TemplateSnapshot *cur, *snap = NULL;
+    int day_index = -1, meal_index = -1;
+
+    if (!enabled) {
+        return 0;
+    }
+    /* Before looking for the slot: a load that has not claimed it yet must not publish */
+    __atomic_add_fetch(&generation, 1, __ATOMIC_SEQ_CST);
+    if ((s = slot_find(template_id, 0)) == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    /* Only writers change current, and they hold the mutex */
+    cur = __atomic_load_n(&s->current, __ATOMIC_ACQUIRE);
+    if (cur == NULL) {
+        pthread_mutex_unlock(&s->mutex);
+        return 0;
+    }
+    for (int i = 0; i < cur->day_count && day_index < 0; i++) {
+        for (int j = 0; j < cur->days[i]->meal_count; j++) {
+            if (cur->days[i]->meals[j]->id == meal_id) {
+                day_index = i;
+                meal_index = j;
+                break;
+            }
+        }
+    }
+
+    if (day_index >= 0) {
+        TemplateMeal *meal = meal_reload(cur->days[day_index]->meals[meal_index]);
+
+        if (meal != NULL) {
+            snap = snapshot_replace_meal(cur, day_index, meal_index, meal);
+        }
+        if (snap != NULL) {
+            snap->version = s->version + 1;
+            if (snapshot_render(snap) != 0) {
+                template_cache_release(snap);
+                snap = NULL;
+            }
+        }
+        if (snap != NULL) {
+            log_append(s, snap->version, day_index, meal_index,
+                       snap->days[day_index]->meals[meal_index]);
+        }
+    }
+    if (snap == NULL) {
+        log_reset(s, s->version);
+    }
+
+    /* Meal not in the snapshot, or out of memory: reload on the next read */
+    slot_publish(s, snap);
+    pthread_mutex_unlock(&s->mutex);
+    __atomic_add_fetch(snap != NULL ? &updates : &invalidations, 1, __ATOMIC_RELAXED);
+    return snap != NULL ? 0 : -1;
+}
+
+/**
+ * @brief A JSON Patch document being written.
+ */
+struct patch {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * @brief Makes room for extra bytes (and a NUL) at the end of a patch.
+ */
+static int patch_reserve(struct patch *p, size_t extra) {
+    size_t cap = p->cap > 0 ? p->cap : 256;
+    char *grown;
+
+    if (p->len + extra + 1 <= p->cap) {
+        return 0;
+    }
+    while (p->len + extra + 1 > cap) {
+        cap *= 2;
+    }
+    grown = realloc(p->data, cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    p->data = grown;
+    p->cap = cap;
+    return 0;
+}
+
+static int patch_append(struct patch *p, const char *data, size_t len) {
+    if (patch_reserve(p, len) != 0) {
+        return -1;
+    }
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+    p->data[p->len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Writes the log entries after a version as replace operations.
+ *
+ * A meal replaced several times gets one operation, with its latest value.
+ *
+ * @note Caller must hold s->mutex
+ */
+static int patch_from_log(struct patch *p, const struct slot *s, uint64_t since,
+                          uint64_t version) {
+    int size = config.template_change_log;
+    char buf[96];
+    int rc = patch_append(p, "[", 1);
+
+    for (int i = 0; i < s->log_count && rc == 0; i++) {
+        const struct change *entry = &s->log[(s->log_start + i) % size];
+        int superseded = 0;
+        int n;
+
+        if (entry->version <= since) {
+            continue;
+        }
+        for (int j = i + 1; j < s->log_count && !superseded; j++) {
+            const struct change *later = &s->log[(s->log_start + j) % size];
+
+            superseded = later->day_index == entry->day_index &&
+                         later->meal_index == entry->meal_index;
+        }
+        if (superseded) {
+            continue;
+        }
+        n = snprintf(buf, sizeof(buf),
+                     "{\"op\":\"replace\",\"path\":\"/template/days/%d/meals/%d\",\"value\":",
+                     entry->day_index, entry->meal_index);
+        rc = patch_append(p, buf, (size_t)n) |
+             patch_append(p, entry->meal->json, entry->meal->json_len) |
+             patch_append(p, "},", 2);
+    }
+    if (rc == 0) {
+        int n = snprintf(buf, sizeof(buf),
+                         "{\"op\":\"replace\",\"path\":\"/template/version\",\"value\":%llu}]",
+                         (unsigned long long)version);
+
+        rc = patch_append(p, buf, (size_t)n);
+    }
+    return rc;
+}
+
+/**
+ * @brief Writes one operation replacing the whole template object.
+ */
+static int patch_full(struct patch *p, const TemplateSnapshot *snap) {
+    static const char op[] = "[{\"op\":\"replace\",\"path\":\"/template\",\"value\":";
+    const char *value = strstr(snap->head, "\"template\":");
+    size_t skip, len;
+
+    if (value == NULL) {
+        return -1;
+    }
+    /* The body is {"success":true,"template":{...}}: keep the inner object */
+    skip = (size_t)(value - snap->head) + strlen("\"template\":");
+    len = snap->body_len - skip - 1;
+    if (patch_append(p, op, sizeof(op) - 1) != 0 || patch_reserve(p, len) != 0) {
+        return -1;
+    }
+    p->len += template_cache_read(snap, skip, p->data + p->len, len);
+    return patch_append(p, "}]", 2);
+}
+
+int template_cache_changes(int id, uint64_t since, TemplateChanges *changes) {
+    struct slot *s;
+    TemplateSnapshot *snap;
+    struct patch p = { NULL, 0, 0 };
+    int rc, full = 1;
+
+    memset(changes, 0, sizeof(*changes));
+    rc = template_cache_get(id, &snap);
+    if (rc != 0) {
+        return rc;
+    }
+
+    s = slot_find(id, 0);
+    if (s != NULL) {
+        TemplateSnapshot *cur;
+
+        pthread_mutex_lock(&s->mutex);
+        /* The log describes the published version, which may be newer */
+        cur = __atomic_load_n(&s->current, __ATOMIC_ACQUIRE);
+        if (cur != NULL && cur != snap) {
+            __atomic_add_fetch(&cur->refs, 1, __ATOMIC_RELAXED);
+            template_cache_release(snap);
+            snap = cur;
+        }
+        if (cur == snap && since == snap->version) {
+            rc = patch_append(&p, "[]", 2);
+            full = 0;
+        } else if (cur == snap && since >= s->log_base && since < snap->version) {
+            rc = patch_from_log(&p, s, since, snap->version);
+            full = 0;
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+    if (full) {
+        rc = patch_full(&p, snap);
+    }
+
+    changes->version = snap->version;
+    changes->full = full;
+    template_cache_release(snap);
+    if (rc != 0) {
+        free(p.data);
+        return -1;
+    }
+    changes->patch = p.data;
+    changes->patch_len = p.len;
+    __atomic_add_fetch(full ? &full_patches : &patches, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void template_cache_invalidate(void) {
+    if (!enabled) {
+        return;
+    }
+    __atomic_add_fetch(&generation, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < TEMPLATE_CACHE_SLOTS; i++) {
+        struct slot *s = &slots[i];
+
+        if (__atomic_load_n(&s->id, __ATOMIC_ACQUIRE) == 0 ||
+            __atomic_load_n(&s->current, __ATOMIC_ACQUIRE) == NULL) {
+            continue;
+        }
+        pthread_mutex_lock(&s->mutex);
+        if (__atomic_load_n(&s->current, __ATOMIC_ACQUIRE) != NULL) {
+            slot_publish(s, NULL);
+            log_reset(s, s->version);
+            __atomic_add_fetch(&invalidations, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+void template_cache_stats(TemplateCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->enabled = enabled;
+    for (int i = 0; i < TEMPLATE_CACHE_SLOTS && enabled; i++) {
+        if (__atomic_load_n(&slots[i].current, __ATOMIC_RELAXED) != NULL) {
+            stats->templates++;
+        }
+    }
+    stats->snapshots = __atomic_load_n(&snapshots_alive, __ATOMIC_RELAXED);
+    stats->days = __atomic_load_n(&days_alive, __ATOMIC_RELAXED);
+    stats->meals = __atomic_load_n(&meals_alive, __ATOMIC_RELAXED);
+    stats->loads = __atomic_load_n(&loads, __ATOMIC_RELAXED);
+    stats->updates = __atomic_load_n(&updates, __ATOMIC_RELAXED);
+    stats->invalidations = __atomic_load_n(&invalidations, __ATOMIC_RELAXED);
+    stats->serialized_bytes = __atomic_load_n(&serialized_bytes, __ATOMIC_RELAXED);
+    stats->patches = __atomic_load_n(&patches, __ATOMIC_RELAXED);
+    stats->full_patches = __atomic_load_n(&full_patches, __ATOMIC_RELAXED);
+}
+
+void template_cache_cleanup(void) {
+    template_cache_invalidate();
+    for (int i = 0; i < TEMPLATE_CACHE_SLOTS; i++) {
+        free(slots[i].log);
+        slots[i].log = NULL;
+    }
+}
@@ -0,0 +1,423 @@
+/**
+ * @file template_document.c
+ * @brief Template-full assembly and the diet_template_documents table.
+ */
+
+#include <cjson/cJSON.h>
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "db.h"
+#include "db_replica.h"
+#include "template_document.h"
+
+/** @brief Most days and meals per day in a document */
+#define MAX_DAYS 100
+#define MAX_MEALS 50
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+static int enabled = 0;
+
+static const char *create_table =
+    "CREATE TABLE IF NOT EXISTS diet_template_documents ("
+    "template_id INTEGER NOT NULL PRIMARY KEY, "
+    "version BIGINT UNSIGNED NOT NULL, "
+    "body MEDIUMBLOB NULL, "
+    "updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP, "
+    "FOREIGN KEY (template_id) REFERENCES diet_templates(id) ON DELETE CASCADE)";
+
+/**
+ * @brief template-full assembled by MySQL.
+ *
+ * JSON_ARRAYAGG takes no ORDER BY and MySQL promises no order for it, so
+ * each array is a GROUP_CONCAT with its own ORDER BY, cast back to JSON.
+ * The hint lifts group_concat_max_len (1024 bytes by default) for this
+ * statement only. The derived tables keep the limits of
+ * template_document_build(); their ORDER BY only picks which rows are kept.
+ */
+static const char *json_query =
+    "SELECT /*+ SET_VAR(group_concat_max_len = 67108864) */ "
+    "JSON_OBJECT('success', TRUE, 'template', JSON_OBJECT("
+    "'id', t.id, 'code', COALESCE(t.code, ''), 'name', COALESCE(t.name, ''), "
+    "'description', COALESCE(t.description, ''), 'segment', COALESCE(t.segment, ''), "
+    "'type', COALESCE(t.type, ''), 'duration_days', COALESCE(t.duration_days, 0), "
+    "'calories_target', COALESCE(t.calories_target, 0), "
+    "'days', (SELECT COALESCE(CAST(CONCAT('[', GROUP_CONCAT(JSON_OBJECT("
+        "'id', d.id, 'day_number', COALESCE(d.day_number, 0), "
+        "'day_name', COALESCE(d.day_name, ''), "
+        "'meals', (SELECT COALESCE(CAST(CONCAT('[', GROUP_CONCAT(JSON_OBJECT("
+            "'id', m.id, 'meal_type', COALESCE(m.meal_type, ''), "
+            "'meal_order', COALESCE(m.meal_order, 0), "
+            "'time_suggestion', COALESCE(m.time_suggestion, ''), "
+            "'items', (SELECT COALESCE(CAST(CONCAT('[', GROUP_CONCAT(JSON_OBJECT("
+                "'id', i.id, 'food_item_id', COALESCE(i.food_item_id, 0), "
+                "'food_name', COALESCE(i.name, ''), "
+                "'portion_grams_min', COALESCE(i.portion_grams_min, 0), "
+                "'portion_grams_max', COALESCE(i.portion_grams_max, 0)) "
+                "ORDER BY i.sort_order, i.id SEPARATOR ','), ']') AS JSON), JSON_ARRAY()) "
+            "FROM (SELECT mi.id, mi.food_item_id, f.name, mi.portion_grams_min, "
+                "mi.portion_grams_max, mi.sort_order FROM diet_meal_items mi "
+                "JOIN food_items f ON mi.food_item_id = f.id "
+                "WHERE mi.meal_id = m.id) i)) "
+            "ORDER BY m.meal_order, m.id SEPARATOR ','), ']') AS JSON), JSON_ARRAY()) "
+        "FROM (SELECT id, meal_type, meal_order, time_suggestion FROM diet_meals "
+            "WHERE day_id = d.id ORDER BY meal_order, id LIMIT " TO_STRING(MAX_MEALS) ") m)) "
+        "ORDER BY d.day_number, d.id SEPARATOR ','), ']') AS JSON), JSON_ARRAY()) "
+    "FROM (SELECT id, day_number, day_name FROM diet_days "
+        "WHERE template_id = t.id ORDER BY day_number, id LIMIT " TO_STRING(MAX_DAYS) ") d))) "
+    "FROM diet_templates t WHERE t.id = %d";
+
+int template_document_init(void) {
+    if (!config.template_documents) {
+        return 0;
+    }
+    if (db_execute(create_table) < 0) {
+        fprintf(stderr, "Cannot create diet_template_documents\n");
+        return -1;
+    }
+    enabled = 1;
+    printf("Template-full documents stored in diet_template_documents\n");
+    return 0;
+}
+
+int template_document_enabled(void) {
+    return enabled;
+}
+
+int template_document_build(int id, unsigned long long version, TemplateFetch fetch, void *ctx,
+                            cJSON **out) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    cJSON *root, *template_obj, *days_arr, *day_obj, *meals_arr, *meal_obj, *items_arr, *item_obj;
+    char query[512];
+    int day_ids[MAX_DAYS];
+    int day_count = 0;
+
+    /* Get template */
+    snprintf(query, sizeof(query),
+        "SELECT id, code, name, description, segment, type, duration_days, calories_target "
+        "FROM diet_templates WHERE id = %d", id);
+
+    result = fetch(ctx, query);
+    if (result == NULL) {
+        return -1;
+    }
+
+    row = mysql_fetch_row(result);
+    if (row == NULL) {
+        mysql_free_result(result);
+        return TEMPLATE_DOCUMENT_NOT_FOUND;
+    }
+
+    root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", 1);
+
+    template_obj = cJSON_AddObjectToObject(root, "template");
+    cJSON_AddNumberToObject(template_obj, "id", atoi(row[0]));
+    if (version > 0) {
+        cJSON_AddNumberToObject(template_obj, "version", (double)version);
+    }
+    cJSON_AddStringToObject(template_obj, "code", row[1] ? row[1] : "");
+    cJSON_AddStringToObject(template_obj, "name", row[2] ? row[2] : "");
+    cJSON_AddStringToObject(template_obj, "description", row[3] ? row[3] : "");
+    cJSON_AddStringToObject(template_obj, "segment", row[4] ? row[4] : "");
+    cJSON_AddStringToObject(template_obj, "type", row[5] ? row[5] : "");
+    cJSON_AddNumberToObject(template_obj, "duration_days", row[6] ? atoi(row[6]) : 0);
+    cJSON_AddNumberToObject(template_obj, "calories_target", row[7] ? atoi(row[7]) : 0);
+
+    mysql_free_result(result);
+
+    /* Get days */
+    days_arr = cJSON_AddArrayToObject(template_obj, "days");
+
+    snprintf(query, sizeof(query),
+        "SELECT id, day_number, day_name FROM diet_days WHERE template_id = %d ORDER BY day_number, id", id);
+
+    result = fetch(ctx, query);
+    if (result == NULL) {
+        cJSON_Delete(root);
+        return -1;
+    }
+
+    while ((row = mysql_fetch_row(result)) != NULL && day_count < MAX_DAYS) {
+        day_obj = cJSON_CreateObject();
+        day_ids[day_count] = atoi(row[0]);
+        cJSON_AddNumberToObject(day_obj, "id", day_ids[day_count]);
+        cJSON_AddNumberToObject(day_obj, "day_number", row[1] ? atoi(row[1]) : 0);
+        cJSON_AddStringToObject(day_obj, "day_name", row[2] ? row[2] : "");
+        cJSON_AddArrayToObject(day_obj, "meals");
+        cJSON_AddItemToArray(days_arr, day_obj);
+        day_count++;
+    }
+    mysql_free_result(result);
+
+    /* Get meals for each day */
+    for (int i = 0; i < day_count; i++) {
+        int meal_ids[MAX_MEALS];
+        int meal_count = 0;
+
+        day_obj = cJSON_GetArrayItem(days_arr, i);
+        meals_arr = cJSON_GetObjectItem(day_obj, "meals");
+
+        snprintf(query, sizeof(query),
+            "SELECT id, meal_type, meal_order, time_suggestion "
+            "FROM diet_meals WHERE day_id = %d ORDER BY meal_order, id", day_ids[i]);
+
+        result = fetch(ctx, query);
+        if (result == NULL) {
+            cJSON_Delete(root);
+            return -1;
+        }
+
+        while ((row = mysql_fetch_row(result)) != NULL && meal_count < MAX_MEALS) {
+            meal_obj = cJSON_CreateObject();
+            meal_ids[meal_count] = atoi(row[0]);
+            cJSON_AddNumberToObject(meal_obj, "id", meal_ids[meal_count]);
+            cJSON_AddStringToObject(meal_obj, "meal_type", row[1] ? row[1] : "");
+            cJSON_AddNumberToObject(meal_obj, "meal_order", row[2] ? atoi(row[2]) : 0);
+            cJSON_AddStringToObject(meal_obj, "time_suggestion", row[3] ? row[3] : "");
+            cJSON_AddArrayToObject(meal_obj, "items");
+            cJSON_AddItemToArray(meals_arr, meal_obj);
+            meal_count++;
+        }
+        mysql_free_result(result);
+
+        /* Get items for each meal */
+        for (int j = 0; j < meal_count; j++) {
+            meal_obj = cJSON_GetArrayItem(meals_arr, j);
+            items_arr = cJSON_GetObjectItem(meal_obj, "items");
+
+            snprintf(query, sizeof(query),
+                "SELECT mi.id, mi.food_item_id, f.name, mi.portion_grams_min, mi.portion_grams_max "
+                "FROM diet_meal_items mi "
+                "JOIN food_items f ON mi.food_item_id = f.id "
+                "WHERE mi.meal_id = %d ORDER BY mi.sort_order, mi.id", meal_ids[j]);
+
+            result = fetch(ctx, query);
+            if (result == NULL) {
+                cJSON_Delete(root);
+                return -1;
+            }
+
+            while ((row = mysql_fetch_row(result)) != NULL) {
+                item_obj = cJSON_CreateObject();
+                cJSON_AddNumberToObject(item_obj, "id", atoi(row[0]));
+                cJSON_AddNumberToObject(item_obj, "food_item_id", row[1] ? atoi(row[1]) : 0);
+                cJSON_AddStringToObject(item_obj, "food_name", row[2] ? row[2] : "");
+                cJSON_AddNumberToObject(item_obj, "portion_grams_min", row[3] ? atoi(row[3]) : 0);
+                cJSON_AddNumberToObject(item_obj, "portion_grams_max", row[4] ? atoi(row[4]) : 0);
+                cJSON_AddItemToArray(items_arr, item_obj);
+            }
+            mysql_free_result(result);
+        }
+    }
+
+    *out = root;
+    return 0;
+}
+
+int template_document_fetch_json(int id, MYSQL_RES **out) {
+    char query[3072];
+    MYSQL_RES *result;
+
+    snprintf(query, sizeof(query), json_query, id);
+    result = db_query_read("template-full", query);
+    if (result == NULL) {
+        return -1;
+    }
+    if (mysql_num_rows(result) == 0) {
+        mysql_free_result(result);
+        return TEMPLATE_DOCUMENT_NOT_FOUND;
+    }
+    *out = result;
+    return 0;
+}
+
+/**
+ * @brief TemplateFetch on the connection of a transaction.
+ */
+static MYSQL_RES *fetch_conn(void *ctx, const char *query) {
+    MYSQL *conn = ctx;
+
+    if (mysql_query(conn, query) != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(conn));
+        return NULL;
+    }
+    return mysql_store_result(conn);
+}
+
+/**
+ * @brief Locks a document row and renders it again.
+ *
+ * @param only_stale Keep a body already stored (another thread rendered it)
+ * @param body Set to the stored body if not NULL (caller frees with free())
+ */
+static int rebuild(MYSQL *conn, int id, int only_stale, char **body) {
+    unsigned long long version = 1;
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    cJSON *root;
+    char query[128];
+    char *json, *sql;
+    size_t json_len;
+    int rc, len;
+
+    snprintf(query, sizeof(query),
+        "SELECT version, body FROM diet_template_documents WHERE template_id = %d FOR UPDATE", id);
+    result = fetch_conn(conn, query);
+    if (result == NULL) {
+        return -1;
+    }
+    row = mysql_fetch_row(result);
+    if (row != NULL && row[0] != NULL) {
+        if (only_stale && row[1] != NULL) {
+            rc = 0;
+            if (body != NULL && (*body = strdup(row[1])) == NULL) {
+                rc = -1;
+            }
+            mysql_free_result(result);
+            return rc;
+        }
+        version = strtoull(row[0], NULL, 10) + 1;
+    }
+    mysql_free_result(result);
+
+    rc = template_document_build(id, version, fetch_conn, conn, &root);
+    if (rc != 0) {
+        return rc;
+    }
+    json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL) {
+        return -1;
+    }
+
+    json_len = strlen(json);
+    sql = malloc(json_len * 2 + 256);
+    if (sql == NULL) {
+        cJSON_free(json);
+        return -1;
+    }
+    len = snprintf(sql, 256,
+        "INSERT INTO diet_template_documents (template_id, version, body) VALUES (%d, %llu, '",
+        id, version);
+    len += (int)mysql_real_escape_string(conn, sql + len, json, (unsigned long)json_len);
+    len += snprintf(sql + len, 128,
+        "') ON DUPLICATE KEY UPDATE version = VALUES(version), body = VALUES(body)");
+
+    rc = mysql_real_query(conn, sql, (unsigned long)len) == 0 ? 0 : -1;
+    if (rc != 0) {
+        fprintf(stderr, "Storing template %d document failed: %s\n", id, mysql_error(conn));
+    }
+    free(sql);
+
+    if (rc == 0 && body != NULL && (*body = strdup(json)) == NULL) {
+        rc = -1;
+    }
+    cJSON_free(json);
+    return rc;
+}
+
+int template_document_rebuild(MYSQL *conn, int id) {
+    return rebuild(conn, id, 0, NULL);
+}
+
+int template_document_meal_template(MYSQL *conn, int meal_id) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    char query[160];
+    int id = -1;
+
+    snprintf(query, sizeof(query),
+        "SELECT d.template_id FROM diet_meals m JOIN diet_days d ON d.id = m.day_id "
+        "WHERE m.id = %d", meal_id);
+    result = fetch_conn(conn, query);
+    if (result == NULL) {
+        return -1;
+    }
+    row = mysql_fetch_row(result);
+    if (row != NULL && row[0] != NULL) {
+        id = atoi(row[0]);
+    }
+    mysql_free_result(result);
+    return id;
+}
+
+int template_document_invalidate_foods(MYSQL *conn, const int *food_ids, size_t count) {
+    size_t size = count * 12 + 512;
+    char *sql;
+    int len, rc;
+
+    if (!enabled || count == 0) {
+        return 0;
+    }
+    sql = malloc(size);
+    if (sql == NULL) {
+        return -1;
+    }
+    len = snprintf(sql, size,
+        "UPDATE diet_template_documents doc "
+        "JOIN (SELECT DISTINCT d.template_id FROM diet_days d "
+        "JOIN diet_meals m ON m.day_id = d.id "
+        "JOIN diet_meal_items mi ON mi.meal_id = m.id "
+        "WHERE mi.food_item_id IN (");
+    for (size_t i = 0; i < count; i++) {
+        len += snprintf(sql + len, size - (size_t)len, "%s%d", i > 0 ? "," : "", food_ids[i]);
+    }
+    len += snprintf(sql + len, size - (size_t)len,
+        ")) t ON t.template_id = doc.template_id "
+        "SET doc.body = NULL, doc.version = doc.version + 1");
+
+    rc = mysql_real_query(conn, sql, (unsigned long)len) == 0 ? 0 : -1;
+    if (rc != 0) {
+        fprintf(stderr, "Invalidating template documents failed: %s\n", mysql_error(conn));
+    }
+    free(sql);
+    return rc;
+}
+
+int template_document_get(int id, char **body) {
+    DbTransaction txn;
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    char query[128];
+    int rc;
+
+    snprintf(query, sizeof(query),
+        "SELECT body FROM diet_template_documents WHERE template_id = %d", id);
+    /* On the primary: a replica could still hold the body from before a write */
+    result = db_query(query);
+    if (result == NULL) {
+        return -1;
+    }
+    row = mysql_fetch_row(result);
+    if (row != NULL && row[0] != NULL) {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+
+        *body = malloc(lengths[0] + 1);
+        if (*body == NULL) {
+            mysql_free_result(result);
+            return -1;
+        }
+        memcpy(*body, row[0], lengths[0]);
+        (*body)[lengths[0]] = '\0';
+        mysql_free_result(result);
+        return 0;
+    }
+    mysql_free_result(result);
+
+    /* Missing or stale: render it on the primary */
+    if (db_begin(&txn) != 0) {
+        return -1;
+    }
+    rc = rebuild(txn.conn, id, 1, body);
+    if (db_end(&txn, rc == 0) != 0 && rc == 0) {
+        free(*body);
+        rc = -1;
+    }
+    return rc;
+}
@@ -0,0 +1,299 @@
+/**
+ * @file template_index.c
+ * @brief In-memory daily nutrition profiles of diet templates.
+ *
+ * Profiles come from a single aggregate query at startup and are kept
+ * sorted by daily calories. A search binary-searches the calorie range
+ * and checks the remaining bounds on that slice only. Writes refresh the
+ * profile of the template they changed, or reload the whole index.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "template_index.h"
+#include "db.h"
+
+/** @brief Loaded template index */
+typedef struct {
+    int count;                  /**< Number of templates */
+    TemplateProfile *profiles;  /**< Sorted by calories, then id */
+    float *calories;            /**< profiles[i].calories, for binary search */
+} TemplateIndex;
+
+/** @brief Currently loaded index (NULL until template_index_load succeeds) */
+static TemplateIndex *index_current = NULL;
+
+/** @brief Guards index_current and the profiles it holds */
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * @brief Totals over all days of a template, using the midpoint of each
+ * item's portion range. Divided by the day count in profile_from_row().
+ */
+#define PROFILE_QUERY \
+    "SELECT t.id, t.code, t.name, t.segment, t.type, t.duration_days, t.calories_target, " \
+    "COUNT(DISTINCT d.id), " \
+    "COALESCE(SUM(f.calories_per_100g * (mi.portion_grams_min + mi.portion_grams_max) / 200), 0), " \
+    "COALESCE(SUM(f.protein_per_100g * (mi.portion_grams_min + mi.portion_grams_max) / 200), 0), " \
+    "COALESCE(SUM(f.carbs_per_100g * (mi.portion_grams_min + mi.portion_grams_max) / 200), 0), " \
+    "COALESCE(SUM(f.fat_per_100g * (mi.portion_grams_min + mi.portion_grams_max) / 200), 0) " \
+    "FROM diet_templates t " \
+    "LEFT JOIN diet_days d ON d.template_id = t.id " \
+    "LEFT JOIN diet_meals m ON m.day_id = d.id " \
+    "LEFT JOIN diet_meal_items mi ON mi.meal_id = m.id " \
+    "LEFT JOIN food_items f ON f.id = mi.food_item_id "
+
+/**
+ * @brief qsort comparator ordering profiles by daily calories, then id.
+ */
+static int compare_profiles(const void *a, const void *b) {
+    const TemplateProfile *pa = a;
+    const TemplateProfile *pb = b;
+    if (pa->calories != pb->calories) {
+        return pa->calories < pb->calories ? -1 : 1;
+    }
+    return (pa->id > pb->id) - (pa->id < pb->id);
+}
+
+/**
+ * @brief Frees the strings of a profile.
+ */
+static void profile_free(TemplateProfile *p) {
+    free(p->code);
+    free(p->name);
+    free(p->segment);
+    free(p->type);
+}
+
+/**
+ * @brief Frees an index and all of its strings.
+ *
+ * @param idx Index to free (may be NULL)
+ */
+static void index_free(TemplateIndex *idx) {
+    if (idx == NULL) {
+        return;
+    }
+    for (int i = 0; i < idx->count; i++) {
+        profile_free(&idx->profiles[i]);
+    }
+    free(idx->profiles);
+    free(idx->calories);
+    free(idx);
+}
+
+/**
+ * @brief Fills a profile from a PROFILE_QUERY row.
+ *
+ * @return 0 on success, -1 if out of memory (strings freed)
+ */
+static int profile_from_row(TemplateProfile *p, MYSQL_ROW row) {
+    int days = row[7] ? atoi(row[7]) : 0;
+    float per_day = days > 0 ? 1.0f / (float)days : 0.0f;
+
+    p->id = atoi(row[0]);
+    p->code = strdup(row[1] ? row[1] : "");
+    p->name = strdup(row[2] ? row[2] : "");
+    p->segment = strdup(row[3] ? row[3] : "");
+    p->type = strdup(row[4] ? row[4] : "");
+    p->duration_days = row[5] ? atoi(row[5]) : 0;
+    p->calories_target = row[6] ? atoi(row[6]) : 0;
+    p->day_count = days;
+    p->calories = (row[8] ? strtof(row[8], NULL) : 0) * per_day;
+    p->protein = (row[9] ? strtof(row[9], NULL) : 0) * per_day;
+    p->carbs = (row[10] ? strtof(row[10], NULL) : 0) * per_day;
+    p->fat = (row[11] ? strtof(row[11], NULL) : 0) * per_day;
+
+    if (p->code == NULL || p->name == NULL || p->segment == NULL || p->type == NULL) {
+        profile_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Restores the calorie order after profiles changed.
+ */
+static void index_sort(TemplateIndex *idx) {
+    qsort(idx->profiles, (size_t)idx->count, sizeof(TemplateProfile), compare_profiles);
+    for (int i = 0; i < idx->count; i++) {
+        idx->calories[i] = idx->profiles[i].calories;
+    }
+}
+
+int template_index_load(void) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    TemplateIndex *idx, *old;
+    size_t row_count;
+
+    result = db_query(PROFILE_QUERY "GROUP BY t.id");
+    if (result == NULL) {
+        fprintf(stderr, "Failed to load template profiles\n");
+        return -1;
+    }
+
+    row_count = (size_t)mysql_num_rows(result);
+    idx = calloc(1, sizeof(TemplateIndex));
+    if (idx != NULL) {
+        idx->profiles = calloc(row_count > 0 ? row_count : 1, sizeof(TemplateProfile));
+        idx->calories = malloc((row_count > 0 ? row_count : 1) * sizeof(float));
+    }
+    if (idx == NULL || idx->profiles == NULL || idx->calories == NULL) {
+        mysql_free_result(result);
+        index_free(idx);
+        return -1;
+    }
+
+    while ((row = mysql_fetch_row(result)) != NULL && (size_t)idx->count < row_count) {
+        if (profile_from_row(&idx->profiles[idx->count], row) != 0) {
+            mysql_free_result(result);
+            index_free(idx);
+            return -1;
+        }
+        idx->count++;
+    }
+    mysql_free_result(result);
+
+    index_sort(idx);
+
+    pthread_rwlock_wrlock(&index_lock);
+    old = index_current;
+    index_current = idx;
+    pthread_rwlock_unlock(&index_lock);
+    index_free(old);
+
+    printf("Loaded template profiles: %d templates\n", idx->count);
+    return 0;
+}
+
+int template_index_refresh(int template_id) {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    TemplateProfile fresh;
+    TemplateIndex *idx;
+    char query[sizeof(PROFILE_QUERY) + 64];
+    int found = 0;
+    int rc = 0;
+    int i = 0;
+
+    snprintf(query, sizeof(query), PROFILE_QUERY "WHERE t.id = %d GROUP BY t.id", template_id);
+    result = db_query(query);
+    if (result == NULL) {
+        return -1;
+    }
+    row = mysql_fetch_row(result);
+    if (row != NULL) {
+        found = 1;
+        rc = profile_from_row(&fresh, row);
+    }
+    mysql_free_result(result);
+    if (rc != 0) {
+        return -1;
+    }
+
+    /* Not loaded yet: template_index_load() will read it with the rest */
+    pthread_rwlock_wrlock(&index_lock);
+    idx = index_current;
+    while (idx != NULL && i < idx->count && idx->profiles[i].id != template_id) {
+        i++;
+    }
+    if (idx != NULL && i < idx->count) {
+        profile_free(&idx->profiles[i]);
+        if (found) {
+            idx->profiles[i] = fresh;
+            found = 0;
+        } else {
+            idx->profiles[i] = idx->profiles[--idx->count];
+        }
+        index_sort(idx);
+    } else if (idx != NULL && found) {
+        TemplateProfile *profiles = realloc(idx->profiles, (size_t)(idx->count + 1) * sizeof(*profiles));
+        float *calories = profiles != NULL
+            ? realloc(idx->calories, (size_t)(idx->count + 1) * sizeof(*calories))
+            : NULL;
+
+        if (profiles != NULL) {
+            idx->profiles = profiles;
+        }
+        if (calories != NULL) {
+            idx->calories = calories;
+            idx->profiles[idx->count++] = fresh;
+            found = 0;
+            index_sort(idx);
+        } else {
+            rc = -1;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    if (found) {
+        profile_free(&fresh);
+    }
+    return rc;
+}
+
+void template_index_read_lock(void) {
+    pthread_rwlock_rdlock(&index_lock);
+}
+
+void template_index_read_unlock(void) {
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void template_query_init(TemplateQuery *query) {
+    query->calories_min = -INFINITY;
+    query->calories_max = INFINITY;
+    query->protein_min = -INFINITY;
+    query->protein_max = INFINITY;
+    query->carbs_min = -INFINITY;
+    query->carbs_max = INFINITY;
+    query->fat_min = -INFINITY;
+    query->fat_max = INFINITY;
+}
+
+int template_index_search(const TemplateQuery *query, const TemplateProfile **out, int max_results) {
+    const TemplateIndex *idx = index_current;
+    int lo, hi, found = 0;
+
+    if (idx == NULL) {
+        return -1;
+    }
+
+    /* First profile with calories >= calories_min */
+    lo = 0;
+    hi = idx->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->calories[mid] < query->calories_min) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (int i = lo; i < idx->count && found < max_results; i++) {
+        const TemplateProfile *p = &idx->profiles[i];
+
+        if (idx->calories[i] > query->calories_max) {
+            break;
+        }
+        if (p->protein < query->protein_min || p->protein > query->protein_max ||
+            p->carbs < query->carbs_min || p->carbs > query->carbs_max ||
+            p->fat < query->fat_min || p->fat > query->fat_max) {
+            continue;
+        }
+        out[found++] = p;
+    }
+    return found;
+}
+
+void template_index_cleanup(void) {
+    pthread_rwlock_wrlock(&index_lock);
+    index_free(index_current);
+    index_current = NULL;
+    pthread_rwlock_unlock(&index_lock);
+}
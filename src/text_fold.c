@@ -0,0 +1,327 @@
+/**
+ * @file text_fold.c
+ * @brief Table-driven UTF-8 case and diacritic folding.
+ *
+ * Each code point is decoded once and mapped through a small lookup
+ * table for its block: ASCII, Latin (U+00A0..U+024F, to ASCII strings)
+ * and Greek/Cyrillic (U+0370..U+045F, to lowercase base letters).
+ * Code points outside these blocks are copied unchanged.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "text_fold.h"
+
+/** @brief ASCII fold: lowercase letter or digit, 0 for separators */
+static const unsigned char ascii_fold[128] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',   0,   0,   0,   0,   0,   0,
+      0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',   0,   0,   0,   0,   0,
+      0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',   0,   0,   0,   0,   0,
+};
+
+/** @brief First code point covered by latin_fold */
+#define LATIN_FIRST 0x00A0
+/** @brief One past the last code point covered by latin_fold */
+#define LATIN_END 0x0250
+
+/**
+ * @brief Latin-1 Supplement and Latin Extended-A/B folding.
+ *
+ * ASCII replacement for each code point; "" marks a separator
+ * (punctuation, symbols) and NULL means "copy unchanged".
+ */
+static const char *const latin_fold[LATIN_END - LATIN_FIRST] = {
+    /* U+00A0 */ "", "", "", "", "", "", "", "",
+    /* U+00A8 */ "", "", "a", "", "", "", "", "",
+    /* U+00B0 */ "", "", "2", "3", "", NULL, "", "",
+    /* U+00B8 */ "", "1", "o", "", "", "", "", "",
+    /* U+00C0 */ "a", "a", "a", "a", "a", "a", "ae", "c",
+    /* U+00C8 */ "e", "e", "e", "e", "i", "i", "i", "i",
+    /* U+00D0 */ "d", "n", "o", "o", "o", "o", "o", "",
+    /* U+00D8 */ "o", "u", "u", "u", "u", "y", "th", "ss",
+    /* U+00E0 */ "a", "a", "a", "a", "a", "a", "ae", "c",
+    /* U+00E8 */ "e", "e", "e", "e", "i", "i", "i", "i",
+    /* U+00F0 */ "d", "n", "o", "o", "o", "o", "o", "",
+    /* U+00F8 */ "o", "u", "u", "u", "u", "y", "th", "y",
+    /* U+0100 */ "a", "a", "a", "a", "a", "a", "c", "c",
+    /* U+0108 */ "c", "c", "c", "c", "c", "c", "d", "d",
+    /* U+0110 */ "d", "d", "e", "e", "e", "e", "e", "e",
+    /* U+0118 */ "e", "e", "e", "e", "g", "g", "g", "g",
+    /* U+0120 */ "g", "g", "g", "g", "h", "h", "h", "h",
+    /* U+0128 */ "i", "i", "i", "i", "i", "i", "i", "i",
+    /* U+0130 */ "i", "i", "ij", "ij", "j", "j", "k", "k",
+    /* U+0138 */ "k", "l", "l", "l", "l", "l", "l", "l",
+    /* U+0140 */ "l", "l", "l", "n", "n", "n", "n", "n",
+    /* U+0148 */ "n", "n", "n", "n", "o", "o", "o", "o",
+    /* U+0150 */ "o", "o", "oe", "oe", "r", "r", "r", "r",
+    /* U+0158 */ "r", "r", "s", "s", "s", "s", "s", "s",
+    /* U+0160 */ "s", "s", "t", "t", "t", "t", "t", "t",
+    /* U+0168 */ "u", "u", "u", "u", "u", "u", "u", "u",
+    /* U+0170 */ "u", "u", "u", "u", "w", "w", "y", "y",
+    /* U+0178 */ "y", "z", "z", "z", "z", "z", "z", "s",
+    /* U+0180 */ "b", "b", NULL, NULL, NULL, NULL, NULL, "c",
+    /* U+0188 */ "c", "d", "d", "d", "d", NULL, NULL, NULL,
+    /* U+0190 */ NULL, "f", "f", "g", NULL, "hv", "i", "i",
+    /* U+0198 */ "k", "k", "l", NULL, NULL, "n", "n", "o",
+    /* U+01A0 */ "o", "o", "oi", "oi", "p", "p", NULL, NULL,
+    /* U+01A8 */ NULL, NULL, NULL, "t", "t", "t", "t", "u",
+    /* U+01B0 */ "u", NULL, NULL, "y", "y", "z", "z", NULL,
+    /* U+01B8 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+    /* U+01C0 */ NULL, NULL, NULL, NULL, "dz", "dz", "dz", "lj",
+    /* U+01C8 */ "lj", "lj", "nj", "nj", "nj", "a", "a", "i",
+    /* U+01D0 */ "i", "o", "o", "u", "u", "u", "u", "u",
+    /* U+01D8 */ "u", "u", "u", "u", "u", "e", "a", "a",
+    /* U+01E0 */ "a", "a", "ae", "ae", "g", "g", "g", "g",
+    /* U+01E8 */ "k", "k", "o", "o", "o", "o", NULL, NULL,
+    /* U+01F0 */ "j", "dz", "dz", "dz", "g", "g", "hv", NULL,
+    /* U+01F8 */ "n", "n", "a", "a", "ae", "ae", "o", "o",
+    /* U+0200 */ "a", "a", "a", "a", "e", "e", "e", "e",
+    /* U+0208 */ "i", "i", "i", "i", "o", "o", "o", "o",
+    /* U+0210 */ "r", "r", "r", "r", "u", "u", "u", "u",
+    /* U+0218 */ "s", "s", "t", "t", NULL, NULL, "h", "h",
+    /* U+0220 */ NULL, "d", "ou", "ou", "z", "z", "a", "a",
+    /* U+0228 */ "e", "e", "o", "o", "o", "o", "o", "o",
+    /* U+0230 */ "o", "o", "y", "y", "l", "n", "t", "j",
+    /* U+0238 */ "db", "qp", "a", "c", "c", "l", "t", "s",
+    /* U+0240 */ "z", NULL, NULL, "b", "u", NULL, "e", "e",
+    /* U+0248 */ "j", "j", "q", "q", "r", "r", "y", "y",
+};
+
+/** @brief First code point covered by greek_cyrillic_fold */
+#define GREEK_FIRST 0x0370
+/** @brief One past the last code point covered by greek_cyrillic_fold */
+#define GREEK_END 0x0460
+
+/**
+ * @brief Greek and Cyrillic folding to lowercase base letters.
+ *
+ * 0 means "copy unchanged". Cyrillic short i (й) is kept distinct.
+ */
+static const uint16_t greek_cyrillic_fold[GREEK_END - GREEK_FIRST] = {
+    /* U+0370 */ 0x0371, 0, 0x0373, 0, 0x02B9, 0, 0x0377, 0,
+    /* U+0378 */ 0, 0, 0, 0, 0, 0, 0, 0x03F3,
+    /* U+0380 */ 0, 0, 0, 0, 0, 0, 0x03B1, 0,
+    /* U+0388 */ 0x03B5, 0x03B7, 0x03B9, 0, 0x03BF, 0, 0x03C5, 0x03C9,
+    /* U+0390 */ 0x03B9, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+    /* U+0398 */ 0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+    /* U+03A0 */ 0x03C0, 0x03C1, 0, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+    /* U+03A8 */ 0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03B1, 0x03B5, 0x03B7, 0x03B9,
+    /* U+03B0 */ 0x03C5, 0, 0, 0, 0, 0, 0, 0,
+    /* U+03B8 */ 0, 0, 0, 0, 0, 0, 0, 0,
+    /* U+03C0 */ 0, 0, 0x03C3, 0, 0, 0, 0, 0,
+    /* U+03C8 */ 0, 0, 0x03B9, 0x03C5, 0x03BF, 0x03C5, 0x03C9, 0x03D7,
+    /* U+03D0 */ 0, 0, 0, 0x03D2, 0x03D2, 0, 0, 0,
+    /* U+03D8 */ 0x03D9, 0, 0x03DB, 0, 0x03DD, 0, 0x03DF, 0,
+    /* U+03E0 */ 0x03E1, 0, 0x03E3, 0, 0x03E5, 0, 0x03E7, 0,
+    /* U+03E8 */ 0x03E9, 0, 0x03EB, 0, 0x03ED, 0, 0x03EF, 0,
+    /* U+03F0 */ 0, 0, 0, 0, 0x03B8, 0, 0, 0x03F8,
+    /* U+03F8 */ 0, 0x03F2, 0x03FB, 0, 0, 0x037B, 0x037C, 0x037D,
+    /* U+0400 */ 0x0435, 0x0435, 0x0452, 0x0433, 0x0454, 0x0455, 0x0456, 0x0456,
+    /* U+0408 */ 0x0458, 0x0459, 0x045A, 0x045B, 0x043A, 0x0438, 0x0443, 0x045F,
+    /* U+0410 */ 0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    /* U+0418 */ 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+    /* U+0420 */ 0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    /* U+0428 */ 0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+    /* U+0430 */ 0, 0, 0, 0, 0, 0, 0, 0,
+    /* U+0438 */ 0, 0, 0, 0, 0, 0, 0, 0,
+    /* U+0440 */ 0, 0, 0, 0, 0, 0, 0, 0,
+    /* U+0448 */ 0, 0, 0, 0, 0, 0, 0, 0,
+    /* U+0450 */ 0x0435, 0x0435, 0, 0x0433, 0, 0, 0, 0x0456,
+    /* U+0458 */ 0, 0, 0, 0, 0x043A, 0x0438, 0x0443, 0,
+};
+
+/**
+ * @brief Decodes one UTF-8 sequence.
+ *
+ * @param p Input pointer (not at NUL)
+ * @param cp Decoded code point, or the raw byte for invalid input
+ * @return Number of bytes consumed (1 for invalid sequences)
+ */
+static size_t utf8_decode(const unsigned char *p, uint32_t *cp) {
+    if (p[0] >= 0xC2 && p[0] <= 0xDF && (p[1] & 0xC0) == 0x80) {
+        *cp = ((uint32_t)(p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+        return 2;
+    }
+    if (p[0] >= 0xE0 && p[0] <= 0xEF && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80) {
+        *cp = ((uint32_t)(p[0] & 0x0F) << 12) | ((uint32_t)(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        if (*cp >= 0x800) {
+            return 3;
+        }
+    }
+    if (p[0] >= 0xF0 && p[0] <= 0xF4 && (p[1] & 0xC0) == 0x80 &&
+        (p[2] & 0xC0) == 0x80 && (p[3] & 0xC0) == 0x80) {
+        *cp = ((uint32_t)(p[0] & 0x07) << 18) | ((uint32_t)(p[1] & 0x3F) << 12) |
+              ((uint32_t)(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+        if (*cp >= 0x10000 && *cp <= 0x10FFFF) {
+            return 4;
+        }
+    }
+    *cp = p[0];
+    return 1;
+}
+
+/**
+ * @brief Encodes a code point below U+0800 as UTF-8.
+ *
+ * @return Number of bytes written (1 or 2)
+ */
+static size_t utf8_encode_small(uint32_t cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+}
+
+size_t text_fold(const char *src, char *dst, size_t dst_size) {
+    const unsigned char *p = (const unsigned char *)src;
+    size_t len = 0;
+    int pending_space = 0;
+
+    if (dst_size == 0) {
+        return 0;
+    }
+
+    while (*p != '\0') {
+        char buf[4];
+        const char *out = buf;
+        size_t out_len = 0;
+        uint32_t cp;
+
+        if (*p < 0x80) {
+            /* ASCII fast path */
+            buf[0] = (char)ascii_fold[*p++];
+            out_len = buf[0] != 0;
+        } else {
+            size_t used = utf8_decode(p, &cp);
+
+            if (used == 1) {
+                out = (const char *)p;
+                out_len = 1;
+            } else if (cp >= LATIN_FIRST && cp < LATIN_END) {
+                const char *fold = latin_fold[cp - LATIN_FIRST];
+                if (fold == NULL) {
+                    out = (const char *)p;
+                    out_len = used;
+                } else {
+                    out = fold;
+                    out_len = strlen(fold);
+                }
+            } else if (cp >= 0x0300 && cp < 0x0370) {
+                /* Combining diacritical mark: drop without separating */
+                p += used;
+                continue;
+            } else if (cp >= GREEK_FIRST && cp < GREEK_END) {
+                uint16_t fold = greek_cyrillic_fold[cp - GREEK_FIRST];
+                if (fold == 0) {
+                    out = (const char *)p;
+                    out_len = used;
+                } else {
+                    out_len = utf8_encode_small(fold, buf);
+                }
+            } else if ((cp >= 0x2000 && cp < 0x2070) || cp == 0x3000 || cp == 0xFEFF) {
+                /* General punctuation, ideographic space, BOM */
+                out_len = 0;
+            } else {
+                out = (const char *)p;
+                out_len = used;
+            }
+            p += used;
+        }
+
+        if (out_len == 0) {
+            pending_space = (len > 0);
+            continue;
+        }
+
+        if (len + (size_t)pending_space + out_len + 1 > dst_size) {
+            break;
+        }
+        if (pending_space) {
+            dst[len++] = ' ';
+            pending_space = 0;
+        }
+        memcpy(dst + len, out, out_len);
+        len += out_len;
+    }
+
+    dst[len] = '\0';
+    return len;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** @brief 16 unsigned bytes (SSE2 / NEON register via vector extensions) */
+typedef unsigned char v16u8 __attribute__((vector_size(16)));
+
+const char *text_find(const char *haystack, size_t hlen, const char *needle, size_t nlen) {
+    size_t i = 0;
+
+    if (nlen == 0) {
+        return haystack;
+    }
+    if (nlen > hlen) {
+        return NULL;
+    }
+
+    /*
+     * Compare the first and last needle byte at 16 consecutive positions;
+     * only positions where both match are checked with memcmp.
+     */
+    v16u8 first, last;
+    memset(&first, (unsigned char)needle[0], sizeof(first));
+    memset(&last, (unsigned char)needle[nlen - 1], sizeof(last));
+
+    for (; i + nlen - 1 + 16 <= hlen; i += 16) {
+        v16u8 block_first, block_last;
+        memcpy(&block_first, haystack + i, sizeof(block_first));
+        memcpy(&block_last, haystack + i + nlen - 1, sizeof(block_last));
+
+        v16u8 mask = (v16u8)(block_first == first) & (v16u8)(block_last == last);
+        uint64_t lanes[2];
+        memcpy(lanes, &mask, sizeof(lanes));
+
+        for (int half = 0; half < 2; half++) {
+            uint64_t bits = lanes[half];
+            while (bits != 0) {
+                size_t lane = (size_t)__builtin_ctzll(bits) / 8;
+                size_t pos = i + (size_t)half * 8 + lane;
+                if (memcmp(haystack + pos + 1, needle + 1, nlen - 1) == 0) {
+                    return haystack + pos;
+                }
+                bits &= ~(0xFFULL << (lane * 8));
+            }
+        }
+    }
+
+    /* Scalar tail */
+    for (; i + nlen <= hlen; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i + 1, needle + 1, nlen - 1) == 0) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+#else
+
+const char *text_find(const char *haystack, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) {
+        return haystack;
+    }
+    for (size_t i = 0; i + nlen <= hlen; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i + 1, needle + 1, nlen - 1) == 0) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+#endif
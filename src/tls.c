@@ -0,0 +1,167 @@
+/**
+ * @file tls.c
+ * @brief Server-side TLS context with rotating ticket keys and kTLS.
+ */
+
+#ifdef HAVE_OPENSSL
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "tls.h"
+
+/**
+ * @brief A session ticket key.
+ */
+struct ticket_key {
+    unsigned char name[16];     /**< Sent in clear in the ticket to pick the key */
+    unsigned char aes_key[32];  /**< AES-256-CBC key */
+    unsigned char hmac_key[32]; /**< HMAC-SHA256 key */
+    time_t created;             /**< When it started issuing tickets (0 = unused) */
+};
+
+/** @brief Key issuing tickets, and the one before it */
+static struct ticket_key current_key, previous_key;
+
+/** @brief Guards the ticket keys */
+static pthread_mutex_t key_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Replaces the current key, keeping it as the previous one.
+ *
+ * @return 0 on success, -1 if no random bytes were available
+ */
+static int rotate_keys(time_t now) {
+    struct ticket_key fresh;
+
+    if (RAND_bytes(fresh.name, sizeof(fresh.name)) != 1 ||
+        RAND_bytes(fresh.aes_key, sizeof(fresh.aes_key)) != 1 ||
+        RAND_bytes(fresh.hmac_key, sizeof(fresh.hmac_key)) != 1) {
+        return -1;
+    }
+    fresh.created = now;
+    OPENSSL_cleanse(&previous_key, sizeof(previous_key));
+    previous_key = current_key;
+    current_key = fresh;
+    OPENSSL_cleanse(&fresh, sizeof(fresh));
+    return 0;
+}
+
+static int init_ticket_cipher(const struct ticket_key *key, unsigned char *iv,
+                              EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *hmac, int enc) {
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void *)key->hmac_key,
+                                          sizeof(key->hmac_key)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0),
+        OSSL_PARAM_construct_end(),
+    };
+
+    if (EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), NULL, key->aes_key, iv, enc) != 1 ||
+        EVP_MAC_CTX_set_params(hmac, params) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Encrypts new tickets with the current key and picks the key of presented ones.
+ *
+ * @return 1 to use the key, 2 to accept the ticket and issue a fresh one,
+ *         0 to ignore the ticket (full handshake), -1 on error
+ */
+static int ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+                         EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *hmac, int enc) {
+    time_t now = time(NULL);
+    int rc = -1;
+    (void)ssl;
+
+    pthread_mutex_lock(&key_mutex);
+    if (now - current_key.created >= TLS_TICKET_KEY_LIFETIME && rotate_keys(now) != 0) {
+        pthread_mutex_unlock(&key_mutex);
+        return -1;
+    }
+
+    if (enc) {
+        if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) == 1 &&
+            init_ticket_cipher(&current_key, iv, cipher, hmac, 1) == 0) {
+            memcpy(key_name, current_key.name, sizeof(current_key.name));
+            rc = 1;
+        }
+    } else if (memcmp(key_name, current_key.name, sizeof(current_key.name)) == 0) {
+        rc = init_ticket_cipher(&current_key, iv, cipher, hmac, 0) == 0 ? 1 : -1;
+    } else if (previous_key.created != 0 &&
+               memcmp(key_name, previous_key.name, sizeof(previous_key.name)) == 0) {
+        rc = init_ticket_cipher(&previous_key, iv, cipher, hmac, 0) == 0 ? 2 : -1;
+    } else {
+        /* Unknown or expired key */
+        rc = 0;
+    }
+    pthread_mutex_unlock(&key_mutex);
+    return rc;
+}
+
+SSL_CTX *tls_context_new(const char *cert_file, const char *key_file, int ktls) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION |
+                       SSL_OP_CIPHER_SERVER_PREFERENCE;
+
+    if (ctx == NULL) {
+        ERR_print_errors_fp(stderr);
+        return NULL;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls) {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#else
+    (void)ktls;
+#endif
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, options);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&key_mutex);
+    if (current_key.created == 0 && rotate_keys(time(NULL)) != 0) {
+        pthread_mutex_unlock(&key_mutex);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    pthread_mutex_unlock(&key_mutex);
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+    /* Tickets outlive their key by one rotation */
+    SSL_CTX_set_timeout(ctx, 2 * TLS_TICKET_KEY_LIFETIME);
+    return ctx;
+}
+
+void tls_context_free(SSL_CTX *ctx) {
+    SSL_CTX_free(ctx);
+
+    pthread_mutex_lock(&key_mutex);
+    OPENSSL_cleanse(&current_key, sizeof(current_key));
+    OPENSSL_cleanse(&previous_key, sizeof(previous_key));
+    pthread_mutex_unlock(&key_mutex);
+}
+
+int tls_ktls_send(SSL *ssl) {
+    /* Without kTLS support in OpenSSL the macro is just (0) */
+    (void)ssl;
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+#endif
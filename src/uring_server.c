@@ -0,0 +1,1192 @@
+/**
+ * @file uring_server.c
+ * @brief io_uring HTTP/1.1 front end.
+ *
+ * Every worker runs one loop: submit pending SQEs and wait for at least
+ * one completion in a single io_uring_enter(), then handle the whole
+ * completion batch. Accepts and receives are multishot, so an idle
+ * connection costs no syscalls; received data lands in a provided buffer
+ * ring and is copied into the connection's input buffer, returning the
+ * ring buffer immediately. Responses are appended to an output buffer
+ * and sent once per batch of pipelined requests.
+ *
+ * Connections count against HTTP_CONNECTION_LIMIT and, per client
+ * address, HTTP_PER_IP_CONNECTION_LIMIT, across all workers; over either
+ * limit a connection is closed as soon as it is accepted. Once a second
+ * each worker sweeps its connections: HTTP_IDLE_TIMEOUT closes those
+ * that neither sent nor took any data for that long, and
+ * HTTP_BODY_TIMEOUT answers 408 to a request still incomplete that long
+ * after its first byte.
+ */
+
+#define _GNU_SOURCE
+
+#include "uring_server.h"
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "http_helpers.h"
+#include "placement.h"
+#include "routes.h"
+
+/** @brief Submission queue entries per worker */
+#define URING_QUEUE_DEPTH 4096
+
+/** @brief Provided buffer group used for receives */
+#define URING_BUFFER_GROUP 0
+
+/** @brief Maximum headers kept per request (extra ones are ignored) */
+#define URING_MAX_HEADERS 64
+
+/** @brief Maximum query arguments kept per request */
+#define URING_MAX_ARGS 32
+
+/** @brief Largest input a connection may buffer */
+#define URING_MAX_INPUT (MAX_IMPORT_SIZE + URING_MAX_HEADER_SIZE)
+
+/** @brief Buckets of the per-address connection counts */
+#define URING_IP_BUCKETS 1024
+
+/** @brief Operation encoded in the low bits of user_data */
+enum uring_op {
+    OP_ACCEPT,  /**< Multishot accept on the listening socket */
+    OP_RECV,    /**< Multishot receive on a connection */
+    OP_SEND,    /**< Send of the connection's output buffer */
+    OP_CANCEL,  /**< Cancellation of a closing connection's operations */
+    OP_STOP,    /**< Poll on the shutdown eventfd */
+    OP_TIMER    /**< Once-a-second timeout driving the connection sweep */
+};
+
+/**
+ * @brief A client connection.
+ */
+struct uring_conn {
+    int fd;                 /**< Client socket */
+    char *in;               /**< Received, unprocessed bytes */
+    size_t in_len;          /**< Bytes in in */
+    size_t in_cap;          /**< Allocated size of in (always > in_len) */
+    char *out;              /**< Responses not yet sent */
+    size_t out_len;         /**< Bytes in out */
+    size_t out_cap;         /**< Allocated size of out */
+    size_t out_sent;        /**< Bytes of out already sent */
+    int recv_armed;         /**< Multishot receive in flight */
+    int send_armed;         /**< Send in flight (out must not move) */
+    int continue_sent;      /**< 100 Continue sent for the pending request */
+    int admitted;           /**< Pending request passed the rate limit */
+    int close_after_send;   /**< Close once out has been sent */
+    int closing;            /**< Closed; freed when nothing is in flight */
+    uint32_t addr;          /**< Client IPv4 address (network order) */
+    int addr_counted;       /**< Counted against the per-address limit */
+    time_t last_active;     /**< Last data received or sent (monotonic seconds) */
+    time_t request_started; /**< First byte of the pending request, 0 if none */
+    struct uring_conn *prev; /**< Previous connection of the worker */
+    struct uring_conn *next; /**< Next connection of the worker */
+};
+
+/**
+ * @brief A worker thread with its own ring and listening socket.
+ */
+struct uring_worker {
+    pthread_t thread;                   /**< Worker thread */
+    int port;                           /**< Port to listen on */
+    int listen_fd;                      /**< SO_REUSEPORT listening socket */
+    int ring_ready;                     /**< ring is initialized */
+    int stop;                           /**< Shutdown requested */
+    struct io_uring ring;               /**< The worker's ring */
+    struct io_uring_buf_ring *buf_ring; /**< Receive buffer ring */
+    int buf_mask;                       /**< Index mask of buf_ring */
+    char *buffers;                      /**< Memory of the receive buffers */
+    struct uring_conn *conns;           /**< Open connections */
+    struct __kernel_timespec tick;      /**< Interval of the sweep timer */
+    time_t date_time;                   /**< Second date was formatted for */
+    char date[40];                      /**< Cached Date header value */
+};
+
+/**
+ * @brief A parsed request; HttpRequest.conn points to it.
+ *
+ * Names and values point into the connection's input buffer.
+ */
+struct uring_request {
+    struct uring_worker *worker;                /**< Worker handling it */
+    struct uring_conn *conn;                    /**< Connection it arrived on */
+    int header_count;                           /**< Entries in headers */
+    const char *headers[URING_MAX_HEADERS][2];  /**< Header name/value pairs */
+    int arg_count;                              /**< Entries in args */
+    const char *args[URING_MAX_ARGS][2];        /**< Decoded query key/value pairs */
+    int keep_alive;                             /**< Connection stays open after the response */
+    int responded;                              /**< A response was written */
+};
+
+/**
+ * @brief Message framing read from the headers before parsing them.
+ */
+struct framing {
+    size_t content_length;  /**< Body length */
+    int chunked;            /**< Transfer-Encoding other than identity */
+    int expect_continue;    /**< Expect: 100-continue */
+    char method[8];         /**< Method, for the rate limit */
+    char path[64];          /**< Start of the path, for the body size limit and rate limit */
+    char client_key[128];   /**< RATE_LIMIT_KEY_HEADER value (truncated) */
+    int has_client_key;     /**< client_key was present */
+};
+
+/** @brief Workers, or NULL when not running */
+static struct uring_worker *workers;
+
+/** @brief Entries in workers */
+static int worker_count;
+
+/** @brief Made readable to stop the workers */
+static int stop_fd = -1;
+
+/** @brief Guards started and start_failures */
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Signalled when a worker finishes setup */
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Workers that finished setup */
+static int started;
+
+/** @brief Workers whose setup failed */
+static int start_failures;
+
+/** @brief Connections open across all workers */
+static int conn_count;
+
+/**
+ * @brief Connections open from one client address.
+ */
+struct ip_count {
+    uint32_t addr;          /**< IPv4 address (network order) */
+    int count;              /**< Open connections */
+    struct ip_count *next;  /**< Next entry of the bucket */
+};
+
+/** @brief Per-address counts, hashed by address */
+static struct ip_count *ip_counts[URING_IP_BUCKETS];
+
+/** @brief Guards ip_counts */
+static pthread_mutex_t ip_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Returns monotonic time in seconds.
+ */
+static time_t monotonic_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static struct ip_count **ip_count_find(uint32_t addr) {
+    struct ip_count **p = &ip_counts[addr * 2654435761u % URING_IP_BUCKETS];
+
+    while (*p != NULL && (*p)->addr != addr) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+/**
+ * @brief Counts a new connection against the connection limits.
+ *
+ * @return 0 if admitted, -1 if a limit is reached (nothing counted)
+ */
+static int conn_admit(struct uring_conn *c) {
+    int per_ip = config.http_per_ip_connection_limit;
+    struct ip_count **p, *e;
+    int rc = 0;
+
+    if (__atomic_add_fetch(&conn_count, 1, __ATOMIC_RELAXED) > config.http_connection_limit) {
+        __atomic_sub_fetch(&conn_count, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if (per_ip <= 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ip_mutex);
+    p = ip_count_find(c->addr);
+    if (*p == NULL && (*p = calloc(1, sizeof(**p))) != NULL) {
+        (*p)->addr = c->addr;
+    }
+    e = *p;
+    if (e == NULL || e->count >= per_ip) {
+        rc = -1;
+    } else {
+        e->count++;
+        c->addr_counted = 1;
+    }
+    pthread_mutex_unlock(&ip_mutex);
+
+    if (rc != 0) {
+        __atomic_sub_fetch(&conn_count, 1, __ATOMIC_RELAXED);
+    }
+    return rc;
+}
+
+/**
+ * @brief Uncounts a connection admitted by conn_admit().
+ */
+static void conn_uncount(struct uring_conn *c) {
+    __atomic_sub_fetch(&conn_count, 1, __ATOMIC_RELAXED);
+    if (c->addr_counted) {
+        struct ip_count **p, *e;
+
+        pthread_mutex_lock(&ip_mutex);
+        p = ip_count_find(c->addr);
+        e = *p;
+        if (e != NULL && --e->count == 0) {
+            *p = e->next;
+            free(e);
+        }
+        pthread_mutex_unlock(&ip_mutex);
+    }
+}
+
+static const char *status_reason(int status_code) {
+    switch (status_code) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 413: return "Content Too Large";
+    case 415: return "Unsupported Media Type";
+    case 422: return "Unprocessable Content";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+/**
+ * @brief Grows a buffer to hold at least needed bytes.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int buffer_reserve(char **buf, size_t *cap, size_t needed) {
+    size_t new_cap;
+    char *grown;
+
+    if (needed <= *cap) {
+        return 0;
+    }
+    new_cap = *cap > 0 ? *cap * 2 : 4096;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    grown = realloc(*buf, new_cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static int out_append(struct uring_conn *c, const char *data, size_t len) {
+    if (buffer_reserve(&c->out, &c->out_cap, c->out_len + len) != 0) {
+        return -1;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+/**
+ * @brief Returns a free SQE, flushing the submission queue if it is full.
+ */
+static struct io_uring_sqe *get_sqe(struct uring_worker *w) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+
+    if (sqe == NULL) {
+        io_uring_submit(&w->ring);
+        sqe = io_uring_get_sqe(&w->ring);
+    }
+    return sqe;
+}
+
+static void set_op(struct io_uring_sqe *sqe, struct uring_conn *c, enum uring_op op) {
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)c | (uint64_t)op);
+}
+
+static void arm_accept(struct uring_worker *w) {
+    struct io_uring_sqe *sqe = get_sqe(w);
+
+    io_uring_prep_multishot_accept(sqe, w->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    set_op(sqe, NULL, OP_ACCEPT);
+}
+
+static void arm_recv(struct uring_worker *w, struct uring_conn *c) {
+    struct io_uring_sqe *sqe = get_sqe(w);
+
+    io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    set_op(sqe, c, OP_RECV);
+    c->recv_armed = 1;
+}
+
+static void arm_send(struct uring_worker *w, struct uring_conn *c) {
+    struct io_uring_sqe *sqe = get_sqe(w);
+
+    io_uring_prep_send(sqe, c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+    set_op(sqe, c, OP_SEND);
+    c->send_armed = 1;
+}
+
+static void arm_timer(struct uring_worker *w) {
+    struct io_uring_sqe *sqe = get_sqe(w);
+
+    w->tick.tv_sec = 1;
+    w->tick.tv_nsec = 0;
+    io_uring_prep_timeout(sqe, &w->tick, 0, 0);
+    set_op(sqe, NULL, OP_TIMER);
+}
+
+/**
+ * @brief Marks a connection closed and cancels its operations.
+ *
+ * The connection is freed by conn_release() once their final
+ * completions have arrived.
+ */
+static void conn_close(struct uring_worker *w, struct uring_conn *c) {
+    if (c->closing) {
+        return;
+    }
+    c->closing = 1;
+    if (c->recv_armed || c->send_armed) {
+        struct io_uring_sqe *sqe = get_sqe(w);
+
+        io_uring_prep_cancel_fd(sqe, c->fd, IORING_ASYNC_CANCEL_ALL);
+        set_op(sqe, NULL, OP_CANCEL);
+    }
+}
+
+/**
+ * @brief Frees a closed connection with no operations in flight.
+ */
+static void conn_release(struct uring_worker *w, struct uring_conn *c) {
+    if (!c->closing || c->recv_armed || c->send_armed) {
+        return;
+    }
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        w->conns = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    conn_uncount(c);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static const char *uring_query_arg(void *conn, const char *key) {
+    struct uring_request *r = conn;
+
+    for (int i = 0; i < r->arg_count; i++) {
+        if (strcmp(r->args[i][0], key) == 0) {
+            return r->args[i][1];
+        }
+    }
+    return NULL;
+}
+
+static const char *uring_header(void *conn, const char *name) {
+    struct uring_request *r = conn;
+
+    for (int i = 0; i < r->header_count; i++) {
+        if (strcasecmp(r->headers[i][0], name) == 0) {
+            return r->headers[i][1];
+        }
+    }
+    return NULL;
+}
+
+static enum MHD_Result uring_respond(void *conn, int status_code, const char *content_type,
+                                     const HttpHeader *headers, int header_count,
+                                     const char *body, size_t body_len) {
+    struct uring_request *r = conn;
+    struct uring_worker *w = r->worker;
+    time_t now = time(NULL);
+    char head[768];
+    int len;
+
+    if (r->responded) {
+        return MHD_NO;
+    }
+    if (now != w->date_time) {
+        struct tm tm;
+
+        gmtime_r(&now, &tm);
+        strftime(w->date, sizeof(w->date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        w->date_time = now;
+    }
+
+    len = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\nDate: %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s",
+                   status_code, status_reason(status_code), w->date, content_type, body_len,
+                   r->keep_alive ? "" : "Connection: close\r\n");
+    for (int i = 0; i < HTTP_CORS_HEADER_COUNT; i++) {
+        len += snprintf(head + len, sizeof(head) - (size_t)len, "%s: %s\r\n",
+                        http_cors_headers[i].name, http_cors_headers[i].value);
+    }
+    for (int i = 0; i < header_count && len < (int)sizeof(head); i++) {
+        len += snprintf(head + len, sizeof(head) - (size_t)len, "%s: %s\r\n",
+                        headers[i].name, headers[i].value);
+    }
+    if (len < (int)sizeof(head)) {
+        len += snprintf(head + len, sizeof(head) - (size_t)len, "\r\n");
+    }
+    if (len >= (int)sizeof(head)) {
+        return MHD_NO;
+    }
+
+    if (out_append(r->conn, head, (size_t)len) != 0 ||
+        out_append(r->conn, body, body_len) != 0) {
+        return MHD_NO;
+    }
+    r->responded = 1;
+    return MHD_YES;
+}
+
+static int uring_peer_address(void *conn, struct sockaddr_storage *addr) {
+    struct uring_request *r = conn;
+    socklen_t len = sizeof(*addr);
+
+    return getpeername(r->conn->fd, (struct sockaddr *)addr, &len) == 0 ? 0 : -1;
+}
+
+/** @brief io_uring front end */
+static const HttpFrontend uring_frontend = {
+    uring_query_arg,
+    uring_header,
+    uring_respond,
+    NULL,
+    NULL,
+    uring_peer_address,
+};
+
+/**
+ * @brief Answers with an error and closes the connection afterwards.
+ */
+static void reply_error(struct uring_worker *w, struct uring_conn *c, int status_code,
+                        const char *message) {
+    struct uring_request r;
+    HttpRequest request = { &uring_frontend, &r, NULL, "", "", "", 0 };
+
+    memset(&r, 0, sizeof(r));
+    r.worker = w;
+    r.conn = c;
+    send_error_response(&request, status_code, message);
+    c->close_after_send = 1;
+}
+
+/**
+ * @brief Returns the value of a header line if it has the given name.
+ *
+ * @param line Start of the header line
+ * @param len Length of the line, without CRLF
+ * @param name Header name followed by ':'
+ * @return Start of the value, or NULL if the name differs
+ */
+static const char *header_value(const char *line, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+
+    if (len < name_len || strncasecmp(line, name, name_len) != 0) {
+        return NULL;
+    }
+    line += name_len;
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    return line;
+}
+
+/**
+ * @brief Reads the message framing without modifying the request.
+ *
+ * Lets the body size be checked and waited for before the headers are
+ * parsed in place.
+ *
+ * @param data Start of the request
+ * @param header_len Length of the request line and headers, final CRLF included
+ * @param f Filled in
+ * @return 0 on success, -1 if Content-Length is invalid
+ */
+static int scan_framing(const char *data, size_t header_len, struct framing *f) {
+    const char *end = data + header_len - 2;
+    const char *p = memchr(data, ' ', header_len);
+    const char *line, *value;
+    size_t n = 0;
+
+    const char *key_header = config.rate_limit_key_header;
+    size_t key_header_len = strlen(key_header);
+
+    memset(f, 0, sizeof(*f));
+    if (p != NULL) {
+        memcpy(f->method, data, (size_t)(p - data) < sizeof(f->method) ? (size_t)(p - data)
+                                                                       : sizeof(f->method) - 1);
+        for (p++; n < sizeof(f->path) - 1 && *p != ' ' && *p != '?' && *p != '\r'; p++) {
+            f->path[n++] = *p;
+        }
+    }
+
+    line = memchr(data, '\n', header_len) + 1;
+    while (line < end) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        size_t len;
+
+        if (eol == NULL) {
+            break;
+        }
+        len = (size_t)(eol - line);
+
+        if ((value = header_value(line, len, "Content-Length:")) != NULL) {
+            size_t length = 0;
+
+            if (!isdigit((unsigned char)*value)) {
+                return -1;
+            }
+            for (; isdigit((unsigned char)*value); value++) {
+                if (length > URING_MAX_INPUT) {
+                    return -1;
+                }
+                length = length * 10 + (size_t)(*value - '0');
+            }
+            f->content_length = length;
+        } else if ((value = header_value(line, len, "Transfer-Encoding:")) != NULL) {
+            f->chunked = strncasecmp(value, "identity", 8) != 0;
+        } else if ((value = header_value(line, len, "Expect:")) != NULL) {
+            f->expect_continue = strncasecmp(value, "100-continue", 12) == 0;
+        } else if (key_header_len > 0 && len > key_header_len && line[key_header_len] == ':' &&
+                   strncasecmp(line, key_header, key_header_len) == 0) {
+            size_t value_len;
+
+            for (value = line + key_header_len + 1; *value == ' ' || *value == '\t'; value++) {
+            }
+            value_len = (size_t)(eol - value);
+            if (value_len >= sizeof(f->client_key)) {
+                value_len = sizeof(f->client_key) - 1;
+            }
+            memcpy(f->client_key, value, value_len);
+            f->client_key[value_len] = '\0';
+            f->has_client_key = 1;
+        }
+        line = eol + 2;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses the request line and headers in place.
+ *
+ * @param r Request to fill in
+ * @param data Start of the request
+ * @param header_len Length of the request line and headers, final CRLF included
+ * @param method Set to the method
+ * @param path Set to the decoded path
+ * @return 0 on success, -1 if the request is malformed
+ */
+static int parse_request(struct uring_request *r, char *data, size_t header_len,
+                         char **method, char **path) {
+    char *line = data, *next, *sp, *target, *version, *query;
+
+    data[header_len - 2] = '\0';
+    next = strstr(line, "\r\n");
+    if (next != NULL) {
+        *next = '\0';
+        next += 2;
+    }
+
+    sp = strchr(line, ' ');
+    if (sp == NULL) {
+        return -1;
+    }
+    *sp = '\0';
+    target = sp + 1;
+    sp = strchr(target, ' ');
+    if (sp == NULL) {
+        return -1;
+    }
+    *sp = '\0';
+    version = sp + 1;
+    if (strncmp(version, "HTTP/1.", 7) != 0 || *target != '/') {
+        return -1;
+    }
+    *method = line;
+    r->keep_alive = strcmp(version, "HTTP/1.1") == 0;
+
+    for (line = next; line != NULL && *line != '\0'; line = next) {
+        char *colon, *value, *value_end;
+
+        next = strstr(line, "\r\n");
+        if (next != NULL) {
+            *next = '\0';
+            next += 2;
+        }
+        colon = strchr(line, ':');
+        if (colon == NULL || colon == line) {
+            return -1;
+        }
+        *colon = '\0';
+        value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        value_end = value + strlen(value);
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            *--value_end = '\0';
+        }
+
+        if (r->header_count < URING_MAX_HEADERS) {
+            r->headers[r->header_count][0] = line;
+            r->headers[r->header_count][1] = value;
+            r->header_count++;
+        }
+        if (strcasecmp(line, "Connection") == 0) {
+            if (strcasestr(value, "close") != NULL) {
+                r->keep_alive = 0;
+            } else if (strcasestr(value, "keep-alive") != NULL) {
+                r->keep_alive = 1;
+            }
+        }
+    }
+
+    query = strchr(target, '?');
+    if (query != NULL) {
+        *query = '\0';
+        r->arg_count = http_parse_query(query + 1, r->args, URING_MAX_ARGS);
+    }
+    http_url_decode(target, 0);
+    *path = target;
+    return 0;
+}
+
+/**
+ * @brief Handles every complete request in the input buffer.
+ *
+ * Only called with no send in flight, since responses are appended to
+ * the output buffer. Arms a send if anything was written.
+ */
+static void process_input(struct uring_worker *w, struct uring_conn *c) {
+    size_t start = 0;
+
+    while (!c->close_after_send) {
+        char *data = c->in + start;
+        size_t avail = c->in_len - start;
+        char *end = memmem(data, avail, "\r\n\r\n", 4);
+        struct framing f;
+        struct uring_request r;
+        size_t header_len;
+        char *method, *path, saved;
+        enum MHD_Result result;
+
+        if (end == NULL) {
+            if (avail > URING_MAX_HEADER_SIZE) {
+                reply_error(w, c, 431, "Request header too large");
+            }
+            break;
+        }
+        header_len = (size_t)(end + 4 - data);
+        if (header_len > URING_MAX_HEADER_SIZE) {
+            reply_error(w, c, 431, "Request header too large");
+            break;
+        }
+        if (scan_framing(data, header_len, &f) != 0) {
+            reply_error(w, c, 400, "Invalid Content-Length");
+            break;
+        }
+        if (f.chunked) {
+            reply_error(w, c, 501, "Chunked request bodies are not supported");
+            break;
+        }
+        if (f.content_length > routes_max_body_size(f.path)) {
+            reply_error(w, c, 413, "Request body too large");
+            break;
+        }
+        if (!c->admitted) {
+            HttpRequest request = { &uring_frontend, &r, NULL, f.method, f.path, "", 0 };
+            int retry_after;
+
+            memset(&r, 0, sizeof(r));
+            r.worker = w;
+            r.conn = c;
+            if (f.has_client_key) {
+                r.headers[0][0] = config.rate_limit_key_header;
+                r.headers[0][1] = f.client_key;
+                r.header_count = 1;
+            }
+            retry_after = routes_rate_limit(&request);
+            if (retry_after > 0) {
+                /* The body is not read, so the connection cannot be reused */
+                r.keep_alive = 0;
+                send_rate_limited(&request, retry_after);
+                c->close_after_send = 1;
+                break;
+            }
+            c->admitted = 1;
+        }
+        if (avail - header_len < f.content_length) {
+            if (f.expect_continue && !c->continue_sent) {
+                out_append(c, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+                c->continue_sent = 1;
+            }
+            break;
+        }
+
+        memset(&r, 0, sizeof(r));
+        r.worker = w;
+        r.conn = c;
+        if (parse_request(&r, data, header_len, &method, &path) != 0) {
+            reply_error(w, c, 400, "Malformed request");
+            break;
+        }
+
+        /* in_cap > in_len, so the byte after the body always exists */
+        saved = data[header_len + f.content_length];
+        data[header_len + f.content_length] = '\0';
+        {
+            HttpRequest request = { &uring_frontend, &r, NULL, method, path,
+                                    data + header_len, f.content_length };
+
+            result = routes_dispatch(&request);
+        }
+        data[header_len + f.content_length] = saved;
+
+        if (!r.responded) {
+            HttpRequest request = { &uring_frontend, &r, NULL, method, path, "", 0 };
+
+            r.keep_alive = 0;
+            send_error_response(&request, 500, "Internal server error");
+        }
+        if (result != MHD_YES || !r.keep_alive) {
+            c->close_after_send = 1;
+        }
+        c->continue_sent = 0;
+        c->admitted = 0;
+        start += header_len + f.content_length;
+    }
+
+    if (start > 0) {
+        memmove(c->in, c->in + start, c->in_len - start);
+        c->in_len -= start;
+        /* Pipelined bytes already in start the next request's clock */
+        c->request_started = c->in_len > 0 ? monotonic_now() : 0;
+    }
+    if (c->out_len > 0) {
+        arm_send(w, c);
+    } else if (c->close_after_send) {
+        conn_close(w, c);
+    }
+}
+
+static void on_accept(struct uring_worker *w, struct io_uring_cqe *cqe) {
+    struct uring_conn *c;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !w->stop) {
+        arm_accept(w);
+    }
+    if (cqe->res < 0) {
+        return;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        close(cqe->res);
+        return;
+    }
+    c->fd = cqe->res;
+    if (getpeername(c->fd, (struct sockaddr *)&addr, &addr_len) == 0 &&
+        addr.sin_family == AF_INET) {
+        c->addr = addr.sin_addr.s_addr;
+    }
+    if (conn_admit(c) != 0) {
+        close(c->fd);
+        free(c);
+        return;
+    }
+    c->last_active = monotonic_now();
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->next = w->conns;
+    if (w->conns != NULL) {
+        w->conns->prev = c;
+    }
+    w->conns = c;
+    arm_recv(w, c);
+}
+
+static void on_recv(struct uring_worker *w, struct uring_conn *c, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        c->recv_armed = 0;
+    }
+
+    if (cqe->res > 0) {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        char *buf = w->buffers + (size_t)bid * URING_RECV_BUFFER_SIZE;
+        size_t len = (size_t)cqe->res;
+
+        c->last_active = monotonic_now();
+        if (!c->closing && !c->close_after_send) {
+            if (c->request_started == 0) {
+                c->request_started = c->last_active;
+            }
+            if (c->in_len + len > URING_MAX_INPUT ||
+                buffer_reserve(&c->in, &c->in_cap, c->in_len + len + 1) != 0) {
+                conn_close(w, c);
+            } else {
+                memcpy(c->in + c->in_len, buf, len);
+                c->in_len += len;
+            }
+        }
+        io_uring_buf_ring_add(w->buf_ring, buf, URING_RECV_BUFFER_SIZE, bid, w->buf_mask, 0);
+        io_uring_buf_ring_advance(w->buf_ring, 1);
+
+        if (!c->closing && !c->send_armed) {
+            process_input(w, c);
+        }
+    } else if (cqe->res == 0 && c->send_armed) {
+        /* Peer finished sending; deliver what is queued, then close */
+        c->close_after_send = 1;
+    } else if (cqe->res != -ENOBUFS) {
+        conn_close(w, c);
+    }
+
+    /* Re-arm after the kernel ended the multishot (e.g. out of buffers) */
+    if (!c->closing && !c->close_after_send && !c->recv_armed) {
+        arm_recv(w, c);
+    }
+    conn_release(w, c);
+}
+
+static void on_send(struct uring_worker *w, struct uring_conn *c, struct io_uring_cqe *cqe) {
+    c->send_armed = 0;
+    if (cqe->res < 0) {
+        conn_close(w, c);
+    } else if (!c->closing) {
+        c->last_active = monotonic_now();
+        c->out_sent += (size_t)cqe->res;
+        if (c->out_sent < c->out_len) {
+            arm_send(w, c);
+        } else {
+            c->out_len = 0;
+            c->out_sent = 0;
+            if (c->close_after_send) {
+                conn_close(w, c);
+            } else {
+                /* Pipelined requests that arrived during the send */
+                process_input(w, c);
+            }
+        }
+    }
+    conn_release(w, c);
+}
+
+/**
+ * @brief Applies the idle and request timeouts to every connection.
+ */
+static void sweep_connections(struct uring_worker *w) {
+    int idle_timeout = CONFIG_LIVE(http_idle_timeout);
+    int request_timeout = CONFIG_LIVE(http_body_timeout);
+    time_t now = monotonic_now();
+
+    for (struct uring_conn *c = w->conns, *next; c != NULL; c = next) {
+        next = c->next;
+        if (c->closing) {
+            continue;
+        }
+        if (idle_timeout > 0 && now - c->last_active >= idle_timeout) {
+            conn_close(w, c);
+        } else if (request_timeout > 0 && c->request_started != 0 && !c->send_armed &&
+                   !c->close_after_send && now - c->request_started >= request_timeout) {
+            /* Headers or body trickling in too slowly */
+            reply_error(w, c, 408, "Request timeout");
+            arm_send(w, c);
+        }
+        conn_release(w, c);
+    }
+}
+
+static void handle_cqe(struct uring_worker *w, struct io_uring_cqe *cqe) {
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    struct uring_conn *c = (struct uring_conn *)(uintptr_t)(data & ~(uint64_t)7);
+
+    switch ((enum uring_op)(data & 7)) {
+    case OP_ACCEPT:
+        on_accept(w, cqe);
+        break;
+    case OP_RECV:
+        on_recv(w, c, cqe);
+        break;
+    case OP_SEND:
+        on_send(w, c, cqe);
+        break;
+    case OP_CANCEL:
+        break;
+    case OP_STOP:
+        w->stop = 1;
+        break;
+    case OP_TIMER:
+        sweep_connections(w);
+        if (!w->stop) {
+            arm_timer(w);
+        }
+        break;
+    }
+}
+
+static int open_listener(int port) {
+    struct sockaddr_in addr;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Creates the worker's socket, ring and buffer ring, and arms
+ * the accept and shutdown polls.
+ *
+ * @return 0 on success, -1 on failure (message printed)
+ */
+static int worker_setup(struct uring_worker *w) {
+    struct io_uring_params params;
+    struct io_uring_sqe *sqe;
+    int rc;
+
+    w->listen_fd = open_listener(w->port);
+    if (w->listen_fd < 0) {
+        perror("io_uring front end: listen");
+        return -1;
+    }
+
+    /* Completions are only reaped by this thread, so task work can wait for it */
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    rc = io_uring_queue_init_params(URING_QUEUE_DEPTH, &w->ring, &params);
+    if (rc == -EINVAL) {
+        /* Kernels before 6.1 */
+        memset(&params, 0, sizeof(params));
+        rc = io_uring_queue_init_params(URING_QUEUE_DEPTH, &w->ring, &params);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "io_uring front end: queue init: %s\n", strerror(-rc));
+        return -1;
+    }
+    w->ring_ready = 1;
+    io_uring_register_ring_fd(&w->ring);
+
+    w->buffers = malloc((size_t)URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    if (w->buffers == NULL) {
+        fprintf(stderr, "io_uring front end: out of memory\n");
+        return -1;
+    }
+    w->buf_ring = io_uring_setup_buf_ring(&w->ring, URING_RECV_BUFFERS, URING_BUFFER_GROUP, 0, &rc);
+    if (w->buf_ring == NULL) {
+        fprintf(stderr, "io_uring front end: buffer ring: %s\n", strerror(-rc));
+        return -1;
+    }
+    w->buf_mask = io_uring_buf_ring_mask(URING_RECV_BUFFERS);
+    for (int i = 0; i < URING_RECV_BUFFERS; i++) {
+        io_uring_buf_ring_add(w->buf_ring, w->buffers + (size_t)i * URING_RECV_BUFFER_SIZE,
+                              URING_RECV_BUFFER_SIZE, (unsigned short)i, w->buf_mask, i);
+    }
+    io_uring_buf_ring_advance(w->buf_ring, URING_RECV_BUFFERS);
+
+    arm_accept(w);
+    arm_timer(w);
+    sqe = get_sqe(w);
+    io_uring_prep_poll_add(sqe, stop_fd, POLLIN);
+    set_op(sqe, NULL, OP_STOP);
+    io_uring_submit(&w->ring);
+    return 0;
+}
+
+static void worker_teardown(struct uring_worker *w) {
+    if (w->listen_fd >= 0) {
+        close(w->listen_fd);
+    }
+    if (w->ring_ready) {
+        if (w->buf_ring != NULL) {
+            io_uring_free_buf_ring(&w->ring, w->buf_ring, URING_RECV_BUFFERS, URING_BUFFER_GROUP);
+        }
+        io_uring_queue_exit(&w->ring);
+    }
+    while (w->conns != NULL) {
+        struct uring_conn *c = w->conns;
+
+        w->conns = c->next;
+        conn_uncount(c);
+        close(c->fd);
+        free(c->in);
+        free(c->out);
+        free(c);
+    }
+    free(w->buffers);
+}
+
+static void *worker_main(void *arg) {
+    struct uring_worker *w = arg;
+    int rc;
+
+    /* Pin before setup so the ring and buffers are allocated on our node */
+    placement_pin_thread(PLACEMENT_ROLE_URING);
+    rc = worker_setup(w);
+
+    pthread_mutex_lock(&start_mutex);
+    started++;
+    if (rc != 0) {
+        start_failures++;
+    }
+    pthread_cond_signal(&start_cond);
+    pthread_mutex_unlock(&start_mutex);
+
+    while (rc == 0 && !w->stop) {
+        struct io_uring_cqe *cqe;
+        unsigned head, count = 0;
+
+        /* One syscall submits everything queued by the last batch and waits */
+        rc = io_uring_submit_and_wait(&w->ring, 1);
+        if (rc == -EINTR) {
+            rc = 0;
+            continue;
+        }
+        if (rc < 0) {
+            fprintf(stderr, "io_uring front end: %s\n", strerror(-rc));
+            break;
+        }
+        rc = 0;
+        io_uring_for_each_cqe(&w->ring, head, cqe) {
+            handle_cqe(w, cqe);
+            count++;
+        }
+        io_uring_cq_advance(&w->ring, count);
+    }
+
+    worker_teardown(w);
+    return NULL;
+}
+
+int uring_server_start(int port, int threads) {
+    int created = 0;
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) {
+            threads = 1;
+        }
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    workers = calloc((size_t)threads, sizeof(*workers));
+    if (stop_fd < 0 || workers == NULL) {
+        worker_count = 0;
+        uring_server_stop();
+        return URING_ERROR_SETUP;
+    }
+
+    started = 0;
+    start_failures = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].port = port;
+        workers[i].listen_fd = -1;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+    worker_count = created;
+
+    pthread_mutex_lock(&start_mutex);
+    while (started < created) {
+        pthread_cond_wait(&start_cond, &start_mutex);
+    }
+    pthread_mutex_unlock(&start_mutex);
+
+    if (created < threads || start_failures > 0) {
+        uring_server_stop();
+        return URING_ERROR_SETUP;
+    }
+    printf("io_uring front end: %d worker threads\n", threads);
+    return 0;
+}
+
+void uring_server_stop(void) {
+    uint64_t one = 1;
+
+    if (stop_fd >= 0 && write(stop_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+        perror("io_uring front end: stop");
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+}
+
+#else
+
+int uring_server_start(int port, int threads) {
+    (void)port;
+    (void)threads;
+    return URING_ERROR_UNAVAILABLE;
+}
+
+void uring_server_stop(void) {
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file test_meal_planner.c
+ * @brief Plan generation against small hand-built catalogs.
+ *
+ * Builds with meal_planner.c itself, so the catalog and configuration
+ * are provided here instead of loaded from the database.
+ */
+
+#include <stdio.h>
+#include "../src/meal_planner.c"
+
+Config config;
+
+static const Catalog *test_catalog;
+
+const Catalog *catalog_get(void) {
+    return test_catalog;
+}
+
+/** @brief Foods: two in category 1, one in category 2 */
+static int category_ids[] = { 1, 1, 2 };
+static float calories[] = { 100, 200, 300 };
+static float protein[] = { 10, 5, 20 };
+static float carbs[] = { 10, 30, 10 };
+static float fat[] = { 2, 5, 15 };
+static unsigned char snack_suitable[] = { 1, 1, 1 };
+static unsigned short default_portions[] = { 100, 100, 100 };
+
+static const Catalog catalog = {
+    .count = 3,
+    .category_ids = category_ids,
+    .calories = calories,
+    .protein = protein,
+    .carbs = carbs,
+    .fat = fat,
+    .snack_suitable = snack_suitable,
+    .default_portions = default_portions,
+};
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    failures += !ok;
+}
+
+static PlanRequest request_with(int meal_count, int item_count, int category_id) {
+    PlanRequest request;
+
+    memset(&request, 0, sizeof(request));
+    request.calories = 600;
+    request.meal_count = meal_count;
+    request.time_budget_ms = 20;
+    request.seed = 42;
+    for (int m = 0; m < meal_count; m++) {
+        snprintf(request.meals[m].meal_type, sizeof(request.meals[m].meal_type), "lunch");
+        request.meals[m].item_count = item_count;
+        if (category_id > 0) {
+            request.meals[m].category_count = 1;
+            request.meals[m].category_ids[0] = category_id;
+        }
+    }
+    return request;
+}
+
+int main(void) {
+    PlanRequest request;
+    PlanResult result;
+    int rc;
+
+    config.plan_threads = 2;
+    test_catalog = &catalog;
+
+    /* Each meal alone has enough candidates, both together do not */
+    request = request_with(2, 2, 1);
+    rc = meal_planner_generate(&request, &result);
+    check(rc == PLAN_ERROR_NO_CANDIDATES, "two meals sharing two foods are refused");
+
+    request = request_with(4, 1, 0);
+    rc = meal_planner_generate(&request, &result);
+    check(rc == PLAN_ERROR_NO_CANDIDATES, "four slots over three foods are refused");
+
+    /* Fits only if the unconstrained meal leaves the category 2 food alone */
+    request = request_with(3, 1, 0);
+    request.meals[0].category_count = 1;
+    request.meals[0].category_ids[0] = 1;
+    request.meals[1].category_count = 1;
+    request.meals[1].category_ids[0] = 1;
+    rc = meal_planner_generate(&request, &result);
+    check(rc == 0, "three slots over three foods are filled");
+    check(rc == 0 && result.items[0][0].index != result.items[1][0].index &&
+          result.items[2][0].index == 2, "every food is used once");
+
+    test_catalog = NULL;
+    request = request_with(1, 1, 0);
+    check(meal_planner_generate(&request, &result) == PLAN_ERROR_NO_CATALOG,
+          "no catalog is reported");
+
+    return failures > 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * @file test_template_cache.c
+ * @brief Slot claiming, and snapshot publishing under concurrent readers
+ *        and writers.
+ *
+ * Builds with template_cache.c itself, so template documents come from
+ * a stub instead of the database. Use-after-free shows up as a snapshot
+ * with the wrong template or an older version than one already seen;
+ * build with -fsanitize=address or thread to catch it outright.
+ */
+
+#include <stdio.h>
+#include "../src/template_cache.c"
+
+Config config;
+
+#define TEMPLATE_ID 7
+#define READERS 4
+#define WRITERS 2
+#define PUBLISHES 5000
+
+MYSQL_RES *db_query(const char *query) {
+    (void)query;
+    return NULL;
+}
+
+/** @brief Set to have the next load overlap a write to the template */
+static int write_during_load = 0;
+
+int template_document_build(int id, unsigned long long version, TemplateFetch fetch, void *ctx,
+                            cJSON **root) {
+    cJSON *obj, *day, *meal;
+
+    (void)version;
+    (void)fetch;
+    (void)ctx;
+    if (id != TEMPLATE_ID) {
+        return TEMPLATE_DOCUMENT_NOT_FOUND;
+    }
+    if (write_during_load) {
+        write_during_load = 0;
+        template_cache_meal_changed(id, 1);
+    }
+    *root = cJSON_CreateObject();
+    obj = cJSON_AddObjectToObject(*root, "template");
+    cJSON_AddNumberToObject(obj, "id", id);
+    cJSON_AddStringToObject(obj, "name", "Test");
+    day = cJSON_CreateObject();
+    cJSON_AddItemToArray(cJSON_AddArrayToObject(obj, "days"), day);
+    cJSON_AddNumberToObject(day, "id", 1);
+    cJSON_AddNumberToObject(day, "day_number", 1);
+    meal = cJSON_CreateObject();
+    cJSON_AddItemToArray(cJSON_AddArrayToObject(day, "meals"), meal);
+    cJSON_AddNumberToObject(meal, "id", 1);
+    cJSON_AddStringToObject(meal, "meal_type", "lunch");
+    cJSON_AddArrayToObject(meal, "items");
+    return 0;
+}
+
+static int failures = 0;
+static int stop = 0;
+static int bad_reads = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    failures += !ok;
+}
+
+static int slots_claimed(void) {
+    int n = 0;
+
+    for (int i = 0; i < TEMPLATE_CACHE_SLOTS; i++) {
+        n += slots[i].id != 0;
+    }
+    return n;
+}
+
+static void *reader(void *arg) {
+    uint64_t last = 0;
+
+    (void)arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        TemplateSnapshot *snap;
+
+        if (template_cache_get(TEMPLATE_ID, &snap) != 0) {
+            __atomic_add_fetch(&bad_reads, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (snap->id != TEMPLATE_ID || snap->version < last || snap->day_count != 1 ||
+            strncmp(snap->head, "{\"success\":true", 15) != 0) {
+            __atomic_add_fetch(&bad_reads, 1, __ATOMIC_RELAXED);
+        }
+        last = snap->version;
+        template_cache_release(snap);
+    }
+    return NULL;
+}
+
+/** @brief Publishes new versions back to back, dropping every tenth */
+static void *writer(void *arg) {
+    struct slot *s = arg;
+
+    for (int i = 0; i < PUBLISHES; i++) {
+        TemplateSnapshot *snap;
+
+        pthread_mutex_lock(&s->mutex);
+        if (i % 10 == 9) {
+            slot_publish(s, NULL);
+        } else if (slot_load(s, TEMPLATE_ID, &snap) == 0) {
+            template_cache_release(snap);
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t readers[READERS], writers[WRITERS];
+    TemplateCacheStats stats;
+    TemplateSnapshot *snap;
+    struct slot *s;
+    uint64_t version, loads;
+    int missing = 0;
+
+    config.template_cache = 1;
+    config.template_change_log = 4;
+    template_cache_init();
+
+    /* Twice as many as fit in the table */
+    for (int id = 1000; id < 1000 + 2 * TEMPLATE_CACHE_SLOTS; id++) {
+        missing += template_cache_get(id, &snap) == TEMPLATE_DOCUMENT_NOT_FOUND;
+    }
+    check(missing == 2 * TEMPLATE_CACHE_SLOTS, "missing templates are reported");
+    check(slots_claimed() == 0, "missing templates take no slot");
+
+    /* The write may have landed after the load read the meal */
+    write_during_load = 1;
+    check(template_cache_get(TEMPLATE_ID, &snap) == 0 && snap->id == TEMPLATE_ID,
+          "a template is loaded on first read");
+    version = snap->version;
+    template_cache_release(snap);
+    check(slots_claimed() == 1, "an existing template takes a slot");
+    template_cache_stats(&stats);
+    check(stats.templates == 0, "a load overlapping a write is not published");
+
+    check(template_cache_get(TEMPLATE_ID, &snap) == 0 && snap->version > version,
+          "the next read loads a newer version");
+    template_cache_release(snap);
+    template_cache_stats(&stats);
+    loads = stats.loads;
+    check(template_cache_get(TEMPLATE_ID, &snap) == 0, "the template is read again");
+    template_cache_release(snap);
+    template_cache_stats(&stats);
+    check(stats.templates == 1 && stats.loads == loads, "the published version is reused");
+
+    s = slot_find(TEMPLATE_ID, 0);
+    check(s != NULL, "the template has a slot");
+    if (s == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, reader, NULL);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_create(&writers[i], NULL, writer, s);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    check(bad_reads == 0, "readers racing publishes see only live snapshots");
+    check(s->readers[0] == 0 && s->readers[1] == 0, "reader counters drain");
+
+    template_cache_cleanup();
+    template_cache_stats(&stats);
+    check(stats.snapshots == 0 && stats.days == 0 && stats.meals == 0,
+          "every snapshot is freed once unpublished and released");
+
+    return failures > 0;
+}